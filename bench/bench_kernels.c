@@ -0,0 +1,312 @@
+/*
+ * bench_kernels.c - microbenchmarks for the core chainage kernels
+ *
+ * Generates synthetic road lines from 10 to 1,000,000 vertices and times
+ * parseLineWKT, calibratePoint, extractSubLineStringByChainages and
+ * interpolatePoint (the kernel behind cut_line_at_chainage). Results are
+ * written as JSON so runs from different releases can be diffed.
+ *
+ * Build and run with: make bench   (or make -f Makefile.core bench)
+ *
+ * Options:
+ *   -o FILE          write JSON to FILE instead of stdout
+ *   -n MAX_VERTICES  largest line size (default 1000000)
+ *   -t MIN_MS        minimum measuring time per case (default 200)
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "road_core.h"
+
+/* ========== Counting Allocator ========== */
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t bytes;
+} AllocStats;
+
+static void *counting_alloc(void *ctx, size_t size) {
+    AllocStats *stats = (AllocStats *) ctx;
+    stats->allocs++;
+    stats->bytes += size;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t size) {
+    AllocStats *stats = (AllocStats *) ctx;
+    stats->allocs++;
+    stats->bytes += size;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void *ctx, void *ptr) {
+    (void) ctx;
+    free(ptr);
+}
+
+/* ========== Cache Miss Counter ========== */
+
+typedef struct {
+    int fd;
+} CacheCounter;
+
+static void cacheCounterOpen(CacheCounter *cc) {
+    cc->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cc->fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void cacheCounterStart(CacheCounter *cc) {
+#ifdef __linux__
+    if (cc->fd >= 0) {
+        ioctl(cc->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(cc->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+/* Returns -1 when hardware counters are unavailable */
+static int64_t cacheCounterStop(CacheCounter *cc) {
+#ifdef __linux__
+    uint64_t value;
+    if (cc->fd >= 0) {
+        ioctl(cc->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(cc->fd, &value, sizeof(value)) == sizeof(value)) {
+            return (int64_t) value;
+        }
+    }
+#endif
+    return -1;
+}
+
+/* ========== Synthetic Data ========== */
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+
+static double randomUnit(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return (double) (rngState >> 11) / (double) (1ULL << 53);
+}
+
+/* Meandering road with a vertex every ~2 m, starting near Dar es Salaam */
+static char *syntheticLineWKT(size_t numVertices) {
+    size_t cap = 32 + numVertices * 48;
+    char *wkt = (char *) malloc(cap);
+    size_t len = 0;
+    double x = 39.2083, y = -6.8161, heading = 0.0;
+
+    len += (size_t) snprintf(wkt + len, cap - len, "LINESTRING(");
+    for (size_t i = 0; i < numVertices; i++) {
+        heading += (randomUnit() - 0.5) * 0.2;
+        x += 1.8e-5 * cos(heading);
+        y += 1.8e-5 * sin(heading);
+        len += (size_t) snprintf(wkt + len, cap - len, "%s%.10f %.10f", i ? ", " : "", x, y);
+    }
+    snprintf(wkt + len, cap - len, ")");
+    return wkt;
+}
+
+/* ========== Timing ========== */
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+typedef struct {
+    const char *wkt;
+    RoadLine line;
+    RoadAllocator allocator;
+    AllocStats stats;
+    Coordinate *probes;
+    double *chainages;
+    size_t numProbes;
+} BenchCase;
+
+typedef int (*KernelFn)(BenchCase *bc, size_t iteration);
+
+static int runParse(BenchCase *bc, size_t iteration) {
+    RoadLine line;
+    (void) iteration;
+    if (!parseLineWKT(bc->wkt, &bc->allocator, &line)) return 0;
+    freeRoadLine(&line);
+    return 1;
+}
+
+static int runCalibrate(BenchCase *bc, size_t iteration) {
+    PointDto dto;
+    return calibratePoint(&bc->line, bc->probes[iteration % bc->numProbes], 0.001, &dto);
+}
+
+static int runExtract(BenchCase *bc, size_t iteration) {
+    SectionDto section;
+    double length = degreesToKm(roadLineLength(&bc->line));
+    double start = bc->chainages[iteration % bc->numProbes] * 0.9;
+    memset(&section, 0, sizeof(section));
+    if (!extractSubLineStringByChainages(&bc->line, start, start + length * 0.1, &section)) return 0;
+    roadFree(&bc->allocator, section.geometry);
+    return 1;
+}
+
+/* Short section: cost should follow the section, not its distance from the line start */
+static int runExtractShort(BenchCase *bc, size_t iteration) {
+    SectionDto section;
+    double length = degreesToKm(roadLineLength(&bc->line));
+    double start = bc->chainages[iteration % bc->numProbes] * 0.999;
+    memset(&section, 0, sizeof(section));
+    if (!extractSubLineStringByChainages(&bc->line, start, start + length * 0.001, &section)) return 0;
+    roadFree(&bc->allocator, section.geometry);
+    return 1;
+}
+
+static int runInterpolate(BenchCase *bc, size_t iteration) {
+    Coordinate pt;
+    return interpolatePoint(&bc->line, kmToDegrees(bc->chainages[iteration % bc->numProbes]), &pt);
+}
+
+static void runKernel(FILE *out, int *first, const char *name, KernelFn fn, BenchCase *bc,
+                      size_t numVertices, uint64_t minNs, CacheCounter *cc) {
+    size_t iterations = 0;
+    uint64_t elapsed = 0;
+    int64_t misses;
+    int ok = 1;
+
+    /* Warm up, then measure until the time budget is used */
+    fn(bc, 0);
+    memset(&bc->stats, 0, sizeof(bc->stats));
+
+    cacheCounterStart(cc);
+    uint64_t start = nowNs();
+    do {
+        for (size_t i = 0; i < 8; i++) {
+            ok &= fn(bc, iterations++);
+        }
+        elapsed = nowNs() - start;
+    } while (elapsed < minNs);
+    misses = cacheCounterStop(cc);
+
+    fprintf(out, "%s    {\"kernel\": \"%s\", \"vertices\": %zu, \"iterations\": %zu, "
+                 "\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f, ",
+            *first ? "" : ",\n", name, numVertices, iterations,
+            (double) elapsed / (double) iterations,
+            (double) bc->stats.allocs / (double) iterations,
+            (double) bc->stats.bytes / (double) iterations);
+    if (misses >= 0) {
+        fprintf(out, "\"cache_misses_per_op\": %.2f, ", (double) misses / (double) iterations);
+    } else {
+        fprintf(out, "\"cache_misses_per_op\": null, ");
+    }
+    fprintf(out, "\"ok\": %s}", ok ? "true" : "false");
+    *first = 0;
+
+    fprintf(stderr, "%-34s %8zu vertices  %12.1f ns/op\n", name, numVertices,
+            (double) elapsed / (double) iterations);
+}
+
+int main(int argc, char **argv) {
+    const char *outPath = NULL;
+    size_t maxVertices = 1000000;
+    uint64_t minNs = 200ULL * 1000000ULL;
+    FILE *out = stdout;
+    CacheCounter cc;
+    int opt, first = 1;
+
+    while ((opt = getopt(argc, argv, "o:n:t:")) != -1) {
+        switch (opt) {
+            case 'o':
+                outPath = optarg;
+                break;
+            case 'n':
+                maxVertices = (size_t) strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                minNs = strtoull(optarg, NULL, 10) * 1000000ULL;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-o file.json] [-n max_vertices] [-t min_ms]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (outPath && !(out = fopen(outPath, "w"))) {
+        perror(outPath);
+        return 1;
+    }
+
+    cacheCounterOpen(&cc);
+
+    fprintf(out, "{\n  \"benchmark\": \"road_core_kernels\",\n  \"timestamp\": %ld,\n",
+            (long) time(NULL));
+    fprintf(out, "  \"cache_counters\": %s,\n  \"results\": [\n", cc.fd >= 0 ? "true" : "false");
+
+    for (size_t n = 10; n <= maxVertices; n *= 10) {
+        BenchCase bc;
+        memset(&bc, 0, sizeof(bc));
+        bc.allocator.alloc = counting_alloc;
+        bc.allocator.realloc = counting_realloc;
+        bc.allocator.free = counting_free;
+        bc.allocator.ctx = &bc.stats;
+
+        char *wkt = syntheticLineWKT(n);
+        bc.wkt = wkt;
+        if (!parseLineWKT(wkt, &bc.allocator, &bc.line)) {
+            fprintf(stderr, "failed to parse synthetic line of %zu vertices\n", n);
+            return 1;
+        }
+
+        /* Probe points near random vertices and random chainages along the line */
+        bc.numProbes = 1024;
+        bc.probes = (Coordinate *) malloc(bc.numProbes * sizeof(Coordinate));
+        bc.chainages = (double *) malloc(bc.numProbes * sizeof(double));
+        double lengthKm = degreesToKm(roadLineLength(&bc.line));
+        for (size_t i = 0; i < bc.numProbes; i++) {
+            size_t v = (size_t) (randomUnit() * (double) (n - 1));
+            bc.probes[i].x = bc.line.coords.data[v].x + 1e-6;
+            bc.probes[i].y = bc.line.coords.data[v].y - 1e-6;
+            bc.chainages[i] = randomUnit() * lengthKm;
+        }
+
+        runKernel(out, &first, "parseLineWKT", runParse, &bc, n, minNs, &cc);
+        runKernel(out, &first, "calibratePoint", runCalibrate, &bc, n, minNs, &cc);
+        runKernel(out, &first, "extractSubLineStringByChainages", runExtract, &bc, n, minNs, &cc);
+        runKernel(out, &first, "extractSubLineStringByChainages/short", runExtractShort, &bc, n, minNs, &cc);
+        runKernel(out, &first, "interpolatePoint", runInterpolate, &bc, n, minNs, &cc);
+
+        freeRoadLine(&bc.line);
+        free(bc.probes);
+        free(bc.chainages);
+        free(wkt);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (outPath) fclose(out);
+    if (cc.fd >= 0) close(cc.fd);
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Generate a synthetic national-scale road network for pg_gis_road_utils benchmarks
+
+Roads are meandering polylines scattered over the Tanzania bounding box with a
+vertex every --spacing meters. GPS probe points are placed a few meters off
+random roads so that calibrate_point_on_line finds a match.
+
+Requirements:
+    pip install pyshp      (only for the shapefile output)
+
+Usage:
+    python3 bench/generate_network.py                     # ~2,000 roads
+    python3 bench/generate_network.py --roads 20000       # national size
+    python3 bench/generate_network.py --out-dir /data/bench --no-shapefile
+
+Output (in --out-dir, default /tmp/bench_data):
+    roads.csv          road_id, road_code, length_km, wkt
+    points.csv         point_id, road_id, wkt
+    national_roads.*   same roads as an ESRI shapefile (if pyshp is installed)
+"""
+
+import argparse
+import csv
+import math
+import os
+import random
+
+METERS_PER_DEGREE = 111320.0
+
+# Tanzania mainland bounding box
+MIN_LON, MAX_LON = 29.5, 40.0
+MIN_LAT, MAX_LAT = -11.5, -1.0
+
+
+def generate_road(rng, spacing_m, min_km, max_km):
+    """Return the vertex list of one meandering road"""
+    length_km = rng.uniform(min_km, max_km)
+    num_vertices = max(2, int(length_km * 1000.0 / spacing_m) + 1)
+    step = spacing_m / METERS_PER_DEGREE
+
+    x = rng.uniform(MIN_LON, MAX_LON)
+    y = rng.uniform(MIN_LAT, MAX_LAT)
+    heading = rng.uniform(0, 2 * math.pi)
+
+    coords = []
+    for _ in range(num_vertices):
+        coords.append((x, y))
+        heading += rng.uniform(-0.05, 0.05)
+        x += step * math.cos(heading)
+        y += step * math.sin(heading)
+    return coords
+
+
+def line_length_km(coords):
+    total = 0.0
+    for (x1, y1), (x2, y2) in zip(coords, coords[1:]):
+        total += math.hypot(x2 - x1, y2 - y1)
+    return total * METERS_PER_DEGREE / 1000.0
+
+
+def to_wkt(coords):
+    return "LINESTRING(" + ", ".join("%.8f %.8f" % c for c in coords) + ")"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("--roads", type=int, default=2000, help="number of roads (default 2000)")
+    parser.add_argument("--points", type=int, default=100000, help="number of GPS points (default 100000)")
+    parser.add_argument("--spacing", type=float, default=20.0, help="vertex spacing in meters (default 20)")
+    parser.add_argument("--min-km", type=float, default=2.0, help="shortest road in km (default 2)")
+    parser.add_argument("--max-km", type=float, default=80.0, help="longest road in km (default 80)")
+    parser.add_argument("--seed", type=int, default=42)
+    parser.add_argument("--out-dir", default="/tmp/bench_data")
+    parser.add_argument("--no-shapefile", action="store_true", help="skip the shapefile output")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    os.makedirs(args.out_dir, exist_ok=True)
+
+    writer = None
+    if not args.no_shapefile:
+        try:
+            import shapefile
+            writer = shapefile.Writer(os.path.join(args.out_dir, "national_roads"), shapeType=shapefile.POLYLINE)
+            writer.field("ROAD_CODE", "C", 10)
+            writer.field("ROAD_CLASS", "C", 20)
+            writer.field("LENGTH_KM", "N", 10, 2)
+        except ImportError:
+            print("pyshp not found, skipping shapefile output (pip install pyshp)")
+
+    roads = []
+    total_vertices = 0
+    classes = ["Trunk Road", "Regional Road", "District Road"]
+
+    with open(os.path.join(args.out_dir, "roads.csv"), "w", newline="") as f:
+        out = csv.writer(f)
+        for road_id in range(1, args.roads + 1):
+            coords = generate_road(rng, args.spacing, args.min_km, args.max_km)
+            length = line_length_km(coords)
+            code = "%s%d" % ("TRD"[road_id % 3], road_id)
+            out.writerow([road_id, code, "%.6f" % length, to_wkt(coords)])
+            roads.append(coords)
+            total_vertices += len(coords)
+            if writer:
+                writer.line([[list(c) for c in coords]])
+                writer.record(code, classes[road_id % 3], length)
+
+    if writer:
+        writer.close()
+
+    offset = 5.0 / METERS_PER_DEGREE
+    with open(os.path.join(args.out_dir, "points.csv"), "w", newline="") as f:
+        out = csv.writer(f)
+        for point_id in range(1, args.points + 1):
+            road_id = rng.randint(1, len(roads))
+            x, y = rng.choice(roads[road_id - 1])
+            out.writerow([point_id, road_id, "POINT(%.8f %.8f)" % (x + rng.uniform(-offset, offset),
+                                                                    y + rng.uniform(-offset, offset))])
+
+    print("Roads:    %d (%d vertices)" % (len(roads), total_vertices))
+    print("Points:   %d" % args.points)
+    print("Output:   %s" % args.out_dir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,6 @@
+-- Calibrate a batch of 100 GPS points against their roads
+\set point_id random(1, :npoints - 100)
+SELECT count(calibrate_point_on_line(r.wkt, p.wkt, 0.001))
+FROM bench_points p
+JOIN bench_roads r USING (road_id)
+WHERE p.point_id BETWEEN :point_id AND :point_id + 99;
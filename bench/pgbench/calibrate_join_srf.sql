@@ -0,0 +1,7 @@
+-- Calibrate a batch of 1000 GPS points against every road with calibrate_join
+\set point_id random(1, :npoints - 1000)
+SELECT count(*)
+FROM calibrate_join(
+    format('SELECT point_id, wkt FROM bench_points WHERE point_id BETWEEN %s AND %s', :point_id, :point_id + 999),
+    'SELECT road_id, wkt FROM bench_roads',
+    0.001);
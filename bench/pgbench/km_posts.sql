@@ -0,0 +1,6 @@
+-- Kilometer posts for a whole road (requires PostGIS)
+\set road_id random(1, :nroads)
+SELECT count(*)
+FROM bench_roads_geom g
+CROSS JOIN LATERAL generate_kilometer_posts(g.geom, 1.0, 0.0)
+WHERE g.road_id = :road_id;
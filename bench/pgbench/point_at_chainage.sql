@@ -0,0 +1,6 @@
+-- Point at a random chainage of a random road
+\set road_id random(1, :nroads)
+\set pos random(0, 100000)
+SELECT cut_line_at_chainage(wkt, (:pos / 100000.0) * length_km * 0.999)
+FROM bench_roads
+WHERE road_id = :road_id;
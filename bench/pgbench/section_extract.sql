@@ -0,0 +1,9 @@
+-- Extract a 5 km section at a random position of a random road
+\set road_id random(1, :nroads)
+\set start_m random(0, 100000)
+SELECT get_section_by_chainage(wkt, s, s + LEAST(5.0, length_km - s))
+FROM (
+    SELECT wkt, length_km, (:start_m / 100000.0) * length_km * 0.9 AS s
+    FROM bench_roads
+    WHERE road_id = :road_id
+) q;
@@ -0,0 +1,3 @@
+-- Full scan of the generated national shapefile
+SELECT count(*), sum(length(geom_wkb))
+FROM read_shapefile_wkb(:shapefile);
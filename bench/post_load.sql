@@ -0,0 +1,16 @@
+-- Run after the CSV files are copied into the benchmark tables
+
+CREATE INDEX ON bench_points (road_id);
+ANALYZE bench_roads;
+ANALYZE bench_points;
+
+-- PostGIS geometry copy for the kilometer-post workload (skipped without PostGIS)
+DO $$
+BEGIN
+    IF EXISTS (SELECT 1 FROM pg_extension WHERE extname = 'postgis') THEN
+        DROP TABLE IF EXISTS bench_roads_geom;
+        CREATE TABLE bench_roads_geom AS
+        SELECT road_id, ST_GeomFromText(wkt, 4326) AS geom FROM bench_roads;
+        ALTER TABLE bench_roads_geom ADD PRIMARY KEY (road_id);
+    END IF;
+END $$;
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+"""
+Run the pg_gis_road_utils pgbench workloads and report throughput and latency
+
+Each script in bench/pgbench/ is run with pgbench against a local cluster,
+with per-transaction logging enabled. The driver reports TPS and latency
+percentiles per workload and writes them as JSON.
+
+Usage:
+    python3 bench/generate_network.py --out-dir /tmp/bench_data
+    python3 bench/run_pgbench.py --load /tmp/bench_data -d test_db
+    python3 bench/run_pgbench.py -d test_db -c 8 -j 4 -T 60 --only calibrate_join,section_extract
+
+Connection settings follow the usual PG* environment variables; -d/-U/-h/-p
+are passed through to psql and pgbench.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SCRIPT_DIR = os.path.join(BENCH_DIR, "pgbench")
+
+
+def conn_args(args):
+    out = []
+    if args.dbname:
+        out += ["-d", args.dbname]
+    if args.user:
+        out += ["-U", args.user]
+    if args.host:
+        out += ["-h", args.host]
+    if args.port:
+        out += ["-p", str(args.port)]
+    return out
+
+
+def psql(args, *extra, capture=False):
+    cmd = ["psql", "-X", "-q", "-v", "ON_ERROR_STOP=1"] + conn_args(args) + list(extra)
+    if capture:
+        return subprocess.run(cmd, check=True, capture_output=True, text=True).stdout.strip()
+    subprocess.run(cmd, check=True)
+    return None
+
+
+def scalar(args, sql):
+    return psql(args, "-A", "-t", "-c", sql, capture=True)
+
+
+def load_data(args):
+    print("Loading %s ..." % args.load)
+    psql(args, "-f", os.path.join(BENCH_DIR, "setup.sql"))
+    psql(args, "-c", "\\copy bench_roads FROM '%s' WITH (FORMAT csv)" % os.path.join(args.load, "roads.csv"))
+    psql(args, "-c", "\\copy bench_points FROM '%s' WITH (FORMAT csv)" % os.path.join(args.load, "points.csv"))
+    psql(args, "-f", os.path.join(BENCH_DIR, "post_load.sql"))
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return None
+    k = (len(sorted_values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(sorted_values) - 1)
+    return sorted_values[lo] + (sorted_values[hi] - sorted_values[lo]) * (k - lo)
+
+
+def read_latencies(log_prefix):
+    """Latencies in ms from pgbench --log files (third column is latency in us)"""
+    values = []
+    for path in glob.glob(log_prefix + ".*"):
+        with open(path) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) >= 3 and fields[2].isdigit():
+                    values.append(int(fields[2]) / 1000.0)
+    values.sort()
+    return values
+
+
+def run_workload(args, name, variables, log_dir):
+    script = os.path.join(SCRIPT_DIR, name + ".sql")
+    log_prefix = os.path.join(log_dir, name)
+    cmd = ["pgbench", "-n", "-f", script, "-c", str(args.clients), "-j", str(args.jobs),
+           "-T", str(args.duration), "--log", "--log-prefix=" + log_prefix] + conn_args(args)
+    for key, value in variables.items():
+        cmd += ["-D", "%s=%s" % (key, value)]
+
+    proc = subprocess.run(cmd, capture_output=True, text=True)
+    if proc.returncode != 0:
+        sys.stderr.write(proc.stdout + proc.stderr)
+        return {"workload": name, "error": "pgbench exited with %d" % proc.returncode}
+
+    tps = re.search(r"tps = ([0-9.]+) \(without initial connection time\)", proc.stdout)
+    failed = re.search(r"number of failed transactions: (\d+)", proc.stdout)
+    latencies = read_latencies(log_prefix)
+
+    return {
+        "workload": name,
+        "clients": args.clients,
+        "duration_s": args.duration,
+        "transactions": len(latencies),
+        "failed": int(failed.group(1)) if failed else 0,
+        "tps": float(tps.group(1)) if tps else None,
+        "latency_ms": {
+            "mean": sum(latencies) / len(latencies) if latencies else None,
+            "p50": percentile(latencies, 50),
+            "p90": percentile(latencies, 90),
+            "p95": percentile(latencies, 95),
+            "p99": percentile(latencies, 99),
+            "max": latencies[-1] if latencies else None,
+        },
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[1])
+    parser.add_argument("-d", "--dbname")
+    parser.add_argument("-U", "--user")
+    parser.add_argument("-H", "--host")
+    parser.add_argument("-p", "--port", type=int)
+    parser.add_argument("-c", "--clients", type=int, default=4)
+    parser.add_argument("-j", "--jobs", type=int, default=2)
+    parser.add_argument("-T", "--duration", type=int, default=30, help="seconds per workload (default 30)")
+    parser.add_argument("--load", metavar="DATA_DIR", help="(re)load bench tables from generate_network.py output")
+    parser.add_argument("--shapefile", help="shapefile path without extension (default DATA_DIR/national_roads)")
+    parser.add_argument("--only", help="comma separated workload names")
+    parser.add_argument("-o", "--output", default="pgbench_results.json")
+    args = parser.parse_args()
+
+    for tool in ("psql", "pgbench"):
+        if not shutil.which(tool):
+            sys.exit("%s not found in PATH" % tool)
+
+    if args.load:
+        load_data(args)
+
+    variables = {
+        "nroads": scalar(args, "SELECT count(*) FROM bench_roads"),
+        "npoints": scalar(args, "SELECT count(*) FROM bench_points"),
+    }
+
+    workloads = sorted(os.path.splitext(os.path.basename(p))[0] for p in glob.glob(os.path.join(SCRIPT_DIR, "*.sql")))
+    if args.only:
+        workloads = [w for w in workloads if w in args.only.split(",")]
+
+    shapefile = args.shapefile or (os.path.join(args.load, "national_roads") if args.load else None)
+    if "shapefile_scan" in workloads:
+        if shapefile and os.path.exists(shapefile + ".shp"):
+            variables["shapefile"] = "'%s'" % shapefile
+        else:
+            print("Skipping shapefile_scan: pass --shapefile or --load with a generated shapefile")
+            workloads.remove("shapefile_scan")
+
+    if "km_posts" in workloads and scalar(args, "SELECT to_regclass('bench_roads_geom') IS NOT NULL") != "t":
+        print("Skipping km_posts: PostGIS is not installed in this database")
+        workloads.remove("km_posts")
+
+    results = []
+    log_dir = tempfile.mkdtemp(prefix="pgbench_logs_")
+    try:
+        for name in workloads:
+            print("Running %-20s (%d clients, %d s) ..." % (name, args.clients, args.duration))
+            results.append(run_workload(args, name, variables, log_dir))
+    finally:
+        shutil.rmtree(log_dir, ignore_errors=True)
+
+    print()
+    print("%-20s %10s %10s %10s %10s %10s" % ("workload", "tps", "p50 ms", "p95 ms", "p99 ms", "max ms"))
+    for r in results:
+        if "error" in r:
+            print("%-20s %s" % (r["workload"], r["error"]))
+            continue
+        lat = r["latency_ms"]
+        fmt = lambda v: "%10.2f" % v if v is not None else "%10s" % "-"
+        print("%-20s %s %s %s %s %s" % (r["workload"], fmt(r["tps"]), fmt(lat["p50"]), fmt(lat["p95"]),
+                                         fmt(lat["p99"]), fmt(lat["max"])))
+
+    with open(args.output, "w") as f:
+        json.dump({
+            "benchmark": "pg_gis_road_utils_pgbench",
+            "timestamp": int(time.time()),
+            "server_version": scalar(args, "SHOW server_version"),
+            "extension_version": scalar(args, "SELECT extversion FROM pg_extension WHERE extname = 'pg_gis_road_utils'"),
+            "roads": int(variables["nroads"]),
+            "points": int(variables["npoints"]),
+            "results": results,
+        }, f, indent=2)
+    print("\nResults written to %s" % args.output)
+
+
+if __name__ == "__main__":
+    main()
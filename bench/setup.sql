@@ -0,0 +1,19 @@
+-- Benchmark schema for the pgbench workloads in bench/pgbench/
+-- Loaded by bench/run_pgbench.py; data comes from bench/generate_network.py
+
+CREATE EXTENSION IF NOT EXISTS pg_gis_road_utils;
+
+DROP TABLE IF EXISTS bench_roads CASCADE;
+CREATE TABLE bench_roads (
+    road_id INTEGER PRIMARY KEY,
+    road_code TEXT NOT NULL,
+    length_km DOUBLE PRECISION NOT NULL,
+    wkt TEXT NOT NULL
+);
+
+DROP TABLE IF EXISTS bench_points CASCADE;
+CREATE TABLE bench_points (
+    point_id INTEGER PRIMARY KEY,
+    road_id INTEGER NOT NULL,
+    wkt TEXT NOT NULL
+);
@@ -0,0 +1,1410 @@
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION pg_gis_road_utils UPDATE TO '1.1.0'" to load this file. \quit
+
+-- Objects added in 1.1.0. CREATE EXTENSION runs pg_gis_road_utils--1.0.0.sql and then this
+-- script, so a fresh install and an upgraded one end up with the same objects.
+
+-- ============================================
+-- RUNTIME STATISTICS
+-- ============================================
+-- Per-function counters kept in shared memory. Requires
+--   shared_preload_libraries = 'pg_gis_road_utils'
+-- Tracking can be switched off with pg_gis_road_utils.track_stats = off.
+
+CREATE OR REPLACE FUNCTION pg_gis_road_utils_stats(
+    OUT function_name TEXT,
+    OUT calls BIGINT,
+    OUT total_time_ms DOUBLE PRECISION,
+    OUT max_time_ms DOUBLE PRECISION,
+    OUT parse_time_ms DOUBLE PRECISION,
+    OUT compute_time_ms DOUBLE PRECISION,
+    OUT output_time_ms DOUBLE PRECISION,
+    OUT vertices BIGINT,
+    OUT bytes_parsed BIGINT,
+    OUT bytes_emitted BIGINT,
+    OUT cache_hits BIGINT,
+    OUT cache_misses BIGINT,
+    OUT shapefile_records BIGINT,
+    OUT shapefile_bytes BIGINT,
+    OUT stats_reset TIMESTAMPTZ
+)
+RETURNS SETOF RECORD
+AS 'MODULE_PATHNAME', 'pg_gis_road_utils_stats'
+LANGUAGE C VOLATILE STRICT;
+
+CREATE OR REPLACE VIEW pg_gis_road_utils_stats AS
+    SELECT * FROM pg_gis_road_utils_stats();
+
+COMMENT ON VIEW pg_gis_road_utils_stats IS
+'Per-function runtime statistics of pg_gis_road_utils: calls, total/max time,
+time split into parsing, computation and output building, vertices processed,
+bytes parsed and emitted, cache hits/misses and shapefile records/bytes read.
+Example: SELECT function_name, calls, total_time_ms, parse_time_ms FROM pg_gis_road_utils_stats;';
+
+CREATE OR REPLACE FUNCTION pg_gis_road_utils_stats_reset()
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'pg_gis_road_utils_stats_reset'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION pg_gis_road_utils_stats_reset IS
+'Reset all counters in pg_gis_road_utils_stats.';
+
+REVOKE ALL ON FUNCTION pg_gis_road_utils_stats_reset() FROM PUBLIC;
+
+-- ============================================
+-- Function: point_at_chainage_offset
+-- ============================================
+-- Returns the point at a chainage moved perpendicular to the line
+-- Positive offsets are to the left of the digitized direction
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset(
+    line_wkt TEXT,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'point_at_chainage_offset'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION point_at_chainage_offset(TEXT, DOUBLE PRECISION, DOUBLE PRECISION) IS
+'Returns a point (WKT) at the chainage (in kilometers), offset perpendicular to the line by offset_m meters.
+Positive offsets are to the left of the line direction, negative to the right.
+Example: SELECT point_at_chainage_offset(''LINESTRING(0 0, 10 0)'', 5.0, 12.5);';
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset(
+    line_wkt TEXT,
+    chainages DOUBLE PRECISION[],
+    offsets DOUBLE PRECISION[]
+)
+RETURNS TEXT[]
+AS 'MODULE_PATHNAME', 'point_at_chainage_offset_batch'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION point_at_chainage_offset(TEXT, DOUBLE PRECISION[], DOUBLE PRECISION[]) IS
+'Array form of point_at_chainage_offset: the line is parsed once for all chainages.
+offsets holds one value per chainage, or a single value used for all of them.
+Chainages outside the line give NULL elements. Large arrays are split over pg_gis_road_utils.batch_threads threads.
+Example: SELECT point_at_chainage_offset(geom_wkt, ARRAY[0.5, 1.2, 3.0], ARRAY[-4.5]) FROM road_signs_batch;';
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_wkt TEXT,
+    points_wkt TEXT[],
+    radius DOUBLE PRECISION
+)
+RETURNS DOUBLE PRECISION[]
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line_batch'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION calibrate_point_on_line(TEXT, TEXT[], DOUBLE PRECISION) IS
+'Array form of calibrate_point_on_line: the line is parsed once and the chainage (in kilometers) of the
+matched vertex is returned for each point, NULL where no vertex is within radius.
+Large arrays are split over pg_gis_road_utils.batch_threads threads.
+Example: SELECT calibrate_point_on_line(geom_wkt, ARRAY[''POINT(5 0.1)'', ''POINT(8 0)''], 1.0) FROM roads;';
+
+-- ============================================
+-- Function: distance_along_road
+-- ============================================
+-- Signed distance along a road between calibrated points
+
+CREATE OR REPLACE FUNCTION distance_along_road(
+    line_wkt TEXT,
+    p1_wkt TEXT,
+    p2_wkt TEXT,
+    radius DOUBLE PRECISION
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'distance_along_road'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION distance_along_road(TEXT, TEXT, TEXT, DOUBLE PRECISION) IS
+'Calibrates two points as calibrate_point_on_line does, against a single parse of the line, and returns
+JSON with from_ch, to_ch, the signed distance to_ch - from_ch (km) and direction (1 forward, -1 reverse,
+0 same vertex). NULL if either point has no vertex within radius.
+Example: SELECT distance_along_road(geom_wkt, ''POINT(36.80 -1.29)'', ''POINT(36.85 -1.30)'', 0.01) FROM roads;';
+
+CREATE OR REPLACE FUNCTION distance_along_road(
+    line_wkt TEXT,
+    points_wkt TEXT[],
+    radius DOUBLE PRECISION
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'distance_along_road_trace'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION distance_along_road(TEXT, TEXT[], DOUBLE PRECISION) IS
+'Trace form of distance_along_road: every fix is calibrated once and element i of the returned JSON array
+holds the distance from fix i to fix i + 1, null where either fix is unmatched.
+Large arrays are split over pg_gis_road_utils.batch_threads threads.
+Example: SELECT distance_along_road(r.geom_wkt, array_agg(ST_AsText(g.geom) ORDER BY g.ts), 0.01) FROM roads r JOIN gps_points g USING (road_code) GROUP BY r.geom_wkt;';
+
+-- ============================================
+-- Function: offset_section
+-- ============================================
+-- Returns the section between two chainages offset parallel to the line
+
+CREATE OR REPLACE FUNCTION offset_section(
+    line_wkt TEXT,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'offset_section'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION offset_section(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, DOUBLE PRECISION) IS
+'Returns the section between two chainages (in kilometers) as a LINESTRING (WKT)
+offset by offset_m meters, with mitered joins. Positive offsets are to the left.
+Example: SELECT offset_section(''LINESTRING(0 0, 10 0, 10 10)'', 100.0, 1200.0, -3.5);';
+
+CREATE OR REPLACE FUNCTION offset_section(
+    line_wkt TEXT,
+    start_chainages DOUBLE PRECISION[],
+    end_chainages DOUBLE PRECISION[],
+    offsets DOUBLE PRECISION[]
+)
+RETURNS TEXT[]
+AS 'MODULE_PATHNAME', 'offset_section_batch'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION offset_section(TEXT, DOUBLE PRECISION[], DOUBLE PRECISION[], DOUBLE PRECISION[]) IS
+'Array form of offset_section: the line is parsed once for all sections.
+offsets holds one value per section, or a single value used for all of them.
+Invalid ranges give NULL elements.
+Example: SELECT offset_section(geom_wkt, ARRAY[0.0, 2.0], ARRAY[1.0, 3.5], ARRAY[3.5]) FROM roads;';
+
+-- PostGIS geometry wrappers
+CREATE OR REPLACE FUNCTION point_at_chainage_offset_geom(
+    line_geom GEOMETRY,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        point_at_chainage_offset(
+            ST_AsText(line_geom),
+            chainage,
+            offset_m
+        ),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION point_at_chainage_offset_geom IS
+'PostGIS geometry wrapper for point_at_chainage_offset. Returns a PostGIS POINT geometry.
+Example: SELECT point_at_chainage_offset_geom(geom, 5.0, 12.5) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION offset_section_geom(
+    line_geom GEOMETRY,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        offset_section(
+            ST_AsText(line_geom),
+            start_chainage,
+            end_chainage,
+            offset_m
+        ),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION offset_section_geom IS
+'PostGIS geometry wrapper for offset_section. Returns a PostGIS LINESTRING geometry.
+Example: SELECT offset_section_geom(geom, 2.0, 3.5, -3.5) FROM roads WHERE id = 1;';
+
+-- ============================================
+-- Function: simplify_line_preserving_chainage
+-- ============================================
+-- Simplifies a line while keeping each remaining vertex's original chainage
+-- as its M value, so chainage functions give unchanged results
+
+CREATE OR REPLACE FUNCTION simplify_line_preserving_chainage(
+    line_wkt TEXT,
+    tolerance_m DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'simplify_line_preserving_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION simplify_line_preserving_chainage IS
+'Douglas-Peucker simplification (tolerance in meters) returning a LINESTRING M (WKT) whose
+M values are the original chainages (km) of the retained vertices. All chainage functions
+read M values as chainages, so results on the simplified line match the original.
+Example: SELECT simplify_line_preserving_chainage(''LINESTRING(0 0, 1 0.00001, 2 0, 2 5)'', 5.0);';
+
+CREATE OR REPLACE FUNCTION simplify_line_preserving_chainage_geom(
+    line_geom GEOMETRY,
+    tolerance_m DOUBLE PRECISION
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        simplify_line_preserving_chainage(
+            ST_AsText(line_geom),
+            tolerance_m
+        ),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION simplify_line_preserving_chainage_geom IS
+'PostGIS geometry wrapper for simplify_line_preserving_chainage. Returns a LINESTRING M geometry.
+Example: UPDATE roads SET geom_simple = simplify_line_preserving_chainage_geom(geom, 2.0);';
+
+-- ============================================
+-- Compact line encoding
+-- ============================================
+-- Quantized, zig-zag delta-varint encoded lines stored as BYTEA.
+-- The chainage functions accept the encoding in place of WKT and decode it
+-- in a single pass, without building any text.
+
+CREATE OR REPLACE FUNCTION encode_road_line(
+    line_wkt TEXT,
+    precision INTEGER DEFAULT 7
+)
+RETURNS BYTEA
+AS 'MODULE_PATHNAME', 'encode_road_line'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION encode_road_line IS
+'Encode a line in the compact format: coordinates rounded to precision decimal digits
+(7 = about 1 cm in degrees) and stored as delta varints; LINESTRING M measures are kept to 1 mm.
+Example: UPDATE roads SET geom_compact = encode_road_line(ST_AsText(geom));';
+
+CREATE OR REPLACE FUNCTION encode_road_line_geom(
+    line_geom GEOMETRY,
+    precision INTEGER DEFAULT 7
+)
+RETURNS BYTEA
+AS $$
+    SELECT encode_road_line(ST_AsText(line_geom), precision);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION encode_road_line_geom IS
+'PostGIS geometry wrapper for encode_road_line.
+Example: UPDATE roads SET geom_compact = encode_road_line_geom(geom, 7);';
+
+CREATE OR REPLACE FUNCTION decode_road_line(
+    line_data BYTEA
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'decode_road_line'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION decode_road_line IS
+'Decode a compact line back to WKT (LINESTRING M / Z / ZM when it carries measures or elevations).
+Example: SELECT ST_GeomFromText(decode_road_line(geom_compact), 4326) FROM roads;';
+
+CREATE OR REPLACE FUNCTION encode_road_line_indexed(
+    line_wkt TEXT
+)
+RETURNS BYTEA
+AS 'MODULE_PATHNAME', 'encode_road_line_indexed'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION encode_road_line_indexed IS
+'Encode a line in the indexed layout: full-precision vertex records behind a block index, so
+point_at_chainage_offset reads only the blocks it needs. Store the column with SET STORAGE EXTERNAL.
+Example: UPDATE roads SET geom_indexed = encode_road_line_indexed(ST_AsText(geom));';
+
+CREATE OR REPLACE FUNCTION encode_road_line_indexed_geom(
+    line_geom GEOMETRY
+)
+RETURNS BYTEA
+AS $$
+    SELECT encode_road_line_indexed(ST_AsText(line_geom));
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION encode_road_line_indexed_geom IS
+'PostGIS geometry wrapper for encode_road_line_indexed.
+Example: UPDATE roads SET geom_indexed = encode_road_line_indexed_geom(geom);';
+
+-- Compact-input overloads of the chainage functions
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage(
+    line_data BYTEA,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'get_section_by_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage(
+    line_data BYTEA,
+    chainage DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'cut_line_at_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_data BYTEA,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION DEFAULT 1.0
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset(
+    line_data BYTEA,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'point_at_chainage_offset'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION offset_section(
+    line_data BYTEA,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'offset_section'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION cut_line_at_chainage(BYTEA, DOUBLE PRECISION) IS
+'cut_line_at_chainage on a line in the compact encoding from encode_road_line.
+Example: SELECT cut_line_at_chainage(geom_compact, 5.0) FROM roads WHERE id = 1;';
+
+-- ============================================
+-- Incremental re-indexing after a geometry edit
+-- ============================================
+
+CREATE OR REPLACE FUNCTION line_edit_span(
+    old_line_wkt TEXT,
+    new_line_wkt TEXT
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'line_edit_span'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION line_edit_span IS
+'Compares two versions of a line from both ends and returns JSON with: changed,
+old/new start and end vertex index of the edited span, start_ch (last unchanged chainage),
+old_end_ch/new_end_ch (where the unchanged tail resumes) and delta (km) for everything after it.
+Example: SELECT line_edit_span(ST_AsText(old.geom), ST_AsText(new.geom)) FROM roads_history old, roads new WHERE ...;';
+
+-- Apply an edit to an events table in one UPDATE: chainages up to start_ch are kept,
+-- chainages past old_end_ch move by delta and those inside the edited span are
+-- stretched proportionally onto the new span. Returns the number of rows rewritten.
+CREATE OR REPLACE FUNCTION apply_chainage_edit(
+    events REGCLASS,
+    chainage_column TEXT,
+    old_line_wkt TEXT,
+    new_line_wkt TEXT,
+    road_column TEXT DEFAULT NULL,
+    road_value TEXT DEFAULT NULL
+)
+RETURNS BIGINT
+AS $$
+DECLARE
+    edit JSON;
+    start_ch DOUBLE PRECISION;
+    old_end_ch DOUBLE PRECISION;
+    new_end_ch DOUBLE PRECISION;
+    scale DOUBLE PRECISION;
+    road_filter TEXT := '';
+    updated BIGINT;
+BEGIN
+    edit := line_edit_span(old_line_wkt, new_line_wkt);
+    IF NOT (edit->>'changed')::BOOLEAN THEN
+        RETURN 0;
+    END IF;
+
+    start_ch := (edit->>'start_ch')::DOUBLE PRECISION;
+    old_end_ch := (edit->>'old_end_ch')::DOUBLE PRECISION;
+    new_end_ch := (edit->>'new_end_ch')::DOUBLE PRECISION;
+    scale := CASE WHEN old_end_ch > start_ch
+                  THEN (new_end_ch - start_ch) / (old_end_ch - start_ch) ELSE 1.0 END;
+
+    IF road_column IS NOT NULL THEN
+        road_filter := format(' AND %I = %L', road_column, road_value);
+    END IF;
+
+    EXECUTE format(
+        'UPDATE %s SET %I = CASE WHEN %I >= $2 THEN %I + ($3 - $2)
+                                 ELSE $1 + (%I - $1) * $4 END
+         WHERE %I > $1%s',
+        events, chainage_column, chainage_column, chainage_column, chainage_column,
+        chainage_column, road_filter)
+    USING start_ch, old_end_ch, new_end_ch, scale;
+
+    GET DIAGNOSTICS updated = ROW_COUNT;
+    RETURN updated;
+END;
+$$ LANGUAGE plpgsql;
+
+COMMENT ON FUNCTION apply_chainage_edit IS
+'Re-index an events table after a road geometry edit in one set-based UPDATE. Only rows past
+the last unchanged chainage are rewritten; road_column/road_value restrict it to one road.
+Example: SELECT apply_chainage_edit(''road_events'', ''chainage'', old_wkt, new_wkt, ''road_code'', ''T7'');';
+
+-- ============================================
+-- Function: calibrate_join
+-- ============================================
+-- Many-to-many calibration of points against roads without a lateral join
+
+CREATE OR REPLACE FUNCTION calibrate_join(
+    points_query TEXT,
+    roads_query TEXT,
+    radius DOUBLE PRECISION DEFAULT 1.0
+)
+RETURNS TABLE (
+    point_id BIGINT,
+    road_id BIGINT,
+    chainage DOUBLE PRECISION,
+    distance DOUBLE PRECISION
+)
+AS 'MODULE_PATHNAME', 'calibrate_join'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION calibrate_join IS
+'Calibrates every point of points_query against every road of roads_query. Both queries return
+(integer id, geometry): point WKT for points, line WKT or encode_road_line output for roads.
+Roads are loaded in work_mem sized batches and indexed on a grid; points are streamed through
+each batch, so points_query should be deterministic. Returns one row per point and road with a
+vertex within radius: chainage (km) and distance (coordinate units, like radius).
+Example: SELECT * FROM calibrate_join(''SELECT id, ST_AsText(geom) FROM gps_points'', ''SELECT id, ST_AsText(geom) FROM roads'', 0.001);';
+
+-- ============================================
+-- Function: road_topology
+-- ============================================
+-- Node/edge topology of a road network from shared line ends
+
+CREATE OR REPLACE FUNCTION road_topology(
+    roads_query TEXT,
+    tolerance DOUBLE PRECISION DEFAULT 0.0
+)
+RETURNS TABLE (
+    road_id BIGINT,
+    start_node BIGINT,
+    end_node BIGINT,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    start_x DOUBLE PRECISION,
+    start_y DOUBLE PRECISION,
+    start_degree INTEGER,
+    end_x DOUBLE PRECISION,
+    end_y DOUBLE PRECISION,
+    end_degree INTEGER,
+    component BIGINT
+)
+AS 'MODULE_PATHNAME', 'road_topology'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION road_topology IS
+'Builds node/edge topology in one pass over roads_query, which returns (integer id, line WKT or
+encode_road_line output). Line ends within tolerance (coordinate units) share a node, placed at
+the first end seen. Returns one row per road: its start and end node, chainages (km), the nodes''
+position and degree, and the connected component. Lines are only noded at their ends.
+Example: SELECT * FROM road_topology(''SELECT id, ST_AsText(geom) FROM roads'', 0.00001);';
+
+-- Write road_topology output as an edge table and a node table. Returns the number of nodes.
+CREATE OR REPLACE FUNCTION build_road_topology(
+    roads_query TEXT,
+    tolerance DOUBLE PRECISION,
+    edge_table TEXT,
+    node_table TEXT
+)
+RETURNS BIGINT
+AS $$
+DECLARE
+    nodes BIGINT;
+    -- Table names may be schema-qualified, as in a regclass
+    edge_name TEXT := (SELECT string_agg(quote_ident(part), '.' ORDER BY n)
+                       FROM unnest(parse_ident(edge_table)) WITH ORDINALITY AS p (part, n));
+    node_name TEXT := (SELECT string_agg(quote_ident(part), '.' ORDER BY n)
+                       FROM unnest(parse_ident(node_table)) WITH ORDINALITY AS p (part, n));
+    -- Private staging table, so a caller's own temp tables are never touched
+    staging TEXT := quote_ident('road_topology_rows_' || md5(clock_timestamp()::TEXT || random()::TEXT));
+BEGIN
+    -- One pass over the roads feeds both tables
+    EXECUTE format(
+        'CREATE TEMP TABLE %s ON COMMIT DROP AS
+         SELECT * FROM road_topology($1, $2)', staging)
+    USING roads_query, tolerance;
+
+    EXECUTE format(
+        'CREATE TABLE %s AS
+         SELECT road_id, start_node, end_node, start_ch, end_ch, component
+         FROM %s', edge_name, staging);
+
+    EXECUTE format(
+        'CREATE TABLE %s AS
+         SELECT DISTINCT ON (ends.node_id) ends.node_id, ends.x, ends.y, ends.degree, t.component
+         FROM %s t
+         CROSS JOIN LATERAL (VALUES (t.start_node, t.start_x, t.start_y, t.start_degree),
+                                    (t.end_node, t.end_x, t.end_y, t.end_degree))
+              AS ends (node_id, x, y, degree)
+         ORDER BY ends.node_id', node_name, staging);
+
+    GET DIAGNOSTICS nodes = ROW_COUNT;
+    EXECUTE format('DROP TABLE %s', staging);
+    RETURN nodes;
+END;
+$$ LANGUAGE plpgsql;
+
+COMMENT ON FUNCTION build_road_topology IS
+'Creates edge_table (road_id, start_node, end_node, start_ch, end_ch, component) and
+node_table (node_id, x, y, degree, component) from road_topology. Both names may be
+schema-qualified (''gis.road_edges'') and are parsed like identifiers.
+Example: SELECT build_road_topology(''SELECT id, ST_AsText(geom) FROM roads'', 0.00001, ''road_edges'', ''road_nodes'');';
+
+-- ============================================
+-- Function: road_network_distance / road_network_route
+-- ============================================
+-- Shortest paths between road chainages over a cached network graph
+
+CREATE OR REPLACE FUNCTION road_network_distance(
+    roads_query TEXT,
+    from_road BIGINT,
+    from_ch DOUBLE PRECISION,
+    to_road BIGINT,
+    to_ch DOUBLE PRECISION,
+    tolerance DOUBLE PRECISION DEFAULT 0.0
+)
+RETURNS DOUBLE PRECISION
+AS 'MODULE_PATHNAME', 'road_network_distance'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION road_network_distance IS
+'Shortest distance (km) over the road network from a chainage on from_road to a chainage on
+to_road, or NULL if they are not connected. The network is the road_topology of roads_query
+with the given tolerance; its graph is built on first use and reused within the transaction
+while roads_query, tolerance, the role and search_path are unchanged and no rows became visible
+or invisible since. It is dropped at the end of the transaction.
+Example: SELECT road_network_distance(''SELECT id, ST_AsText(geom) FROM roads'', 101, 12.4, 205, 3.1);';
+
+CREATE OR REPLACE FUNCTION road_network_route(
+    roads_query TEXT,
+    from_road BIGINT,
+    from_ch DOUBLE PRECISION,
+    to_road BIGINT,
+    to_ch DOUBLE PRECISION,
+    tolerance DOUBLE PRECISION DEFAULT 0.0
+)
+RETURNS TABLE (
+    seq INTEGER,
+    road_id BIGINT,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    length DOUBLE PRECISION
+)
+AS 'MODULE_PATHNAME', 'road_network_route'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION road_network_route IS
+'Legs of the route found by road_network_distance, in travel order: the road and the chainages
+(km) travelled between; end_ch < start_ch runs against the digitized direction. No rows if the
+roads are not connected.
+Example: SELECT * FROM road_network_route(''SELECT id, ST_AsText(geom) FROM roads'', 101, 12.4, 205, 3.1);';
+
+CREATE OR REPLACE FUNCTION road_network_reset()
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'road_network_reset'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION road_network_reset IS
+'Drops the network graph cached by road_network_distance / road_network_route before the end of
+the transaction.
+Example: SELECT road_network_reset();';
+
+-- ============================================
+-- Aggregate: assemble_route
+-- ============================================
+-- Orders connected segments into one continuous chainage route
+
+CREATE OR REPLACE FUNCTION assemble_route_accum(
+    state INTERNAL,
+    segment_id BIGINT,
+    segment_wkt TEXT,
+    tolerance DOUBLE PRECISION
+)
+RETURNS INTERNAL
+AS 'MODULE_PATHNAME', 'assemble_route_accum'
+LANGUAGE C IMMUTABLE;
+
+CREATE OR REPLACE FUNCTION assemble_route_final(state INTERNAL)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'assemble_route_final'
+LANGUAGE C IMMUTABLE;
+
+CREATE AGGREGATE assemble_route(segment_id BIGINT, segment_wkt TEXT, tolerance DOUBLE PRECISION) (
+    SFUNC = assemble_route_accum,
+    STYPE = INTERNAL,
+    FINALFUNC = assemble_route_final
+);
+
+COMMENT ON AGGREGATE assemble_route(BIGINT, TEXT, DOUBLE PRECISION) IS
+'Chains the segments of a road into one route in a single pass, in any input order. Ends within
+tolerance (coordinate units, taken from the first row) are joined, so small gaps are bridged.
+Returns JSON: geometry (merged WKT), length (km), segments in route order with id, start_ch,
+end_ch (km along the merged line) and reversed, and the ids of unassembled segments that the
+walk did not reach (branches or disconnected pieces).
+Example: SELECT road_code, assemble_route(id, ST_AsText(geom), 0.00001) FROM road_links GROUP BY road_code;';
+
+-- ============================================
+-- Aggregate: coalesce_events
+-- ============================================
+-- Merges contiguous runs of equal event values, with parallel combine
+
+CREATE OR REPLACE FUNCTION coalesce_events_accum(
+    state INTERNAL,
+    from_ch DOUBLE PRECISION,
+    to_ch DOUBLE PRECISION,
+    value TEXT
+)
+RETURNS INTERNAL
+AS 'MODULE_PATHNAME', 'coalesce_events_accum'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION coalesce_events_combine(state1 INTERNAL, state2 INTERNAL)
+RETURNS INTERNAL
+AS 'MODULE_PATHNAME', 'coalesce_events_combine'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION coalesce_events_serialize(state INTERNAL)
+RETURNS BYTEA
+AS 'MODULE_PATHNAME', 'coalesce_events_serialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION coalesce_events_deserialize(data BYTEA, state INTERNAL)
+RETURNS INTERNAL
+AS 'MODULE_PATHNAME', 'coalesce_events_deserialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION coalesce_events_final(state INTERNAL)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'coalesce_events_final'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE AGGREGATE coalesce_events(from_ch DOUBLE PRECISION, to_ch DOUBLE PRECISION, value TEXT) (
+    SFUNC = coalesce_events_accum,
+    STYPE = INTERNAL,
+    FINALFUNC = coalesce_events_final,
+    COMBINEFUNC = coalesce_events_combine,
+    SERIALFUNC = coalesce_events_serialize,
+    DESERIALFUNC = coalesce_events_deserialize,
+    PARALLEL = SAFE
+);
+
+COMMENT ON AGGREGATE coalesce_events(DOUBLE PRECISION, DOUBLE PRECISION, TEXT) IS
+'Merges event rows of one road into maximal runs: rows with equal values (NULL equals NULL) that
+touch or overlap are joined. Input in chainage order is merged while streaming, any other order
+is sorted once at the end, and partial states from parallel workers are combined. Rows with a
+NULL chainage are skipped. Returns a JSON array of {from_ch, to_ch, value} in chainage order.
+Example: SELECT road_code, coalesce_events(from_ch, to_ch, surface ORDER BY from_ch) FROM road_surface GROUP BY road_code;';
+
+-- ============================================
+-- Procedure: generate_kilometer_posts_parallel
+-- ============================================
+-- Kilometer posts for a whole network, written by background workers
+
+CREATE TABLE road_post_jobs (
+    job_id BIGSERIAL PRIMARY KEY,
+    roads_query TEXT NOT NULL,
+    target_table REGCLASS NOT NULL,
+    interval_km DOUBLE PRECISION NOT NULL,
+    start_km DOUBLE PRECISION NOT NULL,
+    workers INTEGER NOT NULL,
+    status TEXT NOT NULL DEFAULT 'running',
+    error TEXT,
+    started_at TIMESTAMPTZ NOT NULL DEFAULT clock_timestamp(),
+    finished_at TIMESTAMPTZ
+);
+
+CREATE TABLE road_post_job_workers (
+    job_id BIGINT NOT NULL REFERENCES road_post_jobs ON DELETE CASCADE,
+    worker INTEGER NOT NULL,
+    roads_total BIGINT NOT NULL,
+    roads_done BIGINT NOT NULL DEFAULT 0,
+    posts_written BIGINT NOT NULL DEFAULT 0,
+    last_road_id BIGINT,
+    status TEXT NOT NULL DEFAULT 'pending',
+    error TEXT,
+    updated_at TIMESTAMPTZ,
+    PRIMARY KEY (job_id, worker)
+);
+
+-- Roads of running jobs; worker w reads partition w in road_id order
+CREATE UNLOGGED TABLE road_post_job_roads (
+    job_id BIGINT NOT NULL,
+    part INTEGER NOT NULL,
+    road_id BIGINT NOT NULL,
+    wkt TEXT,
+    PRIMARY KEY (job_id, part, road_id)
+);
+
+CREATE OR REPLACE FUNCTION road_post_job_run(job_id BIGINT, workers INTEGER)
+RETURNS VOID
+AS 'MODULE_PATHNAME', 'road_post_job_run'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION road_post_job_run IS
+'Starts the background workers of a kilometer post job and waits for them; called by
+generate_kilometer_posts_parallel.';
+
+CREATE OR REPLACE PROCEDURE generate_kilometer_posts_parallel(
+    roads_query TEXT,
+    target_table REGCLASS,
+    interval_km DOUBLE PRECISION DEFAULT 1.0,
+    start_km DOUBLE PRECISION DEFAULT 0.0,
+    num_workers INTEGER DEFAULT 4
+)
+AS $$
+DECLARE
+    job BIGINT;
+    failure TEXT;
+    canceled BOOLEAN := false;
+BEGIN
+    IF NOT interval_km > 0 THEN
+        RAISE EXCEPTION 'interval_km must be positive';
+    END IF;
+    IF NOT num_workers > 0 THEN
+        RAISE EXCEPTION 'num_workers must be positive';
+    END IF;
+
+    INSERT INTO road_post_jobs (roads_query, target_table, interval_km, start_km, workers)
+    VALUES (roads_query, target_table, interval_km, start_km, num_workers)
+    RETURNING road_post_jobs.job_id INTO job;
+
+    -- One snapshot of the roads for all workers
+    EXECUTE format(
+        'INSERT INTO road_post_job_roads (job_id, part, road_id, wkt)
+         SELECT $1, abs(r.id::BIGINT %% $2), r.id, r.wkt FROM (%s) AS r (id, wkt)', roads_query)
+    USING job, num_workers;
+
+    INSERT INTO road_post_job_workers (job_id, worker, roads_total)
+    SELECT job, w.part, count(r.road_id)
+    FROM generate_series(0, num_workers - 1) AS w (part)
+    LEFT JOIN road_post_job_roads r ON r.job_id = job AND r.part = w.part
+    GROUP BY w.part;
+
+    -- Workers run in their own transactions and must see the job
+    COMMIT;
+
+    -- OTHERS does not cover a cancel or statement_timeout; the job is closed
+    -- below and the cancel raised again once that is committed
+    BEGIN
+        PERFORM road_post_job_run(job, num_workers);
+    EXCEPTION
+        WHEN query_canceled THEN
+            GET STACKED DIAGNOSTICS failure = MESSAGE_TEXT;
+            canceled := true;
+        WHEN OTHERS THEN
+            GET STACKED DIAGNOSTICS failure = MESSAGE_TEXT;
+    END;
+
+    IF failure IS NULL THEN
+        SELECT string_agg(format('worker %s: %s', w.worker, coalesce(w.error, w.status)), '; ' ORDER BY w.worker)
+        INTO failure
+        FROM road_post_job_workers w
+        WHERE w.job_id = job AND w.status <> 'done';
+    END IF;
+
+    DELETE FROM road_post_job_roads r WHERE r.job_id = job;
+    UPDATE road_post_jobs j
+    SET status = CASE WHEN failure IS NULL THEN 'done' ELSE 'failed' END,
+        error = failure,
+        finished_at = clock_timestamp()
+    WHERE j.job_id = job;
+    COMMIT;
+
+    IF canceled THEN
+        RAISE EXCEPTION 'kilometer post job % canceled: %', job, failure USING ERRCODE = 'query_canceled';
+    ELSIF failure IS NOT NULL THEN
+        RAISE EXCEPTION 'kilometer post job % failed: %', job, failure;
+    END IF;
+END;
+$$ LANGUAGE plpgsql;
+
+COMMENT ON PROCEDURE generate_kilometer_posts_parallel IS
+'Generates kilometer posts every interval_km from start_km for every road of roads_query, which
+returns (id, WKT). The roads are split into num_workers partitions by id and each partition is
+handled by a background worker that inserts (road_id, km_post, point_wkt) into target_table in
+one bulk INSERT per chunk of roads, committing as it goes. Progress is in road_post_job_progress.
+Must be called outside a transaction block; needs num_workers free max_worker_processes slots.
+Example: CALL generate_kilometer_posts_parallel(''SELECT id, ST_AsText(geom) FROM roads'', ''road_km_posts'', 1.0, 0.0, 8);';
+
+CREATE OR REPLACE VIEW road_post_job_progress AS
+    SELECT j.job_id,
+           j.target_table,
+           j.status,
+           sum(w.roads_total) AS roads_total,
+           sum(w.roads_done) AS roads_done,
+           round(100.0 * sum(w.roads_done) / nullif(sum(w.roads_total), 0), 1) AS percent_done,
+           sum(w.posts_written) AS posts_written,
+           count(*) FILTER (WHERE w.status = 'running') AS workers_running,
+           count(*) FILTER (WHERE w.status = 'done') AS workers_done,
+           count(*) FILTER (WHERE w.status = 'failed') AS workers_failed,
+           j.started_at,
+           coalesce(j.finished_at, max(w.updated_at)) AS updated_at,
+           j.error
+    FROM road_post_jobs j
+    JOIN road_post_job_workers w USING (job_id)
+    GROUP BY j.job_id;
+
+COMMENT ON VIEW road_post_job_progress IS
+'One row per kilometer post job with the roads and posts committed so far; per-worker detail is
+in road_post_job_workers.
+Example: SELECT job_id, percent_done, posts_written, workers_running FROM road_post_job_progress;';
+
+-- ============================================
+-- Function: split_line_at_chainages
+-- ============================================
+-- Splits a line into consecutive pieces at many chainages in one pass
+
+CREATE OR REPLACE FUNCTION split_line_at_chainages(
+    line_wkt TEXT,
+    chainages DOUBLE PRECISION[]
+)
+RETURNS TABLE (
+    piece INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    geometry TEXT
+)
+AS 'MODULE_PATHNAME', 'split_line_at_chainages'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION split_line_at_chainages(TEXT, DOUBLE PRECISION[]) IS
+'Splits a line at chainages (km) into ordered pieces (WKT) from a single traversal; neighbouring
+pieces share the exact same cut point. Chainages are sorted; duplicates and chainages at or
+beyond either end are ignored, so k inner chainages give k+1 pieces.
+Example: SELECT * FROM split_line_at_chainages(''LINESTRING(0 0, 10 0, 10 10)'', ARRAY[300.0, 900.0]);';
+
+CREATE OR REPLACE FUNCTION split_line_at_chainages(
+    line_data BYTEA,
+    chainages DOUBLE PRECISION[]
+)
+RETURNS TABLE (
+    piece INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    geometry TEXT
+)
+AS 'MODULE_PATHNAME', 'split_line_at_chainages'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION split_line_at_chainages_geom(
+    line_geom GEOMETRY,
+    chainages DOUBLE PRECISION[]
+)
+RETURNS TABLE (
+    piece INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    geom GEOMETRY
+)
+AS $$
+    SELECT s.piece, s.start_ch, s.end_ch, ST_GeomFromText(s.geometry, ST_SRID(line_geom))
+    FROM split_line_at_chainages(ST_AsText(line_geom), chainages) AS s;
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION split_line_at_chainages_geom IS
+'PostGIS geometry wrapper for split_line_at_chainages.
+Example: SELECT * FROM split_line_at_chainages_geom(geom, ARRAY[12.4, 37.9]) FROM roads WHERE id = 1;';
+
+-- ============================================
+-- Function: road_profile
+-- ============================================
+-- Per-interval bearing, curvature and, for 3D lines, elevation and grade
+-- from a single walk along the line
+
+CREATE OR REPLACE FUNCTION road_profile(
+    line_wkt TEXT,
+    interval_m DOUBLE PRECISION
+)
+RETURNS TABLE (
+    sample INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    elevation DOUBLE PRECISION,
+    grade DOUBLE PRECISION,
+    bearing DOUBLE PRECISION,
+    curvature DOUBLE PRECISION,
+    geometry TEXT
+)
+AS 'MODULE_PATHNAME', 'road_profile'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION road_profile(TEXT, DOUBLE PRECISION) IS
+'Profile of a line every interval_m meters, walking the line once: per interval the start and
+end chainages (km), elevation at the start (m), grade (%), chord bearing (degrees from north),
+curvature (radians per meter, left turns positive) and the start point (WKT). elevation and
+grade are NULL unless the line has Z values.
+Example: SELECT * FROM road_profile(''LINESTRING Z (0 0 100, 0.001 0 101, 0.001 0.001 101)'', 10.0);';
+
+CREATE OR REPLACE FUNCTION road_profile(
+    line_data BYTEA,
+    interval_m DOUBLE PRECISION
+)
+RETURNS TABLE (
+    sample INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    elevation DOUBLE PRECISION,
+    grade DOUBLE PRECISION,
+    bearing DOUBLE PRECISION,
+    curvature DOUBLE PRECISION,
+    geometry TEXT
+)
+AS 'MODULE_PATHNAME', 'road_profile'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION road_profile_geom(
+    line_geom GEOMETRY,
+    interval_m DOUBLE PRECISION
+)
+RETURNS TABLE (
+    sample INTEGER,
+    start_ch DOUBLE PRECISION,
+    end_ch DOUBLE PRECISION,
+    elevation DOUBLE PRECISION,
+    grade DOUBLE PRECISION,
+    bearing DOUBLE PRECISION,
+    curvature DOUBLE PRECISION,
+    geom GEOMETRY
+)
+AS $$
+    SELECT p.sample, p.start_ch, p.end_ch, p.elevation, p.grade, p.bearing, p.curvature,
+           ST_GeomFromText(p.geometry, ST_SRID(line_geom))
+    FROM road_profile(ST_AsText(line_geom), interval_m) AS p;
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION road_profile_geom IS
+'PostGIS geometry wrapper for road_profile; 3D geometries (e.g. PolyLineZ shapefiles) give grades.
+Example: SELECT p.* FROM roads, road_profile_geom(roads.geom, 10.0) AS p WHERE roads.id = 1;';
+
+-- ============================================
+-- Chainage equations
+-- ============================================
+-- Station breaks of realigned roads as an n x 2 array of (measured, posted)
+-- chainage pairs (km), e.g. a column filled with
+-- array_agg(ARRAY[measured_ch, posted_ch] ORDER BY measured_ch).
+-- The overloads below take and return posted chainages and map them to
+-- positions on the line by binary search over the breaks.
+
+CREATE OR REPLACE FUNCTION measured_to_posted_chainage(
+    chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[]
+)
+RETURNS DOUBLE PRECISION
+AS 'MODULE_PATHNAME', 'measured_to_posted_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION measured_to_posted_chainage IS
+'Posted chainage (km) of a measured chainage along the line. From each break on, posted chainage
+continues from the break''s posted value; before the first break it equals the measured chainage.
+Example: SELECT measured_to_posted_chainage(3.0, ''{{2.0, 2.5}, {5.0, 5.3}}'');';
+
+CREATE OR REPLACE FUNCTION posted_to_measured_chainage(
+    chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[]
+)
+RETURNS DOUBLE PRECISION
+AS 'MODULE_PATHNAME', 'posted_to_measured_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION posted_to_measured_chainage IS
+'Measured chainage (km) of a posted chainage; NULL when a forward break skips it. Where a backward
+break posts a chainage twice, the stretch after the break is used.
+Example: SELECT posted_to_measured_chainage(3.0, ''{{2.0, 2.5}, {5.0, 5.3}}'');';
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage(
+    line_wkt TEXT,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'get_section_by_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION get_section_by_chainage(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, DOUBLE PRECISION[], INTEGER) IS
+'get_section_by_chainage with posted chainages; length is the measured length of the section.
+Example: SELECT get_section_by_chainage(geom_wkt, 2.0, 3.0, equations) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage(
+    line_data BYTEA,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'get_section_by_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage(
+    line_wkt TEXT,
+    chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'cut_line_at_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION cut_line_at_chainage(TEXT, DOUBLE PRECISION, DOUBLE PRECISION[], INTEGER) IS
+'cut_line_at_chainage with a posted chainage.
+Example: SELECT cut_line_at_chainage(geom_wkt, 2.7, equations) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage(
+    line_data BYTEA,
+    chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'cut_line_at_chainage'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_wkt TEXT,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION calibrate_point_on_line(TEXT, TEXT, DOUBLE PRECISION, DOUBLE PRECISION[], INTEGER) IS
+'calibrate_point_on_line returning the posted chainage.
+Example: SELECT calibrate_point_on_line(geom_wkt, ''POINT(5 0.1)'', 1.0, equations) FROM roads;';
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_data BYTEA,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage_geom(
+    line_geom GEOMETRY,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS $$
+    SELECT get_section_by_chainage(ST_AsText(line_geom), start_chainage, end_chainage, equations, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage_geom(
+    line_geom GEOMETRY,
+    chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        cut_line_at_chainage(ST_AsText(line_geom), chainage, equations, direction),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line_geom(
+    line_geom GEOMETRY,
+    point_geom GEOMETRY,
+    radius DOUBLE PRECISION,
+    equations DOUBLE PRECISION[],
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSON
+AS $$
+    SELECT calibrate_point_on_line(ST_AsText(line_geom), ST_AsText(point_geom), radius, equations, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+-- ============================================
+-- Direction
+-- ============================================
+-- direction 1 measures chainage in the digitized direction, -1 from the
+-- far end back, as on the reversed line. The stored geometry and its
+-- cumulative lengths are used as they are; nothing is reversed or copied.
+-- Offsets keep their meaning (positive is left in the direction of travel).
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage(
+    line_wkt TEXT,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'get_section_by_chainage_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION get_section_by_chainage(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, INTEGER) IS
+'get_section_by_chainage in a direction; with -1 the section runs from the far end back.
+Example: SELECT get_section_by_chainage(geom_wkt, 0.0, 1.5, -1) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage(
+    line_data BYTEA,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'get_section_by_chainage_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage(
+    line_wkt TEXT,
+    chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'cut_line_at_chainage_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION cut_line_at_chainage(TEXT, DOUBLE PRECISION, INTEGER) IS
+'cut_line_at_chainage in a direction; -1 measures the chainage from the far end.
+Example: SELECT cut_line_at_chainage(geom_wkt, 0.4, -1) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage(
+    line_data BYTEA,
+    chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'cut_line_at_chainage_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_wkt TEXT,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION calibrate_point_on_line(TEXT, TEXT, DOUBLE PRECISION, INTEGER) IS
+'calibrate_point_on_line in a direction; with -1 chainage and vertex index count from the far end.
+Example: SELECT calibrate_point_on_line(geom_wkt, ''POINT(5 0.1)'', 1.0, -1) FROM roads;';
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line(
+    line_data BYTEA,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset(
+    line_wkt TEXT,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'point_at_chainage_offset_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION point_at_chainage_offset(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, INTEGER) IS
+'point_at_chainage_offset in a direction; with -1 positive offsets are left of the reversed line.
+Example: SELECT point_at_chainage_offset(geom_wkt, 0.2, 4.5, -1) FROM road_signs;';
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset(
+    line_data BYTEA,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'point_at_chainage_offset_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION offset_section(
+    line_wkt TEXT,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS TEXT
+AS 'MODULE_PATHNAME', 'offset_section_direction'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION offset_section(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, DOUBLE PRECISION, INTEGER) IS
+'offset_section in a direction; the result runs in the direction of travel.
+Example: SELECT offset_section(geom_wkt, 0.0, 1.0, -3.5, -1) FROM roads WHERE id = 1;';
+
+-- PostGIS geometry wrappers
+CREATE OR REPLACE FUNCTION get_section_by_chainage_geom(
+    line_geom GEOMETRY,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS $$
+    SELECT get_section_by_chainage(ST_AsText(line_geom), start_chainage, end_chainage, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION cut_line_at_chainage_geom(
+    line_geom GEOMETRY,
+    chainage DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        cut_line_at_chainage(ST_AsText(line_geom), chainage, direction),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line_geom(
+    line_geom GEOMETRY,
+    point_geom GEOMETRY,
+    radius DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS JSON
+AS $$
+    SELECT calibrate_point_on_line(ST_AsText(line_geom), ST_AsText(point_geom), radius, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION point_at_chainage_offset_geom(
+    line_geom GEOMETRY,
+    chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        point_at_chainage_offset(ST_AsText(line_geom), chainage, offset_m, direction),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION offset_section_geom(
+    line_geom GEOMETRY,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    offset_m DOUBLE PRECISION,
+    direction INTEGER
+)
+RETURNS GEOMETRY
+AS $$
+    SELECT ST_GeomFromText(
+        offset_section(ST_AsText(line_geom), start_chainage, end_chainage, offset_m, direction),
+        ST_SRID(line_geom)
+    );
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+-- ============================================
+-- JSONB results
+-- ============================================
+-- jsonb variants of the JSON-returning functions, built directly from the
+-- result structs; same keys and values as the json versions, with no text
+-- step when the result is stored or indexed as jsonb.
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage_jsonb(
+    line_wkt TEXT,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS 'MODULE_PATHNAME', 'get_section_by_chainage_jsonb'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION get_section_by_chainage_jsonb(TEXT, DOUBLE PRECISION, DOUBLE PRECISION, DOUBLE PRECISION[], INTEGER) IS
+'get_section_by_chainage returning jsonb. equations and direction are optional as in get_section_by_chainage.
+Example: INSERT INTO sections (road_id, section) SELECT id, get_section_by_chainage_jsonb(geom_wkt, 2.0, 3.0) FROM roads;';
+
+CREATE OR REPLACE FUNCTION get_section_by_chainage_jsonb(
+    line_data BYTEA,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS 'MODULE_PATHNAME', 'get_section_by_chainage_jsonb'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line_jsonb(
+    line_wkt TEXT,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION DEFAULT 1.0,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line_jsonb'
+LANGUAGE C IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION calibrate_point_on_line_jsonb(TEXT, TEXT, DOUBLE PRECISION, DOUBLE PRECISION[], INTEGER) IS
+'calibrate_point_on_line returning jsonb.
+Example: UPDATE gps_points p SET calib = calibrate_point_on_line_jsonb(r.geom_wkt, p.wkt, 0.5) FROM roads r WHERE r.id = p.road_id;';
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line_jsonb(
+    line_data BYTEA,
+    point_wkt TEXT,
+    radius DOUBLE PRECISION DEFAULT 1.0,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS 'MODULE_PATHNAME', 'calibrate_point_on_line_jsonb'
+LANGUAGE C IMMUTABLE STRICT;
+
+-- PostGIS geometry wrappers
+CREATE OR REPLACE FUNCTION get_section_by_chainage_jsonb_geom(
+    line_geom GEOMETRY,
+    start_chainage DOUBLE PRECISION,
+    end_chainage DOUBLE PRECISION,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS $$
+    SELECT get_section_by_chainage_jsonb(ST_AsText(line_geom), start_chainage, end_chainage, equations, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION get_section_by_chainage_jsonb_geom IS
+'PostGIS geometry wrapper for get_section_by_chainage_jsonb.
+Example: SELECT get_section_by_chainage_jsonb_geom(geom, 2.5, 7.5) FROM roads WHERE id = 1;';
+
+CREATE OR REPLACE FUNCTION calibrate_point_on_line_jsonb_geom(
+    line_geom GEOMETRY,
+    point_geom GEOMETRY,
+    radius DOUBLE PRECISION DEFAULT 1.0,
+    equations DOUBLE PRECISION[] DEFAULT '{}',
+    direction INTEGER DEFAULT 1
+)
+RETURNS JSONB
+AS $$
+    SELECT calibrate_point_on_line_jsonb(ST_AsText(line_geom), ST_AsText(point_geom), radius, equations, direction);
+$$ LANGUAGE SQL IMMUTABLE STRICT;
+
+COMMENT ON FUNCTION calibrate_point_on_line_jsonb_geom IS
+'PostGIS geometry wrapper for calibrate_point_on_line_jsonb.
+Example: SELECT calibrate_point_on_line_jsonb_geom(r.geom, p.geom, 0.5) FROM roads r, gps_points p;';
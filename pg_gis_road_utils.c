@@ -5,385 +5,550 @@
  * including chainage-based operations, line cutting, and point calibration.
  * 
  * Converted from JNI-based implementation to PostgreSQL C extension.
+ * The geometry math lives in road_core.c; this file only adapts it to fmgr.
  */
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
 #include "utils/builtins.h"
-#include "utils/geo_decls.h"
+#include "catalog/namespace.h"
 #include "catalog/pg_type.h"
 #include "executor/spi.h"
 #include "funcapi.h"
-#include "access/htup_details.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "nodes/plannodes.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/array.h"
+#include "utils/guc.h"
 #include "utils/json.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/numeric.h"
+#include "utils/snapmgr.h"
+#include "utils/tuplestore.h"
 
-#include <geos_c.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "road_core.h"
+#include "road_stats.h"
+
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
-/* ========== Type Definitions ========== */
+void _PG_init(void);
+PGDLLEXPORT void road_post_worker_main(Datum main_arg);
+static void roadNetworkXactCallback(XactEvent event, void *arg);
 
-typedef struct {
-    double x;
-    double y;
-} Coordinate;
+/* GUC pg_gis_road_utils.batch_threads */
+static int road_batch_threads = 1;
 
-typedef struct {
-    Coordinate *data;
-    size_t size;
-    size_t capacity;
-} CoordinateArray;
+void
+_PG_init(void)
+{
+    roadStatsInit();
+
+    DefineCustomIntVariable("pg_gis_road_utils.batch_threads",
+                            "Threads used by the array forms of calibration and offset points.",
+                            "Each thread takes a contiguous share of the array; small arrays stay on one thread.",
+                            &road_batch_threads,
+                            1,
+                            1, ROAD_PARALLEL_MAX_THREADS,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+
+    RegisterXactCallback(roadNetworkXactCallback, NULL);
+}
 
-typedef struct {
-    double startLat;
-    double startLon;
-    double endLat;
-    double endLon;
-    double startCh;
-    double endCh;
-    double length;
-    char *geometry;
-} SectionDto;
+/* ========== PostgreSQL Allocator ========== */
 
-typedef struct {
-    double lat;
-    double lon;
-    double chainage;
-    int index;
-} PointDto;
+/*
+ * Core allocator backed by palloc. ctx is the target MemoryContext, or NULL
+ * for CurrentMemoryContext. palloc never returns NULL, it throws instead.
+ */
 
-/* ========== Global GEOS Handlers ========== */
+static void *pg_road_alloc(void *ctx, size_t size) {
+    return ctx ? MemoryContextAlloc((MemoryContext) ctx, size) : palloc(size);
+}
 
-static void geos_notice_handler(const char *fmt, ...) {
-    // Suppress GEOS notices
+static void *pg_road_realloc(void *ctx, void *ptr, size_t size) {
+    return repalloc(ptr, size);
 }
 
-static void geos_error_handler(const char *fmt, ...) {
-    va_list ap;
-    char buf[1024];
-    
-    va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
-    
-    ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
-                    errmsg("GEOS error: %s", buf)));
+static void pg_road_free(void *ctx, void *ptr) {
+    pfree(ptr);
 }
 
-/* ========== CoordinateArray Functions ========== */
+static const RoadAllocator pg_road_allocator = {
+    pg_road_alloc,
+    pg_road_realloc,
+    pg_road_free,
+    NULL
+};
 
-static void initCoordinateArray(CoordinateArray *arr, size_t initialCapacity) {
-    arr->data = (Coordinate *)palloc(initialCapacity * sizeof(Coordinate));
-    arr->size = 0;
-    arr->capacity = initialCapacity;
-}
+/* ========== Argument Helpers ========== */
+
+/*
+ * Parse a line argument given either as WKT or in the compact encoding from
+ * encode_road_line. The bytea overloads share the text entry points: text
+ * never contains a zero byte, so the compact header cannot be mistaken for WKT.
+ */
+static int parseLineArgWith(text *arg, const RoadAllocator *allocator, RoadLine *line) {
+    const char *data = VARDATA_ANY(arg);
+    size_t len = VARSIZE_ANY_EXHDR(arg);
 
-static void addCoordinate(CoordinateArray *arr, double x, double y) {
-    if (arr->size >= arr->capacity) {
-        size_t newCapacity = arr->capacity * 2;
-        arr->data = (Coordinate *)repalloc(arr->data, newCapacity * sizeof(Coordinate));
-        arr->capacity = newCapacity;
+    if (isCompactLine(data, len)) {
+        return decodeCompactLine(data, len, allocator, line);
     }
-    arr->data[arr->size].x = x;
-    arr->data[arr->size].y = y;
-    arr->size++;
+    return parseLineWKT(text_to_cstring(arg), allocator, line);
 }
 
-static void freeCoordinateArray(CoordinateArray *arr) {
-    if (arr->data) {
-        pfree(arr->data);
-        arr->data = NULL;
-    }
-    arr->size = 0;
-    arr->capacity = 0;
+static inline int parseLineArg(text *arg, RoadLine *line) {
+    return parseLineArgWith(arg, &pg_road_allocator, line);
 }
 
-/* ========== GEOS Helper Functions ========== */
+/* ========== Per-call-site State ========== */
 
-static GEOSGeometry* createLineStringFromArray(GEOSContextHandle_t context, CoordinateArray *coordsArr) {
-    if (!coordsArr || !coordsArr->data || coordsArr->size < 2) {
-        return NULL;
-    }
+/*
+ * State of one call site, kept in flinfo->fn_extra and allocated under
+ * fn_mcxt, so it lives as long as the query's plan node:
+ *
+ * - a scratch context for the working memory of a single call (detoasted
+ *   arguments, uncached lines, kernel output, WKT and JSON buffers), reset
+ *   at the start of every call so memory stays flat however many rows a
+ *   query processes;
+ *
+ * - the last line parsed at the call site. A nested loop passing the same
+ *   road row after row then parses it once. Hits are decided on the argument
+ *   bytes: a datum pointer alone is not enough, as per-tuple memory is
+ *   recycled between rows. Only the parsed line outlives the call: the copy
+ *   handed to the function carries callAllocator, so sections, WKT and other
+ *   kernel output allocated through line->allocator go to scratch.
+ */
+typedef struct RoadCallSite {
+    MemoryContext scratch;
+    MemoryContext lineContext;  /* holds lineBytes and line; reset on every miss */
+    RoadAllocator lineAllocator;
+    RoadAllocator callAllocator; /* scratch; frees of cached arrays are ignored */
+    bool lineValid;
+    size_t lineLen;
+    char *lineBytes;            /* copy of the argument the line was parsed from */
+    RoadLine line;
+} RoadCallSite;
+
+/* Cached arrays are released with their context, never one by one */
+static void pg_road_cache_free(void *ctx, void *ptr) {
+}
 
-    GEOSCoordSequence *coords = GEOSCoordSeq_create_r(context, coordsArr->size, 2);
-    if (!coords) {
-        return NULL;
-    }
+static void *pg_road_call_alloc(void *ctx, size_t size) {
+    return MemoryContextAlloc(((RoadCallSite *) ctx)->scratch, size);
+}
 
-    for (size_t i = 0; i < coordsArr->size; i++) {
-        GEOSCoordSeq_setX_r(context, coords, i, coordsArr->data[i].x);
-        GEOSCoordSeq_setY_r(context, coords, i, coordsArr->data[i].y);
+static void pg_road_call_free(void *ctx, void *ptr) {
+    if (GetMemoryChunkContext(ptr) != ((RoadCallSite *) ctx)->lineContext) {
+        pfree(ptr);
     }
-
-    return GEOSGeom_createLineString_r(context, coords);
 }
 
-static char* geomToWKT(GEOSContextHandle_t context, GEOSGeometry *geometry) {
-    if (!geometry) {
-        return NULL;
+static RoadCallSite *getCallSite(FmgrInfo *flinfo) {
+    RoadCallSite *site = (RoadCallSite *) flinfo->fn_extra;
+
+    if (!site) {
+        site = (RoadCallSite *) MemoryContextAllocZero(flinfo->fn_mcxt, sizeof(RoadCallSite));
+        site->scratch = AllocSetContextCreate(flinfo->fn_mcxt, "pg_gis_road_utils scratch",
+                                              ALLOCSET_DEFAULT_SIZES);
+        site->lineContext = AllocSetContextCreate(flinfo->fn_mcxt, "pg_gis_road_utils line cache",
+                                                  ALLOCSET_DEFAULT_SIZES);
+        site->lineAllocator = pg_road_allocator;
+        site->lineAllocator.free = pg_road_cache_free;
+        site->lineAllocator.ctx = site->lineContext;
+        site->callAllocator = pg_road_allocator;
+        site->callAllocator.alloc = pg_road_call_alloc;
+        site->callAllocator.free = pg_road_call_free;
+        site->callAllocator.ctx = site;
+        flinfo->fn_extra = site;
     }
+    return site;
+}
 
-    char *wkt = GEOSGeomToWKT_r(context, geometry);
-    if (!wkt) {
-        return NULL;
+/*
+ * Reset the call site's scratch context and make it current; returns the
+ * caller's context, which the function switches back to before building its
+ * result. Kernel output through pg_road_allocator (CurrentMemoryContext) or
+ * through the allocator of a line from parseCachedLineArg lands in scratch;
+ * the cached line itself is the only thing that outlives the call. Without
+ * an FmgrInfo the call runs in the caller's context.
+ */
+static MemoryContext beginScratch(FunctionCallInfo fcinfo) {
+    if (!fcinfo->flinfo) {
+        return CurrentMemoryContext;
     }
 
-    /* Copy to PostgreSQL memory context */
-    char *result = pstrdup(wkt);
-    GEOSFree_r(context, wkt);
-    
-    return result;
+    RoadCallSite *site = getCallSite(fcinfo->flinfo);
+    MemoryContextReset(site->scratch);
+    return MemoryContextSwitchTo(site->scratch);
 }
 
-static GEOSGeometry* getLineFromMultiline(GEOSContextHandle_t context, const char* wkt) {
-    GEOSWKTReader *reader = GEOSWKTReader_create_r(context);
-    if (!reader) {
-        return NULL;
-    }
+/*
+ * parseLineArg through the call site's cache. line receives a shallow copy of
+ * the cached line whose allocator works in the scratch context and ignores
+ * frees of the cached arrays, so callers can treat it like a freshly parsed
+ * line as long as they do not modify it.
+ */
+static int parseCachedLineArg(FunctionCallInfo fcinfo, text *arg, RoadStatFunction fn, RoadLine *line) {
+    const char *data = VARDATA_ANY(arg);
+    size_t len = VARSIZE_ANY_EXHDR(arg);
 
-    GEOSGeometry *geom = GEOSWKTReader_read_r(context, reader, wkt);
-    GEOSWKTReader_destroy_r(context, reader);
+    if (!fcinfo->flinfo) {
+        return parseLineArg(arg, line);
+    }
 
-    if (!geom) {
-        return NULL;
+    RoadCallSite *site = getCallSite(fcinfo->flinfo);
+    if (site->lineValid && site->lineLen == len && memcmp(site->lineBytes, data, len) == 0) {
+        roadStatsAdd(fn, ROAD_STAT_CACHE_HITS, 1);
+        *line = site->line;
+        line->allocator = &site->callAllocator;
+        return 1;
     }
 
-    int geomType = GEOSGeomTypeId_r(context, geom);
+    roadStatsAdd(fn, ROAD_STAT_CACHE_MISSES, 1);
+    site->lineValid = false;
+    MemoryContextReset(site->lineContext);
 
-    if (geomType == GEOS_LINESTRING) {
-        return geom;
-    } else if (geomType == GEOS_MULTILINESTRING) {
-        int numGeoms = GEOSGetNumGeometries_r(context, geom);
-        if (numGeoms > 0) {
-            const GEOSGeometry *firstLine = GEOSGetGeometryN_r(context, geom, 0);
-            GEOSGeometry *result = GEOSGeom_clone_r(context, firstLine);
-            GEOSGeom_destroy_r(context, geom);
-            return result;
-        }
+    if (!parseLineArgWith(arg, &site->lineAllocator, &site->line)) {
+        return 0;
     }
+    site->lineBytes = (char *) MemoryContextAlloc(site->lineContext, len > 0 ? len : 1);
+    memcpy(site->lineBytes, data, len);
+    site->lineLen = len;
+    site->lineValid = true;
 
-    GEOSGeom_destroy_r(context, geom);
-    return NULL;
-}
-
-static double compute_distance(double x1, double y1, double x2, double y2) {
-    return sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
+    *line = site->line;
+    line->allocator = &site->callAllocator;
+    return 1;
 }
 
-/* ========== Core Implementation Functions ========== */
-
-#define MAX_RADIUS 1000000
-
-static int calibratePoint(GEOSContextHandle_t context, const GEOSGeometry* line, 
-                         const GEOSGeometry* referencePoint, double radius, PointDto* pointDto) {
-    if (!line || !referencePoint || !pointDto) {
-        return 0;
+/*
+ * Parse the part of a line argument needed around one chainage (km). Lines in
+ * the indexed layout are read through TOAST slices: the header, the block
+ * index and the one block holding the chainage, so a lookup on a long line
+ * stored EXTERNAL fetches a few chunks instead of the whole datum. Other
+ * encodings are detoasted and go through the call-site cache, counted under
+ * fn. Reverse chainages are mirrored here, since a window does not know where
+ * the line ends. bytes receives the number of bytes read.
+ */
+static int parseLineWindowArg(FunctionCallInfo fcinfo, int argno, RoadStatFunction fn, double *chainage,
+                              int direction, RoadLine *line, size_t *bytes) {
+    Datum arg = PG_GETARG_DATUM(argno);
+    IndexedLineInfo info;
+    size_t first, count;
+    struct varlena *head = PG_DETOAST_DATUM_SLICE(arg, 0, ROAD_INDEXED_HEADER);
+
+    if (!readIndexedLineHeader(VARDATA_ANY(head), VARSIZE_ANY_EXHDR(head), &info)) {
+        text *whole = DatumGetTextPP(arg);
+        *bytes = VARSIZE_ANY_EXHDR(whole);
+        if (!parseCachedLineArg(fcinfo, whole, fn, line)) return 0;
+        if (direction == ROAD_REVERSE) *chainage = reverseChainage(line, *chainage);
+        return 1;
     }
 
-    const GEOSCoordSequence* coordinateSequenceLine = GEOSGeom_getCoordSeq_r(context, line);
-    if (!coordinateSequenceLine) {
-        return 0;
-    }
+    if (direction == ROAD_REVERSE) *chainage = degreesToKm(info.start + info.end) - *chainage;
 
-    unsigned int numPointsLine = 0;
-    GEOSCoordSeq_getSize_r(context, coordinateSequenceLine, &numPointsLine);
+    size_t indexSize = indexedLineIndexSize(&info);
+    struct varlena *index = PG_DETOAST_DATUM_SLICE(arg, ROAD_INDEXED_HEADER, indexSize);
+    if (VARSIZE_ANY_EXHDR(index) != indexSize) return 0;
 
-    double closestReferenceDistance = MAX_RADIUS;
-    double chainage = MAX_RADIUS;
-    double lengthFromStart = 0.0;
-    double prev_x, prev_y;
-    double lat, lon;
-    int index;
+    if (!indexedLineWindow(&info, VARDATA_ANY(index), kmToDegrees(*chainage), &first, &count)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Chainage out of bounds")));
+    }
 
-    GEOSCoordSeq_getX_r(context, coordinateSequenceLine, 0, &prev_x);
-    GEOSCoordSeq_getY_r(context, coordinateSequenceLine, 0, &prev_y);
+    size_t recordsSize = count * info.recordSize;
+    struct varlena *records = PG_DETOAST_DATUM_SLICE(arg, indexedLineRecordOffset(&info, first), recordsSize);
+    if (VARSIZE_ANY_EXHDR(records) != recordsSize) return 0;
 
-    for (unsigned int i = 0; i < numPointsLine; i++) {
-        double x, y;
+    *bytes = ROAD_INDEXED_HEADER + indexSize + recordsSize;
+    return decodeIndexedRecords(&info, VARDATA_ANY(records), first, count, &pg_road_allocator, line);
+}
 
-        if (!GEOSCoordSeq_getX_r(context, coordinateSequenceLine, i, &x) ||
-            !GEOSCoordSeq_getY_r(context, coordinateSequenceLine, i, &y)) {
-            return 0;
-        }
+/* Elements of a one-dimensional float8[] argument; NULL elements are rejected */
+static float8 *getFloat8Array(ArrayType *arr, const char *argName, int *count) {
+    Datum *elems;
+    bool *nulls;
+    int n;
 
-        GEOSGeometry* linePoint = GEOSGeom_createPointFromXY_r(context, x, y);
-        GEOSGeometry* prevPoint = GEOSGeom_createPointFromXY_r(context, prev_x, prev_y);
+    if (ARR_NDIM(arr) > 1) {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("%s must be a one-dimensional array", argName)));
+    }
 
-        if (!linePoint) {
-            GEOSGeom_destroy_r(context, linePoint);
-            return 0;
-        }
+    deconstruct_array(arr, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd', &elems, &nulls, &n);
 
-        double distanceFromReference;
-        if (!GEOSDistance_r(context, referencePoint, linePoint, &distanceFromReference)) {
-            GEOSGeom_destroy_r(context, linePoint);
-            GEOSGeom_destroy_r(context, prevPoint);
-            return 0;
+    float8 *values = (float8 *) palloc((n > 0 ? n : 1) * sizeof(float8));
+    for (int i = 0; i < n; i++) {
+        if (nulls[i]) {
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                            errmsg("%s must not contain NULL elements", argName)));
         }
+        values[i] = DatumGetFloat8(elems[i]);
+    }
 
-        double distanceFromPrevPoint;
-        GEOSDistance_r(context, prevPoint, linePoint, &distanceFromPrevPoint);
-        lengthFromStart += distanceFromPrevPoint;
+    pfree(elems);
+    pfree(nulls);
+    *count = n;
+    return values;
+}
 
-        if (distanceFromReference <= radius && distanceFromReference < closestReferenceDistance) {
-            closestReferenceDistance = distanceFromReference;
-            chainage = lengthFromStart;
-            lon = x;
-            lat = y;
-            index = i;
-        }
+/* Per-element array value, where a single-element array applies to every row */
+static inline float8 broadcastValue(const float8 *values, int count, int i) {
+    return values[count == 1 ? 0 : i];
+}
 
-        prev_x = x;
-        prev_y = y;
-        GEOSGeom_destroy_r(context, linePoint);
-        GEOSGeom_destroy_r(context, prevPoint);
+static void checkBroadcastLength(int count, int expected, const char *argName) {
+    if (count != 1 && count != expected) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("%s must have 1 or %d elements, not %d", argName, expected, count)));
     }
+}
 
-    if (closestReferenceDistance == MAX_RADIUS) {
-        return 0;
+/* One-dimensional text[] from C strings; NULL entries become SQL NULLs */
+static ArrayType *buildTextArray(char **strings, int count) {
+    Datum *elems = (Datum *) palloc((count > 0 ? count : 1) * sizeof(Datum));
+    bool *nulls = (bool *) palloc((count > 0 ? count : 1) * sizeof(bool));
+    int dims[1] = {count};
+    int lbs[1] = {1};
+
+    for (int i = 0; i < count; i++) {
+        nulls[i] = strings[i] == NULL;
+        elems[i] = nulls[i] ? (Datum) 0 : CStringGetTextDatum(strings[i]);
     }
 
-    double final_chainage = (chainage * 111320) / 1000;
+    return construct_md_array(elems, nulls, 1, dims, lbs, TEXTOID, -1, false, 'i');
+}
 
-    pointDto->chainage = final_chainage;
-    pointDto->lat = lat;
-    pointDto->lon = lon;
-    pointDto->index = index;
+/*
+ * Chainage equations from an n x 2 float8[] of (measured, posted) rows, as
+ * built by array_agg(ARRAY[measured, posted] ORDER BY measured). An empty
+ * array means no breaks.
+ */
+static void getChainageEquations(ArrayType *arr, ChainageEquations *eq) {
+    Datum *elems;
+    bool *nulls;
+    int n;
+
+    if (ARR_NDIM(arr) != 0 && (ARR_NDIM(arr) != 2 || ARR_DIMS(arr)[1] != 2)) {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("equations must be an array of (measured, posted) pairs")));
+    }
 
-    return 1;
-}
+    deconstruct_array(arr, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd', &elems, &nulls, &n);
 
-static int extractSubLineStringByChainages(GEOSContextHandle_t context, GEOSGeometry *line, 
-                                           double start_chainage, double end_chainage, SectionDto *sectionDto) {
-    if (!sectionDto || !line || start_chainage >= end_chainage) {
-        return 0;
+    double *measured = (double *) palloc((n > 0 ? n / 2 : 1) * sizeof(double));
+    double *posted = (double *) palloc((n > 0 ? n / 2 : 1) * sizeof(double));
+    for (int i = 0; i < n / 2; i++) {
+        if (nulls[2 * i] || nulls[2 * i + 1]) {
+            ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                            errmsg("equations must not contain NULL elements")));
+        }
+        measured[i] = DatumGetFloat8(elems[2 * i]);
+        posted[i] = DatumGetFloat8(elems[2 * i + 1]);
     }
 
-    start_chainage = (start_chainage * 1000) / 111320;
-    end_chainage = (end_chainage * 1000) / 111320;
+    pfree(elems);
+    pfree(nulls);
 
-    const GEOSCoordSequence *coords = GEOSGeom_getCoordSeq_r(context, line);
-    if (!coords) return 0;
+    eq->measured = measured;
+    eq->posted = posted;
+    eq->count = n / 2;
+    if (!checkChainageEquations(eq)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("equations must be sorted with strictly ascending measured and posted chainages")));
+    }
+}
 
-    unsigned int numPoints;
-    GEOSCoordSeq_getSize_r(context, coords, &numPoints);
+static int getDirectionArg(FunctionCallInfo fcinfo, int arg) {
+    int32 value = PG_GETARG_INT32(arg);
 
-    double total_distance = 0.0;
-    double prev_x, prev_y, curr_x, curr_y;
-    GEOSCoordSeq_getX_r(context, coords, 0, &prev_x);
-    GEOSCoordSeq_getY_r(context, coords, 0, &prev_y);
+    if (value != ROAD_FORWARD && value != ROAD_REVERSE) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("direction must be 1 (forward) or -1 (reverse)")));
+    }
+    return value;
+}
 
-    CoordinateArray coords_arr;
-    initCoordinateArray(&coords_arr, 2);
+/*
+ * Optional trailing arguments from argument first on: chainage equations
+ * (float8[]) and then a direction (1 forward, -1 reverse), or with
+ * directionOnly just a direction. The layout is fixed by the C entry point,
+ * so nothing depends on fn_expr.
+ */
+static void getChainageOptions(FunctionCallInfo fcinfo, int first, bool directionOnly,
+                               ChainageEquations *eq, int *direction) {
+    eq->measured = eq->posted = NULL;
+    eq->count = 0;
+    *direction = ROAD_FORWARD;
+
+    if (PG_NARGS() <= first) {
+        return;
+    }
+    if (directionOnly) {
+        *direction = getDirectionArg(fcinfo, first);
+        return;
+    }
+    getChainageEquations(PG_GETARG_ARRAYTYPE_P(first), eq);
+    if (PG_NARGS() > first + 1) {
+        *direction = getDirectionArg(fcinfo, first + 1);
+    }
+}
 
-    int startAdded = 0, endAdded = 0;
-    double startLat, startLon, endLat, endLon;
+/* Measured chainage of a posted one; posted chainages skipped by a break are an error */
+static double postedChainageArg(const ChainageEquations *eq, double posted) {
+    double measured;
 
-    for (unsigned int i = 1; i < numPoints; i++) {
-        GEOSCoordSeq_getX_r(context, coords, i, &curr_x);
-        GEOSCoordSeq_getY_r(context, coords, i, &curr_y);
+    if (!postedToMeasured(eq, posted, &measured)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Chainage %g is skipped by a chainage equation", posted)));
+    }
+    return measured;
+}
 
-        double segment_length = compute_distance(prev_x, prev_y, curr_x, curr_y);
-        total_distance += segment_length;
+/* ========== JSONB Output ========== */
 
-        if (!startAdded && total_distance >= start_chainage) {
-            double factor = (start_chainage - (total_distance - segment_length)) / segment_length;
-            double start_x = prev_x + factor * (curr_x - prev_x);
-            double start_y = prev_y + factor * (curr_y - prev_y);
-            addCoordinate(&coords_arr, start_x, start_y);
-            startAdded = 1;
-            startLon = start_x;
-            startLat = start_y;
-        }
+/*
+ * The jsonb variants of the JSON-returning functions have their own C entry
+ * points over the same body and build a JsonbValue tree straight from the
+ * result struct, so the result needs no text step. Numbers are rounded to the digits the json
+ * variants print, so both give the same values.
+ */
 
-        if (startAdded && total_distance <= end_chainage) {
-            addCoordinate(&coords_arr, curr_x, curr_y);
-        }
+static void pushJsonbKey(JsonbParseState **state, const char *key) {
+    JsonbValue k;
 
-        if (!endAdded && total_distance >= end_chainage) {
-            double factor = (end_chainage - (total_distance - segment_length)) / segment_length;
-            double end_x = prev_x + factor * (curr_x - prev_x);
-            double end_y = prev_y + factor * (curr_y - prev_y);
-            addCoordinate(&coords_arr, end_x, end_y);
-            endAdded = 1;
-            endLat = end_y;
-            endLon = end_x;
-            break;
-        }
+    k.type = jbvString;
+    k.val.string.val = (char *) key;
+    k.val.string.len = strlen(key);
+    pushJsonbValue(state, WJB_KEY, &k);
+}
 
-        prev_x = curr_x;
-        prev_y = curr_y;
-    }
+static void pushJsonbNumber(JsonbParseState **state, const char *key, double value, int digits) {
+    JsonbValue v;
+    Datum number = DirectFunctionCall1(float8_numeric, Float8GetDatum(value));
 
-    if (coords_arr.size < 2) {
-        freeCoordinateArray(&coords_arr);
-        return 0;
-    }
+    pushJsonbKey(state, key);
+    v.type = jbvNumeric;
+    v.val.numeric = DatumGetNumeric(DirectFunctionCall2(numeric_round, number, Int32GetDatum(digits)));
+    pushJsonbValue(state, WJB_VALUE, &v);
+}
 
-    GEOSGeometry *subLine = createLineStringFromArray(context, &coords_arr);
-    freeCoordinateArray(&coords_arr);
+static void pushJsonbString(JsonbParseState **state, const char *key, const char *value) {
+    JsonbValue v;
 
-    if (!subLine) {
-        return 0;
-    }
+    pushJsonbKey(state, key);
+    v.type = jbvString;
+    v.val.string.val = (char *) value;
+    v.val.string.len = strlen(value);
+    pushJsonbValue(state, WJB_VALUE, &v);
+}
 
-    sectionDto->startCh = start_chainage * 111320 / 1000;
-    sectionDto->endCh = end_chainage * 111320 / 1000;
-    sectionDto->startLat = startLat;
-    sectionDto->startLon = startLon;
-    sectionDto->endLat = endLat;
-    sectionDto->endLon = endLon;
-    sectionDto->length = (end_chainage * 111320 / 1000) - (start_chainage * 111320 / 1000);
-    sectionDto->geometry = geomToWKT(context, subLine);
+/* Same keys and digits as get_section_by_chainage's json */
+static JsonbValue *sectionToJsonbValue(const SectionDto *section) {
+    JsonbParseState *state = NULL;
+
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+    pushJsonbNumber(&state, "start_ch", section->startCh, 6);
+    pushJsonbNumber(&state, "end_ch", section->endCh, 6);
+    pushJsonbNumber(&state, "start_lat", section->startLat, 8);
+    pushJsonbNumber(&state, "start_lon", section->startLon, 8);
+    pushJsonbNumber(&state, "end_lat", section->endLat, 8);
+    pushJsonbNumber(&state, "end_lon", section->endLon, 8);
+    pushJsonbNumber(&state, "length", section->length, 6);
+    pushJsonbString(&state, "geometry", section->geometry ? section->geometry : "");
+    return pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+}
 
-    GEOSGeom_destroy_r(context, subLine);
+/* Same keys and digits as calibrate_point_on_line's json */
+static JsonbValue *pointToJsonbValue(const PointDto *point) {
+    JsonbParseState *state = NULL;
 
-    return 1;
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+    pushJsonbNumber(&state, "chainage", point->chainage, 6);
+    pushJsonbNumber(&state, "lat", point->lat, 8);
+    pushJsonbNumber(&state, "lon", point->lon, 8);
+    pushJsonbNumber(&state, "index", point->index, 0);
+    return pushJsonbValue(&state, WJB_END_OBJECT, NULL);
 }
 
 /* ========== PostgreSQL Function Implementations ========== */
 
-PG_FUNCTION_INFO_V1(get_section_by_chainage);
-
-Datum
-get_section_by_chainage(PG_FUNCTION_ARGS)
+/* Shared by get_section_by_chainage, its direction-only (_direction) and jsonb (_jsonb) variants */
+static Datum
+getSectionByChainageCall(FunctionCallInfo fcinfo, bool directionOnly, bool jsonb)
 {
+    MemoryContext callerContext = beginScratch(fcinfo);
     text *wkt_text = PG_GETARG_TEXT_PP(0);
     float8 start_ch = PG_GETARG_FLOAT8(1);
     float8 end_ch = PG_GETARG_FLOAT8(2);
     
-    char *wkt = text_to_cstring(wkt_text);
+    /* With equations start and end are posted chainages, in the given direction */
+    ChainageEquations eq;
+    int direction;
+    getChainageOptions(fcinfo, 3, directionOnly, &eq, &direction);
     
-    /* Initialize GEOS */
-    GEOSContextHandle_t context = GEOS_init_r();
-    GEOSContext_setNoticeHandler_r(context, geos_notice_handler);
-    GEOSContext_setErrorHandler_r(context, geos_error_handler);
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_GET_SECTION);
     
-    GEOSGeometry* geom = getLineFromMultiline(context, wkt);
-    
-    if (!geom || GEOSGeomTypeId_r(context, geom) != GEOS_LINESTRING) {
-        if (geom) GEOSGeom_destroy_r(context, geom);
-        GEOS_finish_r(context);
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, wkt_text, ROAD_STAT_GET_SECTION, &line)) {
         ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                         errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
     }
     
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_GET_SECTION, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_GET_SECTION, ROAD_STAT_VERTICES, line.coords.size);
+    
     SectionDto section;
     memset(&section, 0, sizeof(SectionDto));
     
-    int res = extractSubLineStringByChainages(context, geom, start_ch, end_ch, &section);
+    int res = extractSectionInDirection(&line, postedChainageArg(&eq, start_ch),
+                                        postedChainageArg(&eq, end_ch), direction, &section);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
     
     if (!res) {
-        GEOSGeom_destroy_r(context, geom);
-        GEOS_finish_r(context);
+        freeRoadLine(&line);
         ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
                         errmsg("Failed to extract sub-line")));
     }
     
+    /* Report the chainages as given; length stays the measured length */
+    section.startCh = start_ch;
+    section.endCh = end_ch;
+    
+    /* jsonb variant: the tree is built in scratch memory, only the result in the caller's */
+    if (jsonb) {
+        JsonbValue *value = sectionToJsonbValue(&section);
+        MemoryContextSwitchTo(callerContext);
+        Jsonb *jsonb = JsonbValueToJsonb(value);
+        
+        roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+        roadStatsAdd(ROAD_STAT_GET_SECTION, ROAD_STAT_BYTES_EMITTED, VARSIZE(jsonb));
+        roadStatsEnd(&stats);
+        
+        PG_RETURN_JSONB_P(jsonb);
+    }
+    
     /* Build JSON result */
     StringInfoData buf;
     initStringInfo(&buf);
@@ -399,109 +564,183 @@ get_section_by_chainage(PG_FUNCTION_ARGS)
     appendStringInfo(&buf, "\"geometry\":\"%s\"", section.geometry ? section.geometry : "");
     appendStringInfo(&buf, "}");
     
-    text *result = cstring_to_text(buf.data);
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
     
     if (section.geometry) pfree(section.geometry);
-    GEOSGeom_destroy_r(context, geom);
-    GEOS_finish_r(context);
+    freeRoadLine(&line);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_GET_SECTION, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
     
     PG_RETURN_TEXT_P(result);
 }
 
-PG_FUNCTION_INFO_V1(cut_line_at_chainage);
+PG_FUNCTION_INFO_V1(get_section_by_chainage);
 
 Datum
-cut_line_at_chainage(PG_FUNCTION_ARGS)
+get_section_by_chainage(PG_FUNCTION_ARGS)
 {
-    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    return getSectionByChainageCall(fcinfo, false, false);
+}
+
+PG_FUNCTION_INFO_V1(get_section_by_chainage_direction);
+
+Datum
+get_section_by_chainage_direction(PG_FUNCTION_ARGS)
+{
+    return getSectionByChainageCall(fcinfo, true, false);
+}
+
+PG_FUNCTION_INFO_V1(get_section_by_chainage_jsonb);
+
+Datum
+get_section_by_chainage_jsonb(PG_FUNCTION_ARGS)
+{
+    return getSectionByChainageCall(fcinfo, false, true);
+}
+
+/* Shared by cut_line_at_chainage and the _direction symbol of its direction-only overloads */
+static Datum
+cutLineAtChainageCall(FunctionCallInfo fcinfo, bool directionOnly)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
     float8 chainage = PG_GETARG_FLOAT8(1);
     
-    char *wkt = text_to_cstring(wkt_text);
+    ChainageEquations eq;
+    int direction;
+    getChainageOptions(fcinfo, 2, directionOnly, &eq, &direction);
+    chainage = postedChainageArg(&eq, chainage);
     
-    GEOSContextHandle_t context = GEOS_init_r();
-    GEOSContext_setNoticeHandler_r(context, geos_notice_handler);
-    GEOSContext_setErrorHandler_r(context, geos_error_handler);
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_CUT_LINE);
     
-    GEOSGeometry* line = getLineFromMultiline(context, wkt);
-    
-    if (!line || GEOSGeomTypeId_r(context, line) != GEOS_LINESTRING) {
-        if (line) GEOSGeom_destroy_r(context, line);
-        GEOS_finish_r(context);
+    /* The argument is left toasted; only the part around the chainage is read, mirrored if reversed */
+    RoadLine line;
+    size_t bytes;
+    if (!parseLineWindowArg(fcinfo, 0, ROAD_STAT_CUT_LINE, &chainage, direction, &line, &bytes)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
         PG_RETURN_NULL();
     }
     
-    /* Convert chainage to degrees */
-    double chainage_degrees = (chainage * 1000) / 111320;
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_CUT_LINE, ROAD_STAT_BYTES_PARSED, bytes);
+    roadStatsAdd(ROAD_STAT_CUT_LINE, ROAD_STAT_VERTICES, line.coords.size);
     
-    /* Use GEOSInterpolate to get point at chainage */
-    double total_length;
-    GEOSLength_r(context, line, &total_length);
+    double chainage_degrees = kmToDegrees(chainage);
+    double total_length = roadLineLength(&line);
     
-    if (chainage_degrees < 0 || chainage_degrees > total_length) {
-        GEOSGeom_destroy_r(context, line);
-        GEOS_finish_r(context);
+    if (chainage_degrees < roadLineStart(&line) || chainage_degrees > total_length) {
+        freeRoadLine(&line);
         ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                         errmsg("Chainage out of bounds")));
     }
     
-    GEOSGeometry* point = GEOSInterpolate_r(context, line, chainage_degrees);
-    
-    if (!point) {
-        GEOSGeom_destroy_r(context, line);
-        GEOS_finish_r(context);
+    Coordinate point;
+    if (!interpolatePoint(&line, chainage_degrees, &point)) {
+        freeRoadLine(&line);
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
         PG_RETURN_NULL();
     }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
     
-    char *result_wkt = geomToWKT(context, point);
+    char *result_wkt = pointToWKT(point.x, point.y, &pg_road_allocator);
+    MemoryContextSwitchTo(callerContext);
     text *result = cstring_to_text(result_wkt);
     
-    if (result_wkt) pfree(result_wkt);
-    GEOSGeom_destroy_r(context, point);
-    GEOSGeom_destroy_r(context, line);
-    GEOS_finish_r(context);
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_CUT_LINE, ROAD_STAT_BYTES_EMITTED, VARSIZE_ANY_EXHDR(result));
+    roadStatsEnd(&stats);
+    
+    pfree(result_wkt);
+    freeRoadLine(&line);
     
     PG_RETURN_TEXT_P(result);
 }
 
-PG_FUNCTION_INFO_V1(calibrate_point_on_line);
+PG_FUNCTION_INFO_V1(cut_line_at_chainage);
 
 Datum
-calibrate_point_on_line(PG_FUNCTION_ARGS)
+cut_line_at_chainage(PG_FUNCTION_ARGS)
+{
+    return cutLineAtChainageCall(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(cut_line_at_chainage_direction);
+
+Datum
+cut_line_at_chainage_direction(PG_FUNCTION_ARGS)
 {
+    return cutLineAtChainageCall(fcinfo, true);
+}
+
+/* Shared by calibrate_point_on_line, its direction-only (_direction) and jsonb (_jsonb) variants */
+static Datum
+calibratePointOnLineCall(FunctionCallInfo fcinfo, bool directionOnly, bool jsonb)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
     text *line_wkt_text = PG_GETARG_TEXT_PP(0);
     text *point_wkt_text = PG_GETARG_TEXT_PP(1);
     float8 radius = PG_GETARG_FLOAT8(2);
     
-    char *line_wkt = text_to_cstring(line_wkt_text);
-    char *point_wkt = text_to_cstring(point_wkt_text);
+    /* With equations the result is a posted chainage, in the given direction */
+    ChainageEquations eq;
+    int direction;
+    getChainageOptions(fcinfo, 3, directionOnly, &eq, &direction);
     
-    GEOSContextHandle_t context = GEOS_init_r();
-    GEOSContext_setNoticeHandler_r(context, geos_notice_handler);
-    GEOSContext_setErrorHandler_r(context, geos_error_handler);
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_CALIBRATE);
     
-    GEOSWKTReader *reader = GEOSWKTReader_create_r(context);
-    GEOSGeometry* line = GEOSWKTReader_read_r(context, reader, line_wkt);
-    GEOSGeometry* point = GEOSWKTReader_read_r(context, reader, point_wkt);
-    GEOSWKTReader_destroy_r(context, reader);
+    char *point_wkt = text_to_cstring(point_wkt_text);
+    
+    RoadLine line;
+    Coordinate point;
     
-    if (!line || !point) {
-        if (line) GEOSGeom_destroy_r(context, line);
-        if (point) GEOSGeom_destroy_r(context, point);
-        GEOS_finish_r(context);
+    if (!parsePointWKT(point_wkt, &point) ||
+        !parseCachedLineArg(fcinfo, line_wkt_text, ROAD_STAT_CALIBRATE, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
         PG_RETURN_NULL();
     }
     
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_BYTES_PARSED,
+                 VARSIZE_ANY_EXHDR(line_wkt_text) + VARSIZE_ANY_EXHDR(point_wkt_text));
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_VERTICES, line.coords.size);
+    
     PointDto pointDto;
     memset(&pointDto, 0, sizeof(PointDto));
     
-    int res = calibratePoint(context, line, point, radius, &pointDto);
+    int res = calibratePoint(&line, point, radius, &pointDto);
+    if (res && direction == ROAD_REVERSE) {
+        /* Vertex index and chainage as on the reversed line */
+        pointDto.chainage = reverseChainage(&line, pointDto.chainage);
+        pointDto.index = (int) line.coords.size - 1 - pointDto.index;
+    }
+    freeRoadLine(&line);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
     
     if (!res) {
-        GEOSGeom_destroy_r(context, line);
-        GEOSGeom_destroy_r(context, point);
-        GEOS_finish_r(context);
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
         PG_RETURN_NULL();
     }
+    pointDto.chainage = measuredToPosted(&eq, pointDto.chainage);
+    
+    if (jsonb) {
+        JsonbValue *value = pointToJsonbValue(&pointDto);
+        MemoryContextSwitchTo(callerContext);
+        Jsonb *jsonb = JsonbValueToJsonb(value);
+        
+        roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+        roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_BYTES_EMITTED, VARSIZE(jsonb));
+        roadStatsEnd(&stats);
+        
+        PG_RETURN_JSONB_P(jsonb);
+    }
     
     /* Build JSON result */
     StringInfoData buf;
@@ -514,11 +753,2302 @@ calibrate_point_on_line(PG_FUNCTION_ARGS)
     appendStringInfo(&buf, "\"index\":%d", pointDto.index);
     appendStringInfo(&buf, "}");
     
-    text *result = cstring_to_text(buf.data);
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(calibrate_point_on_line);
+
+Datum
+calibrate_point_on_line(PG_FUNCTION_ARGS)
+{
+    return calibratePointOnLineCall(fcinfo, false, false);
+}
+
+PG_FUNCTION_INFO_V1(calibrate_point_on_line_direction);
+
+Datum
+calibrate_point_on_line_direction(PG_FUNCTION_ARGS)
+{
+    return calibratePointOnLineCall(fcinfo, true, false);
+}
+
+PG_FUNCTION_INFO_V1(calibrate_point_on_line_jsonb);
+
+Datum
+calibrate_point_on_line_jsonb(PG_FUNCTION_ARGS)
+{
+    return calibratePointOnLineCall(fcinfo, false, true);
+}
+
+PG_FUNCTION_INFO_V1(calibrate_point_on_line_batch);
+
+/*
+ * Array form of calibrate_point_on_line: one parse, the chainage (km) of
+ * the matched vertex for each point, NULL where no vertex is within radius
+ * or the point is NULL or unparseable.
+ */
+Datum
+calibrate_point_on_line_batch(PG_FUNCTION_ARGS)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *line_wkt_text = PG_GETARG_TEXT_PP(0);
+    ArrayType *points_arr = PG_GETARG_ARRAYTYPE_P(1);
+    float8 radius = PG_GETARG_FLOAT8(2);
+    Datum *elems;
+    bool *nulls;
+    int n;
+    
+    if (ARR_NDIM(points_arr) > 1) {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("points must be a one-dimensional array")));
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_CALIBRATE);
+    
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, line_wkt_text, ROAD_STAT_CALIBRATE, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    
+    deconstruct_array(points_arr, TEXTOID, -1, false, 'i', &elems, &nulls, &n);
+    
+    Coordinate *points = (Coordinate *) palloc((n > 0 ? n : 1) * sizeof(Coordinate));
+    unsigned char *parsed = (unsigned char *) palloc0((n > 0 ? n : 1) * sizeof(unsigned char));
+    size_t bytes = VARSIZE_ANY_EXHDR(line_wkt_text);
+    for (int i = 0; i < n; i++) {
+        if (nulls[i]) {
+            /* Keeps the slot so results stay in input order */
+            points[i].x = points[i].y = 0.0;
+            continue;
+        }
+        text *point_text = DatumGetTextPP(elems[i]);
+        bytes += VARSIZE_ANY_EXHDR(point_text);
+        parsed[i] = (unsigned char) parsePointWKT(text_to_cstring(point_text), &points[i]);
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_BYTES_PARSED, bytes);
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_VERTICES, line.coords.size);
+    
+    PointDto *results = (PointDto *) palloc((n > 0 ? n : 1) * sizeof(PointDto));
+    unsigned char *found = (unsigned char *) palloc((n > 0 ? n : 1) * sizeof(unsigned char));
+    calibratePointsParallel(&line, points, (size_t) n, radius, road_batch_threads, results, found);
+    freeRoadLine(&line);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    MemoryContextSwitchTo(callerContext);
+    Datum *values = (Datum *) palloc((n > 0 ? n : 1) * sizeof(Datum));
+    bool *resultNulls = (bool *) palloc((n > 0 ? n : 1) * sizeof(bool));
+    int dims[1] = {n};
+    int lbs[1] = {1};
+    for (int i = 0; i < n; i++) {
+        resultNulls[i] = !parsed[i] || !found[i];
+        values[i] = resultNulls[i] ? (Datum) 0 : Float8GetDatum(results[i].chainage);
+    }
+    ArrayType *result = construct_md_array(values, resultNulls, 1, dims, lbs,
+                                           FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd');
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_CALIBRATE, ROAD_STAT_BYTES_EMITTED, VARSIZE(result));
+    roadStatsEnd(&stats);
+    
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+static void appendAlongRoadJson(StringInfo buf, const AlongRoadDto *dto) {
+    appendStringInfo(buf, "{\"from_ch\":%.6f,\"to_ch\":%.6f,\"distance\":%.6f,\"direction\":%d}",
+                     dto->fromCh, dto->toCh, dto->distance, dto->direction);
+}
+
+PG_FUNCTION_INFO_V1(distance_along_road);
+
+/* Signed distance (km) along the line from p1 to p2, both calibrated against one parse */
+Datum
+distance_along_road(PG_FUNCTION_ARGS)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *line_wkt_text = PG_GETARG_TEXT_PP(0);
+    text *p1_text = PG_GETARG_TEXT_PP(1);
+    text *p2_text = PG_GETARG_TEXT_PP(2);
+    float8 radius = PG_GETARG_FLOAT8(3);
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_DISTANCE_ALONG);
+    
+    RoadLine line;
+    Coordinate p1, p2;
+    
+    if (!parsePointWKT(text_to_cstring(p1_text), &p1) ||
+        !parsePointWKT(text_to_cstring(p2_text), &p2) ||
+        !parseCachedLineArg(fcinfo, line_wkt_text, ROAD_STAT_DISTANCE_ALONG, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_BYTES_PARSED,
+                 VARSIZE_ANY_EXHDR(line_wkt_text) + VARSIZE_ANY_EXHDR(p1_text) + VARSIZE_ANY_EXHDR(p2_text));
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_VERTICES, line.coords.size);
+    
+    AlongRoadDto dto;
+    int res = distanceAlongRoad(&line, p1, p2, radius, &dto);
+    freeRoadLine(&line);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    if (!res) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendAlongRoadJson(&buf, &dto);
+    
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(distance_along_road_trace);
+
+/*
+ * Array form of distance_along_road for a trace: every fix is calibrated
+ * once (threaded as in calibrate_point_on_line_batch) and element i of the
+ * JSON array covers fixes i and i + 1, null where either is unmatched.
+ */
+Datum
+distance_along_road_trace(PG_FUNCTION_ARGS)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *line_wkt_text = PG_GETARG_TEXT_PP(0);
+    ArrayType *points_arr = PG_GETARG_ARRAYTYPE_P(1);
+    float8 radius = PG_GETARG_FLOAT8(2);
+    Datum *elems;
+    bool *nulls;
+    int n;
+    
+    if (ARR_NDIM(points_arr) > 1) {
+        ereport(ERROR, (errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+                        errmsg("points must be a one-dimensional array")));
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_DISTANCE_ALONG);
+    
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, line_wkt_text, ROAD_STAT_DISTANCE_ALONG, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    
+    deconstruct_array(points_arr, TEXTOID, -1, false, 'i', &elems, &nulls, &n);
+    
+    Coordinate *points = (Coordinate *) palloc((n > 0 ? n : 1) * sizeof(Coordinate));
+    unsigned char *parsed = (unsigned char *) palloc0((n > 0 ? n : 1) * sizeof(unsigned char));
+    size_t bytes = VARSIZE_ANY_EXHDR(line_wkt_text);
+    for (int i = 0; i < n; i++) {
+        if (nulls[i]) {
+            points[i].x = points[i].y = 0.0;
+            continue;
+        }
+        text *point_text = DatumGetTextPP(elems[i]);
+        bytes += VARSIZE_ANY_EXHDR(point_text);
+        parsed[i] = (unsigned char) parsePointWKT(text_to_cstring(point_text), &points[i]);
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_BYTES_PARSED, bytes);
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_VERTICES, line.coords.size);
+    
+    PointDto *results = (PointDto *) palloc((n > 0 ? n : 1) * sizeof(PointDto));
+    unsigned char *found = (unsigned char *) palloc((n > 0 ? n : 1) * sizeof(unsigned char));
+    calibratePointsParallel(&line, points, (size_t) n, radius, road_batch_threads, results, found);
+    freeRoadLine(&line);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
     
-    GEOSGeom_destroy_r(context, line);
-    GEOSGeom_destroy_r(context, point);
-    GEOS_finish_r(context);
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '[');
+    for (int i = 0; i + 1 < n; i++) {
+        if (i > 0) appendStringInfoChar(&buf, ',');
+        if (!parsed[i] || !found[i] || !parsed[i + 1] || !found[i + 1]) {
+            appendStringInfoString(&buf, "null");
+            continue;
+        }
+        AlongRoadDto dto;
+        setAlongRoadSpan(results[i].chainage, results[i + 1].chainage, &dto);
+        appendAlongRoadJson(&buf, &dto);
+    }
+    appendStringInfoChar(&buf, ']');
+    
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_DISTANCE_ALONG, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
     
     PG_RETURN_TEXT_P(result);
 }
+
+PG_FUNCTION_INFO_V1(measured_to_posted_chainage);
+
+Datum
+measured_to_posted_chainage(PG_FUNCTION_ARGS)
+{
+    float8 chainage = PG_GETARG_FLOAT8(0);
+    ChainageEquations eq;
+    
+    getChainageEquations(PG_GETARG_ARRAYTYPE_P(1), &eq);
+    PG_RETURN_FLOAT8(measuredToPosted(&eq, chainage));
+}
+
+PG_FUNCTION_INFO_V1(posted_to_measured_chainage);
+
+/* NULL for posted chainages that a forward break skips */
+Datum
+posted_to_measured_chainage(PG_FUNCTION_ARGS)
+{
+    float8 chainage = PG_GETARG_FLOAT8(0);
+    ChainageEquations eq;
+    double measured;
+    
+    getChainageEquations(PG_GETARG_ARRAYTYPE_P(1), &eq);
+    if (!postedToMeasured(&eq, chainage, &measured))
+        PG_RETURN_NULL();
+    PG_RETURN_FLOAT8(measured);
+}
+
+/* Shared by point_at_chainage_offset and the _direction symbol of its direction-only overloads */
+static Datum
+pointAtChainageOffsetCall(FunctionCallInfo fcinfo, bool directionOnly)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    float8 chainage = PG_GETARG_FLOAT8(1);
+    float8 offset_m = PG_GETARG_FLOAT8(2);
+    
+    ChainageEquations eq;
+    int direction;
+    getChainageOptions(fcinfo, 3, directionOnly, &eq, &direction);
+    chainage = postedChainageArg(&eq, chainage);
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_POINT_OFFSET);
+    
+    /* The argument is left toasted; only the part around the chainage is read */
+    RoadLine line;
+    size_t bytes;
+    if (!parseLineWindowArg(fcinfo, 0, ROAD_STAT_POINT_OFFSET, &chainage, direction, &line, &bytes)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_BYTES_PARSED, bytes);
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_VERTICES, line.coords.size);
+    
+    /* Travelling in reverse, left of the road is right of the digitized line */
+    if (direction == ROAD_REVERSE)
+        offset_m = -offset_m;
+    
+    Coordinate point;
+    if (!pointAtChainageOffset(&line, chainage, offset_m, &point, NULL)) {
+        freeRoadLine(&line);
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Chainage out of bounds")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    char *result_wkt = pointToWKT(point.x, point.y, &pg_road_allocator);
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text(result_wkt);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_BYTES_EMITTED, VARSIZE_ANY_EXHDR(result));
+    roadStatsEnd(&stats);
+    
+    pfree(result_wkt);
+    freeRoadLine(&line);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(point_at_chainage_offset);
+
+Datum
+point_at_chainage_offset(PG_FUNCTION_ARGS)
+{
+    return pointAtChainageOffsetCall(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(point_at_chainage_offset_direction);
+
+Datum
+point_at_chainage_offset_direction(PG_FUNCTION_ARGS)
+{
+    return pointAtChainageOffsetCall(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(point_at_chainage_offset_batch);
+
+/*
+ * Array form for whole inventories: one parse, one point per chainage.
+ * offsets may hold a single value for all chainages. Chainages outside the
+ * line give NULL elements instead of an error.
+ */
+Datum
+point_at_chainage_offset_batch(PG_FUNCTION_ARGS)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    int numChainages, numOffsets;
+    float8 *chainages = getFloat8Array(PG_GETARG_ARRAYTYPE_P(1), "chainages", &numChainages);
+    float8 *offsets = getFloat8Array(PG_GETARG_ARRAYTYPE_P(2), "offsets", &numOffsets);
+    
+    checkBroadcastLength(numOffsets, numChainages, "offsets");
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_POINT_OFFSET);
+    
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, wkt_text, ROAD_STAT_POINT_OFFSET, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_VERTICES, line.coords.size);
+    
+    /* Workers fill plain buffers; the WKT is built back on this thread */
+    Coordinate *coords = (Coordinate *) palloc((numChainages > 0 ? numChainages : 1) * sizeof(Coordinate));
+    unsigned char *found = (unsigned char *) palloc((numChainages > 0 ? numChainages : 1) * sizeof(unsigned char));
+    pointsAtChainageOffsetParallel(&line, chainages, (size_t) numChainages, offsets, (size_t) numOffsets,
+                                   road_batch_threads, coords, found);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    char **points = (char **) palloc0((numChainages > 0 ? numChainages : 1) * sizeof(char *));
+    for (int i = 0; i < numChainages; i++) {
+        if (found[i]) {
+            points[i] = pointToWKT(coords[i].x, coords[i].y, &pg_road_allocator);
+        }
+    }
+    
+    MemoryContextSwitchTo(callerContext);
+    ArrayType *result = buildTextArray(points, numChainages);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_POINT_OFFSET, ROAD_STAT_BYTES_EMITTED, VARSIZE(result));
+    roadStatsEnd(&stats);
+    
+    freeRoadLine(&line);
+    
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/* Shared by offset_section and the _direction symbol of its direction-only overloads */
+static Datum
+offsetSectionCall(FunctionCallInfo fcinfo, bool directionOnly)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    float8 start_ch = PG_GETARG_FLOAT8(1);
+    float8 end_ch = PG_GETARG_FLOAT8(2);
+    float8 offset_m = PG_GETARG_FLOAT8(3);
+    
+    ChainageEquations eq;
+    int direction;
+    getChainageOptions(fcinfo, 4, directionOnly, &eq, &direction);
+    start_ch = postedChainageArg(&eq, start_ch);
+    end_ch = postedChainageArg(&eq, end_ch);
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_OFFSET_SECTION);
+    
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, wkt_text, ROAD_STAT_OFFSET_SECTION, &line)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_VERTICES, line.coords.size);
+    
+    /* Reverse: the mirrored forward section on the other side, listed backwards */
+    if (direction == ROAD_REVERSE) {
+        double reverse_start = reverseChainage(&line, end_ch);
+        end_ch = reverseChainage(&line, start_ch);
+        start_ch = reverse_start;
+        offset_m = -offset_m;
+    }
+    
+    CoordinateArray offsetLine;
+    if (!offsetSection(&line, start_ch, end_ch, offset_m, &offsetLine)) {
+        freeRoadLine(&line);
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Failed to extract sub-line")));
+    }
+    if (direction == ROAD_REVERSE)
+        reverseCoordinateArray(&offsetLine);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    char *result_wkt = coordsToWKT(offsetLine.data, offsetLine.size, &pg_road_allocator);
+    MemoryContextSwitchTo(callerContext);
+    text *result = cstring_to_text(result_wkt);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_BYTES_EMITTED, VARSIZE_ANY_EXHDR(result));
+    roadStatsEnd(&stats);
+    
+    pfree(result_wkt);
+    freeCoordinateArray(&offsetLine);
+    freeRoadLine(&line);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(offset_section);
+
+Datum
+offset_section(PG_FUNCTION_ARGS)
+{
+    return offsetSectionCall(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(offset_section_direction);
+
+Datum
+offset_section_direction(PG_FUNCTION_ARGS)
+{
+    return offsetSectionCall(fcinfo, true);
+}
+
+PG_FUNCTION_INFO_V1(offset_section_batch);
+
+/*
+ * Array form: one parse, one offset section per (start, end) pair.
+ * offsets may hold a single value for all sections; invalid ranges give NULL.
+ */
+Datum
+offset_section_batch(PG_FUNCTION_ARGS)
+{
+    MemoryContext callerContext = beginScratch(fcinfo);
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    int numStarts, numEnds, numOffsets;
+    float8 *starts = getFloat8Array(PG_GETARG_ARRAYTYPE_P(1), "start_chainages", &numStarts);
+    float8 *ends = getFloat8Array(PG_GETARG_ARRAYTYPE_P(2), "end_chainages", &numEnds);
+    float8 *offsets = getFloat8Array(PG_GETARG_ARRAYTYPE_P(3), "offsets", &numOffsets);
+    
+    if (numEnds != numStarts) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("start_chainages and end_chainages must have the same length")));
+    }
+    checkBroadcastLength(numOffsets, numStarts, "offsets");
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_OFFSET_SECTION);
+    
+    RoadLine line;
+    if (!parseCachedLineArg(fcinfo, wkt_text, ROAD_STAT_OFFSET_SECTION, &line)) {
+        roadStatsEnd(&stats);
+        MemoryContextSwitchTo(callerContext);
+        PG_RETURN_NULL();
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_VERTICES, line.coords.size);
+    
+    char **sections = (char **) palloc0((numStarts > 0 ? numStarts : 1) * sizeof(char *));
+    for (int i = 0; i < numStarts; i++) {
+        CoordinateArray offsetLine;
+        if (offsetSection(&line, starts[i], ends[i], broadcastValue(offsets, numOffsets, i), &offsetLine)) {
+            sections[i] = coordsToWKT(offsetLine.data, offsetLine.size, &pg_road_allocator);
+            freeCoordinateArray(&offsetLine);
+        }
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    MemoryContextSwitchTo(callerContext);
+    ArrayType *result = buildTextArray(sections, numStarts);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_OFFSET_SECTION, ROAD_STAT_BYTES_EMITTED, VARSIZE(result));
+    roadStatsEnd(&stats);
+    
+    freeRoadLine(&line);
+    
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+PG_FUNCTION_INFO_V1(simplify_line_preserving_chainage);
+
+/*
+ * Douglas-Peucker simplification returning a LINESTRING M whose measures are
+ * the original chainages (km), so the other functions in this file give the
+ * same chainages on the simplified line as on the original.
+ */
+Datum
+simplify_line_preserving_chainage(PG_FUNCTION_ARGS)
+{
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    float8 tolerance_m = PG_GETARG_FLOAT8(1);
+    
+    if (tolerance_m < 0 || isnan(tolerance_m)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Tolerance must be a non-negative number of meters")));
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_SIMPLIFY);
+    
+    RoadLine line;
+    if (!parseLineArg(wkt_text, &line)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_SIMPLIFY, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_SIMPLIFY, ROAD_STAT_VERTICES, line.coords.size);
+    
+    RoadLine simple;
+    if (!simplifyLine(&line, tolerance_m / METERS_PER_DEGREE, &simple)) {
+        freeRoadLine(&line);
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                        errmsg("Failed to simplify line")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    char *result_wkt = measuredLineToWKT(&simple, &pg_road_allocator);
+    text *result = cstring_to_text(result_wkt);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_SIMPLIFY, ROAD_STAT_BYTES_EMITTED, VARSIZE_ANY_EXHDR(result));
+    roadStatsEnd(&stats);
+    
+    pfree(result_wkt);
+    freeRoadLine(&simple);
+    freeRoadLine(&line);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(encode_road_line);
+
+Datum
+encode_road_line(PG_FUNCTION_ARGS)
+{
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    int32 precision = PG_GETARG_INT32(1);
+    
+    if (precision < 0 || precision > ROAD_COMPACT_MAX_PRECISION) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Precision must be between 0 and %d", ROAD_COMPACT_MAX_PRECISION)));
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_ENCODE);
+    
+    RoadLine line;
+    if (!parseLineArg(wkt_text, &line)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_VERTICES, line.coords.size);
+    
+    size_t len;
+    unsigned char *encoded = encodeCompactLine(&line, precision, ROAD_COMPACT_M_PRECISION,
+                                               &pg_road_allocator, &len);
+    if (!encoded) {
+        freeRoadLine(&line);
+        ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                        errmsg("Coordinates do not fit a grid of %d decimal digits", precision)));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    bytea *result = (bytea *) palloc(VARHDRSZ + len);
+    SET_VARSIZE(result, VARHDRSZ + len);
+    memcpy(VARDATA(result), encoded, len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_BYTES_EMITTED, len);
+    roadStatsEnd(&stats);
+    
+    pfree(encoded);
+    freeRoadLine(&line);
+    
+    PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(encode_road_line_indexed);
+
+/* Indexed layout: fixed-width vertex records behind a block index, for slice access */
+Datum
+encode_road_line_indexed(PG_FUNCTION_ARGS)
+{
+    text *wkt_text = PG_GETARG_TEXT_PP(0);
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_ENCODE);
+    
+    RoadLine line;
+    if (!parseLineArg(wkt_text, &line)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_VERTICES, line.coords.size);
+    
+    size_t len;
+    unsigned char *encoded = encodeIndexedLine(&line, &pg_road_allocator, &len);
+    if (!encoded) {
+        freeRoadLine(&line);
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                        errmsg("Line is too long for the indexed layout")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    bytea *result = (bytea *) palloc(VARHDRSZ + len);
+    SET_VARSIZE(result, VARHDRSZ + len);
+    memcpy(VARDATA(result), encoded, len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_ENCODE, ROAD_STAT_BYTES_EMITTED, len);
+    roadStatsEnd(&stats);
+    
+    pfree(encoded);
+    freeRoadLine(&line);
+    
+    PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(decode_road_line);
+
+/* Compact encoding back to WKT; LINESTRING M / Z / ZM when the line carries measures or elevations */
+Datum
+decode_road_line(PG_FUNCTION_ARGS)
+{
+    bytea *data = PG_GETARG_BYTEA_PP(0);
+    
+    RoadLine line;
+    if (!decodeCompactLine(VARDATA_ANY(data), VARSIZE_ANY_EXHDR(data), &pg_road_allocator, &line)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                        errmsg("Invalid compact road line encoding")));
+    }
+    
+    char *wkt = lineToWKT(&line, &pg_road_allocator);
+    text *result = cstring_to_text(wkt);
+    
+    pfree(wkt);
+    freeRoadLine(&line);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+PG_FUNCTION_INFO_V1(line_edit_span);
+
+/*
+ * Edited vertex span between two versions of a road and the chainage shift
+ * of everything after it, as JSON for apply_chainage_edit.
+ */
+Datum
+line_edit_span(PG_FUNCTION_ARGS)
+{
+    text *old_text = PG_GETARG_TEXT_PP(0);
+    text *new_text = PG_GETARG_TEXT_PP(1);
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_LINE_EDIT);
+    
+    RoadLine oldLine, newLine;
+    if (!parseLineArg(old_text, &oldLine)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    if (!parseLineArg(new_text, &newLine)) {
+        freeRoadLine(&oldLine);
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    roadStatsAdd(ROAD_STAT_LINE_EDIT, ROAD_STAT_BYTES_PARSED,
+                 VARSIZE_ANY_EXHDR(old_text) + VARSIZE_ANY_EXHDR(new_text));
+    roadStatsAdd(ROAD_STAT_LINE_EDIT, ROAD_STAT_VERTICES, oldLine.coords.size + newLine.coords.size);
+    
+    LineEditDto edit;
+    int res = diffLines(&oldLine, &newLine, &edit);
+    freeRoadLine(&oldLine);
+    freeRoadLine(&newLine);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    if (!res) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                        errmsg("Failed to compare lines")));
+    }
+    
+    /* Build JSON result */
+    StringInfoData buf;
+    initStringInfo(&buf);
+    
+    appendStringInfo(&buf, "{");
+    appendStringInfo(&buf, "\"changed\":%s,", edit.changed ? "true" : "false");
+    appendStringInfo(&buf, "\"old_start_index\":%zu,", edit.oldStart);
+    appendStringInfo(&buf, "\"old_end_index\":%zu,", edit.oldEnd);
+    appendStringInfo(&buf, "\"new_start_index\":%zu,", edit.newStart);
+    appendStringInfo(&buf, "\"new_end_index\":%zu,", edit.newEnd);
+    appendStringInfo(&buf, "\"start_ch\":%.6f,", edit.startCh);
+    appendStringInfo(&buf, "\"old_end_ch\":%.6f,", edit.oldEndCh);
+    appendStringInfo(&buf, "\"new_end_ch\":%.6f,", edit.newEndCh);
+    appendStringInfo(&buf, "\"delta\":%.6f", edit.delta);
+    appendStringInfo(&buf, "}");
+    
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_LINE_EDIT, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+/* ========== Calibration Join ========== */
+
+/* Rows fetched from each query per SPI_cursor_fetch */
+#define CALIBRATE_JOIN_FETCH 1000
+
+/* Estimated memory per indexed road vertex: coordinate, prefix and grid entry/bucket */
+#define CALIBRATE_JOIN_VERTEX_BYTES \
+    (sizeof(Coordinate) + sizeof(double) + sizeof(RoadGridEntry) + sizeof(size_t))
+
+/* Integer id from column 1 of a calibrate_join input query */
+static int64 getJoinId(HeapTuple tuple, TupleDesc desc, const char *side) {
+    bool isnull;
+    Datum value = SPI_getbinval(tuple, desc, 1, &isnull);
+
+    if (isnull) {
+        ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                        errmsg("%s query returned a NULL id", side)));
+    }
+
+    switch (SPI_gettypeid(desc, 1)) {
+        case INT2OID: return DatumGetInt16(value);
+        case INT4OID: return DatumGetInt32(value);
+        case INT8OID: return DatumGetInt64(value);
+    }
+    ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                    errmsg("first column of the %s query must be an integer id", side)));
+    return 0;
+}
+
+/* Geometry from column 2 (WKT text, or compact bytea for roads); NULL if the value is NULL */
+static text *getJoinGeometry(HeapTuple tuple, TupleDesc desc, const char *side) {
+    bool isnull;
+    Oid type = SPI_gettypeid(desc, 2);
+
+    if (desc->natts < 2 || (type != TEXTOID && type != BYTEAOID)) {
+        ereport(ERROR, (errcode(ERRCODE_DATATYPE_MISMATCH),
+                        errmsg("%s query must return (id, geometry as WKT text or compact bytea)", side)));
+    }
+
+    Datum value = SPI_getbinval(tuple, desc, 2, &isnull);
+    return isnull ? NULL : DatumGetTextPP(value);
+}
+
+PG_FUNCTION_INFO_V1(calibrate_join);
+
+/*
+ * Calibrate every point of points_query against every road of roads_query.
+ * Roads are loaded in batches of about work_mem, their vertices indexed in a
+ * grid of radius-sized cells, and the points streamed through each batch.
+ * Emits one row per (point, road) pair with a road vertex within radius,
+ * matching calibrate_point_on_line for that pair.
+ */
+Datum
+calibrate_join(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    char *points_query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *roads_query = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    float8 radius = PG_GETARG_FLOAT8(2);
+    TupleDesc tupdesc;
+    
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    if (radius < 0 || isnan(radius) || isinf(radius)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Radius must be a non-negative number")));
+    }
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+    }
+    
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    Tuplestorestate *store = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+    
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = store;
+    rsinfo->setDesc = tupdesc;
+    
+    /* Road batches live in batchContext; per-fetch scratch (detoasted values, WKT) in rowContext */
+    MemoryContext batchContext = AllocSetContextCreate(CurrentMemoryContext, "calibrate_join roads",
+                                                       ALLOCSET_DEFAULT_SIZES);
+    MemoryContext rowContext = AllocSetContextCreate(CurrentMemoryContext, "calibrate_join rows",
+                                                     ALLOCSET_DEFAULT_SIZES);
+    RoadAllocator batchAllocator = pg_road_allocator;
+    batchAllocator.ctx = batchContext;
+    Size budget = (Size) work_mem * 1024;
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_CALIBRATE_JOIN);
+    
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("SPI_connect failed")));
+    }
+    MemoryContext spiContext = CurrentMemoryContext;
+    
+    Portal roads = SPI_cursor_open_with_args(NULL, roads_query, 0, NULL, NULL, NULL, true, CURSOR_OPT_NO_SCROLL);
+    bool roadsDone = false;
+    
+    while (!roadsDone) {
+        size_t numLines = 0, capLines = 64;
+        Size used = 0;
+        
+        MemoryContextReset(batchContext);
+        RoadLine *lines = (RoadLine *) MemoryContextAlloc(batchContext, capLines * sizeof(RoadLine));
+        int64 *roadIds = (int64 *) MemoryContextAlloc(batchContext, capLines * sizeof(int64));
+        
+        /* Load roads until the batch reaches work_mem */
+        while (used < budget) {
+            SPI_cursor_fetch(roads, true, CALIBRATE_JOIN_FETCH);
+            if (SPI_processed == 0) {
+                roadsDone = true;
+                break;
+            }
+            
+            MemoryContextSwitchTo(rowContext);
+            for (uint64 r = 0; r < SPI_processed; r++) {
+                HeapTuple tuple = SPI_tuptable->vals[r];
+                int64 id = getJoinId(tuple, SPI_tuptable->tupdesc, "roads");
+                text *geometry = getJoinGeometry(tuple, SPI_tuptable->tupdesc, "roads");
+                
+                if (numLines == capLines) {
+                    capLines *= 2;
+                    lines = (RoadLine *) repalloc(lines, capLines * sizeof(RoadLine));
+                    roadIds = (int64 *) repalloc(roadIds, capLines * sizeof(int64));
+                }
+                
+                /* Unparseable roads are skipped, as calibrate_point_on_line would return NULL */
+                if (!geometry || !parseLineArgWith(geometry, &batchAllocator, &lines[numLines])) {
+                    continue;
+                }
+                if (!lineInGridRange(&lines[numLines])) {
+                    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                    errmsg("road " INT64_FORMAT " has non-finite coordinates or coordinates beyond %g",
+                                           id, ROAD_GRID_MAX_COORD)));
+                }
+                
+                roadStatsAdd(ROAD_STAT_CALIBRATE_JOIN, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(geometry));
+                roadStatsAdd(ROAD_STAT_CALIBRATE_JOIN, ROAD_STAT_VERTICES, lines[numLines].coords.size);
+                used += sizeof(RoadLine) + sizeof(int64) + lines[numLines].coords.size * CALIBRATE_JOIN_VERTEX_BYTES;
+                roadIds[numLines++] = id;
+            }
+            MemoryContextSwitchTo(spiContext);
+            SPI_freetuptable(SPI_tuptable);
+            MemoryContextReset(rowContext);
+        }
+        roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+        
+        if (numLines == 0) {
+            break;
+        }
+        
+        RoadGridIndex index;
+        RoadMatchArray matches = {0};
+        if (!buildGridIndex(&index, lines, numLines, radius, &batchAllocator)) {
+            ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to build road index")));
+        }
+        
+        /* Stream every point through this batch of roads */
+        Portal points = SPI_cursor_open_with_args(NULL, points_query, 0, NULL, NULL, NULL, true,
+                                                  CURSOR_OPT_NO_SCROLL);
+        for (;;) {
+            SPI_cursor_fetch(points, true, CALIBRATE_JOIN_FETCH);
+            if (SPI_processed == 0) {
+                break;
+            }
+            
+            MemoryContextSwitchTo(rowContext);
+            for (uint64 r = 0; r < SPI_processed; r++) {
+                HeapTuple tuple = SPI_tuptable->vals[r];
+                int64 pointId = getJoinId(tuple, SPI_tuptable->tupdesc, "points");
+                text *geometry = getJoinGeometry(tuple, SPI_tuptable->tupdesc, "points");
+                Coordinate point;
+                
+                if (!geometry || !parsePointWKT(text_to_cstring(geometry), &point)) {
+                    continue;
+                }
+                if (!queryGridIndex(&index, point, radius, &matches)) {
+                    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Road index query failed")));
+                }
+                
+                for (size_t m = 0; m < matches.size; m++) {
+                    const RoadMatch *match = &matches.data[m];
+                    Datum values[4];
+                    bool nulls[4] = {false};
+                    
+                    values[0] = Int64GetDatum(pointId);
+                    values[1] = Int64GetDatum(roadIds[match->line]);
+                    values[2] = Float8GetDatum(degreesToKm(lines[match->line].prefix[match->vertex]));
+                    values[3] = Float8GetDatum(match->distance);
+                    tuplestore_putvalues(store, tupdesc, values, nulls);
+                }
+            }
+            MemoryContextSwitchTo(spiContext);
+            SPI_freetuptable(SPI_tuptable);
+            MemoryContextReset(rowContext);
+        }
+        SPI_cursor_close(points);
+        roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    }
+    
+    SPI_cursor_close(roads);
+    SPI_finish();
+    
+    MemoryContextDelete(rowContext);
+    MemoryContextDelete(batchContext);
+    roadStatsEnd(&stats);
+    
+    return (Datum) 0;
+}
+
+/* ========== Road Topology ========== */
+
+/* Largest planner estimate trusted for the initial topology size */
+#define ROAD_TOPOLOGY_MAX_ESTIMATE 4000000
+
+/* Planner row estimate of an open cursor, 0 when unknown */
+static size_t estimateCursorRows(Portal portal) {
+    if (list_length(portal->stmts) != 1) return 0;
+
+    PlannedStmt *stmt = linitial_node(PlannedStmt, portal->stmts);
+    if (!stmt->planTree || !(stmt->planTree->plan_rows > 0)) return 0;
+    return stmt->planTree->plan_rows < ROAD_TOPOLOGY_MAX_ESTIMATE
+           ? (size_t) stmt->planTree->plan_rows : ROAD_TOPOLOGY_MAX_ESTIMATE;
+}
+
+/*
+ * Stream every road of roads_query into topo, allocated with allocator
+ * (which must outlive topo). Returns the road id of each edge, allocated
+ * in CurrentMemoryContext. Unparseable roads are skipped.
+ */
+static int64 *loadRoadTopology(const char *roads_query, double tolerance, const RoadAllocator *allocator,
+                               RoadStatFunction fn, RoadTopology *topo)
+{
+    MemoryContext callerContext = CurrentMemoryContext;
+    MemoryContext rowContext = AllocSetContextCreate(CurrentMemoryContext, "road topology rows",
+                                                     ALLOCSET_DEFAULT_SIZES);
+    
+    if (tolerance < 0 || isnan(tolerance) || isinf(tolerance)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Tolerance must be a non-negative number")));
+    }
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("SPI_connect failed")));
+    }
+    MemoryContext spiContext = CurrentMemoryContext;
+    
+    Portal roads = SPI_cursor_open_with_args(NULL, roads_query, 0, NULL, NULL, NULL, true, CURSOR_OPT_NO_SCROLL);
+    size_t expected = estimateCursorRows(roads);
+    
+    if (!initTopology(topo, expected, tolerance, allocator)) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to allocate road topology")));
+    }
+    size_t capIds = expected + 16;
+    int64 *roadIds = (int64 *) MemoryContextAlloc(callerContext, capIds * sizeof(int64));
+    
+    for (;;) {
+        SPI_cursor_fetch(roads, true, CALIBRATE_JOIN_FETCH);
+        if (SPI_processed == 0) {
+            break;
+        }
+        
+        MemoryContextSwitchTo(rowContext);
+        for (uint64 r = 0; r < SPI_processed; r++) {
+            HeapTuple tuple = SPI_tuptable->vals[r];
+            int64 id = getJoinId(tuple, SPI_tuptable->tupdesc, "roads");
+            text *geometry = getJoinGeometry(tuple, SPI_tuptable->tupdesc, "roads");
+            RoadLine line;
+            
+            if (!geometry || !parseLineArg(geometry, &line) || line.coords.size < 2) {
+                continue;
+            }
+            if (!lineInGridRange(&line)) {
+                ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                                errmsg("road " INT64_FORMAT " has non-finite coordinates or coordinates beyond %g",
+                                       id, ROAD_GRID_MAX_COORD)));
+            }
+            roadStatsAdd(fn, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(geometry));
+            roadStatsAdd(fn, ROAD_STAT_VERTICES, line.coords.size);
+            
+            if (topo->numEdges == capIds) {
+                capIds *= 2;
+                roadIds = (int64 *) repalloc(roadIds, capIds * sizeof(int64));
+            }
+            if (!addTopologyLine(topo, topo->numEdges, &line)) {
+                ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to add road to topology")));
+            }
+            roadIds[topo->numEdges - 1] = id;
+        }
+        MemoryContextSwitchTo(spiContext);
+        SPI_freetuptable(SPI_tuptable);
+        MemoryContextReset(rowContext);
+    }
+    
+    SPI_cursor_close(roads);
+    SPI_finish();
+    MemoryContextDelete(rowContext);
+    
+    return roadIds;
+}
+
+PG_FUNCTION_INFO_V1(road_topology);
+
+/*
+ * Node/edge topology of every road of roads_query in one pass. Roads are
+ * streamed through a cursor; only their end points and lengths are kept,
+ * in a node table sized from the planner's row estimate. Emits one row per
+ * road with its start and end node, chainages and the nodes' positions,
+ * degrees and connected component.
+ */
+Datum
+road_topology(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    char *roads_query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    float8 tolerance = PG_GETARG_FLOAT8(1);
+    TupleDesc tupdesc;
+    
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+    }
+    
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    Tuplestorestate *store = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+    
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = store;
+    rsinfo->setDesc = tupdesc;
+    
+    /* Topology and road ids live in topoContext */
+    MemoryContext topoContext = AllocSetContextCreate(CurrentMemoryContext, "road_topology nodes",
+                                                      ALLOCSET_DEFAULT_SIZES);
+    RoadAllocator topoAllocator = pg_road_allocator;
+    topoAllocator.ctx = topoContext;
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_TOPOLOGY);
+    
+    RoadTopology topo;
+    MemoryContextSwitchTo(topoContext);
+    int64 *roadIds = loadRoadTopology(roads_query, tolerance, &topoAllocator, ROAD_STAT_TOPOLOGY, &topo);
+    MemoryContextSwitchTo(oldcontext);
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    
+    if (!labelTopologyComponents(&topo)) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to label road network components")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    /* Node and component numbers are 1-based in SQL */
+    for (size_t e = 0; e < topo.numEdges; e++) {
+        const RoadTopoEdge *edge = &topo.edges[e];
+        const RoadTopoNode *start = &topo.nodes[edge->startNode];
+        const RoadTopoNode *end = &topo.nodes[edge->endNode];
+        Datum values[12];
+        bool nulls[12] = {false};
+        
+        values[0] = Int64GetDatum(roadIds[edge->line]);
+        values[1] = Int64GetDatum((int64) edge->startNode + 1);
+        values[2] = Int64GetDatum((int64) edge->endNode + 1);
+        values[3] = Float8GetDatum(0.0);
+        values[4] = Float8GetDatum(edge->length);
+        values[5] = Float8GetDatum(start->x);
+        values[6] = Float8GetDatum(start->y);
+        values[7] = Int32GetDatum((int32) start->degree);
+        values[8] = Float8GetDatum(end->x);
+        values[9] = Float8GetDatum(end->y);
+        values[10] = Int32GetDatum((int32) end->degree);
+        values[11] = Int64GetDatum((int64) start->component + 1);
+        tuplestore_putvalues(store, tupdesc, values, nulls);
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    
+    freeTopology(&topo);
+    MemoryContextDelete(topoContext);
+    roadStatsEnd(&stats);
+    
+    return (Datum) 0;
+}
+
+/* ========== Network Routing ========== */
+
+typedef struct {
+    int64 id;
+    size_t edge;
+} RoadIdEntry;
+
+/*
+ * Graph of the last roads_query routed over, in its own context under
+ * TopMemoryContext. It is reused only by the same role and search_path,
+ * with the same query text and tolerance, under a snapshot that sees the
+ * same rows; edits made since, in this transaction or committed by others,
+ * rebuild it. The graph is dropped at the end of the transaction and by
+ * road_network_reset().
+ */
+typedef struct {
+    MemoryContext context;
+    char *query;
+    double tolerance;
+    Oid userId;
+    char *searchPath;
+    SnapshotData snapshot;  /* visibility fields only; xip and subxip copied */
+    RoadAllocator allocator;
+    RoadTopology topo;
+    RoadGraph graph;
+    int64 *roadIds;         /* road id of each edge */
+    RoadIdEntry *byId;      /* edges sorted by road id */
+} RoadNetwork;
+
+static RoadNetwork *roadNetwork = NULL;
+
+static int compareRoadIds(const void *a, const void *b) {
+    int64 x = ((const RoadIdEntry *) a)->id;
+    int64 y = ((const RoadIdEntry *) b)->id;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void resetRoadNetwork(void) {
+    if (roadNetwork) {
+        MemoryContextDelete(roadNetwork->context);
+        roadNetwork = NULL;
+    }
+}
+
+static void roadNetworkXactCallback(XactEvent event, void *arg) {
+    if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT || event == XACT_EVENT_PREPARE ||
+        event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT) {
+        resetRoadNetwork();
+    }
+}
+
+/* Snapshots with the same xmin, xmax, in-progress xids and command id see the same rows */
+static bool sameSnapshotData(const SnapshotData *a, Snapshot b) {
+    return a->xmin == b->xmin && a->xmax == b->xmax && a->curcid == b->curcid &&
+           a->xcnt == b->xcnt && a->subxcnt == b->subxcnt && a->suboverflowed == b->suboverflowed &&
+           (a->xcnt == 0 || memcmp(a->xip, b->xip, a->xcnt * sizeof(TransactionId)) == 0) &&
+           (a->subxcnt <= 0 || memcmp(a->subxip, b->subxip, a->subxcnt * sizeof(TransactionId)) == 0);
+}
+
+static void copySnapshotData(SnapshotData *dst, Snapshot src) {
+    memset(dst, 0, sizeof(SnapshotData));
+    dst->xmin = src->xmin;
+    dst->xmax = src->xmax;
+    dst->curcid = src->curcid;
+    dst->xcnt = src->xcnt;
+    dst->subxcnt = src->subxcnt;
+    dst->suboverflowed = src->suboverflowed;
+    dst->xip = (TransactionId *) palloc((src->xcnt + 1) * sizeof(TransactionId));
+    memcpy(dst->xip, src->xip, src->xcnt * sizeof(TransactionId));
+    if (src->subxcnt > 0) {
+        dst->subxip = (TransactionId *) palloc(src->subxcnt * sizeof(TransactionId));
+        memcpy(dst->subxip, src->subxip, src->subxcnt * sizeof(TransactionId));
+    }
+}
+
+static RoadNetwork *getRoadNetwork(text *query_text, double tolerance) {
+    char *query = text_to_cstring(query_text);
+    Oid userId = GetUserId();
+    Snapshot snapshot = GetActiveSnapshot();
+    
+    if (roadNetwork && roadNetwork->tolerance == tolerance && strcmp(roadNetwork->query, query) == 0 &&
+        roadNetwork->userId == userId && strcmp(roadNetwork->searchPath, namespace_search_path) == 0 &&
+        sameSnapshotData(&roadNetwork->snapshot, snapshot)) {
+        roadStatsAdd(ROAD_STAT_NETWORK_ROUTE, ROAD_STAT_CACHE_HITS, 1);
+        return roadNetwork;
+    }
+    roadStatsAdd(ROAD_STAT_NETWORK_ROUTE, ROAD_STAT_CACHE_MISSES, 1);
+    resetRoadNetwork();
+    
+    /* Built under the caller's context, so an error part way frees it */
+    MemoryContext context = AllocSetContextCreate(CurrentMemoryContext, "pg_gis_road_utils network",
+                                                  ALLOCSET_DEFAULT_SIZES);
+    MemoryContext oldcontext = MemoryContextSwitchTo(context);
+    RoadNetwork *net = (RoadNetwork *) palloc0(sizeof(RoadNetwork));
+    
+    net->context = context;
+    net->query = pstrdup(query);
+    net->tolerance = tolerance;
+    net->userId = userId;
+    net->searchPath = pstrdup(namespace_search_path);
+    copySnapshotData(&net->snapshot, snapshot);
+    net->allocator = pg_road_allocator;
+    net->allocator.ctx = context;
+    net->roadIds = loadRoadTopology(query, tolerance, &net->allocator, ROAD_STAT_NETWORK_ROUTE, &net->topo);
+    
+    if (!buildRoadGraph(&net->graph, &net->topo, &net->allocator)) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to build road network graph")));
+    }
+    
+    net->byId = (RoadIdEntry *) palloc((net->topo.numEdges + 1) * sizeof(RoadIdEntry));
+    for (size_t e = 0; e < net->topo.numEdges; e++) {
+        net->byId[e].id = net->roadIds[e];
+        net->byId[e].edge = e;
+    }
+    qsort(net->byId, net->topo.numEdges, sizeof(RoadIdEntry), compareRoadIds);
+    
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextSetParent(context, TopMemoryContext);
+    roadNetwork = net;
+    return net;
+}
+
+/* Position of a road id and chainage (km) on the network; the first edge if an id repeats */
+static RoadGraphPosition getRoadPosition(const RoadNetwork *net, int64 id, double chainage) {
+    size_t lo = 0, hi = net->topo.numEdges;
+    RoadGraphPosition position;
+    
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (net->byId[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == net->topo.numEdges || net->byId[lo].id != id) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Road " INT64_FORMAT " is not in the network", id)));
+    }
+    
+    position.edge = net->byId[lo].edge;
+    position.chainage = chainage;
+    if (!(chainage >= 0 && chainage <= net->topo.edges[position.edge].length)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("Chainage out of bounds")));
+    }
+    return position;
+}
+
+/*
+ * Route between the positions given by arguments 1-4 over the network of
+ * argument 0 with tolerance argument 5. Returns 0 if no route exists.
+ */
+static int routeArgs(FunctionCallInfo fcinfo, RoadNetwork **net, RoadRoute *route) {
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_NETWORK_ROUTE);
+    
+    *net = getRoadNetwork(PG_GETARG_TEXT_PP(0), PG_GETARG_FLOAT8(5));
+    RoadGraphPosition from = getRoadPosition(*net, PG_GETARG_INT64(1), PG_GETARG_FLOAT8(2));
+    RoadGraphPosition to = getRoadPosition(*net, PG_GETARG_INT64(3), PG_GETARG_FLOAT8(4));
+    roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+    
+    int found = findRoadRoute(&(*net)->graph, from, to, &pg_road_allocator, route);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    roadStatsEnd(&stats);
+    return found;
+}
+
+PG_FUNCTION_INFO_V1(road_network_distance);
+
+/* Shortest network distance (km) between two road chainages, NULL if unconnected */
+Datum
+road_network_distance(PG_FUNCTION_ARGS)
+{
+    RoadNetwork *net;
+    RoadRoute route;
+    
+    if (!routeArgs(fcinfo, &net, &route)) {
+        PG_RETURN_NULL();
+    }
+    freeRoadRoute(&route);
+    PG_RETURN_FLOAT8(route.distance);
+}
+
+PG_FUNCTION_INFO_V1(road_network_route);
+
+/* Legs of the shortest route as (seq, road_id, start_ch, end_ch, length); empty if unconnected */
+Datum
+road_network_route(PG_FUNCTION_ARGS)
+{
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    RoadNetwork *net;
+    RoadRoute route;
+    
+    if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("set-valued function called in context that cannot accept a set")));
+    }
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+    }
+    
+    MemoryContext oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    tupdesc = CreateTupleDescCopy(tupdesc);
+    Tuplestorestate *store = tuplestore_begin_heap(true, false, work_mem);
+    MemoryContextSwitchTo(oldcontext);
+    
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = store;
+    rsinfo->setDesc = tupdesc;
+    
+    if (!routeArgs(fcinfo, &net, &route)) {
+        return (Datum) 0;
+    }
+    
+    for (size_t i = 0; i < route.numLegs; i++) {
+        const RoadRouteLeg *leg = &route.legs[i];
+        Datum values[5];
+        bool nulls[5] = {false};
+        
+        values[0] = Int32GetDatum((int32) i + 1);
+        values[1] = Int64GetDatum(net->roadIds[leg->edge]);
+        values[2] = Float8GetDatum(leg->startCh);
+        values[3] = Float8GetDatum(leg->endCh);
+        values[4] = Float8GetDatum(fabs(leg->endCh - leg->startCh));
+        tuplestore_putvalues(store, tupdesc, values, nulls);
+    }
+    freeRoadRoute(&route);
+    
+    return (Datum) 0;
+}
+
+PG_FUNCTION_INFO_V1(road_network_reset);
+
+Datum
+road_network_reset(PG_FUNCTION_ARGS)
+{
+    resetRoadNetwork();
+    PG_RETURN_VOID();
+}
+
+/* ========== Route Assembly ========== */
+
+/* Segments collected by assemble_route, in the aggregate context */
+typedef struct {
+    RoadAllocator allocator;
+    double tolerance;
+    RoadLine *lines;
+    int64 *ids;
+    size_t numLines;
+    size_t capLines;
+} RouteAssemblyState;
+
+PG_FUNCTION_INFO_V1(assemble_route_accum);
+
+/* Transition function: parse and keep one segment; NULL or unparseable segments are skipped */
+Datum
+assemble_route_accum(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggContext;
+    RouteAssemblyState *state = PG_ARGISNULL(0) ? NULL : (RouteAssemblyState *) PG_GETARG_POINTER(0);
+    
+    if (!AggCheckCallContext(fcinfo, &aggContext)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("assemble_route_accum called in non-aggregate context")));
+    }
+    
+    if (!state) {
+        float8 tolerance = PG_ARGISNULL(3) ? 0.0 : PG_GETARG_FLOAT8(3);
+        if (tolerance < 0 || isnan(tolerance) || isinf(tolerance)) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("Tolerance must be a non-negative number")));
+        }
+        
+        state = (RouteAssemblyState *) MemoryContextAllocZero(aggContext, sizeof(RouteAssemblyState));
+        state->allocator = pg_road_allocator;
+        state->allocator.ctx = aggContext;
+        state->tolerance = tolerance;
+        state->capLines = 16;
+        state->lines = (RoadLine *) MemoryContextAlloc(aggContext, state->capLines * sizeof(RoadLine));
+        state->ids = (int64 *) MemoryContextAlloc(aggContext, state->capLines * sizeof(int64));
+    }
+    
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+        PG_RETURN_POINTER(state);
+    }
+    
+    text *segment = PG_GETARG_TEXT_PP(2);
+    if (state->numLines == state->capLines) {
+        state->capLines *= 2;
+        state->lines = (RoadLine *) repalloc(state->lines, state->capLines * sizeof(RoadLine));
+        state->ids = (int64 *) repalloc(state->ids, state->capLines * sizeof(int64));
+    }
+    
+    RoadLine *line = &state->lines[state->numLines];
+    if (parseLineArgWith(segment, &state->allocator, line)) {
+        if (line->coords.size >= 2 && !lineInGridRange(line)) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("road " INT64_FORMAT " has non-finite coordinates or coordinates beyond %g",
+                                   PG_GETARG_INT64(1), ROAD_GRID_MAX_COORD)));
+        }
+        if (line->coords.size >= 2) {
+            roadStatsAdd(ROAD_STAT_ASSEMBLE_ROUTE, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(segment));
+            roadStatsAdd(ROAD_STAT_ASSEMBLE_ROUTE, ROAD_STAT_VERTICES, line->coords.size);
+            state->ids[state->numLines++] = PG_GETARG_INT64(1);
+        } else {
+            freeRoadLine(line);
+        }
+    }
+    
+    PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(assemble_route_final);
+
+/*
+ * Final function: the merged route as JSON with the chainage span of every
+ * segment in route order, and the ids of segments the walk did not reach.
+ */
+Datum
+assemble_route_final(PG_FUNCTION_ARGS)
+{
+    RouteAssemblyState *state = PG_ARGISNULL(0) ? NULL : (RouteAssemblyState *) PG_GETARG_POINTER(0);
+    
+    if (!state || state->numLines == 0) {
+        PG_RETURN_NULL();
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_ASSEMBLE_ROUTE);
+    
+    AssembledRoute route;
+    if (!assembleRoute(state->lines, state->numLines, state->tolerance, &pg_road_allocator, &route)) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("Failed to assemble route")));
+    }
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    char *wkt = lineToWKT(&route.line, &pg_road_allocator);
+    bool *reached = (bool *) palloc0(state->numLines * sizeof(bool));
+    StringInfoData buf;
+    initStringInfo(&buf);
+    
+    appendStringInfo(&buf, "{\"geometry\":\"%s\",", wkt);
+    appendStringInfo(&buf, "\"length\":%.6f,", degreesToKm(route.line.prefix[route.line.coords.size - 1]));
+    appendStringInfoString(&buf, "\"segments\":[");
+    for (size_t i = 0; i < route.numSegments; i++) {
+        const RouteSegmentDto *seg = &route.segments[i];
+        reached[seg->line] = true;
+        appendStringInfo(&buf, "%s{\"id\":" INT64_FORMAT ",\"start_ch\":%.6f,\"end_ch\":%.6f,\"reversed\":%s}",
+                         i > 0 ? "," : "", state->ids[seg->line], seg->startCh, seg->endCh,
+                         seg->reversed ? "true" : "false");
+    }
+    appendStringInfoString(&buf, "],\"unassembled\":[");
+    for (size_t l = 0, n = 0; l < state->numLines; l++) {
+        if (!reached[l]) {
+            appendStringInfo(&buf, "%s" INT64_FORMAT, n++ > 0 ? "," : "", state->ids[l]);
+        }
+    }
+    appendStringInfoString(&buf, "]}");
+    
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_ASSEMBLE_ROUTE, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
+    
+    pfree(wkt);
+    freeAssembledRoute(&route);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+/* ========== Event Coalescing ========== */
+
+/*
+ * Runs collected by coalesce_events. Rows extend the last run while they
+ * continue it, so sorted input keeps one run per class change; values are
+ * copied once per run and shared by neighbouring runs with the same value.
+ */
+typedef struct {
+    EventRun *runs;
+    size_t numRuns;
+    size_t capRuns;
+} EventRunState;
+
+static EventRunState *newEventRunState(MemoryContext context) {
+    EventRunState *state = (EventRunState *) MemoryContextAllocZero(context, sizeof(EventRunState));
+    state->capRuns = 64;
+    state->runs = (EventRun *) MemoryContextAlloc(context, state->capRuns * sizeof(EventRun));
+    return state;
+}
+
+static void appendEventRun(EventRunState *state, MemoryContext context, double from, double to,
+                           const char *value, size_t valueLen) {
+    EventRun *last = state->numRuns > 0 ? &state->runs[state->numRuns - 1] : NULL;
+    
+    if (last && extendEventRun(last, from, to, value, valueLen)) {
+        return;
+    }
+    if (state->numRuns == state->capRuns) {
+        state->capRuns *= 2;
+        state->runs = (EventRun *) repalloc(state->runs, state->capRuns * sizeof(EventRun));
+        last = &state->runs[state->numRuns - 1];
+    }
+    
+    EventRun *run = &state->runs[state->numRuns++];
+    run->from = from;
+    run->to = to;
+    run->valueLen = valueLen;
+    if (last && value && last->value && last->valueLen == valueLen && memcmp(last->value, value, valueLen) == 0) {
+        run->value = last->value;
+    } else if (value) {
+        char *copy = (char *) MemoryContextAlloc(context, valueLen + 1);
+        memcpy(copy, value, valueLen);
+        copy[valueLen] = '\0';
+        run->value = copy;
+    } else {
+        run->value = NULL;
+    }
+}
+
+static MemoryContext requireAggContext(FunctionCallInfo fcinfo, const char *name) {
+    MemoryContext aggContext;
+    if (!AggCheckCallContext(fcinfo, &aggContext)) {
+        ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                        errmsg("%s called in non-aggregate context", name)));
+    }
+    return aggContext;
+}
+
+PG_FUNCTION_INFO_V1(coalesce_events_accum);
+
+/* Transition function; rows with a NULL chainage are skipped */
+Datum
+coalesce_events_accum(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggContext = requireAggContext(fcinfo, "coalesce_events_accum");
+    EventRunState *state = PG_ARGISNULL(0) ? newEventRunState(aggContext) : (EventRunState *) PG_GETARG_POINTER(0);
+    
+    if (PG_ARGISNULL(1) || PG_ARGISNULL(2)) {
+        PG_RETURN_POINTER(state);
+    }
+    
+    float8 from = PG_GETARG_FLOAT8(1);
+    float8 to = PG_GETARG_FLOAT8(2);
+    if (!(from <= to)) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("from_ch must not be greater than to_ch")));
+    }
+    
+    if (PG_ARGISNULL(3)) {
+        appendEventRun(state, aggContext, from, to, NULL, 0);
+    } else {
+        text *value = PG_GETARG_TEXT_PP(3);
+        appendEventRun(state, aggContext, from, to, VARDATA_ANY(value), VARSIZE_ANY_EXHDR(value));
+    }
+    
+    PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(coalesce_events_combine);
+
+/* Combine function for parallel aggregation: the runs of state2 are appended to state1 */
+Datum
+coalesce_events_combine(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggContext = requireAggContext(fcinfo, "coalesce_events_combine");
+    EventRunState *state1 = PG_ARGISNULL(0) ? NULL : (EventRunState *) PG_GETARG_POINTER(0);
+    EventRunState *state2 = PG_ARGISNULL(1) ? NULL : (EventRunState *) PG_GETARG_POINTER(1);
+    
+    if (!state2) {
+        if (!state1) PG_RETURN_NULL();
+        PG_RETURN_POINTER(state1);
+    }
+    if (!state1) {
+        state1 = newEventRunState(aggContext);
+    }
+    
+    for (size_t i = 0; i < state2->numRuns; i++) {
+        const EventRun *run = &state2->runs[i];
+        appendEventRun(state1, aggContext, run->from, run->to, run->value, run->valueLen);
+    }
+    
+    PG_RETURN_POINTER(state1);
+}
+
+PG_FUNCTION_INFO_V1(coalesce_events_serialize);
+
+/* Run count, then from, to, value length (-1 for NULL) and value bytes per run */
+Datum
+coalesce_events_serialize(PG_FUNCTION_ARGS)
+{
+    EventRunState *state = (EventRunState *) PG_GETARG_POINTER(0);
+    StringInfoData buf;
+    
+    pq_begintypsend(&buf);
+    pq_sendint64(&buf, (int64) state->numRuns);
+    for (size_t i = 0; i < state->numRuns; i++) {
+        const EventRun *run = &state->runs[i];
+        pq_sendfloat8(&buf, run->from);
+        pq_sendfloat8(&buf, run->to);
+        pq_sendint32(&buf, run->value ? (int32) run->valueLen : -1);
+        if (run->value) {
+            pq_sendbytes(&buf, run->value, (int) run->valueLen);
+        }
+    }
+    
+    PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+PG_FUNCTION_INFO_V1(coalesce_events_deserialize);
+
+Datum
+coalesce_events_deserialize(PG_FUNCTION_ARGS)
+{
+    MemoryContext aggContext = requireAggContext(fcinfo, "coalesce_events_deserialize");
+    bytea *data = PG_GETARG_BYTEA_PP(0);
+    EventRunState *state = newEventRunState(aggContext);
+    StringInfoData buf;
+    
+    buf.data = VARDATA_ANY(data);
+    buf.len = VARSIZE_ANY_EXHDR(data);
+    buf.maxlen = buf.len;
+    buf.cursor = 0;
+    
+    int64 numRuns = pq_getmsgint64(&buf);
+    for (int64 i = 0; i < numRuns; i++) {
+        float8 from = pq_getmsgfloat8(&buf);
+        float8 to = pq_getmsgfloat8(&buf);
+        int32 len = (int32) pq_getmsgint(&buf, 4);
+        const char *value = len >= 0 ? pq_getmsgbytes(&buf, len) : NULL;
+        appendEventRun(state, aggContext, from, to, value, len >= 0 ? (size_t) len : 0);
+    }
+    pq_getmsgend(&buf);
+    
+    PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(coalesce_events_final);
+
+/* Final function: merged runs in chainage order as a JSON array */
+Datum
+coalesce_events_final(PG_FUNCTION_ARGS)
+{
+    EventRunState *state = PG_ARGISNULL(0) ? NULL : (EventRunState *) PG_GETARG_POINTER(0);
+    
+    if (!state || state->numRuns == 0) {
+        PG_RETURN_NULL();
+    }
+    
+    RoadStatCall stats;
+    roadStatsBegin(&stats, ROAD_STAT_COALESCE_EVENTS);
+    
+    /* Sorted on a copy: the state may be finalized again in a window */
+    EventRun *runs = (EventRun *) palloc(state->numRuns * sizeof(EventRun));
+    memcpy(runs, state->runs, state->numRuns * sizeof(EventRun));
+    size_t n = coalesceEventRuns(runs, state->numRuns);
+    roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+    
+    StringInfoData buf;
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '[');
+    for (size_t i = 0; i < n; i++) {
+        appendStringInfo(&buf, "%s{\"from_ch\":%.6f,\"to_ch\":%.6f,\"value\":",
+                         i > 0 ? "," : "", runs[i].from, runs[i].to);
+        if (runs[i].value) {
+            escape_json(&buf, runs[i].value);
+        } else {
+            appendStringInfoString(&buf, "null");
+        }
+        appendStringInfoChar(&buf, '}');
+    }
+    appendStringInfoChar(&buf, ']');
+    
+    text *result = cstring_to_text_with_len(buf.data, buf.len);
+    
+    roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+    roadStatsAdd(ROAD_STAT_COALESCE_EVENTS, ROAD_STAT_BYTES_EMITTED, buf.len);
+    roadStatsEnd(&stats);
+    
+    PG_RETURN_TEXT_P(result);
+}
+
+/* ========== Line Splitting ========== */
+
+typedef struct {
+    int numPieces;
+    double *bounds;     /* numPieces + 1 chainages (km) */
+    char **geometries;  /* WKT per piece, NULL for a degenerate piece */
+} SplitLineContext;
+
+static int compareFloat8(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+PG_FUNCTION_INFO_V1(split_line_at_chainages);
+
+/*
+ * Split a line at many chainages in one traversal. Chainages are sorted;
+ * duplicates and chainages not strictly inside the line are ignored.
+ */
+Datum
+split_line_at_chainages(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    
+    if (SRF_IS_FIRSTCALL()) {
+        TupleDesc tupdesc;
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        text *wkt_text = PG_GETARG_TEXT_PP(0);
+        int numChainages;
+        float8 *chainages = getFloat8Array(PG_GETARG_ARRAYTYPE_P(1), "chainages", &numChainages);
+        
+        RoadStatCall stats;
+        roadStatsBegin(&stats, ROAD_STAT_SPLIT_LINE);
+        
+        RoadLine line;
+        if (!parseLineArg(wkt_text, &line)) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+        }
+        roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+        roadStatsAdd(ROAD_STAT_SPLIT_LINE, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+        roadStatsAdd(ROAD_STAT_SPLIT_LINE, ROAD_STAT_VERTICES, line.coords.size);
+        
+        double startKm = degreesToKm(roadLineStart(&line));
+        double endKm = degreesToKm(roadLineLength(&line));
+        int numCuts = 0;
+        
+        qsort(chainages, numChainages, sizeof(float8), compareFloat8);
+        for (int i = 0; i < numChainages; i++) {
+            double cut = chainages[i];
+            double cutDegrees = kmToDegrees(cut);
+            if (cutDegrees <= roadLineStart(&line) || cutDegrees >= roadLineLength(&line) ||
+                (numCuts > 0 && cut == chainages[numCuts - 1])) {
+                continue;
+            }
+            chainages[numCuts++] = cut;
+        }
+        
+        CoordinateArray *pieces = (CoordinateArray *) palloc((numCuts + 1) * sizeof(CoordinateArray));
+        if (!splitLineAtChainages(&line, chainages, numCuts, pieces)) {
+            freeRoadLine(&line);
+            ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                            errmsg("Failed to split line")));
+        }
+        roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+        
+        SplitLineContext *ctx = (SplitLineContext *) palloc(sizeof(SplitLineContext));
+        ctx->numPieces = numCuts + 1;
+        ctx->bounds = (double *) palloc((numCuts + 2) * sizeof(double));
+        ctx->geometries = (char **) palloc((numCuts + 1) * sizeof(char *));
+        
+        ctx->bounds[0] = startKm;
+        for (int i = 0; i < numCuts; i++) ctx->bounds[i + 1] = chainages[i];
+        ctx->bounds[numCuts + 1] = endKm;
+        
+        size_t emitted = 0;
+        for (int i = 0; i <= numCuts; i++) {
+            ctx->geometries[i] = coordsToWKT(pieces[i].data, pieces[i].size, &pg_road_allocator);
+            if (ctx->geometries[i]) emitted += strlen(ctx->geometries[i]);
+            freeCoordinateArray(&pieces[i]);
+        }
+        freeRoadLine(&line);
+        
+        roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+        roadStatsAdd(ROAD_STAT_SPLIT_LINE, ROAD_STAT_BYTES_EMITTED, emitted);
+        roadStatsEnd(&stats);
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        funcctx->max_calls = ctx->numPieces;
+        funcctx->user_fctx = ctx;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    SplitLineContext *ctx = (SplitLineContext *) funcctx->user_fctx;
+    
+    if (funcctx->call_cntr >= funcctx->max_calls)
+        SRF_RETURN_DONE(funcctx);
+    
+    int i = (int) funcctx->call_cntr;
+    Datum values[4];
+    bool nulls[4] = {false};
+    
+    values[0] = Int32GetDatum(i + 1);
+    values[1] = Float8GetDatum(ctx->bounds[i]);
+    values[2] = Float8GetDatum(ctx->bounds[i + 1]);
+    if (ctx->geometries[i])
+        values[3] = CStringGetTextDatum(ctx->geometries[i]);
+    else
+        nulls[3] = true;
+    
+    HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/* ========== Road Profile ========== */
+
+typedef struct {
+    RoadLine line;
+    RoadProfileCursor cursor;
+    uint64 elapsedNs;   /* time spent in this profile, reported when it finishes */
+} RoadProfileContext;
+
+PG_FUNCTION_INFO_V1(road_profile);
+
+/*
+ * Bearing, curvature and, for 3D lines, elevation and grade every interval_m
+ * meters. Each call computes the next interval from where the previous one
+ * stopped, so the whole profile walks the line once.
+ */
+Datum
+road_profile(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+    uint64 callStart = roadStatsNow();
+    
+    if (SRF_IS_FIRSTCALL()) {
+        TupleDesc tupdesc;
+        
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+        
+        text *wkt_text = PG_GETARG_TEXT_PP(0);
+        float8 interval_m = PG_GETARG_FLOAT8(1);
+        
+        if (!(interval_m > 0) || isinf(interval_m)) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("Interval must be a positive number of meters")));
+        }
+        
+        RoadProfileContext *ctx = (RoadProfileContext *) palloc(sizeof(RoadProfileContext));
+        if (!parseLineArg(wkt_text, &ctx->line)) {
+            ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                            errmsg("Invalid geometry: must be LINESTRING or MULTILINESTRING")));
+        }
+        roadStatsAdd(ROAD_STAT_ROAD_PROFILE, ROAD_STAT_BYTES_PARSED, VARSIZE_ANY_EXHDR(wkt_text));
+        roadStatsAdd(ROAD_STAT_ROAD_PROFILE, ROAD_STAT_VERTICES, ctx->line.coords.size);
+        
+        initProfileCursor(&ctx->cursor, &ctx->line, interval_m);
+        ctx->elapsedNs = 0;
+        
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        funcctx->user_fctx = ctx;
+        
+        MemoryContextSwitchTo(oldcontext);
+    }
+    
+    funcctx = SRF_PERCALL_SETUP();
+    RoadProfileContext *ctx = (RoadProfileContext *) funcctx->user_fctx;
+    
+    ProfileSampleDto sample;
+    if (!nextProfileSample(&ctx->cursor, &sample)) {
+        /* A profile is counted once, when it completes */
+        roadStatsAddTime(ROAD_STAT_ROAD_PROFILE, ctx->elapsedNs + (roadStatsNow() - callStart));
+        SRF_RETURN_DONE(funcctx);
+    }
+    
+    Datum values[8];
+    bool nulls[8] = {false};
+    
+    values[0] = Int32GetDatum((int32) funcctx->call_cntr + 1);
+    values[1] = Float8GetDatum(sample.startCh);
+    values[2] = Float8GetDatum(sample.endCh);
+    values[3] = Float8GetDatum(sample.elevation);
+    values[4] = Float8GetDatum(sample.grade);
+    values[5] = Float8GetDatum(sample.bearing);
+    values[6] = Float8GetDatum(sample.curvature);
+    nulls[3] = isnan(sample.elevation);
+    nulls[4] = isnan(sample.grade);
+    nulls[6] = isnan(sample.curvature);
+    
+    char *point_wkt = pointToWKT(sample.point.x, sample.point.y, &pg_road_allocator);
+    values[7] = CStringGetTextDatum(point_wkt);
+    roadStatsAdd(ROAD_STAT_ROAD_PROFILE, ROAD_STAT_BYTES_EMITTED, strlen(point_wkt));
+    pfree(point_wkt);
+    
+    ctx->elapsedNs += roadStatsNow() - callStart;
+    HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+/* ========== Kilometer Post Jobs ========== */
+
+/*
+ * generate_kilometer_posts_parallel stages the roads of a job in
+ * road_post_job_roads, partitioned by id, and road_post_job_run starts one
+ * dynamic background worker per partition. Each worker pages through its
+ * partition in id order and commits every chunk together with its row in
+ * road_post_job_workers, so the progress view never runs ahead of the posts
+ * already visible in the target table.
+ */
+
+#define ROAD_POST_JOB_CHUNK 500
+/* Each worker is a backend process, so this is not tied to ROAD_PARALLEL_MAX_THREADS */
+#define ROAD_POST_JOB_MAX_WORKERS 32
+
+/* Passed to each worker in bgw_extra */
+typedef struct {
+    int64 jobId;
+    int32 worker;
+    Oid database;
+    Oid role;
+    Oid schema;
+} RoadPostWorkerArgs;
+
+PG_FUNCTION_INFO_V1(road_post_job_run);
+
+/*
+ * Start the workers of a job and wait for all of them. On an error or a
+ * cancel while waiting, the workers already started are terminated.
+ */
+Datum
+road_post_job_run(PG_FUNCTION_ARGS)
+{
+    int64 jobId = PG_GETARG_INT64(0);
+    int32 numWorkers = PG_GETARG_INT32(1);
+    
+    if (numWorkers < 1 || numWorkers > ROAD_POST_JOB_MAX_WORKERS) {
+        ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                        errmsg("workers must be between 1 and %d", ROAD_POST_JOB_MAX_WORKERS)));
+    }
+    if (numWorkers > max_worker_processes) {
+        ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+                        errmsg("%d workers requested but max_worker_processes is %d",
+                               numWorkers, max_worker_processes)));
+    }
+    
+    BackgroundWorkerHandle **handles = (BackgroundWorkerHandle **) palloc0(numWorkers * sizeof(BackgroundWorkerHandle *));
+    RoadPostWorkerArgs args;
+    memset(&args, 0, sizeof(args));
+    args.jobId = jobId;
+    args.database = MyDatabaseId;
+    args.role = GetUserId();
+    args.schema = get_func_namespace(fcinfo->flinfo->fn_oid);
+    
+    PG_TRY();
+    {
+        for (int i = 0; i < numWorkers; i++) {
+            BackgroundWorker worker;
+            memset(&worker, 0, sizeof(worker));
+            worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+            worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+            worker.bgw_restart_time = BGW_NEVER_RESTART;
+            snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_gis_road_utils");
+            snprintf(worker.bgw_function_name, BGW_MAXLEN, "road_post_worker_main");
+            snprintf(worker.bgw_name, BGW_MAXLEN, "pg_gis_road_utils km posts job " INT64_FORMAT " worker %d",
+                     jobId, i);
+            snprintf(worker.bgw_type, BGW_MAXLEN, "pg_gis_road_utils km posts");
+            worker.bgw_main_arg = Int32GetDatum(i);
+            worker.bgw_notify_pid = MyProcPid;
+            args.worker = i;
+            memcpy(worker.bgw_extra, &args, sizeof(args));
+            
+            if (!RegisterDynamicBackgroundWorker(&worker, &handles[i])) {
+                ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+                                errmsg("could not start worker %d of %d for kilometer post job " INT64_FORMAT,
+                                       i + 1, numWorkers, jobId),
+                                errhint("Raise max_worker_processes or run the job with fewer workers.")));
+            }
+        }
+        
+        for (int i = 0; i < numWorkers; i++) {
+            if (WaitForBackgroundWorkerShutdown(handles[i]) == BGWH_POSTMASTER_DIED) {
+                ereport(FATAL, (errcode(ERRCODE_ADMIN_SHUTDOWN),
+                                errmsg("postmaster exited during kilometer post job " INT64_FORMAT, jobId)));
+            }
+        }
+    }
+    PG_CATCH();
+    {
+        for (int i = 0; i < numWorkers; i++) {
+            if (handles[i]) {
+                TerminateBackgroundWorker(handles[i]);
+            }
+        }
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    
+    PG_RETURN_VOID();
+}
+
+/* Run one statement of a worker; the caller holds a transaction and SPI connection */
+static void workerExecute(SPIPlanPtr plan, Datum *values, const char *nulls, int expected) {
+    int ret = SPI_execute_plan(plan, values, nulls, false, 0);
+    if (ret != expected) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                        errmsg("kilometer post worker statement failed: %s", SPI_result_code_string(ret))));
+    }
+}
+
+static SPIPlanPtr workerPrepare(const char *query, int nargs, Oid *argtypes) {
+    SPIPlanPtr plan = SPI_prepare(query, nargs, argtypes);
+    if (!plan) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                        errmsg("could not prepare \"%s\": %s", query, SPI_result_code_string(SPI_result))));
+    }
+    SPI_keepplan(plan);
+    return plan;
+}
+
+static void workerBeginChunk(const char *activity) {
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR), errmsg("SPI_connect failed")));
+    }
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, activity);
+}
+
+static void workerEndChunk(void) {
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+    pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/* Set when the leader terminates the worker; see roadPostWorkerSigterm */
+static volatile sig_atomic_t roadPostWorkerTerminated = false;
+
+/*
+ * SIGTERM from the leader cancels the running statement instead of dying
+ * like die() would, so the error reaches the PG_CATCH of the worker and its
+ * progress row is marked failed rather than left running.
+ */
+static void roadPostWorkerSigterm(SIGNAL_ARGS) {
+    int save_errno = errno;
+
+    roadPostWorkerTerminated = true;
+    QueryCancelPending = true;
+    InterruptPending = true;
+    SetLatch(MyLatch);
+    errno = save_errno;
+}
+
+/*
+ * Entry point of a job worker. Each chunk of ROAD_POST_JOB_CHUNK roads is
+ * one transaction: the posts go into the target table in one unnest
+ * INSERT and the worker's progress row is advanced with them. An error,
+ * including termination by the leader, is recorded on the progress row
+ * before the worker exits.
+ */
+void
+road_post_worker_main(Datum main_arg)
+{
+    RoadPostWorkerArgs args;
+    memcpy(&args, MyBgworkerEntry->bgw_extra, sizeof(args));
+    
+    pqsignal(SIGTERM, roadPostWorkerSigterm);
+    BackgroundWorkerUnblockSignals();
+    BackgroundWorkerInitializeConnectionByOid(args.database, args.role, 0);
+    
+    MemoryContext workerContext = AllocSetContextCreate(TopMemoryContext, "road_post_worker",
+                                                        ALLOCSET_DEFAULT_SIZES);
+    MemoryContext chunkContext = AllocSetContextCreate(workerContext, "road_post_worker chunk",
+                                                       ALLOCSET_DEFAULT_SIZES);
+    RoadAllocator chunkAllocator = pg_road_allocator;
+    chunkAllocator.ctx = chunkContext;
+    char *volatile schema = NULL;
+    
+    PG_TRY();
+    {
+        /* Job parameters and the plans used by every chunk */
+        workerBeginChunk("loading kilometer post job");
+        schema = MemoryContextStrdup(workerContext, quote_identifier(get_namespace_name(args.schema)));
+        
+        Oid jobTypes[2] = {INT8OID, INT4OID};
+        Datum jobValues[2] = {Int64GetDatum(args.jobId), Int32GetDatum(args.worker)};
+        char *query = psprintf("SELECT target_table::oid, interval_km, start_km FROM %s.road_post_jobs "
+                               "WHERE job_id = $1", schema);
+        if (SPI_execute_with_args(query, 1, jobTypes, jobValues, NULL, true, 1) != SPI_OK_SELECT ||
+            SPI_processed != 1) {
+            ereport(ERROR, (errcode(ERRCODE_NO_DATA_FOUND),
+                            errmsg("kilometer post job " INT64_FORMAT " does not exist", args.jobId)));
+        }
+        bool isnull;
+        Oid target = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+        double intervalKm = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+        double startKm = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3, &isnull));
+        if (!get_rel_name(target)) {
+            ereport(ERROR, (errcode(ERRCODE_UNDEFINED_TABLE),
+                            errmsg("target table of kilometer post job " INT64_FORMAT " no longer exists", args.jobId)));
+        }
+        char *targetName = quote_qualified_identifier(get_namespace_name(get_rel_namespace(target)),
+                                                      get_rel_name(target));
+        
+        Oid roadTypes[4] = {INT8OID, INT4OID, INT8OID, INT4OID};
+        SPIPlanPtr roadsPlan = workerPrepare(
+            psprintf("SELECT road_id, wkt FROM %s.road_post_job_roads "
+                     "WHERE job_id = $1 AND part = $2 AND road_id >= $3 ORDER BY road_id LIMIT $4", schema),
+            4, roadTypes);
+        Oid insertTypes[3] = {INT8ARRAYOID, FLOAT8ARRAYOID, TEXTARRAYOID};
+        SPIPlanPtr insertPlan = workerPrepare(
+            psprintf("INSERT INTO %s (road_id, km_post, point_wkt) SELECT * FROM unnest($1, $2, $3)", targetName),
+            3, insertTypes);
+        Oid progressTypes[6] = {INT8OID, INT4OID, INT8OID, INT8OID, INT8OID, TEXTOID};
+        SPIPlanPtr progressPlan = workerPrepare(
+            psprintf("UPDATE %s.road_post_job_workers SET roads_done = roads_done + $3, "
+                     "posts_written = posts_written + $4, last_road_id = coalesce($5, last_road_id), "
+                     "status = $6, updated_at = clock_timestamp() WHERE job_id = $1 AND worker = $2", schema),
+            6, progressTypes);
+        workerEndChunk();
+        
+        RoadStatCall stats;
+        roadStatsBegin(&stats, ROAD_STAT_KM_POST_JOB);
+        
+        int64 nextId = PG_INT64_MIN;
+        bool done = false;
+        while (!done) {
+            CHECK_FOR_INTERRUPTS();
+            if (roadPostWorkerTerminated) {
+                ereport(ERROR, (errcode(ERRCODE_QUERY_CANCELED),
+                                errmsg("terminated by the job leader")));
+            }
+            workerBeginChunk("generating kilometer posts");
+            
+            Datum roadValues[4] = {Int64GetDatum(args.jobId), Int32GetDatum(args.worker),
+                                   Int64GetDatum(nextId), Int32GetDatum(ROAD_POST_JOB_CHUNK)};
+            workerExecute(roadsPlan, roadValues, NULL, SPI_OK_SELECT);
+            uint64 numRoads = SPI_processed;
+            SPITupleTable *roads = SPI_tuptable;
+            roadStatsPhase(&stats, ROAD_PHASE_PARSE);
+            
+            MemoryContext spiContext = MemoryContextSwitchTo(chunkContext);
+            size_t numPosts = 0, capPosts = 1024;
+            Datum *ids = (Datum *) palloc(capPosts * sizeof(Datum));
+            Datum *kms = (Datum *) palloc(capPosts * sizeof(Datum));
+            Datum *wkts = (Datum *) palloc(capPosts * sizeof(Datum));
+            int64 lastId = nextId;
+            
+            for (uint64 r = 0; r < numRoads; r++) {
+                lastId = DatumGetInt64(SPI_getbinval(roads->vals[r], roads->tupdesc, 1, &isnull));
+                Datum wkt = SPI_getbinval(roads->vals[r], roads->tupdesc, 2, &isnull);
+                
+                /* Roads without a usable line get no posts, as in generate_kilometer_posts */
+                RoadLine line;
+                PointDto *posts;
+                size_t n;
+                if (isnull || !parseLineArgWith(DatumGetTextPP(wkt), &chunkAllocator, &line)) {
+                    continue;
+                }
+                roadStatsAdd(ROAD_STAT_KM_POST_JOB, ROAD_STAT_VERTICES, line.coords.size);
+                if (!kilometerPosts(&line, startKm, intervalKm, &posts, &n)) {
+                    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                                    errmsg("Failed to generate kilometer posts for road " INT64_FORMAT, lastId)));
+                }
+                
+                if (numPosts + n > capPosts) {
+                    while (numPosts + n > capPosts) capPosts *= 2;
+                    ids = (Datum *) repalloc(ids, capPosts * sizeof(Datum));
+                    kms = (Datum *) repalloc(kms, capPosts * sizeof(Datum));
+                    wkts = (Datum *) repalloc(wkts, capPosts * sizeof(Datum));
+                }
+                for (size_t i = 0; i < n; i++) {
+                    char *point_wkt = pointToWKT(posts[i].lon, posts[i].lat, &chunkAllocator);
+                    ids[numPosts] = Int64GetDatum(lastId);
+                    kms[numPosts] = Float8GetDatum(posts[i].chainage);
+                    wkts[numPosts] = CStringGetTextDatum(point_wkt);
+                    numPosts++;
+                }
+                freeRoadLine(&line);
+            }
+            roadStatsPhase(&stats, ROAD_PHASE_COMPUTE);
+            
+            if (numPosts > 0) {
+                Datum insertValues[3] = {
+                    PointerGetDatum(construct_array(ids, (int) numPosts, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd')),
+                    PointerGetDatum(construct_array(kms, (int) numPosts, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd')),
+                    PointerGetDatum(construct_array(wkts, (int) numPosts, TEXTOID, -1, false, 'i'))
+                };
+                MemoryContextSwitchTo(spiContext);
+                workerExecute(insertPlan, insertValues, NULL, SPI_OK_INSERT);
+            }
+            MemoryContextSwitchTo(spiContext);
+            
+            done = numRoads < ROAD_POST_JOB_CHUNK || lastId == PG_INT64_MAX;
+            Datum progressValues[6] = {
+                Int64GetDatum(args.jobId), Int32GetDatum(args.worker), Int64GetDatum((int64) numRoads),
+                Int64GetDatum((int64) numPosts), Int64GetDatum(lastId),
+                CStringGetTextDatum(done ? "done" : "running")
+            };
+            workerExecute(progressPlan, progressValues, numRoads > 0 ? "      " : "    n ", SPI_OK_UPDATE);
+            workerEndChunk();
+            MemoryContextReset(chunkContext);
+            roadStatsPhase(&stats, ROAD_PHASE_OUTPUT);
+            
+            nextId = lastId + 1;
+        }
+        
+        roadStatsEnd(&stats);
+    }
+    PG_CATCH();
+    {
+        /* A second SIGTERM must not cancel the statement recording the failure */
+        HOLD_INTERRUPTS();
+        MemoryContextSwitchTo(workerContext);
+        ErrorData *edata = CopyErrorData();
+        FlushErrorState();
+        AbortCurrentTransaction();
+        if (roadPostWorkerTerminated) {
+            edata->message = pstrdup("terminated by the job leader");
+        }
+        
+        ereport(LOG, (errmsg("kilometer post job " INT64_FORMAT " worker %d failed: %s",
+                             args.jobId, args.worker, edata->message)));
+        
+        if (schema) {
+            workerBeginChunk("recording kilometer post job failure");
+            Oid failTypes[3] = {INT8OID, INT4OID, TEXTOID};
+            Datum failValues[3] = {Int64GetDatum(args.jobId), Int32GetDatum(args.worker),
+                                   CStringGetTextDatum(edata->message)};
+            SPI_execute_with_args(psprintf("UPDATE %s.road_post_job_workers SET status = 'failed', error = $3, "
+                                           "updated_at = clock_timestamp() WHERE job_id = $1 AND worker = $2",
+                                           schema),
+                                  3, failTypes, failValues, NULL, false, 0);
+            workerEndChunk();
+        }
+        proc_exit(1);
+    }
+    PG_END_TRY();
+    
+    proc_exit(0);
+}
@@ -0,0 +1,2606 @@
+/*
+ * road_core.c - PostgreSQL-independent chainage kernels
+ *
+ * Line parsing, prefix lengths, calibration, section extraction and
+ * interpolation used by pg_gis_road_utils. See road_core.h.
+ */
+
+#include "road_core.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* ========== Allocation ========== */
+
+static void *malloc_alloc(void *ctx, size_t size) {
+    (void) ctx;
+    return malloc(size);
+}
+
+static void *malloc_realloc(void *ctx, void *ptr, size_t size) {
+    (void) ctx;
+    return realloc(ptr, size);
+}
+
+static void malloc_free(void *ctx, void *ptr) {
+    (void) ctx;
+    free(ptr);
+}
+
+const RoadAllocator road_malloc_allocator = {
+    malloc_alloc,
+    malloc_realloc,
+    malloc_free,
+    NULL
+};
+
+void *roadAlloc(const RoadAllocator *allocator, size_t size) {
+    return allocator->alloc(allocator->ctx, size);
+}
+
+void *roadRealloc(const RoadAllocator *allocator, void *ptr, size_t size) {
+    return allocator->realloc(allocator->ctx, ptr, size);
+}
+
+void roadFree(const RoadAllocator *allocator, void *ptr) {
+    if (ptr) {
+        allocator->free(allocator->ctx, ptr);
+    }
+}
+
+/* ========== CoordinateArray Functions ========== */
+
+int initCoordinateArray(CoordinateArray *arr, size_t initialCapacity, const RoadAllocator *allocator) {
+    if (initialCapacity < 2) {
+        initialCapacity = 2;
+    }
+    arr->allocator = allocator;
+    arr->data = (Coordinate *) roadAlloc(allocator, initialCapacity * sizeof(Coordinate));
+    arr->size = 0;
+    arr->capacity = arr->data ? initialCapacity : 0;
+    return arr->data != NULL;
+}
+
+int addCoordinate(CoordinateArray *arr, double x, double y) {
+    if (arr->size >= arr->capacity) {
+        size_t newCapacity = arr->capacity * 2;
+        Coordinate *data = (Coordinate *) roadRealloc(arr->allocator, arr->data, newCapacity * sizeof(Coordinate));
+        if (!data) {
+            return 0;
+        }
+        arr->data = data;
+        arr->capacity = newCapacity;
+    }
+    arr->data[arr->size].x = x;
+    arr->data[arr->size].y = y;
+    arr->size++;
+    return 1;
+}
+
+/* Append unless the point repeats the last one (section boundaries on vertices) */
+static int addDistinctCoordinate(CoordinateArray *arr, double x, double y) {
+    if (arr->size > 0 && arr->data[arr->size - 1].x == x && arr->data[arr->size - 1].y == y) {
+        return 1;
+    }
+    return addCoordinate(arr, x, y);
+}
+
+void reverseCoordinateArray(CoordinateArray *arr) {
+    for (size_t i = 0, j = arr->size; i + 1 < j; i++, j--) {
+        Coordinate t = arr->data[i];
+        arr->data[i] = arr->data[j - 1];
+        arr->data[j - 1] = t;
+    }
+}
+
+void freeCoordinateArray(CoordinateArray *arr) {
+    if (arr->data) {
+        roadFree(arr->allocator, arr->data);
+        arr->data = NULL;
+    }
+    arr->size = 0;
+    arr->capacity = 0;
+}
+
+/* ========== WKT Parsing ========== */
+
+static const char *skipSpaces(const char *p) {
+    while (*p && isspace((unsigned char) *p)) p++;
+    return p;
+}
+
+/* Read an alphabetic token into buf; returns pointer past it */
+static const char *readWord(const char *p, char *buf, size_t bufSize) {
+    size_t n = 0;
+    p = skipSpaces(p);
+    while (*p && isalpha((unsigned char) *p)) {
+        if (n + 1 < bufSize) buf[n++] = *p;
+        p++;
+    }
+    buf[n] = '\0';
+    return p;
+}
+
+/* Skip an optional "SRID=4326;" EWKT prefix */
+static const char *skipSridPrefix(const char *p) {
+    p = skipSpaces(p);
+    if (strncasecmp(p, "SRID=", 5) == 0) {
+        const char *semi = strchr(p, ';');
+        if (semi) return semi + 1;
+    }
+    return p;
+}
+
+/*
+ * Skip an optional Z / M / ZM tag. *measureIndex is updated to the ordinate
+ * holding the measure (2 for M, 3 for ZM, -1 for none) when a tag is present.
+ * Returns NULL for EMPTY or any other word, which the callers reject.
+ */
+static const char *skipDimensionTag(const char *p, int *measureIndex) {
+    char word[16];
+    const char *next = readWord(p, word, sizeof(word));
+
+    if (word[0] == '\0') return p;
+    if (strcasecmp(word, "EMPTY") == 0) return NULL;
+    if (strcasecmp(word, "Z") == 0 || strcasecmp(word, "M") == 0 || strcasecmp(word, "ZM") == 0) {
+        *measureIndex = strcasecmp(word, "M") == 0 ? 2 : strcasecmp(word, "ZM") == 0 ? 3 : -1;
+        next = skipSpaces(next);
+        if (strncasecmp(next, "EMPTY", 5) == 0) return NULL;
+        return next;
+    }
+    return NULL;
+}
+
+/*
+ * Strip an EWKT dimension suffix ("LINESTRINGM", "LINESTRINGZM") from a type
+ * word and report the measure ordinate as skipDimensionTag does.
+ */
+static void stripDimensionSuffix(char *word, int *measureIndex) {
+    size_t len = strlen(word);
+
+    *measureIndex = -1;
+    if (len > 2 && strcasecmp(word + len - 2, "ZM") == 0) {
+        *measureIndex = 3;
+        word[len - 2] = '\0';
+    } else if (len > 1 && (word[len - 1] == 'M' || word[len - 1] == 'm')) {
+        *measureIndex = 2;
+        word[len - 1] = '\0';
+    } else if (len > 1 && (word[len - 1] == 'Z' || word[len - 1] == 'z')) {
+        word[len - 1] = '\0';
+    }
+}
+
+/* Number of comma separated tuples before the closing ')' of a coordinate list */
+static size_t countTuples(const char *p) {
+    size_t n = 1;
+
+    for (; *p && *p != ')'; p++) {
+        if (*p == ',') n++;
+    }
+    return n < 2 ? 2 : n;
+}
+
+/* Set the value of the vertex just added to arr, growing values alongside arr */
+static int storeOrdinate(const CoordinateArray *arr, double **values, size_t *cap, double v) {
+    if (arr->size > *cap) {
+        double *grown = *values
+                        ? (double *) roadRealloc(arr->allocator, *values, arr->capacity * sizeof(double))
+                        : (double *) roadAlloc(arr->allocator, arr->capacity * sizeof(double));
+        if (!grown) return 0;
+        *values = grown;
+        *cap = arr->capacity;
+    }
+    (*values)[arr->size - 1] = v;
+    return 1;
+}
+
+/*
+ * Parse "x y [z [m]]" tuples up to and including the closing ')'.
+ * With measureIndex >= 0 the measure of every tuple is appended to *measures.
+ * Elevations go to *zs when the first tuple has one, and then every tuple must.
+ */
+static int parseCoordinateList(const char **pp, CoordinateArray *arr, int measureIndex, double **measures,
+                               double **zs) {
+    const char *p = *pp;
+    size_t measureCap = 0, zCap = 0;
+    int hasZ = -1;
+
+    for (;;) {
+        double ord[4];
+        int n = 0;
+
+        p = skipSpaces(p);
+        while (n < 4) {
+            char *end;
+            double v = strtod(p, &end);
+            if (end == p) break;
+            ord[n++] = v;
+            p = skipSpaces(end);
+        }
+        if (n < 2 || n <= measureIndex) return 0;
+        if (!addCoordinate(arr, ord[0], ord[1])) return 0;
+
+        /* Ordinate 2 is the measure of an M line and the elevation otherwise */
+        int tupleZ = n >= 3 && measureIndex != 2;
+        if (hasZ < 0) hasZ = tupleZ;
+        if (tupleZ != hasZ) return 0;
+
+        if (hasZ && !storeOrdinate(arr, zs, &zCap, ord[2])) return 0;
+        if (measureIndex >= 0 && !storeOrdinate(arr, measures, &measureCap, ord[measureIndex])) return 0;
+
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == ')') {
+            p++;
+            break;
+        }
+        return 0;
+    }
+
+    *pp = p;
+    return 1;
+}
+
+static double compute_distance(double x1, double y1, double x2, double y2) {
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    return sqrt(dx * dx + dy * dy);
+}
+
+int computePrefixLengths(RoadLine *line) {
+    size_t n = line->coords.size;
+    const Coordinate *c = line->coords.data;
+
+    if (!line->prefix) {
+        line->prefix = (double *) roadAlloc(line->allocator, (n > 0 ? n : 1) * sizeof(double));
+        if (!line->prefix) return 0;
+    }
+    if (n == 0) return 1;
+
+    line->prefix[0] = 0.0;
+    for (size_t i = 1; i < n; i++) {
+        line->prefix[i] = line->prefix[i - 1] + compute_distance(c[i - 1].x, c[i - 1].y, c[i].x, c[i].y);
+    }
+    return 1;
+}
+
+/* Use measures (km) as the line's chainages; they must never decrease */
+static int applyMeasures(RoadLine *line, double *measures) {
+    size_t n = line->coords.size;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!isfinite(measures[i]) || (i > 0 && measures[i] < measures[i - 1])) return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        measures[i] = kmToDegrees(measures[i]);
+    }
+
+    line->prefix = measures;
+    line->measured = 1;
+    return 1;
+}
+
+int parseLineWKT(const char *wkt, const RoadAllocator *allocator, RoadLine *line) {
+    char word[32];
+    const char *p;
+    int isMulti;
+    int measureIndex;
+    double *measures = NULL;
+
+    memset(line, 0, sizeof(RoadLine));
+    line->allocator = allocator;
+
+    if (!wkt) return 0;
+
+    p = readWord(skipSridPrefix(wkt), word, sizeof(word));
+    stripDimensionSuffix(word, &measureIndex);
+    if (strcasecmp(word, "LINESTRING") == 0) {
+        isMulti = 0;
+    } else if (strcasecmp(word, "MULTILINESTRING") == 0) {
+        isMulti = 1;
+    } else {
+        return 0;
+    }
+
+    p = skipDimensionTag(p, &measureIndex);
+    if (!p) return 0;
+
+    p = skipSpaces(p);
+    if (*p++ != '(') return 0;
+    if (isMulti) {
+        /* Only the first part is used, as in the original implementation */
+        p = skipSpaces(p);
+        if (*p++ != '(') return 0;
+    }
+
+    /* Size coords (and with them z and measures) once from the tuple count */
+    if (!initCoordinateArray(&line->coords, countTuples(p), allocator)) return 0;
+
+    if (!parseCoordinateList(&p, &line->coords, measureIndex, &measures, &line->z) ||
+        line->coords.size < 2) {
+        goto fail;
+    }
+
+    if (measures) {
+        if (!applyMeasures(line, measures)) goto fail;
+    } else if (!computePrefixLengths(line)) {
+        goto fail;
+    }
+
+    return 1;
+
+fail:
+    if (measures && line->prefix != measures) roadFree(allocator, measures);
+    freeRoadLine(line);
+    return 0;
+}
+
+int parsePointWKT(const char *wkt, Coordinate *point) {
+    char word[16];
+    const char *p;
+    double ord[4];
+    int n = 0;
+    int measureIndex;
+
+    if (!wkt || !point) return 0;
+
+    p = readWord(skipSridPrefix(wkt), word, sizeof(word));
+    stripDimensionSuffix(word, &measureIndex);
+    if (strcasecmp(word, "POINT") != 0) return 0;
+
+    p = skipDimensionTag(p, &measureIndex);
+    if (!p) return 0;
+
+    p = skipSpaces(p);
+    if (*p++ != '(') return 0;
+
+    p = skipSpaces(p);
+    while (n < 4) {
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p) break;
+        ord[n++] = v;
+        p = skipSpaces(end);
+    }
+    if (n < 2 || *p != ')') return 0;
+
+    point->x = ord[0];
+    point->y = ord[1];
+    return 1;
+}
+
+void freeRoadLine(RoadLine *line) {
+    freeCoordinateArray(&line->coords);
+    if (line->prefix) {
+        roadFree(line->allocator, line->prefix);
+        line->prefix = NULL;
+    }
+    if (line->z) {
+        roadFree(line->allocator, line->z);
+        line->z = NULL;
+    }
+}
+
+double roadLineLength(const RoadLine *line) {
+    if (!line->prefix || line->coords.size == 0) return 0.0;
+    return line->prefix[line->coords.size - 1];
+}
+
+double roadLineStart(const RoadLine *line) {
+    if (!line->prefix || line->coords.size == 0) return 0.0;
+    return line->prefix[0];
+}
+
+double reverseChainage(const RoadLine *line, double chainage) {
+    return degreesToKm(roadLineStart(line) + roadLineLength(line)) - chainage;
+}
+
+/* ========== WKT Output ========== */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    const RoadAllocator *allocator;
+} RoadBuffer;
+
+static int bufferInit(RoadBuffer *buf, size_t cap, const RoadAllocator *allocator) {
+    buf->allocator = allocator;
+    buf->data = (char *) roadAlloc(allocator, cap);
+    buf->len = 0;
+    buf->cap = buf->data ? cap : 0;
+    if (buf->data) buf->data[0] = '\0';
+    return buf->data != NULL;
+}
+
+static int bufferAppend(RoadBuffer *buf, const char *s, size_t n) {
+    if (buf->len + n + 1 > buf->cap) {
+        size_t newCap = buf->cap * 2;
+        char *data;
+        while (newCap < buf->len + n + 1) newCap *= 2;
+        data = (char *) roadRealloc(buf->allocator, buf->data, newCap);
+        if (!data) return 0;
+        buf->data = data;
+        buf->cap = newCap;
+    }
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+    buf->data[buf->len] = '\0';
+    return 1;
+}
+
+/* Shortest of %.15g / %.17g that round-trips, like the GEOS WKT writer */
+static int formatOrdinate(char *out, size_t outSize, double v) {
+    int n = snprintf(out, outSize, "%.15g", v);
+    if (strtod(out, NULL) != v) {
+        n = snprintf(out, outSize, "%.17g", v);
+    }
+    return n;
+}
+
+static int appendCoordinate(RoadBuffer *buf, double x, double y) {
+    char num[32];
+    int n;
+
+    n = formatOrdinate(num, sizeof(num), x);
+    if (!bufferAppend(buf, num, (size_t) n) || !bufferAppend(buf, " ", 1)) return 0;
+    n = formatOrdinate(num, sizeof(num), y);
+    return bufferAppend(buf, num, (size_t) n);
+}
+
+char *pointToWKT(double x, double y, const RoadAllocator *allocator) {
+    RoadBuffer buf;
+
+    if (!bufferInit(&buf, 64, allocator)) return NULL;
+    if (!bufferAppend(&buf, "POINT (", 7) || !appendCoordinate(&buf, x, y) || !bufferAppend(&buf, ")", 1)) {
+        roadFree(allocator, buf.data);
+        return NULL;
+    }
+    return buf.data;
+}
+
+char *coordsToWKT(const Coordinate *coords, size_t size, const RoadAllocator *allocator) {
+    RoadBuffer buf;
+
+    if (!coords || size < 2) return NULL;
+    if (!bufferInit(&buf, 16 + size * 40, allocator)) return NULL;
+
+    if (!bufferAppend(&buf, "LINESTRING (", 12)) goto fail;
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0 && !bufferAppend(&buf, ", ", 2)) goto fail;
+        if (!appendCoordinate(&buf, coords[i].x, coords[i].y)) goto fail;
+    }
+    if (!bufferAppend(&buf, ")", 1)) goto fail;
+
+    return buf.data;
+
+fail:
+    roadFree(allocator, buf.data);
+    return NULL;
+}
+
+/* LINESTRING with Z when the line has elevations and M (chainage, km) when withMeasures */
+static char *writeLineWKT(const RoadLine *line, int withMeasures, const RoadAllocator *allocator) {
+    static const char *const tags[4] = {"LINESTRING (", "LINESTRING M (", "LINESTRING Z (", "LINESTRING ZM ("};
+    RoadBuffer buf;
+    char num[32];
+    size_t size;
+    int n;
+
+    if (!line || !line->prefix || line->coords.size < 2) return NULL;
+    size = line->coords.size;
+    if (!bufferInit(&buf, 20 + size * 80, allocator)) return NULL;
+
+    const char *tag = tags[(line->z ? 2 : 0) + (withMeasures ? 1 : 0)];
+    if (!bufferAppend(&buf, tag, strlen(tag))) goto fail;
+    for (size_t i = 0; i < size; i++) {
+        if (i > 0 && !bufferAppend(&buf, ", ", 2)) goto fail;
+        if (!appendCoordinate(&buf, line->coords.data[i].x, line->coords.data[i].y)) goto fail;
+        if (line->z) {
+            n = formatOrdinate(num, sizeof(num), line->z[i]);
+            if (!bufferAppend(&buf, " ", 1) || !bufferAppend(&buf, num, (size_t) n)) goto fail;
+        }
+        if (withMeasures) {
+            n = formatOrdinate(num, sizeof(num), degreesToKm(line->prefix[i]));
+            if (!bufferAppend(&buf, " ", 1) || !bufferAppend(&buf, num, (size_t) n)) goto fail;
+        }
+    }
+    if (!bufferAppend(&buf, ")", 1)) goto fail;
+
+    return buf.data;
+
+fail:
+    roadFree(allocator, buf.data);
+    return NULL;
+}
+
+char *measuredLineToWKT(const RoadLine *line, const RoadAllocator *allocator) {
+    return writeLineWKT(line, 1, allocator);
+}
+
+char *lineToWKT(const RoadLine *line, const RoadAllocator *allocator) {
+    return line ? writeLineWKT(line, line->measured, allocator) : NULL;
+}
+
+/* ========== Core Implementation Functions ========== */
+
+int calibratePoint(const RoadLine *line, Coordinate referencePoint, double radius, PointDto *pointDto) {
+    if (!line || !line->coords.data || !line->prefix || !pointDto) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    size_t numPointsLine = line->coords.size;
+
+    double closestReferenceDistance = MAX_RADIUS;
+    double chainage = MAX_RADIUS;
+    double lat = 0.0, lon = 0.0;
+    int index = -1;
+
+    for (size_t i = 0; i < numPointsLine; i++) {
+        double distanceFromReference = compute_distance(referencePoint.x, referencePoint.y, c[i].x, c[i].y);
+
+        if (distanceFromReference <= radius && distanceFromReference < closestReferenceDistance) {
+            closestReferenceDistance = distanceFromReference;
+            chainage = line->prefix[i];
+            lon = c[i].x;
+            lat = c[i].y;
+            index = (int) i;
+        }
+    }
+
+    if (index < 0) {
+        return 0;
+    }
+
+    pointDto->chainage = degreesToKm(chainage);
+    pointDto->lat = lat;
+    pointDto->lon = lon;
+    pointDto->index = index;
+
+    return 1;
+}
+
+void setAlongRoadSpan(double fromCh, double toCh, AlongRoadDto *dto) {
+    dto->fromCh = fromCh;
+    dto->toCh = toCh;
+    dto->distance = toCh - fromCh;
+    dto->direction = toCh > fromCh ? ROAD_FORWARD : (toCh < fromCh ? ROAD_REVERSE : 0);
+}
+
+int distanceAlongRoad(const RoadLine *line, Coordinate from, Coordinate to, double radius, AlongRoadDto *dto) {
+    PointDto p1, p2;
+
+    if (!dto || !calibratePoint(line, from, radius, &p1) || !calibratePoint(line, to, radius, &p2)) {
+        return 0;
+    }
+
+    setAlongRoadSpan(p1.chainage, p2.chainage, dto);
+    return 1;
+}
+
+/*
+ * First vertex i >= 1 with prefix[i] >= distance, or n if there is none,
+ * so the segment (i - 1, i) holds the distance.
+ */
+static size_t searchPrefix(const double *prefix, size_t n, double distance) {
+    size_t lo = 1, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (prefix[mid] < distance) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int extractSubLineStringByChainages(const RoadLine *line, double start_chainage, double end_chainage,
+                                    SectionDto *sectionDto) {
+    return extractSectionInDirection(line, start_chainage, end_chainage, ROAD_FORWARD, sectionDto);
+}
+
+int extractSectionInDirection(const RoadLine *line, double start_chainage, double end_chainage, int direction,
+                              SectionDto *sectionDto) {
+    if (!sectionDto || !line || !line->coords.data || !line->prefix || start_chainage >= end_chainage) {
+        return 0;
+    }
+
+    double start_km = start_chainage;
+    double end_km = end_chainage;
+    start_chainage = kmToDegrees(start_km);
+    end_chainage = kmToDegrees(end_km);
+    if (direction == ROAD_REVERSE) {
+        /* The same stretch of the forward line, walked as usual and emitted backwards */
+        double mirror = roadLineStart(line) + roadLineLength(line);
+        start_chainage = mirror - kmToDegrees(end_km);
+        end_chainage = mirror - kmToDegrees(start_km);
+    }
+
+    const Coordinate *c = line->coords.data;
+    const double *prefix = line->prefix;
+    size_t numPoints = line->coords.size;
+
+    /* Jump straight to the segment holding the start; the walk below only covers the section */
+    size_t first = searchPrefix(prefix, numPoints, start_chainage);
+    if (first >= numPoints) {
+        return 0;
+    }
+
+    double total_distance = 0.0;
+    double prev_x = c[first - 1].x, prev_y = c[first - 1].y;
+
+    /* At most the interior vertices up to the end segment plus the two cut points */
+    size_t last = searchPrefix(prefix, numPoints, end_chainage);
+    if (last >= numPoints) last = numPoints - 1;
+
+    CoordinateArray coords_arr;
+    if (!initCoordinateArray(&coords_arr, last >= first ? last - first + 2 : 2, line->allocator)) {
+        return 0;
+    }
+
+    int startAdded = 0, endAdded = 0;
+    double startLat = 0.0, startLon = 0.0, endLat = 0.0, endLon = 0.0;
+
+    for (size_t i = first; i < numPoints; i++) {
+        double curr_x = c[i].x;
+        double curr_y = c[i].y;
+
+        /* Chainages come from prefix so measured lines use their own measures */
+        double segment_length = prefix[i] - prefix[i - 1];
+        total_distance = prefix[i];
+
+        if (!startAdded && total_distance >= start_chainage) {
+            double factor = segment_length > 0
+                            ? (start_chainage - prefix[i - 1]) / segment_length : 0.0;
+            if (factor < 0) factor = 0.0;
+            double start_x = prev_x + factor * (curr_x - prev_x);
+            double start_y = prev_y + factor * (curr_y - prev_y);
+            if (!addDistinctCoordinate(&coords_arr, start_x, start_y)) goto fail;
+            startAdded = 1;
+            startLon = start_x;
+            startLat = start_y;
+        }
+
+        if (startAdded && total_distance <= end_chainage) {
+            if (!addDistinctCoordinate(&coords_arr, curr_x, curr_y)) goto fail;
+        }
+
+        if (!endAdded && total_distance >= end_chainage) {
+            double factor = segment_length > 0
+                            ? (end_chainage - prefix[i - 1]) / segment_length : 1.0;
+            double end_x = prev_x + factor * (curr_x - prev_x);
+            double end_y = prev_y + factor * (curr_y - prev_y);
+            if (!addDistinctCoordinate(&coords_arr, end_x, end_y)) goto fail;
+            endAdded = 1;
+            endLat = end_y;
+            endLon = end_x;
+            break;
+        }
+
+        prev_x = curr_x;
+        prev_y = curr_y;
+    }
+
+    /* Section runs past the end of the line: it ends on the last vertex */
+    if (startAdded && !endAdded) {
+        endLon = c[numPoints - 1].x;
+        endLat = c[numPoints - 1].y;
+    }
+
+    if (coords_arr.size < 2) {
+        goto fail;
+    }
+
+    if (direction == ROAD_REVERSE) {
+        double t;
+        reverseCoordinateArray(&coords_arr);
+        t = startLat; startLat = endLat; endLat = t;
+        t = startLon; startLon = endLon; endLon = t;
+    }
+
+    sectionDto->geometry = coordsToWKT(coords_arr.data, coords_arr.size, line->allocator);
+    freeCoordinateArray(&coords_arr);
+
+    if (!sectionDto->geometry) {
+        return 0;
+    }
+
+    sectionDto->startCh = start_km;
+    sectionDto->endCh = end_km;
+    sectionDto->startLat = startLat;
+    sectionDto->startLon = startLon;
+    sectionDto->endLat = endLat;
+    sectionDto->endLon = endLon;
+    sectionDto->length = end_km - start_km;
+
+    return 1;
+
+fail:
+    freeCoordinateArray(&coords_arr);
+    return 0;
+}
+
+int locateDistance(const RoadLine *line, double distance, size_t *segment, double *factor) {
+    if (!line || !line->prefix || line->coords.size < 2) {
+        return 0;
+    }
+
+    size_t n = line->coords.size;
+    const double *prefix = line->prefix;
+
+    if (distance < prefix[0] || distance > prefix[n - 1]) {
+        return 0;
+    }
+
+    size_t lo = searchPrefix(prefix, n, distance);
+
+    double segment_length = prefix[lo] - prefix[lo - 1];
+    *segment = lo;
+    *factor = segment_length > 0 ? (distance - prefix[lo - 1]) / segment_length : 0.0;
+
+    return 1;
+}
+
+int interpolatePoint(const RoadLine *line, double distance, Coordinate *point) {
+    size_t seg;
+    double factor;
+
+    if (!point || !locateDistance(line, distance, &seg, &factor)) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    point->x = c[seg - 1].x + factor * (c[seg].x - c[seg - 1].x);
+    point->y = c[seg - 1].y + factor * (c[seg].y - c[seg - 1].y);
+
+    return 1;
+}
+
+int collectSectionCoordinates(const RoadLine *line, double start_distance, double end_distance,
+                              CoordinateArray *out) {
+    size_t startSeg, endSeg;
+    double startFactor, endFactor;
+    Coordinate startPt, endPt;
+
+    if (!line || !out || start_distance >= end_distance) {
+        return 0;
+    }
+
+    double length = roadLineLength(line);
+    if (start_distance < roadLineStart(line)) start_distance = roadLineStart(line);
+    if (end_distance > length) end_distance = length;
+    if (start_distance >= end_distance) {
+        return 0;
+    }
+
+    if (!locateDistance(line, start_distance, &startSeg, &startFactor) ||
+        !locateDistance(line, end_distance, &endSeg, &endFactor)) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    startPt.x = c[startSeg - 1].x + startFactor * (c[startSeg].x - c[startSeg - 1].x);
+    startPt.y = c[startSeg - 1].y + startFactor * (c[startSeg].y - c[startSeg - 1].y);
+    endPt.x = c[endSeg - 1].x + endFactor * (c[endSeg].x - c[endSeg - 1].x);
+    endPt.y = c[endSeg - 1].y + endFactor * (c[endSeg].y - c[endSeg - 1].y);
+
+    if (!addDistinctCoordinate(out, startPt.x, startPt.y)) return 0;
+    for (size_t v = startSeg; v < endSeg; v++) {
+        if (!addDistinctCoordinate(out, c[v].x, c[v].y)) return 0;
+    }
+    if (!addDistinctCoordinate(out, endPt.x, endPt.y)) return 0;
+
+    return 1;
+}
+
+int kilometerPosts(const RoadLine *line, double startKm, double intervalKm, PointDto **posts, size_t *numPosts) {
+    if (!posts || !numPosts) {
+        return 0;
+    }
+    *posts = NULL;
+    *numPosts = 0;
+    if (!line || !line->prefix || line->coords.size < 2 || !(intervalKm > 0)) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    const double *prefix = line->prefix;
+    size_t n = line->coords.size;
+    double firstKm = degreesToKm(prefix[0]);
+    double lastKm = degreesToKm(prefix[n - 1]);
+
+    double first = startKm < firstKm ? ceil((firstKm - startKm) / intervalKm) : 0.0;
+    double last = floor((lastKm - startKm) / intervalKm);
+    if (last < first) {
+        return 1;
+    }
+
+    PointDto *out = (PointDto *) roadAlloc(line->allocator, (size_t) (last - first + 2) * sizeof(PointDto));
+    if (!out) {
+        return 0;
+    }
+
+    size_t count = 0, v = 1;
+    for (double i = first; i <= last + 1; i++) {
+        double chainage = startKm + i * intervalKm;
+        if (chainage < firstKm) continue;
+        if (chainage > lastKm) break;
+
+        /* Rounding between km and degrees must not step off either end */
+        double d = kmToDegrees(chainage);
+        if (d < prefix[0]) d = prefix[0];
+        if (d > prefix[n - 1]) d = prefix[n - 1];
+
+        while (v < n - 1 && prefix[v] < d) v++;
+        double segment_length = prefix[v] - prefix[v - 1];
+        double factor = segment_length > 0 ? (d - prefix[v - 1]) / segment_length : 0.0;
+
+        out[count].lon = c[v - 1].x + factor * (c[v].x - c[v - 1].x);
+        out[count].lat = c[v - 1].y + factor * (c[v].y - c[v - 1].y);
+        out[count].chainage = chainage;
+        out[count].index = (int) (v - 1);
+        count++;
+    }
+
+    if (count == 0) {
+        roadFree(line->allocator, out);
+        out = NULL;
+    }
+    *posts = out;
+    *numPosts = count;
+    return 1;
+}
+
+int splitLineAtChainages(const RoadLine *line, const double *chainages, size_t numChainages,
+                         CoordinateArray *pieces) {
+    size_t piece = 0, v = 1;
+
+    if (!line || !line->prefix || line->coords.size < 2 || !pieces || (numChainages > 0 && !chainages)) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    const double *prefix = line->prefix;
+    size_t n = line->coords.size;
+
+    for (size_t j = 0; j < numChainages; j++) {
+        double cut = kmToDegrees(chainages[j]);
+        if (!(cut > prefix[0] && cut < prefix[n - 1]) || (j > 0 && !(chainages[j] > chainages[j - 1]))) {
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i <= numChainages; i++) {
+        if (!initCoordinateArray(&pieces[i], 16, line->allocator)) {
+            while (i > 0) freeCoordinateArray(&pieces[--i]);
+            return 0;
+        }
+    }
+
+    if (!addCoordinate(&pieces[0], c[0].x, c[0].y)) goto fail;
+
+    for (size_t j = 0; j < numChainages; j++) {
+        double cut = kmToDegrees(chainages[j]);
+
+        /* Vertices before the cut belong to the current piece */
+        while (prefix[v] < cut) {
+            if (!addDistinctCoordinate(&pieces[piece], c[v].x, c[v].y)) goto fail;
+            v++;
+        }
+
+        /* A cut on a vertex reuses the vertex itself rather than a rounded copy */
+        double segment_length = prefix[v] - prefix[v - 1];
+        double factor = segment_length > 0 ? (cut - prefix[v - 1]) / segment_length : 0.0;
+        double x = prefix[v] == cut ? c[v].x : c[v - 1].x + factor * (c[v].x - c[v - 1].x);
+        double y = prefix[v] == cut ? c[v].y : c[v - 1].y + factor * (c[v].y - c[v - 1].y);
+
+        if (!addDistinctCoordinate(&pieces[piece], x, y)) goto fail;
+        piece++;
+        if (!addCoordinate(&pieces[piece], x, y)) goto fail;
+    }
+
+    for (; v < n; v++) {
+        if (!addDistinctCoordinate(&pieces[piece], c[v].x, c[v].y)) goto fail;
+    }
+
+    return 1;
+
+fail:
+    for (size_t i = 0; i <= numChainages; i++) freeCoordinateArray(&pieces[i]);
+    return 0;
+}
+
+int diffLines(const RoadLine *oldLine, const RoadLine *newLine, LineEditDto *edit) {
+    if (!oldLine || !newLine || !edit || !oldLine->prefix || !newLine->prefix ||
+        oldLine->coords.size < 2 || newLine->coords.size < 2) {
+        return 0;
+    }
+
+    const Coordinate *a = oldLine->coords.data;
+    const Coordinate *b = newLine->coords.data;
+    size_t na = oldLine->coords.size;
+    size_t nb = newLine->coords.size;
+    size_t shorter = na < nb ? na : nb;
+    size_t head = 0, tail = 0;
+
+    while (head < shorter && a[head].x == b[head].x && a[head].y == b[head].y) head++;
+    while (tail < shorter - head &&
+           a[na - 1 - tail].x == b[nb - 1 - tail].x && a[na - 1 - tail].y == b[nb - 1 - tail].y) {
+        tail++;
+    }
+
+    edit->oldStart = edit->newStart = head;
+    edit->oldEnd = na - tail;
+    edit->newEnd = nb - tail;
+    edit->changed = edit->oldEnd > head || edit->newEnd > head;
+
+    /* The edit is bounded by the last untouched vertex before it and the first one after it */
+    edit->startCh = degreesToKm(head > 0 ? oldLine->prefix[head - 1] : roadLineStart(oldLine));
+    edit->oldEndCh = degreesToKm(tail > 0 ? oldLine->prefix[na - tail] : roadLineLength(oldLine));
+    edit->newEndCh = degreesToKm(tail > 0 ? newLine->prefix[nb - tail] : roadLineLength(newLine));
+    edit->delta = edit->newEndCh - edit->oldEndCh;
+
+    return 1;
+}
+
+/* ========== Chainage Equations ========== */
+
+int checkChainageEquations(const ChainageEquations *eq) {
+    for (size_t i = 0; i < eq->count; i++) {
+        if (!isfinite(eq->measured[i]) || !isfinite(eq->posted[i])) return 0;
+        if (i > 0 && (eq->measured[i] <= eq->measured[i - 1] || eq->posted[i] <= eq->posted[i - 1])) return 0;
+    }
+    return 1;
+}
+
+/* Number of leading entries of the ascending column keys that are <= value */
+static size_t countNotAbove(const double *keys, size_t n, double value) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys[mid] <= value) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+double measuredToPosted(const ChainageEquations *eq, double measured) {
+    size_t k = countNotAbove(eq->measured, eq->count, measured);
+    if (k == 0) return measured;
+    return eq->posted[k - 1] + (measured - eq->measured[k - 1]);
+}
+
+int postedToMeasured(const ChainageEquations *eq, double posted, double *measured) {
+    size_t k = countNotAbove(eq->posted, eq->count, posted);
+    double m = k == 0 ? posted : eq->measured[k - 1] + (posted - eq->posted[k - 1]);
+
+    /* Past the stretch's back station: the posted value was skipped by the next break */
+    if (k < eq->count && m > eq->measured[k]) return 0;
+    *measured = m;
+    return 1;
+}
+
+/* ========== Offsets ========== */
+
+/* Longest miter, as a multiple of the offset, before sharp bends are clipped */
+#define OFFSET_MITER_LIMIT 4.0
+
+/* Unit direction of segment (seg - 1, seg), skipping zero-length segments */
+static int segmentDirection(const CoordinateArray *coords, size_t seg, double *ux, double *uy) {
+    const Coordinate *c = coords->data;
+
+    for (size_t s = seg; s < coords->size; s++) {
+        double len = compute_distance(c[s - 1].x, c[s - 1].y, c[s].x, c[s].y);
+        if (len > 0) {
+            *ux = (c[s].x - c[s - 1].x) / len;
+            *uy = (c[s].y - c[s - 1].y) / len;
+            return 1;
+        }
+    }
+    for (size_t s = seg; s >= 1; s--) {
+        double len = compute_distance(c[s - 1].x, c[s - 1].y, c[s].x, c[s].y);
+        if (len > 0) {
+            *ux = (c[s].x - c[s - 1].x) / len;
+            *uy = (c[s].y - c[s - 1].y) / len;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pointAtChainageOffset(const RoadLine *line, double chainage, double offset_m,
+                          Coordinate *point, double *bearing) {
+    size_t seg;
+    double factor, ux, uy;
+
+    if (!point || !locateDistance(line, kmToDegrees(chainage), &seg, &factor) ||
+        !segmentDirection(&line->coords, seg, &ux, &uy)) {
+        return 0;
+    }
+
+    const Coordinate *c = line->coords.data;
+    double offset = offset_m / METERS_PER_DEGREE;
+
+    /* Left normal of the travel direction is (-uy, ux) */
+    point->x = c[seg - 1].x + factor * (c[seg].x - c[seg - 1].x) - uy * offset;
+    point->y = c[seg - 1].y + factor * (c[seg].y - c[seg - 1].y) + ux * offset;
+
+    if (bearing) {
+        double deg = atan2(ux, uy) * 180.0 / M_PI;
+        *bearing = deg < 0 ? deg + 360.0 : deg;
+    }
+
+    return 1;
+}
+
+int offsetCoordinates(const CoordinateArray *in, double offset_m, CoordinateArray *out) {
+    double offset = offset_m / METERS_PER_DEGREE;
+    const Coordinate *c = in->data;
+    size_t n = in->size;
+
+    if (n < 2) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        double ax, ay, bx, by, nx, ny, scale;
+        int hasBefore = i > 0 && segmentDirection(in, i, &ax, &ay);
+        int hasAfter = i + 1 < n && segmentDirection(in, i + 1, &bx, &by);
+
+        if (!hasBefore && !hasAfter) {
+            return 0;
+        }
+        if (!hasBefore) {
+            ax = bx;
+            ay = by;
+        }
+        if (!hasAfter) {
+            bx = ax;
+            by = ay;
+        }
+
+        /* Miter: bisector of the two left normals, lengthened to keep the offset distance */
+        nx = -ay - by;
+        ny = ax + bx;
+        double len = sqrt(nx * nx + ny * ny);
+        if (len < 1e-12) {
+            nx = -ay;
+            ny = ax;
+            scale = offset;
+        } else {
+            nx /= len;
+            ny /= len;
+            double cosHalf = nx * -ay + ny * ax;
+            scale = offset / cosHalf;
+            if (fabs(scale) > OFFSET_MITER_LIMIT * fabs(offset)) {
+                scale = scale > 0 ? OFFSET_MITER_LIMIT * fabs(offset) : -OFFSET_MITER_LIMIT * fabs(offset);
+            }
+        }
+
+        if (!addCoordinate(out, c[i].x + nx * scale, c[i].y + ny * scale)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int offsetSection(const RoadLine *line, double start_chainage, double end_chainage, double offset_m,
+                  CoordinateArray *out) {
+    CoordinateArray section;
+    int ok;
+
+    if (!line || !out || !initCoordinateArray(&section, 16, line->allocator)) {
+        return 0;
+    }
+
+    ok = collectSectionCoordinates(line, kmToDegrees(start_chainage), kmToDegrees(end_chainage), &section) &&
+         section.size >= 2 &&
+         initCoordinateArray(out, section.size, line->allocator);
+
+    if (ok && !offsetCoordinates(&section, offset_m, out)) {
+        freeCoordinateArray(out);
+        ok = 0;
+    }
+
+    freeCoordinateArray(&section);
+    return ok;
+}
+
+/* ========== Road Profile ========== */
+
+int initProfileCursor(RoadProfileCursor *cursor, const RoadLine *line, double interval_m) {
+    if (!cursor || !line || !line->prefix || line->coords.size < 2 || !(interval_m > 0) || !isfinite(interval_m)) {
+        return 0;
+    }
+
+    cursor->line = line;
+    cursor->interval = interval_m / METERS_PER_DEGREE;
+    cursor->index = 0;
+    cursor->segment = 1;
+    return 1;
+}
+
+/* Move seg forward to the first segment ending at or after distance */
+static void advanceSegment(const RoadLine *line, size_t *seg, double distance) {
+    size_t last = line->coords.size - 1;
+    while (*seg < last && line->prefix[*seg] < distance) (*seg)++;
+}
+
+/* Point and elevation at distance on segment (seg - 1, seg) */
+static void pointOnSegment(const RoadLine *line, size_t seg, double distance, Coordinate *point, double *z) {
+    const Coordinate *c = line->coords.data;
+    double len = line->prefix[seg] - line->prefix[seg - 1];
+    double f = len > 0 ? (distance - line->prefix[seg - 1]) / len : 0.0;
+
+    if (f < 0) f = 0.0;
+    else if (f > 1) f = 1.0;
+    point->x = c[seg - 1].x + f * (c[seg].x - c[seg - 1].x);
+    point->y = c[seg - 1].y + f * (c[seg].y - c[seg - 1].y);
+    *z = line->z ? line->z[seg - 1] + f * (line->z[seg] - line->z[seg - 1]) : NAN;
+}
+
+int nextProfileSample(RoadProfileCursor *cursor, ProfileSampleDto *sample) {
+    const RoadLine *line = cursor->line;
+    const Coordinate *c = line->coords.data;
+    const double *prefix = line->prefix;
+    size_t last = line->coords.size - 1;
+
+    /* Computed from the index rather than accumulated, so long roads do not drift */
+    double s = prefix[0] + (double) cursor->index * cursor->interval;
+    double e = s + cursor->interval;
+    if (s >= prefix[last]) {
+        return 0;
+    }
+    if (e > prefix[last]) e = prefix[last];
+
+    size_t seg = cursor->segment;
+    double zs, ze;
+    advanceSegment(line, &seg, s);
+    pointOnSegment(line, seg, s, &sample->point, &zs);
+
+    /*
+     * One walk over the vertices of [s, e): horizontal length from the part
+     * of each segment inside the interval, turning from every vertex in it.
+     */
+    double horizontal = 0.0, turning = 0.0;
+    size_t j = seg;
+    for (;;) {
+        double from = prefix[j - 1] > s ? prefix[j - 1] : s;
+        double to = prefix[j] < e ? prefix[j] : e;
+        double len = prefix[j] - prefix[j - 1];
+        if (len > 0 && to > from) {
+            horizontal += (to - from) / len * compute_distance(c[j - 1].x, c[j - 1].y, c[j].x, c[j].y);
+        }
+
+        if (j == last || prefix[j] >= e) break;
+
+        double ax, ay, bx, by;
+        if (segmentDirection(&line->coords, j, &ax, &ay) && segmentDirection(&line->coords, j + 1, &bx, &by)) {
+            turning += atan2(ax * by - ay * bx, ax * bx + ay * by);
+        }
+        j++;
+    }
+
+    Coordinate end;
+    pointOnSegment(line, j, e, &end, &ze);
+    cursor->segment = j;
+    cursor->index++;
+
+    double dx = end.x - sample->point.x;
+    double dy = end.y - sample->point.y;
+    double ux, uy;
+    if (dx == 0 && dy == 0 && segmentDirection(&line->coords, seg, &ux, &uy)) {
+        dx = ux;
+        dy = uy;
+    }
+    double deg = atan2(dx, dy) * 180.0 / M_PI;
+    double meters = horizontal * METERS_PER_DEGREE;
+
+    sample->startCh = degreesToKm(s);
+    sample->endCh = degreesToKm(e);
+    sample->elevation = zs;
+    sample->bearing = deg < 0 ? deg + 360.0 : deg;
+    sample->grade = line->z && meters > 0 ? (ze - zs) / meters * 100.0 : NAN;
+    sample->curvature = meters > 0 ? turning / meters : NAN;
+    return 1;
+}
+
+/* ========== Simplification ========== */
+
+/* Distance from p to the segment a-b */
+static double segmentDistance(Coordinate p, Coordinate a, Coordinate b) {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0.0;
+
+    if (t < 0) t = 0;
+    else if (t > 1) t = 1;
+    return compute_distance(p.x, p.y, a.x + t * dx, a.y + t * dy);
+}
+
+int simplifyLine(const RoadLine *line, double tolerance, RoadLine *out) {
+    const Coordinate *c;
+    size_t n, kept = 0;
+    unsigned char *keep = NULL;
+    size_t *stack = NULL;
+    size_t top = 0;
+
+    if (!line || !out || !line->prefix || line->coords.size < 2 || !(tolerance >= 0)) {
+        return 0;
+    }
+
+    c = line->coords.data;
+    n = line->coords.size;
+
+    memset(out, 0, sizeof(RoadLine));
+    out->allocator = line->allocator;
+    out->measured = 1;
+
+    keep = (unsigned char *) roadAlloc(line->allocator, n);
+    /* Each pending range is pushed as a (first, last) pair; at most n - 1 are pending */
+    stack = (size_t *) roadAlloc(line->allocator, 2 * n * sizeof(size_t));
+    if (!keep || !stack) goto fail;
+
+    memset(keep, 0, n);
+    keep[0] = keep[n - 1] = 1;
+    stack[top++] = 0;
+    stack[top++] = n - 1;
+
+    /* Iterative Douglas-Peucker so million-vertex lines cannot overflow the C stack */
+    while (top > 0) {
+        size_t last = stack[--top];
+        size_t first = stack[--top];
+        size_t farthest = 0;
+        double maxDistance = -1.0;
+
+        for (size_t i = first + 1; i < last; i++) {
+            double d = segmentDistance(c[i], c[first], c[last]);
+            if (d > maxDistance) {
+                maxDistance = d;
+                farthest = i;
+            }
+        }
+
+        if (maxDistance > tolerance) {
+            keep[farthest] = 1;
+            stack[top++] = first;
+            stack[top++] = farthest;
+            stack[top++] = farthest;
+            stack[top++] = last;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) kept += keep[i];
+
+    if (!initCoordinateArray(&out->coords, kept, line->allocator)) goto fail;
+    out->prefix = (double *) roadAlloc(line->allocator, kept * sizeof(double));
+    if (!out->prefix) goto fail;
+    if (line->z) {
+        out->z = (double *) roadAlloc(line->allocator, kept * sizeof(double));
+        if (!out->z) goto fail;
+    }
+
+    /* Retained vertices keep the chainage (and elevation) they had on the original line */
+    for (size_t i = 0; i < n; i++) {
+        if (!keep[i]) continue;
+        out->prefix[out->coords.size] = line->prefix[i];
+        if (out->z) out->z[out->coords.size] = line->z[i];
+        if (!addCoordinate(&out->coords, c[i].x, c[i].y)) goto fail;
+    }
+
+    roadFree(line->allocator, keep);
+    roadFree(line->allocator, stack);
+    return 1;
+
+fail:
+    roadFree(line->allocator, keep);
+    roadFree(line->allocator, stack);
+    freeRoadLine(out);
+    return 0;
+}
+
+/* ========== Spatial Index ========== */
+
+#define ROAD_GRID_EMPTY ((size_t) -1)
+
+static inline size_t gridBucket(const RoadGridIndex *index, int64_t cx, int64_t cy) {
+    uint64_t h = (uint64_t) cx * UINT64_C(0x9E3779B97F4A7C15) ^ (uint64_t) cy * UINT64_C(0xC2B2AE3D27D4EB4F);
+    return (size_t) (h ^ (h >> 32)) & index->mask;
+}
+
+/* Cells beyond this cannot hold an indexed vertex; larger indices are clamped to it */
+#define ROAD_GRID_CELL_LIMIT (ROAD_GRID_MAX_COORD / ROAD_GRID_MIN_CELL + 1)
+
+/* Cell of v; NaN and far-out values are clamped, so the cast is always defined */
+static inline int64_t gridCell(double v, double cellSize) {
+    double cell = floor(v / cellSize);
+    if (!(cell >= -ROAD_GRID_CELL_LIMIT)) return (int64_t) -ROAD_GRID_CELL_LIMIT;
+    if (cell > ROAD_GRID_CELL_LIMIT) return (int64_t) ROAD_GRID_CELL_LIMIT;
+    return (int64_t) cell;
+}
+
+static inline double gridCellSize(double requested) {
+    return requested > ROAD_GRID_MIN_CELL ? requested : ROAD_GRID_MIN_CELL;
+}
+
+static inline int coordinateInGridRange(Coordinate c) {
+    return fabs(c.x) <= ROAD_GRID_MAX_COORD && fabs(c.y) <= ROAD_GRID_MAX_COORD;
+}
+
+int lineInGridRange(const RoadLine *line) {
+    for (size_t v = 0; v < line->coords.size; v++) {
+        if (!coordinateInGridRange(line->coords.data[v])) return 0;
+    }
+    return 1;
+}
+
+int buildGridIndex(RoadGridIndex *index, const RoadLine *lines, size_t numLines, double cellSize,
+                   const RoadAllocator *allocator) {
+    size_t total = 0, numBuckets = 16;
+
+    memset(index, 0, sizeof(RoadGridIndex));
+    index->lines = lines;
+    index->allocator = allocator;
+    /* Radius 0 still needs a usable cell size; only exact hits can match then */
+    index->cellSize = gridCellSize(cellSize);
+
+    for (size_t l = 0; l < numLines; l++) {
+        if (!lineInGridRange(&lines[l])) return 0;
+        total += lines[l].coords.size;
+    }
+    while (numBuckets < total) numBuckets <<= 1;
+
+    index->mask = numBuckets - 1;
+    index->buckets = (size_t *) roadAlloc(allocator, numBuckets * sizeof(size_t));
+    index->entries = (RoadGridEntry *) roadAlloc(allocator, (total > 0 ? total : 1) * sizeof(RoadGridEntry));
+    if (!index->buckets || !index->entries) {
+        freeGridIndex(index);
+        return 0;
+    }
+
+    for (size_t b = 0; b < numBuckets; b++) index->buckets[b] = ROAD_GRID_EMPTY;
+
+    for (size_t l = 0; l < numLines; l++) {
+        const Coordinate *c = lines[l].coords.data;
+        for (size_t v = 0; v < lines[l].coords.size; v++) {
+            RoadGridEntry *e = &index->entries[index->numEntries];
+            e->cx = gridCell(c[v].x, index->cellSize);
+            e->cy = gridCell(c[v].y, index->cellSize);
+            e->line = l;
+            e->vertex = v;
+
+            size_t b = gridBucket(index, e->cx, e->cy);
+            e->next = index->buckets[b];
+            index->buckets[b] = index->numEntries++;
+        }
+    }
+
+    return 1;
+}
+
+void freeGridIndex(RoadGridIndex *index) {
+    roadFree(index->allocator, index->buckets);
+    roadFree(index->allocator, index->entries);
+    index->buckets = NULL;
+    index->entries = NULL;
+    index->numEntries = 0;
+}
+
+static int recordMatch(RoadMatchArray *matches, size_t line, size_t vertex, double distance) {
+    for (size_t i = 0; i < matches->size; i++) {
+        RoadMatch *m = &matches->data[i];
+        if (m->line == line) {
+            if (distance < m->distance || (distance == m->distance && vertex < m->vertex)) {
+                m->vertex = vertex;
+                m->distance = distance;
+            }
+            return 1;
+        }
+    }
+
+    if (matches->size >= matches->capacity) {
+        size_t newCap = matches->capacity ? matches->capacity * 2 : 8;
+        RoadMatch *data = matches->data
+                          ? (RoadMatch *) roadRealloc(matches->allocator, matches->data, newCap * sizeof(RoadMatch))
+                          : (RoadMatch *) roadAlloc(matches->allocator, newCap * sizeof(RoadMatch));
+        if (!data) return 0;
+        matches->data = data;
+        matches->capacity = newCap;
+    }
+
+    matches->data[matches->size].line = line;
+    matches->data[matches->size].vertex = vertex;
+    matches->data[matches->size].distance = distance;
+    matches->size++;
+    return 1;
+}
+
+int queryGridIndex(const RoadGridIndex *index, Coordinate point, double radius, RoadMatchArray *matches) {
+    if (!index || !index->buckets || !matches || !(radius >= 0) || isinf(radius)) {
+        return 0;
+    }
+
+    if (!matches->allocator) matches->allocator = index->allocator;
+    matches->size = 0;
+    if (!isfinite(point.x) || !isfinite(point.y)) {
+        return 1;
+    }
+
+    int64_t x0 = gridCell(point.x - radius, index->cellSize);
+    int64_t x1 = gridCell(point.x + radius, index->cellSize);
+    int64_t y0 = gridCell(point.y - radius, index->cellSize);
+    int64_t y1 = gridCell(point.y + radius, index->cellSize);
+
+    for (int64_t cx = x0; cx <= x1; cx++) {
+        for (int64_t cy = y0; cy <= y1; cy++) {
+            for (size_t e = index->buckets[gridBucket(index, cx, cy)]; e != ROAD_GRID_EMPTY;
+                 e = index->entries[e].next) {
+                const RoadGridEntry *entry = &index->entries[e];
+                if (entry->cx != cx || entry->cy != cy) continue;
+
+                const Coordinate *v = &index->lines[entry->line].coords.data[entry->vertex];
+                double d = compute_distance(point.x, point.y, v->x, v->y);
+                if (d <= radius && !recordMatch(matches, entry->line, entry->vertex, d)) return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+void freeRoadMatchArray(RoadMatchArray *matches) {
+    if (matches->allocator) roadFree(matches->allocator, matches->data);
+    matches->data = NULL;
+    matches->size = matches->capacity = 0;
+}
+
+/* ========== Road Topology ========== */
+
+static inline size_t topoSlot(const RoadTopology *topo, int64_t cx, int64_t cy) {
+    uint64_t h = (uint64_t) cx * UINT64_C(0x9E3779B97F4A7C15) ^ (uint64_t) cy * UINT64_C(0xC2B2AE3D27D4EB4F);
+    return (size_t) (h ^ (h >> 32)) & topo->mask;
+}
+
+/* Slots for at most half full with numNodes nodes */
+static int resizeTopoSlots(RoadTopology *topo, size_t numNodes) {
+    size_t numSlots = 16;
+    while (numSlots < numNodes * 2) numSlots <<= 1;
+
+    size_t *slots = (size_t *) roadAlloc(topo->allocator, numSlots * sizeof(size_t));
+    if (!slots) return 0;
+    memset(slots, 0, numSlots * sizeof(size_t));
+
+    roadFree(topo->allocator, topo->slots);
+    topo->slots = slots;
+    topo->mask = numSlots - 1;
+
+    for (size_t n = 0; n < topo->numNodes; n++) {
+        size_t s = topoSlot(topo, topo->nodes[n].cx, topo->nodes[n].cy);
+        while (topo->slots[s]) s = (s + 1) & topo->mask;
+        topo->slots[s] = n + 1;
+    }
+    return 1;
+}
+
+int initTopology(RoadTopology *topo, size_t expectedLines, double tolerance, const RoadAllocator *allocator) {
+    memset(topo, 0, sizeof(RoadTopology));
+    if (!(tolerance >= 0) || isinf(tolerance)) return 0;
+
+    topo->allocator = allocator;
+    topo->tolerance = tolerance;
+    /* Tolerance 0 still needs a usable cell size; only equal ends share a node then */
+    topo->cellSize = gridCellSize(tolerance);
+
+    /* A connected network has about as many nodes as lines */
+    topo->capNodes = expectedLines + 16;
+    topo->capEdges = expectedLines + 16;
+    topo->nodes = (RoadTopoNode *) roadAlloc(allocator, topo->capNodes * sizeof(RoadTopoNode));
+    topo->edges = (RoadTopoEdge *) roadAlloc(allocator, topo->capEdges * sizeof(RoadTopoEdge));
+    if (!topo->nodes || !topo->edges || !resizeTopoSlots(topo, topo->capNodes)) {
+        freeTopology(topo);
+        return 0;
+    }
+    return 1;
+}
+
+void freeTopology(RoadTopology *topo) {
+    roadFree(topo->allocator, topo->nodes);
+    roadFree(topo->allocator, topo->edges);
+    roadFree(topo->allocator, topo->slots);
+    topo->nodes = NULL;
+    topo->edges = NULL;
+    topo->slots = NULL;
+    topo->numNodes = topo->numEdges = 0;
+    topo->capNodes = topo->capEdges = 0;
+}
+
+int findTopologyNode(const RoadTopology *topo, Coordinate p, size_t *node) {
+    if (!coordinateInGridRange(p)) return 0;
+
+    int64_t x0 = gridCell(p.x - topo->tolerance, topo->cellSize);
+    int64_t x1 = gridCell(p.x + topo->tolerance, topo->cellSize);
+    int64_t y0 = gridCell(p.y - topo->tolerance, topo->cellSize);
+    int64_t y1 = gridCell(p.y + topo->tolerance, topo->cellSize);
+    double best = topo->tolerance;
+    int found = 0;
+
+    if (!topo->slots) return 0;
+
+    for (int64_t cx = x0; cx <= x1; cx++) {
+        for (int64_t cy = y0; cy <= y1; cy++) {
+            for (size_t s = topoSlot(topo, cx, cy); topo->slots[s]; s = (s + 1) & topo->mask) {
+                size_t n = topo->slots[s] - 1;
+                const RoadTopoNode *candidate = &topo->nodes[n];
+                if (candidate->cx != cx || candidate->cy != cy) continue;
+
+                double d = compute_distance(p.x, p.y, candidate->x, candidate->y);
+                if (d < best || (d == best && (!found || n < *node))) {
+                    best = d;
+                    *node = n;
+                    found = 1;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+/* Node for a line end: the nearest within tolerance, or a new one */
+static int snapTopologyNode(RoadTopology *topo, Coordinate p, size_t *node) {
+    if (findTopologyNode(topo, p, node)) {
+        topo->nodes[*node].degree++;
+        return 1;
+    }
+
+    if (topo->numNodes == topo->capNodes) {
+        size_t newCap = topo->capNodes * 2;
+        RoadTopoNode *nodes = (RoadTopoNode *) roadRealloc(topo->allocator, topo->nodes,
+                                                           newCap * sizeof(RoadTopoNode));
+        if (!nodes) return 0;
+        topo->nodes = nodes;
+        topo->capNodes = newCap;
+    }
+    if ((topo->numNodes + 1) * 2 > topo->mask + 1 && !resizeTopoSlots(topo, topo->numNodes + 1)) {
+        return 0;
+    }
+
+    RoadTopoNode *n = &topo->nodes[topo->numNodes];
+    n->x = p.x;
+    n->y = p.y;
+    n->cx = gridCell(p.x, topo->cellSize);
+    n->cy = gridCell(p.y, topo->cellSize);
+    n->degree = 1;
+    n->component = 0;
+
+    size_t s = topoSlot(topo, n->cx, n->cy);
+    while (topo->slots[s]) s = (s + 1) & topo->mask;
+    topo->slots[s] = topo->numNodes + 1;
+
+    *node = topo->numNodes++;
+    return 1;
+}
+
+int addTopologyLine(RoadTopology *topo, size_t id, const RoadLine *line) {
+    if (!topo->nodes || !line || !line->prefix || line->coords.size < 2 || !lineInGridRange(line)) {
+        return 0;
+    }
+
+    if (topo->numEdges == topo->capEdges) {
+        size_t newCap = topo->capEdges * 2;
+        RoadTopoEdge *edges = (RoadTopoEdge *) roadRealloc(topo->allocator, topo->edges,
+                                                           newCap * sizeof(RoadTopoEdge));
+        if (!edges) return 0;
+        topo->edges = edges;
+        topo->capEdges = newCap;
+    }
+
+    RoadTopoEdge *e = &topo->edges[topo->numEdges];
+    const Coordinate *c = line->coords.data;
+    size_t last = line->coords.size - 1;
+
+    if (!snapTopologyNode(topo, c[0], &e->startNode) || !snapTopologyNode(topo, c[last], &e->endNode)) {
+        return 0;
+    }
+    e->line = id;
+    e->length = degreesToKm(line->prefix[last]);
+    topo->numEdges++;
+    return 1;
+}
+
+static size_t findRoot(size_t *parent, size_t n) {
+    while (parent[n] != n) {
+        parent[n] = parent[parent[n]];
+        n = parent[n];
+    }
+    return n;
+}
+
+int labelTopologyComponents(RoadTopology *topo) {
+    size_t *parent = (size_t *) roadAlloc(topo->allocator, (topo->numNodes + 1) * sizeof(size_t));
+    if (!parent) return 0;
+
+    for (size_t n = 0; n < topo->numNodes; n++) parent[n] = n;
+    for (size_t e = 0; e < topo->numEdges; e++) {
+        size_t a = findRoot(parent, topo->edges[e].startNode);
+        size_t b = findRoot(parent, topo->edges[e].endNode);
+        /* The lower node becomes the root, so components number in node order */
+        if (a < b) parent[b] = a;
+        else if (b < a) parent[a] = b;
+    }
+
+    topo->numComponents = 0;
+    for (size_t n = 0; n < topo->numNodes; n++) {
+        size_t root = findRoot(parent, n);
+        topo->nodes[n].component = root == n ? topo->numComponents++ : topo->nodes[root].component;
+    }
+
+    roadFree(topo->allocator, parent);
+    return 1;
+}
+
+/* ========== Network Routing ========== */
+
+#define ROAD_SEED_START ((size_t) -1)   /* pred of a node entered from the start of the position's edge */
+#define ROAD_SEED_END   ((size_t) -2)
+
+typedef struct {
+    double key;
+    size_t node;
+} RoadHeapEntry;
+
+typedef struct {
+    RoadHeapEntry *data;
+    size_t size;
+} RoadHeap;
+
+static void heapPush(RoadHeap *heap, double key, size_t node) {
+    size_t i = heap->size++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->data[parent].key <= key) break;
+        heap->data[i] = heap->data[parent];
+        i = parent;
+    }
+    heap->data[i].key = key;
+    heap->data[i].node = node;
+}
+
+static RoadHeapEntry heapPop(RoadHeap *heap) {
+    RoadHeapEntry top = heap->data[0];
+    RoadHeapEntry last = heap->data[--heap->size];
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap->size) break;
+        if (child + 1 < heap->size && heap->data[child + 1].key < heap->data[child].key) child++;
+        if (last.key <= heap->data[child].key) break;
+        heap->data[i] = heap->data[child];
+        i = child;
+    }
+    if (heap->size > 0) heap->data[i] = last;
+    return top;
+}
+
+int buildRoadGraph(RoadGraph *graph, const RoadTopology *topo, const RoadAllocator *allocator) {
+    size_t n = topo->numNodes;
+
+    memset(graph, 0, sizeof(RoadGraph));
+    graph->topo = topo;
+    graph->allocator = allocator;
+    graph->numNodes = n;
+    graph->numArcs = topo->numEdges * 2;
+
+    size_t arcs = graph->numArcs > 0 ? graph->numArcs : 1;
+    graph->offsets = (size_t *) roadAlloc(allocator, (n + 1) * sizeof(size_t));
+    graph->arcTarget = (size_t *) roadAlloc(allocator, arcs * sizeof(size_t));
+    graph->arcEdge = (size_t *) roadAlloc(allocator, arcs * sizeof(size_t));
+    graph->arcLength = (double *) roadAlloc(allocator, arcs * sizeof(double));
+    graph->dist = (double *) roadAlloc(allocator, (2 * n + 1) * sizeof(double));
+    graph->pred = (size_t *) roadAlloc(allocator, (2 * n + 1) * sizeof(size_t));
+    graph->stamp = (unsigned *) roadAlloc(allocator, (2 * n + 1) * sizeof(unsigned));
+    /* Every push follows an improvement through an arc or a seed */
+    graph->heap = roadAlloc(allocator, 2 * (arcs + 2) * sizeof(RoadHeapEntry));
+    if (!graph->offsets || !graph->arcTarget || !graph->arcEdge || !graph->arcLength ||
+        !graph->dist || !graph->pred || !graph->stamp || !graph->heap) {
+        freeRoadGraph(graph);
+        return 0;
+    }
+    memset(graph->stamp, 0, (2 * n + 1) * sizeof(unsigned));
+
+    /* Counting sort of the arcs by source node */
+    memset(graph->offsets, 0, (n + 1) * sizeof(size_t));
+    for (size_t e = 0; e < topo->numEdges; e++) {
+        graph->offsets[topo->edges[e].startNode + 1]++;
+        graph->offsets[topo->edges[e].endNode + 1]++;
+    }
+    for (size_t i = 0; i < n; i++) graph->offsets[i + 1] += graph->offsets[i];
+
+    size_t *fill = (size_t *) roadAlloc(allocator, (n + 1) * sizeof(size_t));
+    if (!fill) {
+        freeRoadGraph(graph);
+        return 0;
+    }
+    memcpy(fill, graph->offsets, (n + 1) * sizeof(size_t));
+
+    for (size_t e = 0; e < topo->numEdges; e++) {
+        const RoadTopoEdge *edge = &topo->edges[e];
+        size_t a = fill[edge->startNode]++;
+        graph->arcTarget[a] = edge->endNode;
+        graph->arcEdge[a] = 2 * e;
+        graph->arcLength[a] = edge->length;
+
+        a = fill[edge->endNode]++;
+        graph->arcTarget[a] = edge->startNode;
+        graph->arcEdge[a] = 2 * e + 1;
+        graph->arcLength[a] = edge->length;
+    }
+    roadFree(allocator, fill);
+    return 1;
+}
+
+void freeRoadGraph(RoadGraph *graph) {
+    roadFree(graph->allocator, graph->offsets);
+    roadFree(graph->allocator, graph->arcTarget);
+    roadFree(graph->allocator, graph->arcEdge);
+    roadFree(graph->allocator, graph->arcLength);
+    roadFree(graph->allocator, graph->dist);
+    roadFree(graph->allocator, graph->pred);
+    roadFree(graph->allocator, graph->stamp);
+    roadFree(graph->allocator, graph->heap);
+    memset(graph, 0, sizeof(RoadGraph));
+}
+
+/* Label of node in search side (0 forward, 1 backward); false if unreached */
+static inline int graphReached(const RoadGraph *graph, int side, size_t node) {
+    return graph->stamp[side * graph->numNodes + node] == graph->generation;
+}
+
+static void graphLabel(RoadGraph *graph, RoadHeap *heap, int side, size_t node, double dist, size_t pred) {
+    size_t i = side * graph->numNodes + node;
+    if (graph->stamp[i] == graph->generation && graph->dist[i] <= dist) return;
+
+    graph->stamp[i] = graph->generation;
+    graph->dist[i] = dist;
+    graph->pred[i] = pred;
+    heapPush(heap, dist, node);
+}
+
+static int appendLeg(RoadRoute *route, size_t *capacity, size_t edge, double startCh, double endCh) {
+    if (route->numLegs == *capacity) {
+        size_t newCap = *capacity ? *capacity * 2 : 8;
+        RoadRouteLeg *legs = route->legs
+                             ? (RoadRouteLeg *) roadRealloc(route->allocator, route->legs, newCap * sizeof(RoadRouteLeg))
+                             : (RoadRouteLeg *) roadAlloc(route->allocator, newCap * sizeof(RoadRouteLeg));
+        if (!legs) return 0;
+        route->legs = legs;
+        *capacity = newCap;
+    }
+    route->legs[route->numLegs].edge = edge;
+    route->legs[route->numLegs].startCh = startCh;
+    route->legs[route->numLegs].endCh = endCh;
+    route->numLegs++;
+    return 1;
+}
+
+/* Legs of the route through meet, from the two predecessor chains */
+static int buildRouteLegs(const RoadGraph *graph, RoadGraphPosition from, RoadGraphPosition to,
+                          size_t meet, RoadRoute *route) {
+    const RoadTopoEdge *edges = graph->topo->edges;
+    size_t n = graph->numNodes;
+    size_t capacity = 0, count = 0, node;
+
+    /* Forward chain is walked backwards: count its arcs, then fill them in place */
+    for (node = meet; graph->pred[node] < ROAD_SEED_END; count++) {
+        size_t code = graph->arcEdge[graph->pred[node]];
+        node = (code & 1) ? edges[code / 2].endNode : edges[code / 2].startNode;
+    }
+
+    int fromStart = graph->pred[node] == ROAD_SEED_START;
+    if (!appendLeg(route, &capacity, from.edge, from.chainage, fromStart ? 0.0 : edges[from.edge].length)) return 0;
+
+    size_t first = route->numLegs;
+    for (size_t i = 0; i < count; i++) {
+        if (!appendLeg(route, &capacity, 0, 0.0, 0.0)) return 0;
+    }
+    node = meet;
+    for (size_t i = count; i > 0; i--) {
+        size_t arc = graph->pred[node];
+        size_t e = graph->arcEdge[arc] / 2;
+        int reverse = (int) (graph->arcEdge[arc] & 1);
+        RoadRouteLeg *leg = &route->legs[first + i - 1];
+        leg->edge = e;
+        leg->startCh = reverse ? edges[e].length : 0.0;
+        leg->endCh = reverse ? 0.0 : edges[e].length;
+        node = reverse ? edges[e].endNode : edges[e].startNode;
+    }
+
+    /* Backward chain runs from meet towards the destination */
+    for (node = meet; graph->pred[n + node] < ROAD_SEED_END;) {
+        size_t arc = graph->pred[n + node];
+        size_t e = graph->arcEdge[arc] / 2;
+        int reverse = (int) (graph->arcEdge[arc] & 1);
+        /* The backward search followed the arc into node; travel runs against it */
+        if (!appendLeg(route, &capacity, e, reverse ? 0.0 : edges[e].length, reverse ? edges[e].length : 0.0)) {
+            return 0;
+        }
+        node = reverse ? edges[e].endNode : edges[e].startNode;
+    }
+
+    int toStart = graph->pred[n + node] == ROAD_SEED_START;
+    return appendLeg(route, &capacity, to.edge, toStart ? 0.0 : edges[to.edge].length, to.chainage);
+}
+
+/* Drop zero-length legs, keeping one if nothing else is left */
+static void compactLegs(RoadRoute *route) {
+    size_t kept = 0;
+    for (size_t i = 0; i < route->numLegs; i++) {
+        if (route->legs[i].startCh != route->legs[i].endCh) route->legs[kept++] = route->legs[i];
+    }
+    route->numLegs = kept > 0 ? kept : (route->numLegs > 0 ? 1 : 0);
+}
+
+int findRoadRoute(RoadGraph *graph, RoadGraphPosition from, RoadGraphPosition to,
+                  const RoadAllocator *allocator, RoadRoute *route) {
+    const RoadTopology *topo = graph->topo;
+    size_t n = graph->numNodes;
+
+    route->distance = 0.0;
+    route->legs = NULL;
+    route->numLegs = 0;
+    route->allocator = allocator;
+
+    if (!topo || from.edge >= topo->numEdges || to.edge >= topo->numEdges) return 0;
+
+    const RoadTopoEdge *fe = &topo->edges[from.edge];
+    const RoadTopoEdge *te = &topo->edges[to.edge];
+    if (!(from.chainage >= 0 && from.chainage <= fe->length) || !(to.chainage >= 0 && to.chainage <= te->length)) {
+        return 0;
+    }
+
+    /* Stamps wrap after 2^32 searches; clear them once then */
+    if (++graph->generation == 0) {
+        memset(graph->stamp, 0, (2 * n + 1) * sizeof(unsigned));
+        graph->generation = 1;
+    }
+
+    RoadHeap heaps[2];
+    heaps[0].data = (RoadHeapEntry *) graph->heap;
+    heaps[1].data = heaps[0].data + graph->numArcs + 2;
+    heaps[0].size = heaps[1].size = 0;
+    graph->settled = 0;
+
+    graphLabel(graph, &heaps[0], 0, fe->startNode, from.chainage, ROAD_SEED_START);
+    graphLabel(graph, &heaps[0], 0, fe->endNode, fe->length - from.chainage, ROAD_SEED_END);
+    graphLabel(graph, &heaps[1], 1, te->startNode, to.chainage, ROAD_SEED_START);
+    graphLabel(graph, &heaps[1], 1, te->endNode, te->length - to.chainage, ROAD_SEED_END);
+
+    double best = INFINITY;
+    size_t meet = 0;
+    int found = 0;
+    size_t seeds[4] = {fe->startNode, fe->endNode, te->startNode, te->endNode};
+    for (int k = 0; k < 4; k++) {
+        size_t v = seeds[k];
+        if (graphReached(graph, 0, v) && graphReached(graph, 1, v) && graph->dist[v] + graph->dist[n + v] < best) {
+            best = graph->dist[v] + graph->dist[n + v];
+            meet = v;
+            found = 1;
+        }
+    }
+
+    /* Stop once the two frontiers cannot beat the best meeting found */
+    while (heaps[0].size > 0 && heaps[1].size > 0 && heaps[0].data[0].key + heaps[1].data[0].key < best) {
+        int side = heaps[0].data[0].key <= heaps[1].data[0].key ? 0 : 1;
+        RoadHeapEntry top = heapPop(&heaps[side]);
+        size_t u = top.node;
+        double du = graph->dist[side * n + u];
+        if (top.key > du) continue;   /* superseded entry */
+        graph->settled++;
+
+        for (size_t a = graph->offsets[u]; a < graph->offsets[u + 1]; a++) {
+            size_t v = graph->arcTarget[a];
+            double dv = du + graph->arcLength[a];
+            graphLabel(graph, &heaps[side], side, v, dv, a);
+            if (graphReached(graph, 1 - side, v) && graph->dist[v] + graph->dist[n + v] < best) {
+                best = graph->dist[v] + graph->dist[n + v];
+                meet = v;
+                found = 1;
+            }
+        }
+    }
+
+    /* Along the shared edge without touching a node */
+    if (from.edge == to.edge && fabs(to.chainage - from.chainage) <= best) {
+        size_t capacity = 0;
+        route->distance = fabs(to.chainage - from.chainage);
+        return appendLeg(route, &capacity, from.edge, from.chainage, to.chainage);
+    }
+    if (!found) return 0;
+
+    route->distance = best;
+    if (!buildRouteLegs(graph, from, to, meet, route)) {
+        freeRoadRoute(route);
+        return 0;
+    }
+    compactLegs(route);
+    return 1;
+}
+
+void freeRoadRoute(RoadRoute *route) {
+    if (route->allocator) roadFree(route->allocator, route->legs);
+    route->legs = NULL;
+    route->numLegs = 0;
+}
+
+/* ========== Route Assembly ========== */
+
+/* First end used by an odd number of lines: a line start, else a line end, else the first start */
+static size_t routeStartNode(const RoadTopology *topo) {
+    for (size_t e = 0; e < topo->numEdges; e++) {
+        if (topo->nodes[topo->edges[e].startNode].degree % 2) return topo->edges[e].startNode;
+    }
+    for (size_t e = 0; e < topo->numEdges; e++) {
+        if (topo->nodes[topo->edges[e].endNode].degree % 2) return topo->edges[e].endNode;
+    }
+    return topo->edges[0].startNode;
+}
+
+int assembleRoute(const RoadLine *lines, size_t numLines, double tolerance, const RoadAllocator *allocator,
+                  AssembledRoute *route) {
+    RoadTopology topo;
+    RoadGraph graph;
+    unsigned char *used = NULL;
+    size_t *bounds = NULL;
+    size_t total = 0;
+    int ok = 0;
+
+    memset(route, 0, sizeof(AssembledRoute));
+    memset(&graph, 0, sizeof(RoadGraph));
+    if (!initTopology(&topo, numLines, tolerance, allocator)) return 0;
+
+    for (size_t l = 0; l < numLines; l++) {
+        if (!addTopologyLine(&topo, l, &lines[l])) goto done;
+        total += lines[l].coords.size;
+    }
+    if (topo.numEdges == 0 || !buildRoadGraph(&graph, &topo, allocator)) goto done;
+
+    used = (unsigned char *) roadAlloc(allocator, topo.numEdges);
+    /* First and last vertex of each segment in the merged line */
+    bounds = (size_t *) roadAlloc(allocator, 2 * topo.numEdges * sizeof(size_t));
+    route->segments = (RouteSegmentDto *) roadAlloc(allocator, topo.numEdges * sizeof(RouteSegmentDto));
+    route->line.allocator = allocator;
+    if (!used || !bounds || !route->segments || !initCoordinateArray(&route->line.coords, total, allocator)) {
+        goto done;
+    }
+    memset(used, 0, topo.numEdges);
+
+    size_t node = routeStartNode(&topo);
+    for (;;) {
+        size_t a = graph.offsets[node];
+        while (a < graph.offsets[node + 1] && used[graph.arcEdge[a] / 2]) a++;
+        if (a == graph.offsets[node + 1]) break;
+
+        size_t e = graph.arcEdge[a] / 2;
+        int reversed = (int) (graph.arcEdge[a] & 1);
+        const CoordinateArray *c = &lines[e].coords;
+        CoordinateArray *out = &route->line.coords;
+        size_t i = route->numSegments++;
+
+        for (size_t v = 0; v < c->size; v++) {
+            const Coordinate *p = &c->data[reversed ? c->size - 1 - v : v];
+            if (!addDistinctCoordinate(out, p->x, p->y)) goto done;
+            /* The first vertex may be shared with the previous segment's last */
+            if (v == 0) bounds[2 * i] = out->size - 1;
+        }
+        bounds[2 * i + 1] = out->size - 1;
+
+        route->segments[i].line = e;
+        route->segments[i].reversed = reversed;
+        used[e] = 1;
+        node = graph.arcTarget[a];
+    }
+
+    /* Run the way most segments are digitized; a walked path is as valid backwards */
+    size_t numReversed = 0, n = route->numSegments, last = route->line.coords.size - 1;
+    for (size_t i = 0; i < n; i++) numReversed += (size_t) route->segments[i].reversed;
+    if (numReversed * 2 > n) {
+        reverseCoordinateArray(&route->line.coords);
+        for (size_t i = 0; i < n; i++) {
+            size_t first = bounds[2 * i];
+            bounds[2 * i] = last - bounds[2 * i + 1];
+            bounds[2 * i + 1] = last - first;
+            route->segments[i].reversed = !route->segments[i].reversed;
+        }
+        for (size_t i = 0, j = n - 1; i < j; i++, j--) {
+            RouteSegmentDto seg = route->segments[i];
+            size_t first = bounds[2 * i], end = bounds[2 * i + 1];
+            route->segments[i] = route->segments[j];
+            route->segments[j] = seg;
+            bounds[2 * i] = bounds[2 * j];
+            bounds[2 * i + 1] = bounds[2 * j + 1];
+            bounds[2 * j] = first;
+            bounds[2 * j + 1] = end;
+        }
+    }
+
+    if (!computePrefixLengths(&route->line)) goto done;
+    for (size_t i = 0; i < n; i++) {
+        route->segments[i].startCh = degreesToKm(route->line.prefix[bounds[2 * i]]);
+        route->segments[i].endCh = degreesToKm(route->line.prefix[bounds[2 * i + 1]]);
+    }
+    ok = 1;
+
+done:
+    roadFree(allocator, used);
+    roadFree(allocator, bounds);
+    freeRoadGraph(&graph);
+    freeTopology(&topo);
+    if (!ok) freeAssembledRoute(route);
+    return ok;
+}
+
+void freeAssembledRoute(AssembledRoute *route) {
+    if (route->line.allocator) {
+        roadFree(route->line.allocator, route->segments);
+        freeRoadLine(&route->line);
+    }
+    route->segments = NULL;
+    route->numSegments = 0;
+}
+
+/* ========== Event Coalescing ========== */
+
+static int eventValuesEqual(const char *a, size_t aLen, const char *b, size_t bLen) {
+    if (!a || !b) return a == b;
+    return aLen == bLen && memcmp(a, b, aLen) == 0;
+}
+
+int extendEventRun(EventRun *run, double from, double to, const char *value, size_t valueLen) {
+    if (!eventValuesEqual(run->value, run->valueLen, value, valueLen) ||
+        from < run->from || from > run->to + ROAD_EVENT_GAP) {
+        return 0;
+    }
+    if (to > run->to) run->to = to;
+    return 1;
+}
+
+static int compareEventRuns(const void *a, const void *b) {
+    const EventRun *x = (const EventRun *) a;
+    const EventRun *y = (const EventRun *) b;
+    if (x->from != y->from) return x->from < y->from ? -1 : 1;
+    if (x->to != y->to) return x->to < y->to ? -1 : 1;
+    return 0;
+}
+
+size_t coalesceEventRuns(EventRun *runs, size_t n) {
+    size_t kept = 0;
+
+    if (n == 0) return 0;
+    qsort(runs, n, sizeof(EventRun), compareEventRuns);
+
+    for (size_t i = 1; i < n; i++) {
+        if (!extendEventRun(&runs[kept], runs[i].from, runs[i].to, runs[i].value, runs[i].valueLen)) {
+            runs[++kept] = runs[i];
+        }
+    }
+    return kept + 1;
+}
+
+/* ========== Compact Encoding ========== */
+
+/*
+ * Layout (all integers are unsigned LEB128 varints unless noted):
+ *   byte    0x00 marker (cannot start WKT text)
+ *   byte    format version
+ *   byte    flags (ROAD_COMPACT_MEASURED, ROAD_COMPACT_Z)
+ *   byte    xy precision (decimal digits)
+ *   byte    measure precision (decimal digits)
+ *   byte    z precision (decimal digits), only with ROAD_COMPACT_Z
+ *   varint  vertex count
+ *   then per vertex the zig-zag deltas of x, y [, z] [, m] in grid units
+ */
+#define ROAD_COMPACT_MARKER   0x00
+#define ROAD_COMPACT_VERSION  1
+#define ROAD_COMPACT_MEASURED 0x01
+#define ROAD_COMPACT_Z        0x02
+#define ROAD_COMPACT_HEADER   5
+#define ROAD_INDEXED_VERSION  2
+
+/* Largest quantized ordinate; keeps every delta inside int64 */
+#define ROAD_COMPACT_MAX_Q    4611686018427387904.0   /* 2^62 */
+
+static const double roadPow10[ROAD_COMPACT_MAX_PRECISION + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+static int quantize(double v, double scale, int64_t *q) {
+    double scaled = v * scale;
+    if (!isfinite(scaled) || fabs(scaled) >= ROAD_COMPACT_MAX_Q) return 0;
+    *q = (int64_t) llround(scaled);
+    return 1;
+}
+
+static int appendVarint(RoadBuffer *buf, uint64_t v) {
+    unsigned char bytes[10];
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        bytes[n++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    bytes[n++] = (unsigned char) v;
+    return bufferAppend(buf, (const char *) bytes, n);
+}
+
+static int appendDelta(RoadBuffer *buf, int64_t delta) {
+    return appendVarint(buf, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));   /* zig-zag */
+}
+
+static int readVarint(const unsigned char **pp, const unsigned char *end, uint64_t *out) {
+    const unsigned char *p = *pp;
+    uint64_t v = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p >= end) return 0;
+        v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *out = v;
+            *pp = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* Add a zig-zag delta to q; 0 if the sum leaves the range quantize can produce */
+static inline int addDelta(int64_t *q, uint64_t v) {
+    int64_t sum;
+
+    if (__builtin_add_overflow(*q, unzigzag(v), &sum) ||
+        sum >= (int64_t) ROAD_COMPACT_MAX_Q || sum <= -(int64_t) ROAD_COMPACT_MAX_Q) {
+        return 0;
+    }
+    *q = sum;
+    return 1;
+}
+
+int isCompactLine(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    return len >= ROAD_COMPACT_HEADER && p[0] == ROAD_COMPACT_MARKER;
+}
+
+unsigned char *encodeCompactLine(const RoadLine *line, int xyPrecision, int mPrecision,
+                                 const RoadAllocator *allocator, size_t *len) {
+    RoadBuffer buf;
+    int64_t px = 0, py = 0, pz = 0, pm = 0;
+
+    if (!line || !line->prefix || line->coords.size < 2 || !len ||
+        xyPrecision < 0 || xyPrecision > ROAD_COMPACT_MAX_PRECISION ||
+        mPrecision < 0 || mPrecision > ROAD_COMPACT_MAX_PRECISION) {
+        return NULL;
+    }
+
+    double xyScale = roadPow10[xyPrecision];
+    double zScale = roadPow10[ROAD_COMPACT_Z_PRECISION];
+    double mScale = roadPow10[mPrecision];
+    size_t n = line->coords.size;
+    unsigned char header[ROAD_COMPACT_HEADER + 1] = {
+        ROAD_COMPACT_MARKER, ROAD_COMPACT_VERSION,
+        (line->measured ? ROAD_COMPACT_MEASURED : 0) | (line->z ? ROAD_COMPACT_Z : 0),
+        (unsigned char) xyPrecision, (unsigned char) mPrecision, ROAD_COMPACT_Z_PRECISION
+    };
+
+    if (!bufferInit(&buf, 16 + n * (6 + (line->measured ? 3 : 0) + (line->z ? 3 : 0)), allocator)) return NULL;
+    if (!bufferAppend(&buf, (const char *) header, ROAD_COMPACT_HEADER + (line->z ? 1 : 0)) ||
+        !appendVarint(&buf, (uint64_t) n)) {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        int64_t qx, qy, qm;
+
+        if (!quantize(line->coords.data[i].x, xyScale, &qx) ||
+            !quantize(line->coords.data[i].y, xyScale, &qy) ||
+            !appendDelta(&buf, qx - px) || !appendDelta(&buf, qy - py)) {
+            goto fail;
+        }
+        px = qx;
+        py = qy;
+
+        if (line->z) {
+            int64_t qz;
+            if (!quantize(line->z[i], zScale, &qz) || !appendDelta(&buf, qz - pz)) goto fail;
+            pz = qz;
+        }
+
+        if (line->measured) {
+            if (!quantize(degreesToKm(line->prefix[i]), mScale, &qm) || !appendDelta(&buf, qm - pm)) goto fail;
+            pm = qm;
+        }
+    }
+
+    *len = buf.len;
+    return (unsigned char *) buf.data;
+
+fail:
+    roadFree(allocator, buf.data);
+    return NULL;
+}
+
+static int decodeIndexedLine(const void *data, size_t len, const RoadAllocator *allocator, RoadLine *line);
+
+int decodeCompactLine(const void *data, size_t len, const RoadAllocator *allocator, RoadLine *line) {
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + len;
+    uint64_t count, v;
+    int64_t qx = 0, qy = 0, qz = 0, qm = 0;
+    double zScale = 1.0;
+
+    memset(line, 0, sizeof(RoadLine));
+    line->allocator = allocator;
+
+    if (isCompactLine(data, len) && p[1] == ROAD_INDEXED_VERSION) {
+        return decodeIndexedLine(data, len, allocator, line);
+    }
+    if (!isCompactLine(data, len) || p[1] != ROAD_COMPACT_VERSION ||
+        (p[2] & ~(ROAD_COMPACT_MEASURED | ROAD_COMPACT_Z)) != 0 ||
+        p[3] > ROAD_COMPACT_MAX_PRECISION || p[4] > ROAD_COMPACT_MAX_PRECISION) {
+        return 0;
+    }
+
+    int measured = (p[2] & ROAD_COMPACT_MEASURED) != 0;
+    int hasZ = (p[2] & ROAD_COMPACT_Z) != 0;
+    double xyScale = roadPow10[p[3]];
+    double mScale = roadPow10[p[4]];
+    p += ROAD_COMPACT_HEADER;
+
+    if (hasZ) {
+        if (p >= end || *p > ROAD_COMPACT_MAX_PRECISION) return 0;
+        zScale = roadPow10[*p++];
+    }
+
+    /* Every vertex takes at least one byte per ordinate */
+    if (!readVarint(&p, end, &count) || count < 2 ||
+        count > (uint64_t) (end - p) / (2 + measured + hasZ)) {
+        return 0;
+    }
+
+    size_t n = (size_t) count;
+    if (!initCoordinateArray(&line->coords, n, allocator)) return 0;
+    line->prefix = (double *) roadAlloc(allocator, n * sizeof(double));
+    if (!line->prefix) goto fail;
+    if (hasZ) {
+        line->z = (double *) roadAlloc(allocator, n * sizeof(double));
+        if (!line->z) goto fail;
+    }
+    line->measured = measured;
+
+    /* One pass: accumulate deltas straight into coords and prefix */
+    Coordinate *c = line->coords.data;
+    for (size_t i = 0; i < n; i++) {
+        if (!readVarint(&p, end, &v) || !addDelta(&qx, v)) goto fail;
+        if (!readVarint(&p, end, &v) || !addDelta(&qy, v)) goto fail;
+
+        c[i].x = (double) qx / xyScale;
+        c[i].y = (double) qy / xyScale;
+
+        if (hasZ) {
+            if (!readVarint(&p, end, &v) || !addDelta(&qz, v)) goto fail;
+            line->z[i] = (double) qz / zScale;
+        }
+
+        if (measured) {
+            if (!readVarint(&p, end, &v)) goto fail;
+            int64_t previous = qm;
+            if (!addDelta(&qm, v) || qm < previous) goto fail;
+            line->prefix[i] = kmToDegrees((double) qm / mScale);
+        } else {
+            line->prefix[i] = i == 0 ? 0.0
+                              : line->prefix[i - 1] + compute_distance(c[i - 1].x, c[i - 1].y, c[i].x, c[i].y);
+        }
+    }
+    line->coords.size = n;
+
+    if (p != end) goto fail;
+    return 1;
+
+fail:
+    freeRoadLine(line);
+    return 0;
+}
+
+/* ========== Indexed Layout ========== */
+
+/*
+ * Layout (integers and doubles little-endian):
+ *   byte    0x00 marker, shared with the compact encoding
+ *   byte    format version (ROAD_INDEXED_VERSION)
+ *   byte    flags (ROAD_COMPACT_MEASURED, ROAD_COMPACT_Z)
+ *   byte    log2 of the block size
+ *   uint32  vertex count
+ *   double  chainage of the first and of the last vertex (degrees)
+ *   double  chainage of vertex b * block size, for every block b
+ *   then per vertex the doubles x, y, chainage [, z]
+ */
+
+static void putFloat64(unsigned char *p, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char) (bits >> (8 * i));
+}
+
+static double getFloat64(const unsigned char *p) {
+    uint64_t bits = 0;
+    double v;
+    for (int i = 0; i < 8; i++) bits |= (uint64_t) p[i] << (8 * i);
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static int blockShift(size_t blockSize) {
+    int shift = 0;
+    while (((size_t) 1 << shift) < blockSize) shift++;
+    return shift;
+}
+
+size_t indexedLineIndexSize(const IndexedLineInfo *info) {
+    return info->blocks * sizeof(double);
+}
+
+size_t indexedLineRecordOffset(const IndexedLineInfo *info, size_t vertex) {
+    return ROAD_INDEXED_HEADER + indexedLineIndexSize(info) + vertex * info->recordSize;
+}
+
+unsigned char *encodeIndexedLine(const RoadLine *line, const RoadAllocator *allocator, size_t *len) {
+    IndexedLineInfo info;
+
+    if (!line || !line->prefix || line->coords.size < 2 || line->coords.size > UINT32_MAX || !len) {
+        return NULL;
+    }
+
+    info.count = line->coords.size;
+    info.hasZ = line->z != NULL;
+    info.blockSize = ROAD_INDEXED_BLOCK;
+    info.blocks = (info.count + info.blockSize - 1) / info.blockSize;
+    info.recordSize = (info.hasZ ? 4 : 3) * sizeof(double);
+
+    size_t total = indexedLineRecordOffset(&info, info.count);
+    unsigned char *out = (unsigned char *) roadAlloc(allocator, total);
+    if (!out) return NULL;
+
+    out[0] = ROAD_COMPACT_MARKER;
+    out[1] = ROAD_INDEXED_VERSION;
+    out[2] = (line->measured ? ROAD_COMPACT_MEASURED : 0) | (info.hasZ ? ROAD_COMPACT_Z : 0);
+    out[3] = (unsigned char) blockShift(info.blockSize);
+    for (int i = 0; i < 4; i++) out[4 + i] = (unsigned char) (info.count >> (8 * i));
+    putFloat64(out + 8, line->prefix[0]);
+    putFloat64(out + 16, line->prefix[info.count - 1]);
+
+    unsigned char *index = out + ROAD_INDEXED_HEADER;
+    for (size_t b = 0; b < info.blocks; b++) {
+        putFloat64(index + b * sizeof(double), line->prefix[b * info.blockSize]);
+    }
+
+    for (size_t i = 0; i < info.count; i++) {
+        unsigned char *rec = out + indexedLineRecordOffset(&info, i);
+        putFloat64(rec, line->coords.data[i].x);
+        putFloat64(rec + 8, line->coords.data[i].y);
+        putFloat64(rec + 16, line->prefix[i]);
+        if (info.hasZ) putFloat64(rec + 24, line->z[i]);
+    }
+
+    *len = total;
+    return out;
+}
+
+int readIndexedLineHeader(const void *data, size_t len, IndexedLineInfo *info) {
+    const unsigned char *p = (const unsigned char *) data;
+
+    if (len < ROAD_INDEXED_HEADER || p[0] != ROAD_COMPACT_MARKER || p[1] != ROAD_INDEXED_VERSION ||
+        (p[2] & ~(ROAD_COMPACT_MEASURED | ROAD_COMPACT_Z)) != 0 || p[3] >= 32) {
+        return 0;
+    }
+
+    info->count = (size_t) p[4] | (size_t) p[5] << 8 | (size_t) p[6] << 16 | (size_t) p[7] << 24;
+    info->measured = (p[2] & ROAD_COMPACT_MEASURED) != 0;
+    info->hasZ = (p[2] & ROAD_COMPACT_Z) != 0;
+    info->blockSize = (size_t) 1 << p[3];
+    info->blocks = (info->count + info->blockSize - 1) / info->blockSize;
+    info->recordSize = (info->hasZ ? 4 : 3) * sizeof(double);
+    info->start = getFloat64(p + 8);
+    info->end = getFloat64(p + 16);
+
+    return info->count >= 2 && info->start <= info->end;
+}
+
+int indexedLineWindow(const IndexedLineInfo *info, const void *index, double distance,
+                      size_t *first, size_t *count) {
+    const unsigned char *p = (const unsigned char *) index;
+
+    if (!(distance >= info->start && distance <= info->end)) {
+        return 0;
+    }
+
+    /* Last block starting before distance; its segments reach the next block's first vertex */
+    size_t lo = 0, hi = info->blocks;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (getFloat64(p + mid * sizeof(double)) < distance) lo = mid;
+        else hi = mid;
+    }
+
+    size_t last = (lo + 1) * info->blockSize;
+    if (last > info->count - 1) last = info->count - 1;
+    *first = lo * info->blockSize;
+    *count = last - *first + 1;
+    return 1;
+}
+
+int decodeIndexedRecords(const IndexedLineInfo *info, const void *records, size_t first, size_t count,
+                         const RoadAllocator *allocator, RoadLine *line) {
+    const unsigned char *p = (const unsigned char *) records;
+
+    memset(line, 0, sizeof(RoadLine));
+    line->allocator = allocator;
+
+    if (count < 2 || first + count > info->count) return 0;
+    if (!initCoordinateArray(&line->coords, count, allocator)) return 0;
+    line->prefix = (double *) roadAlloc(allocator, count * sizeof(double));
+    if (!line->prefix) goto fail;
+    if (info->hasZ) {
+        line->z = (double *) roadAlloc(allocator, count * sizeof(double));
+        if (!line->z) goto fail;
+    }
+    line->measured = info->measured;
+
+    for (size_t i = 0; i < count; i++, p += info->recordSize) {
+        line->coords.data[i].x = getFloat64(p);
+        line->coords.data[i].y = getFloat64(p + 8);
+        line->prefix[i] = getFloat64(p + 16);
+        if (info->hasZ) line->z[i] = getFloat64(p + 24);
+        /* Records come from user data too; only finite values the encoder could have written pass */
+        if (!isfinite(line->coords.data[i].x) || !isfinite(line->coords.data[i].y) ||
+            !isfinite(line->prefix[i]) || (info->hasZ && !isfinite(line->z[i]))) {
+            goto fail;
+        }
+        if (i > 0 && line->prefix[i] < line->prefix[i - 1]) goto fail;
+    }
+    line->coords.size = count;
+    return 1;
+
+fail:
+    freeRoadLine(line);
+    return 0;
+}
+
+static int decodeIndexedLine(const void *data, size_t len, const RoadAllocator *allocator, RoadLine *line) {
+    IndexedLineInfo info;
+
+    if (!readIndexedLineHeader(data, len, &info) || len != indexedLineRecordOffset(&info, info.count)) {
+        return 0;
+    }
+    return decodeIndexedRecords(&info, (const unsigned char *) data + indexedLineRecordOffset(&info, 0),
+                                0, info.count, allocator, line);
+}
+
+/* ========== Parallel Batches ========== */
+
+typedef void (*RoadRangeFn)(void *arg, size_t begin, size_t end);
+
+typedef struct {
+    RoadRangeFn fn;
+    void *arg;
+    size_t begin;
+    size_t end;
+} RoadRange;
+
+static void *runRange(void *p) {
+    RoadRange *range = (RoadRange *) p;
+    range->fn(range->arg, range->begin, range->end);
+    return NULL;
+}
+
+/*
+ * fn over [0, n) in contiguous ranges, the first on the calling thread, as
+ * are the ranges of any worker that cannot be started. Signals are blocked
+ * while the workers start so they inherit a full mask and the host process
+ * (a PostgreSQL backend) keeps handling them on its own thread.
+ */
+static void parallelFor(size_t n, int threads, RoadRangeFn fn, void *arg) {
+    pthread_t tids[ROAD_PARALLEL_MAX_THREADS];
+    RoadRange ranges[ROAD_PARALLEL_MAX_THREADS];
+    sigset_t all, old;
+    int started = 1;
+
+    if (threads > ROAD_PARALLEL_MAX_THREADS) threads = ROAD_PARALLEL_MAX_THREADS;
+    if ((size_t) threads > n / ROAD_PARALLEL_MIN_ITEMS) threads = (int) (n / ROAD_PARALLEL_MIN_ITEMS);
+    if (threads <= 1) {
+        fn(arg, 0, n);
+        return;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        ranges[t].fn = fn;
+        ranges[t].arg = arg;
+        ranges[t].begin = n * (size_t) t / (size_t) threads;
+        ranges[t].end = n * (size_t) (t + 1) / (size_t) threads;
+    }
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (started < threads && pthread_create(&tids[started], NULL, runRange, &ranges[started]) == 0) {
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    runRange(&ranges[0]);
+    for (int t = started; t < threads; t++) {
+        runRange(&ranges[t]);
+    }
+    for (int t = 1; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+typedef struct {
+    const RoadLine *line;
+    const Coordinate *points;
+    double radius;
+    PointDto *results;
+    unsigned char *found;
+} CalibrateBatch;
+
+static void calibrateRange(void *p, size_t begin, size_t end) {
+    CalibrateBatch *b = (CalibrateBatch *) p;
+    for (size_t i = begin; i < end; i++) {
+        b->found[i] = (unsigned char) calibratePoint(b->line, b->points[i], b->radius, &b->results[i]);
+    }
+}
+
+void calibratePointsParallel(const RoadLine *line, const Coordinate *points, size_t n, double radius,
+                             int threads, PointDto *results, unsigned char *found) {
+    CalibrateBatch batch = {line, points, radius, results, found};
+    parallelFor(n, threads, calibrateRange, &batch);
+}
+
+typedef struct {
+    const RoadLine *line;
+    const double *chainages;
+    const double *offsets;
+    size_t numOffsets;
+    Coordinate *points;
+    unsigned char *found;
+} OffsetBatch;
+
+static void offsetRange(void *p, size_t begin, size_t end) {
+    OffsetBatch *b = (OffsetBatch *) p;
+    for (size_t i = begin; i < end; i++) {
+        double offset = b->offsets[b->numOffsets == 1 ? 0 : i];
+        b->found[i] = (unsigned char) pointAtChainageOffset(b->line, b->chainages[i], offset, &b->points[i], NULL);
+    }
+}
+
+void pointsAtChainageOffsetParallel(const RoadLine *line, const double *chainages, size_t n,
+                                    const double *offsets, size_t numOffsets, int threads,
+                                    Coordinate *points, unsigned char *found) {
+    OffsetBatch batch = {line, chainages, offsets, numOffsets, points, found};
+    parallelFor(n, threads, offsetRange, &batch);
+}
@@ -0,0 +1,723 @@
+/**
+ * @file road_core.h
+ * @brief PostgreSQL-independent chainage kernels for pg_gis_road_utils
+ *
+ * Plain C implementation of the line parsing and chainage math used by the
+ * extension. Nothing in here includes PostgreSQL or GEOS headers: every
+ * allocation goes through a RoadAllocator and failures are reported by
+ * return value, so the same code can be linked into the extension, the
+ * unit tests, the benchmarks or any standalone ingest tool.
+ *
+ * Chainages handed to and returned from the kernels are in kilometers;
+ * line coordinates are in degrees and converted with METERS_PER_DEGREE,
+ * matching the original JNI implementation.
+ */
+
+#ifndef ROAD_CORE_H
+#define ROAD_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METERS_PER_DEGREE 111320.0
+#define MAX_RADIUS        1000000
+
+/**
+ * Allocator interface used by all core functions.
+ * alloc/realloc may return NULL (malloc) or never return on failure (palloc).
+ */
+typedef struct RoadAllocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+} RoadAllocator;
+
+/** Default allocator backed by malloc/realloc/free */
+extern const RoadAllocator road_malloc_allocator;
+
+typedef struct {
+    double x;
+    double y;
+} Coordinate;
+
+typedef struct {
+    Coordinate *data;
+    size_t size;
+    size_t capacity;
+    const RoadAllocator *allocator;
+} CoordinateArray;
+
+/**
+ * Parsed line with cumulative vertex distances.
+ * prefix[i] is the chainage of vertex i in coordinate units: the length from
+ * vertex 0 for plain lines, or the vertex measure for measured lines, whose
+ * chainages survive simplification and need not start at zero.
+ * z holds the elevation (meters) of every vertex, or is NULL for 2D lines.
+ */
+typedef struct {
+    CoordinateArray coords;
+    double *prefix;
+    double *z;
+    int measured;
+    const RoadAllocator *allocator;
+} RoadLine;
+
+typedef struct {
+    double startLat;
+    double startLon;
+    double endLat;
+    double endLon;
+    double startCh;
+    double endCh;
+    double length;
+    char *geometry;
+} SectionDto;
+
+typedef struct {
+    double lat;
+    double lon;
+    double chainage;
+    int index;
+} PointDto;
+
+/**
+ * Along-road distance between two calibrated points: distance = toCh -
+ * fromCh (km), direction ROAD_FORWARD, ROAD_REVERSE or 0 when both match
+ * the same chainage.
+ */
+typedef struct {
+    double fromCh;
+    double toCh;
+    double distance;
+    int direction;
+} AlongRoadDto;
+
+/**
+ * Difference between two versions of a line. Vertices [oldStart, oldEnd) of
+ * the old line were replaced by [newStart, newEnd) of the new one; chainages
+ * up to startCh are unchanged and those from oldEndCh on move by delta (km).
+ */
+typedef struct {
+    int changed;
+    size_t oldStart;
+    size_t oldEnd;
+    size_t newStart;
+    size_t newEnd;
+    double startCh;
+    double oldEndCh;
+    double newEndCh;
+    double delta;
+} LineEditDto;
+
+static inline double kmToDegrees(double km) {
+    return (km * 1000) / METERS_PER_DEGREE;
+}
+
+static inline double degreesToKm(double degrees) {
+    return (degrees * METERS_PER_DEGREE) / 1000;
+}
+
+/* ========== Allocation ========== */
+
+void *roadAlloc(const RoadAllocator *allocator, size_t size);
+void *roadRealloc(const RoadAllocator *allocator, void *ptr, size_t size);
+void roadFree(const RoadAllocator *allocator, void *ptr);
+
+/* ========== CoordinateArray ========== */
+
+int initCoordinateArray(CoordinateArray *arr, size_t initialCapacity, const RoadAllocator *allocator);
+int addCoordinate(CoordinateArray *arr, double x, double y);
+void freeCoordinateArray(CoordinateArray *arr);
+
+/** Reverse the order of the coordinates in place */
+void reverseCoordinateArray(CoordinateArray *arr);
+
+/* ========== Parsing ========== */
+
+/**
+ * Parse a LINESTRING or MULTILINESTRING WKT (first part only) into a RoadLine
+ * and compute its prefix lengths. Z ordinates are kept in line->z. M
+ * ordinates, as written by measuredLineToWKT, are taken as vertex chainages
+ * in km and must not decrease. Returns 1 on success, 0 on invalid input or
+ * allocation failure.
+ */
+int parseLineWKT(const char *wkt, const RoadAllocator *allocator, RoadLine *line);
+
+/**
+ * Parse a POINT WKT. Returns 1 on success, 0 on invalid input.
+ */
+int parsePointWKT(const char *wkt, Coordinate *point);
+
+/**
+ * (Re)compute line->prefix from line->coords.
+ */
+int computePrefixLengths(RoadLine *line);
+
+void freeRoadLine(RoadLine *line);
+
+/** Chainage of the last vertex in coordinate units (the length of plain lines) */
+double roadLineLength(const RoadLine *line);
+
+/** Chainage of the first vertex in coordinate units (0 for plain lines) */
+double roadLineStart(const RoadLine *line);
+
+/* ========== Direction ========== */
+
+/**
+ * Travel direction of a query. Reverse chainages mirror the forward ones, so
+ * the last vertex has the line's first chainage and the first vertex its
+ * last: the same numbers as on the reversed line, without building it.
+ */
+#define ROAD_FORWARD  1
+#define ROAD_REVERSE  (-1)
+
+/** Forward chainage (km) of a reverse one and vice versa */
+double reverseChainage(const RoadLine *line, double chainage);
+
+/* ========== Kernels ========== */
+
+/**
+ * Find the vertex closest to referencePoint within radius and report its
+ * chainage (km), coordinates and index. Returns 0 if no vertex qualifies.
+ */
+int calibratePoint(const RoadLine *line, Coordinate referencePoint, double radius, PointDto *pointDto);
+
+/** Fill dto for the span from fromCh to toCh (km) */
+void setAlongRoadSpan(double fromCh, double toCh, AlongRoadDto *dto);
+
+/**
+ * Calibrate both points as calibratePoint does and report the signed
+ * distance between them along the line. Returns 0 if either point has no
+ * vertex within radius.
+ */
+int distanceAlongRoad(const RoadLine *line, Coordinate from, Coordinate to, double radius, AlongRoadDto *dto);
+
+/**
+ * Extract the part of the line between two chainages (km). The section WKT is
+ * allocated with the line's allocator. Returns 0 on invalid range.
+ */
+int extractSubLineStringByChainages(const RoadLine *line, double start_chainage, double end_chainage,
+                                    SectionDto *sectionDto);
+
+/**
+ * extractSubLineStringByChainages in the given direction; a reverse section
+ * lists its coordinates from the reverse start, as on the reversed line.
+ */
+int extractSectionInDirection(const RoadLine *line, double start_chainage, double end_chainage, int direction,
+                              SectionDto *sectionDto);
+
+/**
+ * Interpolate the point at the given distance (coordinate units) along the
+ * line. Returns 0 if the distance is outside [0, length].
+ */
+int interpolatePoint(const RoadLine *line, double distance, Coordinate *point);
+
+/**
+ * Find the segment holding a distance (coordinate units) along the line:
+ * the point lies between vertex segment-1 and segment at the given factor.
+ * Returns 0 if the distance is outside [0, length].
+ */
+int locateDistance(const RoadLine *line, double distance, size_t *segment, double *factor);
+
+/**
+ * Append the coordinates of the line between two distances (coordinate
+ * units, clipped to the line) to out, interpolating both ends.
+ */
+int collectSectionCoordinates(const RoadLine *line, double start_distance, double end_distance,
+                              CoordinateArray *out);
+
+/**
+ * Kilometer posts every intervalKm from startKm to the end of the line in one
+ * traversal, skipping chainages before its start. Post i is at startKm + i *
+ * intervalKm, so no rounding accumulates along long roads; index is the
+ * vertex starting its segment. *posts is allocated with the line's
+ * allocator (NULL when there are none). Returns 0 on a non-positive
+ * interval or allocation failure.
+ */
+int kilometerPosts(const RoadLine *line, double startKm, double intervalKm, PointDto **posts, size_t *numPosts);
+
+/**
+ * Split the line at strictly ascending chainages (km), all strictly inside
+ * the line, into numChainages + 1 consecutive pieces in one traversal. Each
+ * cut point is interpolated once and shared exactly by the pieces on either
+ * side. pieces must hold numChainages + 1 arrays; they are initialized here
+ * and nothing is left to free on failure.
+ */
+int splitLineAtChainages(const RoadLine *line, const double *chainages, size_t numChainages,
+                         CoordinateArray *pieces);
+
+/**
+ * Compare two versions of a line vertex by vertex from both ends and report
+ * the edited span and the chainage shift of everything after it.
+ */
+int diffLines(const RoadLine *oldLine, const RoadLine *newLine, LineEditDto *edit);
+
+/* ========== Chainage Equations ========== */
+
+/**
+ * Station breaks of a realigned road. From measured[i] (km along the line)
+ * on, the posted chainage is posted[i] plus the distance past the break;
+ * before the first break posted equals measured. Both columns must be
+ * strictly ascending, so a break may jump forward (a gap in posted
+ * chainage) or back by less than the following stretch (an overlap).
+ */
+typedef struct {
+    const double *measured;
+    const double *posted;
+    size_t count;
+} ChainageEquations;
+
+/** Whether the table is finite and strictly ascending in both columns */
+int checkChainageEquations(const ChainageEquations *eq);
+
+/** Posted chainage (km) of a measured chainage, by binary search */
+double measuredToPosted(const ChainageEquations *eq, double measured);
+
+/**
+ * Measured chainage (km) of a posted chainage, by binary search. In an
+ * overlap the stretch after the break wins; returns 0 in a gap.
+ */
+int postedToMeasured(const ChainageEquations *eq, double posted, double *measured);
+
+/* ========== Offsets ========== */
+
+/**
+ * Point at a chainage (km), moved offset_m meters perpendicular to the line:
+ * positive to the left of the digitized direction, negative to the right.
+ * bearing (optional) receives the segment azimuth in degrees from north.
+ */
+int pointAtChainageOffset(const RoadLine *line, double chainage, double offset_m,
+                          Coordinate *point, double *bearing);
+
+/**
+ * Offset a polyline by offset_m meters (left positive) with mitered joins;
+ * out must be initialized and receives one coordinate per input vertex.
+ */
+int offsetCoordinates(const CoordinateArray *in, double offset_m, CoordinateArray *out);
+
+/**
+ * Section between two chainages (km) offset by offset_m meters.
+ * out is initialized here with the line's allocator.
+ */
+int offsetSection(const RoadLine *line, double start_chainage, double end_chainage, double offset_m,
+                  CoordinateArray *out);
+
+/* ========== Road Profile ========== */
+
+/**
+ * Geometry of one interval [startCh, endCh] (km) along a line. elevation is
+ * at startCh; grade (percent) and curvature (radians per meter, left turns
+ * positive) are averaged over the interval's horizontal length; bearing is
+ * the azimuth in degrees from north from the start to the end point.
+ * elevation and grade are NAN for 2D lines.
+ */
+typedef struct {
+    double startCh;
+    double endCh;
+    Coordinate point;
+    double elevation;
+    double grade;
+    double bearing;
+    double curvature;
+} ProfileSampleDto;
+
+/** Position of a profile walk; the line must outlive it */
+typedef struct {
+    const RoadLine *line;
+    double interval;
+    size_t index;
+    size_t segment;
+} RoadProfileCursor;
+
+/** Start a profile of line every interval_m meters from its first chainage */
+int initProfileCursor(RoadProfileCursor *cursor, const RoadLine *line, double interval_m);
+
+/**
+ * Compute the next interval, the last one ending on the last vertex.
+ * Successive calls walk the line once in total. Returns 0 past the end.
+ */
+int nextProfileSample(RoadProfileCursor *cursor, ProfileSampleDto *sample);
+
+/* ========== Simplification ========== */
+
+/**
+ * Douglas-Peucker simplification with tolerance in coordinate units.
+ * out is a measured line holding the retained vertices with their chainage
+ * on the original line, so chainages along out match the original at every
+ * retained vertex and are interpolated in between.
+ */
+int simplifyLine(const RoadLine *line, double tolerance, RoadLine *out);
+
+/* ========== Spatial Index ========== */
+
+typedef struct {
+    int64_t cx;
+    int64_t cy;
+    size_t line;
+    size_t vertex;
+    size_t next;
+} RoadGridEntry;
+
+/**
+ * Uniform grid over the vertices of many lines, hashed by cell. With the
+ * cell size equal to the search radius a query visits at most 3x3 cells.
+ */
+typedef struct {
+    double cellSize;
+    size_t mask;
+    size_t *buckets;
+    RoadGridEntry *entries;
+    size_t numEntries;
+    const RoadLine *lines;
+    const RoadAllocator *allocator;
+} RoadGridIndex;
+
+/** Nearest vertex of one line to a query point */
+typedef struct {
+    size_t line;
+    size_t vertex;
+    double distance;
+} RoadMatch;
+
+typedef struct {
+    RoadMatch *data;
+    size_t size;
+    size_t capacity;
+    const RoadAllocator *allocator;
+} RoadMatchArray;
+
+/*
+ * Grid cells are never smaller than ROAD_GRID_MIN_CELL, and only vertices
+ * within ROAD_GRID_MAX_COORD of the origin are indexed, so cell indices stay
+ * far inside int64 for any radius. A cell larger than the radius only costs
+ * bucket collisions, never matches.
+ */
+#define ROAD_GRID_MIN_CELL  1e-6
+#define ROAD_GRID_MAX_COORD 1e9
+
+/** 1 if every vertex is finite and within ROAD_GRID_MAX_COORD in both axes */
+int lineInGridRange(const RoadLine *line);
+
+/**
+ * Index the vertices of lines in cells of cellSize, raised to at least
+ * ROAD_GRID_MIN_CELL. Returns 0 if a line is not lineInGridRange or on
+ * allocation failure.
+ */
+int buildGridIndex(RoadGridIndex *index, const RoadLine *lines, size_t numLines, double cellSize,
+                   const RoadAllocator *allocator);
+void freeGridIndex(RoadGridIndex *index);
+
+/**
+ * Replace the contents of matches with the nearest vertex within radius of
+ * every indexed line, ties going to the lower vertex index as in
+ * calibratePoint. matches must be zeroed before first use. A non-finite
+ * point matches nothing; a non-finite or negative radius returns 0.
+ */
+int queryGridIndex(const RoadGridIndex *index, Coordinate point, double radius, RoadMatchArray *matches);
+void freeRoadMatchArray(RoadMatchArray *matches);
+
+/* ========== Road Topology ========== */
+
+/** Road end shared by every line end snapped to it */
+typedef struct {
+    double x;
+    double y;
+    int64_t cx;         /* grid cell of (x, y) */
+    int64_t cy;
+    size_t degree;      /* line ends at this node; a loop counts twice */
+    size_t component;   /* connected component, numbered from 0 */
+} RoadTopoNode;
+
+/** One input line between two nodes */
+typedef struct {
+    size_t line;        /* caller's line number */
+    size_t startNode;
+    size_t endNode;
+    double length;      /* km, the end chainage of the line */
+} RoadTopoEdge;
+
+/**
+ * Node and edge topology of a road network, built one line at a time.
+ * Line ends are snapped to the nearest node within tolerance (degrees) or
+ * start a new node at their own position. Nodes are found through an
+ * open-addressing table keyed by tolerance-sized grid cells, so a lookup
+ * probes at most 3x3 cells. Only line ends are noded; lines crossing or
+ * touching mid-line are not split.
+ */
+typedef struct {
+    double tolerance;
+    double cellSize;
+    RoadTopoNode *nodes;
+    size_t numNodes;
+    size_t capNodes;
+    RoadTopoEdge *edges;
+    size_t numEdges;
+    size_t capEdges;
+    size_t *slots;      /* node index + 1, 0 when empty */
+    size_t mask;
+    size_t numComponents;
+    const RoadAllocator *allocator;
+} RoadTopology;
+
+/**
+ * Empty topology sized for about expectedLines lines; grows past that. Nodes
+ * are hashed on the spatial index grid, so the cell size is the tolerance
+ * raised to ROAD_GRID_MIN_CELL. Returns 0 for a negative or non-finite
+ * tolerance.
+ */
+int initTopology(RoadTopology *topo, size_t expectedLines, double tolerance, const RoadAllocator *allocator);
+void freeTopology(RoadTopology *topo);
+
+/**
+ * Add line number id as an edge between the nodes of its first and last
+ * vertex. Returns 0 if the line is not lineInGridRange.
+ */
+int addTopologyLine(RoadTopology *topo, size_t id, const RoadLine *line);
+
+/** Nearest node within tolerance of p; 0 if there is none */
+int findTopologyNode(const RoadTopology *topo, Coordinate p, size_t *node);
+
+/** Number the connected components of the nodes added so far into node.component */
+int labelTopologyComponents(RoadTopology *topo);
+
+/* ========== Network Routing ========== */
+
+/**
+ * Compressed sparse row graph over a topology: the arcs leaving node n are
+ * offsets[n] .. offsets[n + 1] - 1, two per edge (one each way). The search
+ * arrays are part of the graph and stamped per search, so repeated searches
+ * on a cached graph do not clear or allocate per-node state.
+ */
+typedef struct {
+    size_t numNodes;
+    size_t numArcs;
+    size_t *offsets;
+    size_t *arcTarget;
+    size_t *arcEdge;        /* 2 * edge, + 1 for an arc from the end node to the start node */
+    double *arcLength;      /* km */
+    const RoadTopology *topo;
+
+    /* Search state, forward then backward */
+    double *dist;
+    size_t *pred;
+    unsigned *stamp;
+    unsigned generation;
+    void *heap;
+    size_t settled;         /* nodes taken from the queues in the last search */
+    const RoadAllocator *allocator;
+} RoadGraph;
+
+/** Graph over topo, which must outlive it */
+int buildRoadGraph(RoadGraph *graph, const RoadTopology *topo, const RoadAllocator *allocator);
+void freeRoadGraph(RoadGraph *graph);
+
+/** A place on the network: a chainage (km) along a topology edge */
+typedef struct {
+    size_t edge;
+    double chainage;
+} RoadGraphPosition;
+
+/** Part of a route along one edge; endCh < startCh runs against the line's direction */
+typedef struct {
+    size_t edge;
+    double startCh;
+    double endCh;
+} RoadRouteLeg;
+
+typedef struct {
+    double distance;        /* km */
+    RoadRouteLeg *legs;
+    size_t numLegs;
+    const RoadAllocator *allocator;
+} RoadRoute;
+
+/**
+ * Shortest route between two positions by bidirectional Dijkstra. Each
+ * position joins the graph through the ends of its edge; on the same edge
+ * the direct stretch is used when it is shorter. Legs of zero length are
+ * left out unless the route has no other. Legs are allocated with
+ * allocator. Returns 0 if either position is invalid or the destination
+ * cannot be reached.
+ */
+int findRoadRoute(RoadGraph *graph, RoadGraphPosition from, RoadGraphPosition to,
+                  const RoadAllocator *allocator, RoadRoute *route);
+void freeRoadRoute(RoadRoute *route);
+
+/* ========== Route Assembly ========== */
+
+/** Where one input line ended up in an assembled route */
+typedef struct {
+    size_t line;        /* index of the input line */
+    int reversed;       /* 1 if it runs against its digitized direction */
+    double startCh;     /* km along the merged line */
+    double endCh;
+} RouteSegmentDto;
+
+typedef struct {
+    RoadLine line;              /* merged plain 2D line */
+    RouteSegmentDto *segments;  /* in route order */
+    size_t numSegments;         /* segments used; the others were not reached */
+} AssembledRoute;
+
+/**
+ * Chain lines into one route through ends snapped within tolerance
+ * (degrees), as in RoadTopology. The walk starts at an end used by an odd
+ * number of lines, preferring the start of the lowest numbered line, and at
+ * each node continues on the lowest numbered unused line there; it stops at
+ * the first node with none left. The route then runs in the digitized
+ * direction of most of its segments. Gaps within tolerance stay in the
+ * merged line between the chainages of the two segments.
+ */
+int assembleRoute(const RoadLine *lines, size_t numLines, double tolerance, const RoadAllocator *allocator,
+                  AssembledRoute *route);
+void freeAssembledRoute(AssembledRoute *route);
+
+/* ========== Event Coalescing ========== */
+
+/** Chainage span (km) carrying one attribute value */
+typedef struct {
+    double from;
+    double to;
+    const char *value;  /* NULL for no value */
+    size_t valueLen;
+} EventRun;
+
+/* Spans this close (km) count as contiguous */
+#define ROAD_EVENT_GAP 1e-9
+
+/**
+ * Extend run with (from, to) if the values are equal and from lies within
+ * the run or at most ROAD_EVENT_GAP past its end. Returns 1 if extended.
+ */
+int extendEventRun(EventRun *run, double from, double to, const char *value, size_t valueLen);
+
+/**
+ * Sort runs by chainage and merge neighbours that extendEventRun joins, in
+ * place, so the result does not depend on input order. Returns the number
+ * of runs left.
+ */
+size_t coalesceEventRuns(EventRun *runs, size_t n);
+
+/* ========== Compact Encoding ========== */
+
+#define ROAD_COMPACT_MAX_PRECISION 15
+
+/** Default grids: 1e-7 degrees (about 1 cm) for x/y, 1e-6 km (1 mm) for measures, 1 mm for z */
+#define ROAD_COMPACT_XY_PRECISION  7
+#define ROAD_COMPACT_M_PRECISION   6
+#define ROAD_COMPACT_Z_PRECISION   3
+
+/**
+ * Encode a line as fixed-point coordinates (xyPrecision decimal digits) stored
+ * as zig-zag delta varints; measured lines also carry their measures (km,
+ * mPrecision digits) and 3D lines their elevations (ROAD_COMPACT_Z_PRECISION
+ * digits). Returns a buffer allocated with allocator and its length, or NULL
+ * if an ordinate does not fit the grid.
+ */
+unsigned char *encodeCompactLine(const RoadLine *line, int xyPrecision, int mPrecision,
+                                 const RoadAllocator *allocator, size_t *len);
+
+/**
+ * Decode a compact line in a single streaming pass into coords and prefix.
+ * Returns 0 on truncated or malformed input.
+ */
+int decodeCompactLine(const void *data, size_t len, const RoadAllocator *allocator, RoadLine *line);
+
+/** Whether data starts with the compact encoding header (WKT text never does) */
+int isCompactLine(const void *data, size_t len);
+
+/* ========== Indexed Layout ========== */
+
+/*
+ * Fixed-width storage for long lines read through TOAST slices: a header, the
+ * chainage at the start of every block of ROAD_INDEXED_BLOCK vertices, then
+ * one record per vertex (x, y, chainage [, z]). A chainage lookup needs the
+ * header, the block index and one block, wherever they sit in the datum.
+ * Indexed lines also pass isCompactLine and decode with decodeCompactLine.
+ */
+
+#define ROAD_INDEXED_HEADER 24
+#define ROAD_INDEXED_BLOCK  256
+
+typedef struct {
+    size_t count;        /* vertices */
+    int measured;
+    int hasZ;
+    size_t blockSize;    /* vertices per index entry */
+    size_t blocks;       /* index entries */
+    size_t recordSize;   /* bytes per vertex record */
+    double start;        /* chainage of the first vertex (degrees) */
+    double end;          /* chainage of the last vertex (degrees) */
+} IndexedLineInfo;
+
+/** Encode a line in the indexed layout; a buffer allocated with allocator, or NULL */
+unsigned char *encodeIndexedLine(const RoadLine *line, const RoadAllocator *allocator, size_t *len);
+
+/**
+ * Read the first ROAD_INDEXED_HEADER bytes of a datum. Returns 0 when the
+ * data is not in the indexed layout (WKT or the varint compact encoding).
+ */
+int readIndexedLineHeader(const void *data, size_t len, IndexedLineInfo *info);
+
+/** Length of the block index (at offset ROAD_INDEXED_HEADER) and the offset of a vertex record */
+size_t indexedLineIndexSize(const IndexedLineInfo *info);
+size_t indexedLineRecordOffset(const IndexedLineInfo *info, size_t vertex);
+
+/**
+ * Vertex window [*first, *first + *count) holding the segment at distance
+ * (degrees), from the block index alone. Returns 0 if distance is off the line.
+ */
+int indexedLineWindow(const IndexedLineInfo *info, const void *index, double distance,
+                      size_t *first, size_t *count);
+
+/**
+ * Decode count consecutive vertex records starting at vertex first into a
+ * line whose prefix keeps the chainages of the whole line.
+ */
+int decodeIndexedRecords(const IndexedLineInfo *info, const void *records, size_t first, size_t count,
+                         const RoadAllocator *allocator, RoadLine *line);
+
+/* ========== Parallel Batches ========== */
+
+/*
+ * Batch kernels for one line and many inputs, split into contiguous ranges
+ * over up to threads POSIX threads. Workers only read the line and write
+ * their own range of the caller's output buffers, so results come back in
+ * input order and nothing is allocated or reported from a worker. Workers
+ * run with all signals blocked. threads <= 1, or fewer than
+ * ROAD_PARALLEL_MIN_ITEMS inputs per thread, runs on the calling thread, as
+ * does the range of any worker that cannot be started. found[i] tells
+ * whether results[i] / points[i] was set.
+ */
+
+#define ROAD_PARALLEL_MAX_THREADS 64
+#define ROAD_PARALLEL_MIN_ITEMS   1024
+
+/** calibratePoint for every point */
+void calibratePointsParallel(const RoadLine *line, const Coordinate *points, size_t n, double radius,
+                             int threads, PointDto *results, unsigned char *found);
+
+/**
+ * pointAtChainageOffset for every chainage (km); offsets holds numOffsets
+ * values in meters, where a single value applies to every chainage.
+ */
+void pointsAtChainageOffsetParallel(const RoadLine *line, const double *chainages, size_t n,
+                                    const double *offsets, size_t numOffsets, int threads,
+                                    Coordinate *points, unsigned char *found);
+
+/* ========== WKT Output ========== */
+
+char *pointToWKT(double x, double y, const RoadAllocator *allocator);
+char *coordsToWKT(const Coordinate *coords, size_t size, const RoadAllocator *allocator);
+
+/**
+ * "LINESTRING M (x y m, ...)" with each vertex chainage (km) as its measure;
+ * "LINESTRING ZM" when the line has elevations.
+ */
+char *measuredLineToWKT(const RoadLine *line, const RoadAllocator *allocator);
+
+/** The line as parsed: measures only for measured lines, Z when present */
+char *lineToWKT(const RoadLine *line, const RoadAllocator *allocator);
+
+#endif /* ROAD_CORE_H */
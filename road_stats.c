@@ -0,0 +1,256 @@
+/*
+ * road_stats.c - shared-memory runtime statistics for pg_gis_road_utils
+ *
+ * One row of pg_atomic_uint64 counters per function, allocated in shared
+ * memory at startup when the library is in shared_preload_libraries.
+ * Updates are lock-free fetch-add (and compare-exchange for the maximum),
+ * so tracking can stay enabled in production.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/timestamp.h"
+
+#include <time.h>
+
+#include "road_stats.h"
+
+static const char *const roadStatFunctionNames[ROAD_STAT_NUM_FUNCTIONS] = {
+    "get_section_by_chainage",
+    "cut_line_at_chainage",
+    "calibrate_point_on_line",
+    "read_shapefile_wkt",
+    "read_shapefile_wkb",
+    "point_at_chainage_offset",
+    "offset_section",
+    "simplify_line_preserving_chainage",
+    "encode_road_line",
+    "line_edit_span",
+    "calibrate_join",
+    "split_line_at_chainages",
+    "road_profile",
+    "road_topology",
+    "road_network_route",
+    "assemble_route",
+    "coalesce_events",
+    "distance_along_road",
+    "generate_kilometer_posts_parallel"
+};
+
+typedef struct RoadStatsShared {
+    pg_atomic_uint64 stats_reset;   /* TimestampTz of the last reset */
+    pg_atomic_uint64 counters[ROAD_STAT_NUM_FUNCTIONS][ROAD_STAT_NUM_COUNTERS];
+} RoadStatsShared;
+
+bool road_stats_track = true;
+
+static RoadStatsShared *roadStats = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* ========== Shared Memory Setup ========== */
+
+static void road_stats_shmem_request(void) {
+#if PG_VERSION_NUM >= 150000
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+#endif
+    RequestAddinShmemSpace(MAXALIGN(sizeof(RoadStatsShared)));
+}
+
+static void road_stats_shmem_startup(void) {
+    bool found;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+    roadStats = ShmemInitStruct("pg_gis_road_utils stats", sizeof(RoadStatsShared), &found);
+    if (!found) {
+        pg_atomic_init_u64(&roadStats->stats_reset, (uint64) GetCurrentTimestamp());
+        for (int f = 0; f < ROAD_STAT_NUM_FUNCTIONS; f++)
+            for (int c = 0; c < ROAD_STAT_NUM_COUNTERS; c++)
+                pg_atomic_init_u64(&roadStats->counters[f][c], 0);
+    }
+
+    LWLockRelease(AddinShmemInitLock);
+}
+
+void roadStatsInit(void) {
+    DefineCustomBoolVariable("pg_gis_road_utils.track_stats",
+                             "Collects per-function statistics in pg_gis_road_utils_stats.",
+                             "Only effective when the library is in shared_preload_libraries.",
+                             &road_stats_track,
+                             true,
+                             PGC_SUSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    if (!process_shared_preload_libraries_in_progress)
+        return;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = road_stats_shmem_request;
+#else
+    road_stats_shmem_request();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = road_stats_shmem_startup;
+}
+
+/* ========== Counter Updates ========== */
+
+uint64 roadStatsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64) ts.tv_sec * UINT64CONST(1000000000) + (uint64) ts.tv_nsec;
+}
+
+static inline bool roadStatsActive(void) {
+    return roadStats != NULL && road_stats_track;
+}
+
+static void atomicMax(pg_atomic_uint64 *counter, uint64 value) {
+    uint64 current = pg_atomic_read_u64(counter);
+
+    while (value > current) {
+        if (pg_atomic_compare_exchange_u64(counter, &current, value))
+            break;
+    }
+}
+
+void roadStatsAdd(RoadStatFunction fn, RoadStatCounter counter, uint64 value) {
+    if (!roadStatsActive() || value == 0)
+        return;
+    pg_atomic_fetch_add_u64(&roadStats->counters[fn][counter], value);
+}
+
+void roadStatsAddTime(RoadStatFunction fn, uint64 elapsed_ns) {
+    if (!roadStatsActive())
+        return;
+    pg_atomic_fetch_add_u64(&roadStats->counters[fn][ROAD_STAT_CALLS], 1);
+    pg_atomic_fetch_add_u64(&roadStats->counters[fn][ROAD_STAT_TOTAL_NS], elapsed_ns);
+    atomicMax(&roadStats->counters[fn][ROAD_STAT_MAX_NS], elapsed_ns);
+}
+
+void roadStatsBegin(RoadStatCall *call, RoadStatFunction fn) {
+    call->fn = fn;
+    call->enabled = roadStatsActive();
+    call->start_ns = call->enabled ? roadStatsNow() : 0;
+    call->mark_ns = call->start_ns;
+}
+
+void roadStatsPhase(RoadStatCall *call, RoadStatPhase phase) {
+    uint64 now;
+
+    if (!call->enabled)
+        return;
+
+    now = roadStatsNow();
+    roadStatsAdd(call->fn, (RoadStatCounter) (ROAD_STAT_PARSE_NS + phase), now - call->mark_ns);
+    call->mark_ns = now;
+}
+
+void roadStatsEnd(RoadStatCall *call) {
+    if (!call->enabled)
+        return;
+    roadStatsAddTime(call->fn, roadStatsNow() - call->start_ns);
+    call->enabled = false;
+}
+
+/* ========== SQL Interface ========== */
+
+static void requireStats(void) {
+    if (!roadStats)
+        ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                        errmsg("pg_gis_road_utils statistics are not available"),
+                        errhint("Add pg_gis_road_utils to shared_preload_libraries and restart the server.")));
+}
+
+#define NS_TO_MS(ns) ((double) (ns) / 1000000.0)
+
+PG_FUNCTION_INFO_V1(pg_gis_road_utils_stats);
+
+Datum
+pg_gis_road_utils_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext *funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        TupleDesc tupdesc;
+
+        requireStats();
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            ereport(ERROR, (errmsg("function returning record called in context that cannot accept type record")));
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+        funcctx->max_calls = ROAD_STAT_NUM_FUNCTIONS;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+
+    if (funcctx->call_cntr >= funcctx->max_calls)
+        SRF_RETURN_DONE(funcctx);
+
+    int f = (int) funcctx->call_cntr;
+    uint64 v[ROAD_STAT_NUM_COUNTERS];
+    for (int c = 0; c < ROAD_STAT_NUM_COUNTERS; c++)
+        v[c] = pg_atomic_read_u64(&roadStats->counters[f][c]);
+
+    Datum values[15];
+    bool nulls[15] = {false};
+    int i = 0;
+
+    values[i++] = CStringGetTextDatum(roadStatFunctionNames[f]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_CALLS]);
+    values[i++] = Float8GetDatum(NS_TO_MS(v[ROAD_STAT_TOTAL_NS]));
+    values[i++] = Float8GetDatum(NS_TO_MS(v[ROAD_STAT_MAX_NS]));
+    values[i++] = Float8GetDatum(NS_TO_MS(v[ROAD_STAT_PARSE_NS]));
+    values[i++] = Float8GetDatum(NS_TO_MS(v[ROAD_STAT_COMPUTE_NS]));
+    values[i++] = Float8GetDatum(NS_TO_MS(v[ROAD_STAT_OUTPUT_NS]));
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_VERTICES]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_BYTES_PARSED]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_BYTES_EMITTED]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_CACHE_HITS]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_CACHE_MISSES]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_SHP_RECORDS]);
+    values[i++] = Int64GetDatum((int64) v[ROAD_STAT_SHP_BYTES]);
+    values[i++] = TimestampTzGetDatum((TimestampTz) pg_atomic_read_u64(&roadStats->stats_reset));
+
+    HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+PG_FUNCTION_INFO_V1(pg_gis_road_utils_stats_reset);
+
+Datum
+pg_gis_road_utils_stats_reset(PG_FUNCTION_ARGS)
+{
+    requireStats();
+
+    for (int f = 0; f < ROAD_STAT_NUM_FUNCTIONS; f++)
+        for (int c = 0; c < ROAD_STAT_NUM_COUNTERS; c++)
+            pg_atomic_write_u64(&roadStats->counters[f][c], 0);
+    pg_atomic_write_u64(&roadStats->stats_reset, (uint64) GetCurrentTimestamp());
+
+    PG_RETURN_VOID();
+}
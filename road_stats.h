@@ -0,0 +1,93 @@
+/**
+ * @file road_stats.h
+ * @brief Shared-memory runtime statistics for pg_gis_road_utils functions
+ *
+ * Per-function counters kept in shared memory and updated with atomic
+ * operations only, exposed through the pg_gis_road_utils_stats view.
+ * Requires the library in shared_preload_libraries; otherwise every call
+ * below is a no-op.
+ */
+
+#ifndef ROAD_STATS_H
+#define ROAD_STATS_H
+
+/**
+ * Functions with their own row in pg_gis_road_utils_stats.
+ * Keep in sync with roadStatFunctionNames in road_stats.c.
+ */
+typedef enum RoadStatFunction {
+    ROAD_STAT_GET_SECTION = 0,
+    ROAD_STAT_CUT_LINE,
+    ROAD_STAT_CALIBRATE,
+    ROAD_STAT_READ_SHAPEFILE_WKT,
+    ROAD_STAT_READ_SHAPEFILE_WKB,
+    ROAD_STAT_POINT_OFFSET,
+    ROAD_STAT_OFFSET_SECTION,
+    ROAD_STAT_SIMPLIFY,
+    ROAD_STAT_ENCODE,
+    ROAD_STAT_LINE_EDIT,
+    ROAD_STAT_CALIBRATE_JOIN,
+    ROAD_STAT_SPLIT_LINE,
+    ROAD_STAT_ROAD_PROFILE,
+    ROAD_STAT_TOPOLOGY,
+    ROAD_STAT_NETWORK_ROUTE,
+    ROAD_STAT_ASSEMBLE_ROUTE,
+    ROAD_STAT_COALESCE_EVENTS,
+    ROAD_STAT_DISTANCE_ALONG,
+    ROAD_STAT_KM_POST_JOB,
+    ROAD_STAT_NUM_FUNCTIONS
+} RoadStatFunction;
+
+typedef enum RoadStatCounter {
+    ROAD_STAT_CALLS = 0,
+    ROAD_STAT_TOTAL_NS,
+    ROAD_STAT_MAX_NS,
+    ROAD_STAT_PARSE_NS,
+    ROAD_STAT_COMPUTE_NS,
+    ROAD_STAT_OUTPUT_NS,
+    ROAD_STAT_VERTICES,
+    ROAD_STAT_BYTES_PARSED,
+    ROAD_STAT_BYTES_EMITTED,
+    ROAD_STAT_CACHE_HITS,
+    ROAD_STAT_CACHE_MISSES,
+    ROAD_STAT_SHP_RECORDS,
+    ROAD_STAT_SHP_BYTES,
+    ROAD_STAT_NUM_COUNTERS
+} RoadStatCounter;
+
+/** Phases of a call; time since the previous mark is charged to the phase */
+typedef enum RoadStatPhase {
+    ROAD_PHASE_PARSE = 0,
+    ROAD_PHASE_COMPUTE,
+    ROAD_PHASE_OUTPUT
+} RoadStatPhase;
+
+/**
+ * Timer for one function call, kept on the caller's stack
+ */
+typedef struct RoadStatCall {
+    RoadStatFunction fn;
+    bool enabled;
+    uint64 start_ns;
+    uint64 mark_ns;
+} RoadStatCall;
+
+/* GUC pg_gis_road_utils.track_stats */
+extern bool road_stats_track;
+
+/** Register hooks and GUCs; called from _PG_init */
+extern void roadStatsInit(void);
+
+extern uint64 roadStatsNow(void);
+
+extern void roadStatsBegin(RoadStatCall *call, RoadStatFunction fn);
+extern void roadStatsPhase(RoadStatCall *call, RoadStatPhase phase);
+extern void roadStatsEnd(RoadStatCall *call);
+
+/** Add to a counter directly; for timing use roadStatsAddTime */
+extern void roadStatsAdd(RoadStatFunction fn, RoadStatCounter counter, uint64 value);
+
+/** Count one completed call of elapsed_ns (total, max and calls) */
+extern void roadStatsAddTime(RoadStatFunction fn, uint64 elapsed_ns);
+
+#endif /* ROAD_STATS_H */
@@ -3,7 +3,8 @@
  * PostgreSQL extension for reading ESRI Shapefiles (.shp + .dbf)
  * Returns records with WKT or WKB geometry
  *
- * Supports Point, MultiPoint, Polyline (LineString/MultiLineString), Polygon
+ * Supports Point, MultiPoint, Polyline (LineString/MultiLineString), Polygon;
+ * PolylineZ keeps its Z values
  */
 
 #include "postgres.h"
@@ -23,6 +24,7 @@
 #include <arpa/inet.h>
 
 #include "shapefile_reader.h"
+#include "road_stats.h"
 
 /* ============================
  * Helper Functions
@@ -165,7 +167,12 @@ static GEOSGeometry *read_multipoint_geometry(GEOSContextHandle_t context, FILE
     return geom;
 }
 
-static GEOSGeometry *read_polyline_geometry(GEOSContextHandle_t context, FILE *fp) {
+/*
+ * PolyLine and PolyLineZ records. For PolyLineZ the Z range and one Z per
+ * point follow the XY points and are kept as a 3D coordinate sequence;
+ * the optional M block after them is skipped by the record reader.
+ */
+static GEOSGeometry *read_polyline_geometry(GEOSContextHandle_t context, FILE *fp, int hasZ) {
     fseek(fp, 32, SEEK_CUR);
     int32_t numParts, numPoints;
     fread(&numParts, 4, 1, fp);
@@ -183,6 +190,13 @@ static GEOSGeometry *read_polyline_geometry(GEOSContextHandle_t context, FILE *f
         fread(&coords[i * 2 + 1], 8, 1, fp);
     }
 
+    double *z = NULL;
+    if (hasZ) {
+        fseek(fp, 16, SEEK_CUR); // skip Z range
+        z = palloc(numPoints * sizeof(double));
+        fread(z, 8, numPoints, fp);
+    }
+
     GEOSGeometry **lines = (GEOSGeometry **) palloc(numParts * sizeof(GEOSGeometry * ));
     int validParts = 0;
 
@@ -191,11 +205,12 @@ static GEOSGeometry *read_polyline_geometry(GEOSContextHandle_t context, FILE *f
         int end = (part < numParts - 1) ? parts[part + 1] : numPoints;
         int size = end - start;
         if (size < 2) continue; // skip invalid
-        GEOSCoordSequence *seq = GEOSCoordSeq_create_r(context, size, 2);
+        GEOSCoordSequence *seq = GEOSCoordSeq_create_r(context, size, hasZ ? 3 : 2);
         for (int i = 0; i < size; i++) {
             int idx = start + i;
             GEOSCoordSeq_setX_r(context, seq, i, coords[idx * 2]);
             GEOSCoordSeq_setY_r(context, seq, i, coords[idx * 2 + 1]);
+            if (z) GEOSCoordSeq_setZ_r(context, seq, i, z[idx]);
         }
         lines[validParts++] = GEOSGeom_createLineString_r(context, seq);
     }
@@ -208,6 +223,7 @@ static GEOSGeometry *read_polyline_geometry(GEOSContextHandle_t context, FILE *f
     pfree(lines);
     pfree(parts);
     pfree(coords);
+    if (z) pfree(z);
 
     return geom;
 }
@@ -280,6 +296,11 @@ static ShapefileRecord *read_shapefile_record(
     }
     fread(&contentLength, 4, 1, shpFile);
     record->recordNumber = swap_endian_32(recNum);
+    long contentStart = ftell(shpFile);
+
+    /* Content length is in 16-bit words; the DBF row has a deletion flag */
+    record->bytesRead = 8 + (int) swap_endian_32(contentLength) * 2 + 1;
+    for (int i = 0; i < numFields; i++) record->bytesRead += fields[i].length;
 
     int32_t shapeType;
     fread(&shapeType, 4, 1, shpFile);
@@ -295,19 +316,21 @@ static ShapefileRecord *read_shapefile_record(
             record->geometry = read_multipoint_geometry(context, shpFile);
             break;
         case SHAPE_POLYLINE:
-            record->geometry = read_polyline_geometry(context, shpFile);
+            record->geometry = read_polyline_geometry(context, shpFile, 0);
             break;
         case SHAPE_POLYGON:
             record->geometry = read_polygon_geometry(context, shpFile);
             break;
+        case SHAPE_POLYLINEZ:
+            // road profiles need elevations
+            record->geometry = read_polyline_geometry(context, shpFile, 1);
+            break;
         case SHAPE_POINTZ:
         case SHAPE_MULTIPOINTZ:
-        case SHAPE_POLYLINEZ:
         case SHAPE_POLYGONZ:
             // ignore Z
             if (shapeType == SHAPE_POINTZ) record->geometry = read_point_geometry(context, shpFile);
             else if (shapeType == SHAPE_MULTIPOINTZ) record->geometry = read_multipoint_geometry(context, shpFile);
-            else if (shapeType == SHAPE_POLYLINEZ) record->geometry = read_polyline_geometry(context, shpFile);
             else if (shapeType == SHAPE_POLYGONZ) record->geometry = read_polygon_geometry(context, shpFile);
             break;
         default:
@@ -315,6 +338,9 @@ static ShapefileRecord *read_shapefile_record(
             break;
     }
 
+    /* Z and M blocks are not always read in full; continue at the next record */
+    fseek(shpFile, contentStart + (long) swap_endian_32(contentLength) * 2, SEEK_SET);
+
     record->attributes = read_dbf_attributes(dbfFile, fields, numFields);
     record->numAttributes = numFields;
 
@@ -330,6 +356,7 @@ PG_FUNCTION_INFO_V1(read_shapefile_wkb);
 
 Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
     FuncCallContext *funcctx;
+    uint64_t callStart = roadStatsNow();
 
     if (SRF_IS_FIRSTCALL()) {
         funcctx = SRF_FIRSTCALL_INIT();  // MUST call first!
@@ -342,6 +369,7 @@ Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
         ShapefileContext *ctx = (ShapefileContext *) palloc(sizeof(ShapefileContext));
         ctx->currentRecord = 0;
         ctx->geosContext = GEOS_init_r();
+        ctx->elapsedNs = 0;
 
         // Open files
         char shp_path[1024], dbf_path[1024];
@@ -386,6 +414,8 @@ Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
         fclose(ctx->shpFile);
         fclose(ctx->dbfFile);
         GEOS_finish_r(ctx->geosContext);
+        /* A scan is counted once, when it completes */
+        roadStatsAddTime(ROAD_STAT_READ_SHAPEFILE_WKT, ctx->elapsedNs + (roadStatsNow() - callStart));
         SRF_RETURN_DONE(funcctx);
     }
 
@@ -409,6 +439,7 @@ Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
 
     if (record->geometry) {
         GEOSWKTWriter *writer = GEOSWKTWriter_create_r(ctx->geosContext);
+        GEOSWKTWriter_setOutputDimension_r(ctx->geosContext, writer, 3); // keep PolyLineZ elevations
         char *wkt = GEOSWKTWriter_write_r(ctx->geosContext, writer, record->geometry);
 
         MemoryContext oldctx = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
@@ -422,7 +453,12 @@ Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
         nulls[2] = true;
     }
 
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKT, ROAD_STAT_SHP_RECORDS, 1);
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKT, ROAD_STAT_SHP_BYTES, record->bytesRead);
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKT, ROAD_STAT_BYTES_EMITTED, nulls[2] ? 0 : VARSIZE_ANY_EXHDR(DatumGetPointer(values[2])));
+
     ctx->currentRecord++;
+    ctx->elapsedNs += roadStatsNow() - callStart;
     HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
     Datum result = HeapTupleGetDatum(tuple);
     SRF_RETURN_NEXT(funcctx, result);
@@ -432,6 +468,7 @@ Datum read_shapefile_wkt(PG_FUNCTION_ARGS) {
 Datum
 read_shapefile_wkb(PG_FUNCTION_ARGS) {
     FuncCallContext *funcctx;
+    uint64_t callStart = roadStatsNow();
     ShapefileContext *ctx;
 
     if (SRF_IS_FIRSTCALL()) {
@@ -445,6 +482,7 @@ read_shapefile_wkb(PG_FUNCTION_ARGS) {
         ctx = (ShapefileContext *) palloc(sizeof(ShapefileContext));
         ctx->currentRecord = 0;
         ctx->geosContext = GEOS_init_r();
+        ctx->elapsedNs = 0;
 
         char shp_path[1024], dbf_path[1024];
         snprintf(shp_path, sizeof(shp_path), "%s.shp", base_path);
@@ -488,6 +526,8 @@ read_shapefile_wkb(PG_FUNCTION_ARGS) {
         fclose(ctx->shpFile);
         fclose(ctx->dbfFile);
         GEOS_finish_r(ctx->geosContext);
+        /* A scan is counted once, when it completes */
+        roadStatsAddTime(ROAD_STAT_READ_SHAPEFILE_WKB, ctx->elapsedNs + (roadStatsNow() - callStart));
         SRF_RETURN_DONE(funcctx);
     }
 
@@ -516,6 +556,7 @@ read_shapefile_wkb(PG_FUNCTION_ARGS) {
     if (record->geometry) {
         GEOSWKBWriter *wkbWriter = GEOSWKBWriter_create_r(ctx->geosContext);
         GEOSWKBWriter_setByteOrder_r(ctx->geosContext, wkbWriter, 1); // 1 = little-endian
+        GEOSWKBWriter_setOutputDimension_r(ctx->geosContext, wkbWriter, 3);
 
         size_t wkb_size = 0;
         unsigned char *wkb_buffer = GEOSWKBWriter_write_r(ctx->geosContext, wkbWriter, record->geometry, &wkb_size);
@@ -537,7 +578,12 @@ read_shapefile_wkb(PG_FUNCTION_ARGS) {
         nulls[2] = true;
     }
 
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKB, ROAD_STAT_SHP_RECORDS, 1);
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKB, ROAD_STAT_SHP_BYTES, record->bytesRead);
+    roadStatsAdd(ROAD_STAT_READ_SHAPEFILE_WKB, ROAD_STAT_BYTES_EMITTED, nulls[2] ? 0 : VARSIZE_ANY_EXHDR(DatumGetPointer(values[2])));
+
     ctx->currentRecord++;
+    ctx->elapsedNs += roadStatsNow() - callStart;
 
     HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
     Datum result = HeapTupleGetDatum(tuple);
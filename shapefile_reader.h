@@ -70,6 +70,7 @@ typedef struct {
     char **attributes;
     int numAttributes;
     void *geometry;  // GEOSGeometry* (void* to avoid including geos_c.h here)
+    int bytesRead;   // .shp record plus .dbf row, for statistics
 } ShapefileRecord;
 
 /**
@@ -83,6 +84,7 @@ typedef struct {
     DBFField *fields;
     int numFields;
     void *geosContext;  // GEOSContextHandle_t
+    uint64_t elapsedNs; // time spent in this scan, reported when it finishes
 } ShapefileContext;
 
 #endif /* SHAPEFILE_READER_H */
\ No newline at end of file
@@ -263,6 +263,594 @@ SELECT
     (section_json->>'start_lon')::DOUBLE PRECISION AS start_longitude
 FROM section_data;
 
+\echo ''
+\echo 'Test 13: Runtime statistics'
+\echo '----------------------------'
+
+-- Needs shared_preload_libraries = 'pg_gis_road_utils'
+DO $$
+DECLARE
+    n_calls BIGINT;
+BEGIN
+    PERFORM pg_gis_road_utils_stats_reset();
+    PERFORM cut_line_at_chainage('LINESTRING(0 0, 10 0)', 5.0);
+    SELECT calls INTO n_calls FROM pg_gis_road_utils_stats
+    WHERE function_name = 'cut_line_at_chainage';
+    IF n_calls = 1 THEN
+        RAISE NOTICE 'SUCCESS: cut_line_at_chainage counted once';
+    ELSE
+        RAISE NOTICE 'ERROR: expected 1 call, got %', n_calls;
+    END IF;
+EXCEPTION WHEN object_not_in_prerequisite_state THEN
+    RAISE NOTICE 'SKIPPED: %', SQLERRM;
+END $$;
+
+SELECT function_name, calls, vertices, bytes_parsed, bytes_emitted
+FROM pg_gis_road_utils_stats
+WHERE calls > 0;
+
+\echo ''
+\echo 'Test 14: Offset points and sections'
+\echo '------------------------------------'
+
+-- 111.32 km is one degree along the line; 1113.2 m is 0.01 degrees
+SELECT point_at_chainage_offset('LINESTRING(0 0, 10 0)', 111.32, 1113.2) AS left_of_line;
+SELECT point_at_chainage_offset('LINESTRING(0 0, 10 0)', 111.32, -1113.2) AS right_of_line;
+
+SELECT point_at_chainage_offset(
+    'LINESTRING(0 0, 10 0)',
+    ARRAY[0.0, 111.32, 5000.0],
+    ARRAY[1113.2]
+) AS batch_points;
+
+SELECT offset_section('LINESTRING(0 0, 10 0, 10 10)', 556.6, 1669.8, 1113.2) AS offset_corner;
+
+SELECT offset_section(
+    'LINESTRING(0 0, 10 0, 10 10)',
+    ARRAY[0.0, 556.6, 3000.0],
+    ARRAY[111.32, 1669.8, 3100.0],
+    ARRAY[-1113.2]
+) AS batch_sections;
+
+\echo ''
+\echo 'Test 15: Chainage-preserving simplification'
+\echo '--------------------------------------------'
+
+SELECT simplify_line_preserving_chainage('LINESTRING(0 0, 1 0.00001, 2 0, 2 5)', 5.0) AS simplified;
+
+-- Chainages on the simplified line match the original
+DO $$
+DECLARE
+    original TEXT := 'LINESTRING(0 0, 1 0.00001, 2 0, 2 1, 2 2, 2 5)';
+    a JSON;
+    b JSON;
+BEGIN
+    a := get_section_by_chainage(original, 333.96, 400.0);
+    b := get_section_by_chainage(simplify_line_preserving_chainage(original, 5.0), 333.96, 400.0);
+    IF abs((a->>'start_lat')::DOUBLE PRECISION - (b->>'start_lat')::DOUBLE PRECISION) < 1e-9
+       AND abs((a->>'start_lon')::DOUBLE PRECISION - (b->>'start_lon')::DOUBLE PRECISION) < 1e-9 THEN
+        RAISE NOTICE 'SUCCESS: chainage preserved after simplification';
+    ELSE
+        RAISE NOTICE 'ERROR: % <> %', a->>'geometry', b->>'geometry';
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 16: Compact line encoding'
+\echo '-------------------------------'
+
+SELECT octet_length(encode_road_line('LINESTRING(39.2083 -6.7924, 39.2101 -6.7950, 39.2155 -6.8012)')) AS compact_bytes,
+       octet_length('LINESTRING(39.2083 -6.7924, 39.2101 -6.7950, 39.2155 -6.8012)') AS wkt_bytes;
+
+SELECT decode_road_line(encode_road_line('LINESTRING(39.2083 -6.7924, 39.2101 -6.7950, 39.2155 -6.8012)')) AS decoded;
+
+DO $$
+DECLARE
+    wkt TEXT := 'LINESTRING(0 0, 10 0, 10 10)';
+BEGIN
+    IF cut_line_at_chainage(encode_road_line(wkt), 500.0) = cut_line_at_chainage(wkt, 500.0) THEN
+        RAISE NOTICE 'SUCCESS: compact and WKT input agree';
+    ELSE
+        RAISE NOTICE 'ERROR: % <> %', cut_line_at_chainage(encode_road_line(wkt), 500.0), cut_line_at_chainage(wkt, 500.0);
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 17: Incremental re-indexing after an edit'
+\echo '-----------------------------------------------'
+
+SELECT line_edit_span(
+    'LINESTRING(0 0, 1 0, 2 0, 3 0, 4 0)',
+    'LINESTRING(0 0, 1 0, 1.5 1, 2.5 1, 3 0, 4 0)'
+) AS edit;
+
+DROP TABLE IF EXISTS road_events;
+CREATE TABLE road_events (id SERIAL PRIMARY KEY, road_code TEXT, chainage DOUBLE PRECISION);
+INSERT INTO road_events (road_code, chainage) VALUES
+    ('A1', 50.0), ('A1', 200.0), ('A1', 400.0), ('B2', 400.0);
+
+DO $$
+DECLARE
+    n BIGINT;
+    moved DOUBLE PRECISION;
+BEGIN
+    n := apply_chainage_edit('road_events', 'chainage',
+        'LINESTRING(0 0, 1 0, 2 0, 3 0, 4 0)',
+        'LINESTRING(0 0, 1 0, 1.5 1, 2.5 1, 3 0, 4 0)',
+        'road_code', 'A1');
+    SELECT chainage INTO moved FROM road_events WHERE road_code = 'A1' AND id = 3;
+    IF n = 2 AND abs(moved - (400.0 + 111.32 * (2 * sqrt(1.25) - 1))) < 0.001 THEN
+        RAISE NOTICE 'SUCCESS: % events re-indexed', n;
+    ELSE
+        RAISE NOTICE 'ERROR: % rows updated, chainage %', n, moved;
+    END IF;
+END $$;
+
+DROP TABLE road_events;
+
+\echo ''
+\echo 'Test 18: Calibration join'
+\echo '--------------------------'
+
+SELECT * FROM calibrate_join(
+    $q$SELECT * FROM (VALUES (1, 'POINT(5 0.1)'), (2, 'POINT(10 9.95)'), (3, 'POINT(50 50)')) AS p(id, wkt)$q$,
+    $q$SELECT * FROM (VALUES (10, 'LINESTRING(0 0, 5 0, 10 0, 10 10)'), (20, 'LINESTRING(5 -5, 5 5)')) AS r(id, wkt)$q$,
+    1.0
+) ORDER BY point_id, road_id;
+
+DO $$
+DECLARE
+    joined DOUBLE PRECISION;
+    direct DOUBLE PRECISION;
+BEGIN
+    SELECT chainage INTO joined FROM calibrate_join(
+        $q$SELECT 1, 'POINT(5 0.1)'$q$, $q$SELECT 10, 'LINESTRING(0 0, 5 0, 10 0, 10 10)'$q$, 1.0);
+    direct := (calibrate_point_on_line('LINESTRING(0 0, 5 0, 10 0, 10 10)', 'POINT(5 0.1)', 1.0)->>'chainage')::DOUBLE PRECISION;
+    IF abs(joined - direct) < 1e-6 THEN
+        RAISE NOTICE 'SUCCESS: calibrate_join matches calibrate_point_on_line';
+    ELSE
+        RAISE NOTICE 'ERROR: % <> %', joined, direct;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 19: Split line at chainages'
+\echo '---------------------------------'
+
+SELECT * FROM split_line_at_chainages('LINESTRING(0 0, 10 0, 10 10)', ARRAY[900.0, 300.0, 1113.2, 300.0, 5000.0]);
+
+DO $$
+DECLARE
+    n INTEGER;
+BEGIN
+    SELECT count(*) INTO n FROM split_line_at_chainages('LINESTRING(0 0, 10 0, 10 10)', ARRAY[300.0, 900.0]);
+    IF n = 3 THEN
+        RAISE NOTICE 'SUCCESS: 2 chainages give 3 pieces';
+    ELSE
+        RAISE NOTICE 'ERROR: expected 3 pieces, got %', n;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 20: Road profile'
+\echo '---------------------'
+
+SELECT * FROM road_profile('LINESTRING Z (0 0 100, 0.001 0 101.1132, 0.001 0.001 101.1132)', 40.0);
+
+DO $$
+DECLARE
+    n INTEGER;
+    g DOUBLE PRECISION;
+BEGIN
+    SELECT count(*), min(grade) FILTER (WHERE sample = 1) INTO n, g
+    FROM road_profile('LINESTRING Z (0 0 100, 0.001 0 101.1132, 0.001 0.001 101.1132)', 40.0);
+    IF n = 6 AND abs(g - 1.0) < 1e-6 THEN
+        RAISE NOTICE 'SUCCESS: 6 intervals, 1%% grade on the first';
+    ELSE
+        RAISE NOTICE 'ERROR: expected 6 intervals with 1%% grade, got % and %', n, g;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 21: Chainage equations'
+\echo '---------------------------'
+
+SELECT measured_to_posted_chainage(3.0, '{{2.0, 2.5}, {5.0, 5.3}}') AS posted,
+       posted_to_measured_chainage(3.5, '{{2.0, 2.5}, {5.0, 5.3}}') AS measured,
+       posted_to_measured_chainage(2.2, '{{2.0, 2.5}, {5.0, 5.3}}') AS skipped;
+
+DO $$
+DECLARE
+    line TEXT := 'LINESTRING(0 0, 0.0449156 0, 0.1 0)';
+    eq DOUBLE PRECISION[] := '{{2.0, 2.5}, {5.0, 5.3}}';
+    ch DOUBLE PRECISION;
+BEGIN
+    -- The middle vertex is at measured 5.0 km, posted 5.3 km
+    SELECT (calibrate_point_on_line(line, 'POINT(0.0449156 0)', 0.001, eq)->>'chainage')::DOUBLE PRECISION
+    INTO ch;
+    IF abs(ch - 5.3) < 0.001 AND cut_line_at_chainage(line, 5.3, eq) = cut_line_at_chainage(line, 5.0) THEN
+        RAISE NOTICE 'SUCCESS: calibration and cuts use posted chainages';
+    ELSE
+        RAISE NOTICE 'ERROR: expected posted chainage 5.3, got %', ch;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 22: Direction of travel'
+\echo '----------------------------'
+
+SELECT cut_line_at_chainage('LINESTRING(5 0, 10 0, 10 8)', 200.0, -1) AS reverse_cut,
+       offset_section('LINESTRING(5 0, 10 0, 10 8)', 0.0, 100.0, 3.5, -1) AS reverse_offset;
+
+DO $$
+DECLARE
+    line TEXT := 'LINESTRING(5 0, 10 0, 10 8)';
+    reversed TEXT := 'LINESTRING(10 8, 10 0, 5 0)';
+    a JSON;
+    b JSON;
+    ch DOUBLE PRECISION;
+BEGIN
+    -- Same section and calibration as on a reversed copy of the line
+    a := get_section_by_chainage(line, 100.0, 1000.0, -1);
+    b := get_section_by_chainage(reversed, 100.0, 1000.0);
+    SELECT (calibrate_point_on_line(line, 'POINT(10 2)', 1.0, -1)->>'chainage')::DOUBLE PRECISION INTO ch;
+    IF a->>'start_lat' = b->>'start_lat' AND a->>'end_lon' = b->>'end_lon'
+       AND a->>'length' = b->>'length' AND abs(ch - 6 * 111.32) < 0.001 THEN
+        RAISE NOTICE 'SUCCESS: direction -1 matches the reversed line';
+    ELSE
+        RAISE NOTICE 'ERROR: direction -1 differs from the reversed line (% vs %, chainage %)', a, b, ch;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 23: Indexed layout'
+\echo '-----------------------'
+
+DO $$
+DECLARE
+    line TEXT;
+    indexed BYTEA;
+BEGIN
+    SELECT 'LINESTRING(' || string_agg((i * 0.001)::TEXT || ' ' || (i % 2 * 0.0005)::TEXT, ', ') || ')'
+    INTO line FROM generate_series(0, 999) AS i;
+    indexed := encode_road_line_indexed(line);
+    IF point_at_chainage_offset(indexed, 50.0, 3.0) = point_at_chainage_offset(line, 50.0, 3.0)
+       AND point_at_chainage_offset(indexed, 50.0, 3.0, -1) = point_at_chainage_offset(line, 50.0, 3.0, -1)
+       AND cut_line_at_chainage(indexed, 50.0) = cut_line_at_chainage(line, 50.0)
+       AND cut_line_at_chainage(indexed, 50.0, -1) = cut_line_at_chainage(line, 50.0, -1) THEN
+        RAISE NOTICE 'SUCCESS: indexed lines give the same results as WKT';
+    ELSE
+        RAISE NOTICE 'ERROR: indexed and WKT results differ';
+    END IF;
+END $$;
+
+-- Needs shared_preload_libraries = 'pg_gis_road_utils'
+DO $$
+DECLARE
+    indexed BYTEA;
+    parsed BIGINT;
+BEGIN
+    SELECT encode_road_line_indexed('LINESTRING(' || string_agg((i * 0.001)::TEXT || ' 0', ', ') || ')')
+    INTO indexed FROM generate_series(0, 4999) AS i;
+    PERFORM pg_gis_road_utils_stats_reset();
+    PERFORM cut_line_at_chainage(indexed, 50.0);
+    SELECT bytes_parsed INTO parsed FROM pg_gis_road_utils_stats
+    WHERE function_name = 'cut_line_at_chainage';
+    IF parsed < octet_length(indexed) / 10 THEN
+        RAISE NOTICE 'SUCCESS: cut_line_at_chainage reads one block of an indexed line';
+    ELSE
+        RAISE NOTICE 'ERROR: cut_line_at_chainage read % of % bytes', parsed, octet_length(indexed);
+    END IF;
+EXCEPTION WHEN object_not_in_prerequisite_state THEN
+    RAISE NOTICE 'SKIPPED: %', SQLERRM;
+END $$;
+
+\echo ''
+\echo 'Test 24: Repeated line arguments'
+\echo '--------------------------------'
+
+DO $$
+DECLARE
+    n INTEGER;
+BEGIN
+    -- The same call site sees alternating and repeated lines; cached lines must not leak across rows
+    SELECT count(*) INTO n
+    FROM (
+        SELECT i,
+               CASE WHEN i % 3 = 0 THEN 'LINESTRING(0 0, 0 1)' ELSE 'LINESTRING(0 0, 1 0)' END AS line
+        FROM generate_series(1, 30) AS i
+    ) t
+    WHERE cut_line_at_chainage(line, 50.0) <>
+          CASE WHEN i % 3 = 0 THEN cut_line_at_chainage('LINESTRING(0 0, 0 1)', 50.0)
+               ELSE cut_line_at_chainage('LINESTRING(0 0, 1 0)', 50.0) END;
+    IF n = 0 THEN
+        RAISE NOTICE 'SUCCESS: repeated and alternating lines give per-row results';
+    ELSE
+        RAISE NOTICE 'ERROR: % rows used the wrong cached line', n;
+    END IF;
+END $$;
+
+DO $$
+DECLARE
+    line TEXT;
+    section JSON;
+    offset_wkt TEXT;
+    warm BIGINT;
+    total BIGINT;
+BEGIN
+    -- Cache hits must leave section output in the per-call scratch, not in the line cache
+    IF to_regclass('pg_backend_memory_contexts') IS NULL THEN
+        RAISE NOTICE 'SKIPPED: pg_backend_memory_contexts needs PostgreSQL 14';
+        RETURN;
+    END IF;
+    SELECT 'LINESTRING(' || string_agg(format('%s %s', i * 0.001, (i % 2) * 0.0001), ', ') || ')'
+    INTO line FROM generate_series(0, 500) AS i;
+    FOR i IN 1..2000 LOOP
+        section := get_section_by_chainage(line, 1.0, 50.0);
+        offset_wkt := offset_section(line, 1.0, 50.0, 3.5);
+        IF i = 20 THEN
+            SELECT sum(total_bytes) INTO warm FROM pg_backend_memory_contexts
+            WHERE name = 'pg_gis_road_utils line cache';
+        END IF;
+    END LOOP;
+    SELECT sum(total_bytes) INTO total FROM pg_backend_memory_contexts
+    WHERE name = 'pg_gis_road_utils line cache';
+    IF total = warm THEN
+        RAISE NOTICE 'SUCCESS: line cache stays at % bytes over 2000 cache hits', total;
+    ELSE
+        RAISE NOTICE 'ERROR: line cache grew from % to % bytes', warm, total;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 25: JSONB results'
+\echo '----------------------'
+
+SELECT get_section_by_chainage_jsonb('LINESTRING(0 0, 10 0, 10 10)', 100.0, 1200.0) AS section,
+       calibrate_point_on_line_jsonb('LINESTRING(0 0, 10 0)', 'POINT(5 0.1)', 1.0) AS calibration;
+
+DO $$
+BEGIN
+    IF get_section_by_chainage_jsonb('LINESTRING(0 0, 10 0, 10 10)', 100.0, 1200.0) =
+       get_section_by_chainage('LINESTRING(0 0, 10 0, 10 10)', 100.0, 1200.0)::JSONB
+       AND calibrate_point_on_line_jsonb('LINESTRING(0 0, 10 0)', 'POINT(5 0.1)', 1.0, '{}', -1) =
+           calibrate_point_on_line('LINESTRING(0 0, 10 0)', 'POINT(5 0.1)', 1.0, -1)::JSONB THEN
+        RAISE NOTICE 'SUCCESS: jsonb variants match the json results';
+    ELSE
+        RAISE NOTICE 'ERROR: jsonb and json results differ';
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 26: Threaded batch kernels'
+\echo '-------------------------------'
+
+DO $$
+DECLARE
+    line TEXT := 'LINESTRING(0 0, 2 0, 2 2, 4 2, 4 4)';
+    chainages DOUBLE PRECISION[] := ARRAY(SELECT g * 0.2 FROM generate_series(0, 5000) g);
+    points TEXT[] := ARRAY(SELECT format('POINT(%s %s)', g * 0.001, (g % 7) * 0.0001) FROM generate_series(0, 5000) g);
+    serial_points TEXT[];
+    serial_chainages DOUBLE PRECISION[];
+BEGIN
+    SET LOCAL pg_gis_road_utils.batch_threads = 1;
+    serial_points := point_at_chainage_offset(line, chainages, ARRAY[-4.5]);
+    serial_chainages := calibrate_point_on_line(line, points, 0.5);
+
+    SET LOCAL pg_gis_road_utils.batch_threads = 4;
+    IF point_at_chainage_offset(line, chainages, ARRAY[-4.5]) IS NOT DISTINCT FROM serial_points
+       AND calibrate_point_on_line(line, points, 0.5) IS NOT DISTINCT FROM serial_chainages
+       AND array_length(serial_chainages, 1) = 5001 THEN
+        RAISE NOTICE 'SUCCESS: threaded batches match the single-threaded results';
+    ELSE
+        RAISE NOTICE 'ERROR: threaded batch results differ';
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 27: Road topology'
+\echo '----------------------'
+
+SELECT road_id, start_node, end_node, round(end_ch::NUMERIC, 3) AS end_ch, start_degree, end_degree, component
+FROM road_topology($q$SELECT * FROM (VALUES (1, 'LINESTRING(0 0, 1 0)'),
+                                            (2, 'LINESTRING(1.0004 0, 1 1)'),
+                                            (3, 'LINESTRING(1 0, 2 0)'),
+                                            (4, 'LINESTRING(5 5, 6 5)')) AS r (id, wkt)$q$, 0.001)
+ORDER BY road_id;
+
+DO $$
+DECLARE
+    nodes BIGINT;
+    junction_degree INTEGER;
+BEGIN
+    -- A schema-qualified edge table, and a caller's temp table named like the old staging table
+    CREATE SCHEMA test_topology_schema;
+    CREATE TEMP TABLE road_topology_rows (note TEXT);
+    nodes := build_road_topology($q$SELECT * FROM (VALUES (1, 'LINESTRING(0 0, 1 0)'),
+                                                          (2, 'LINESTRING(1.0004 0, 1 1)'),
+                                                          (3, 'LINESTRING(1 0, 2 0)'),
+                                                          (4, 'LINESTRING(5 5, 6 5)')) AS r (id, wkt)$q$,
+                                 0.001, 'test_topology_schema.test_topology_edges', 'test_topology_nodes');
+    SELECT degree INTO junction_degree FROM test_topology_nodes WHERE x = 1 AND y = 0;
+    IF nodes = 6 AND junction_degree = 3
+       AND (SELECT count(DISTINCT component) FROM test_topology_schema.test_topology_edges) = 2 THEN
+        RAISE NOTICE 'SUCCESS: topology has 6 nodes, a degree 3 junction and 2 components';
+    ELSE
+        RAISE NOTICE 'ERROR: unexpected topology (% nodes, junction degree %)', nodes, junction_degree;
+    END IF;
+    DROP SCHEMA test_topology_schema CASCADE;
+    DROP TABLE test_topology_nodes;
+    DROP TABLE road_topology_rows;
+END $$;
+
+\echo ''
+\echo 'Test 28: Network routing'
+\echo '------------------------'
+
+CREATE TEMP TABLE test_network (id BIGINT, wkt TEXT);
+INSERT INTO test_network VALUES
+    (1, 'LINESTRING(0 0, 1 0)'),
+    (2, 'LINESTRING(1 0, 2 0)'),
+    (3, 'LINESTRING(0 0, 0 1, 2 1, 2 0)'),
+    (4, 'LINESTRING(5 5, 6 5)');
+
+SELECT seq, road_id, round(start_ch::NUMERIC, 3) AS start_ch, round(end_ch::NUMERIC, 3) AS end_ch
+FROM road_network_route('SELECT id, wkt FROM test_network', 1, 20.0, 3, 400.0);
+
+DO $$
+DECLARE
+    d DOUBLE PRECISION;
+    unit DOUBLE PRECISION := (calibrate_point_on_line('LINESTRING(0 0, 1 0)', 'POINT(1 0)', 0.1)->>'chainage')::DOUBLE PRECISION;
+BEGIN
+    -- Road 3 is 4 units long; 400 km is reached through roads 1 and 2
+    d := road_network_distance('SELECT id, wkt FROM test_network', 1, 20.0, 3, 400.0);
+    IF abs(d - ((unit - 20.0) + unit + (4 * unit - 400.0))) < 1e-6
+       AND road_network_distance('SELECT id, wkt FROM test_network', 1, 20.0, 4, 0.0) IS NULL
+       AND road_network_distance('SELECT id, wkt FROM test_network', 1, 20.0, 1, 50.0) = 30.0 THEN
+        RAISE NOTICE 'SUCCESS: network distances follow the shortest route';
+    ELSE
+        RAISE NOTICE 'ERROR: unexpected network distance %', d;
+    END IF;
+
+    -- An edit later in the same transaction is routed over without road_network_reset()
+    INSERT INTO test_network VALUES (5, 'LINESTRING(2 0, 5 5)');
+    IF road_network_distance('SELECT id, wkt FROM test_network', 1, 20.0, 4, 0.0) IS NOT NULL THEN
+        RAISE NOTICE 'SUCCESS: the network graph follows edits to the roads';
+    ELSE
+        RAISE NOTICE 'ERROR: the network graph missed an edit to the roads';
+    END IF;
+    PERFORM road_network_reset();
+END $$;
+
+DROP TABLE test_network;
+
+\echo ''
+\echo 'Test 29: Route assembly'
+\echo '-----------------------'
+
+SELECT assemble_route(id, wkt, 0.001)
+FROM (VALUES (10, 'LINESTRING(1 0, 2 0)'),
+             (11, 'LINESTRING(3 0, 2.0005 0)'),
+             (12, 'LINESTRING(0 0, 0.5 0, 1 0)'),
+             (13, 'LINESTRING(5 5, 6 5)')) AS links (id, wkt);
+
+DO $$
+DECLARE
+    route JSON;
+BEGIN
+    SELECT assemble_route(id, wkt, 0.001) INTO route
+    FROM (VALUES (10, 'LINESTRING(1 0, 2 0)'),
+                 (11, 'LINESTRING(3 0, 2.0005 0)'),
+                 (12, 'LINESTRING(0 0, 0.5 0, 1 0)'),
+                 (13, 'LINESTRING(5 5, 6 5)')) AS links (id, wkt);
+    IF route->'segments'->0->>'id' = '12' AND route->'segments'->2->>'reversed' = 'true'
+       AND (route->'unassembled'->>0)::INT = 13
+       AND abs((route->>'length')::DOUBLE PRECISION -
+               (calibrate_point_on_line('LINESTRING(0 0, 3 0)', 'POINT(3 0)', 0.1)->>'chainage')::DOUBLE PRECISION) < 1e-5 THEN
+        RAISE NOTICE 'SUCCESS: segments assembled in route order across the gap';
+    ELSE
+        RAISE NOTICE 'ERROR: unexpected route %', route;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 30: Event coalescing'
+\echo '-------------------------'
+
+SELECT coalesce_events(from_ch, to_ch, surface ORDER BY from_ch)
+FROM (VALUES (0.0, 1.0, 'paved'), (1.0, 2.5, 'paved'), (2.5, 3.0, 'gravel'),
+             (3.0, 4.0, 'paved'), (5.0, 6.0, 'paved')) AS events (from_ch, to_ch, surface);
+
+DO $$
+DECLARE
+    runs JSON;
+BEGIN
+    -- Unordered input with an overlap and NULL values
+    SELECT coalesce_events(from_ch, to_ch, surface) INTO runs
+    FROM (VALUES (3.0, 4.0, NULL), (1.0, 2.5, 'paved'), (0.0, 1.2, 'paved'),
+                 (2.5, 3.0, 'gravel'), (4.0, 4.5, NULL)) AS events (from_ch, to_ch, surface);
+    IF json_array_length(runs) = 3
+       AND (runs->0->>'to_ch')::DOUBLE PRECISION = 2.5 AND runs->0->>'value' = 'paved'
+       AND runs->2->>'value' IS NULL AND (runs->2->>'to_ch')::DOUBLE PRECISION = 4.5 THEN
+        RAISE NOTICE 'SUCCESS: events coalesced into % runs', json_array_length(runs);
+    ELSE
+        RAISE NOTICE 'ERROR: unexpected runs %', runs;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 31: Distance along road'
+\echo '----------------------------'
+
+SELECT distance_along_road('LINESTRING(0 0, 5 0, 10 0)', 'POINT(9.9 0.1)', 'POINT(0.1 0)', 1.0);
+
+DO $$
+DECLARE
+    single JSON;
+    trace JSON;
+BEGIN
+    single := distance_along_road('LINESTRING(0 0, 5 0, 10 0)', 'POINT(9.9 0.1)', 'POINT(0.1 0)', 1.0);
+    trace := distance_along_road('LINESTRING(0 0, 5 0, 10 0)',
+                                 ARRAY['POINT(0 0)', 'POINT(5 0.1)', 'POINT(20 20)', 'POINT(10 0)', 'POINT(4.9 0)'], 1.0);
+    IF (single->>'direction')::INT = -1
+       AND abs((single->>'distance')::DOUBLE PRECISION +
+               (calibrate_point_on_line('LINESTRING(0 0, 5 0, 10 0)', 'POINT(10 0)', 0.1)->>'chainage')::DOUBLE PRECISION) < 1e-6
+       AND json_array_length(trace) = 4
+       AND (trace->0->>'direction')::INT = 1
+       AND json_typeof(trace->1) = 'null' AND json_typeof(trace->2) = 'null'
+       AND (trace->3->>'distance')::DOUBLE PRECISION = -(trace->0->>'distance')::DOUBLE PRECISION THEN
+        RAISE NOTICE 'SUCCESS: signed along-road distances for pair and trace';
+    ELSE
+        RAISE NOTICE 'ERROR: unexpected distances % / %', single, trace;
+    END IF;
+END $$;
+
+\echo ''
+\echo 'Test 32: Parallel kilometer posts'
+\echo '---------------------------------'
+
+CREATE TABLE test_post_roads (id BIGINT, wkt TEXT);
+INSERT INTO test_post_roads VALUES
+    (1, 'LINESTRING(0 0, 0.05 0)'),
+    (2, 'LINESTRING(0 0, 0 0.02, 0.01 0.02)'),
+    (3, NULL);
+CREATE TABLE test_km_posts (road_id BIGINT, km_post DOUBLE PRECISION, point_wkt TEXT);
+
+CALL generate_kilometer_posts_parallel('SELECT id, wkt FROM test_post_roads', 'test_km_posts', 1.0, 0.0, 2);
+
+SELECT status, roads_total, roads_done, percent_done, posts_written, workers_done
+FROM road_post_job_progress ORDER BY job_id DESC LIMIT 1;
+
+DO $$
+DECLARE
+    posts BIGINT;
+    mismatched BIGINT;
+    progress RECORD;
+BEGIN
+    SELECT count(*), count(*) FILTER (WHERE p.point_wkt <> cut_line_at_chainage(r.wkt, p.km_post))
+    INTO posts, mismatched
+    FROM test_km_posts p JOIN test_post_roads r ON r.id = p.road_id;
+    SELECT * INTO progress FROM road_post_job_progress ORDER BY job_id DESC LIMIT 1;
+    IF posts = 10 AND mismatched = 0 AND progress.status = 'done'
+       AND progress.roads_done = 3 AND progress.posts_written = 10 THEN
+        RAISE NOTICE 'SUCCESS: % posts written by % workers', posts, progress.workers_done;
+    ELSE
+        RAISE NOTICE 'ERROR: % posts (% mismatched), progress %', posts, mismatched, progress;
+    END IF;
+END $$;
+
+DROP TABLE test_km_posts;
+DROP TABLE test_post_roads;
+
+\echo ''
+\echo 'Test 33: Extension version'
+\echo '--------------------------'
+
+-- CREATE EXTENSION reaches 1.1.0 through the 1.0.0 script and the 1.0.0--1.1.0 update
+SELECT extversion FROM pg_extension WHERE extname = 'pg_gis_road_utils';
+SELECT path FROM pg_extension_update_paths('pg_gis_road_utils')
+WHERE source = '1.0.0' AND target = '1.1.0' AND path IS NOT NULL;
+
 \echo ''
 \echo '========================================'
 \echo 'All tests completed!'
@@ -0,0 +1,1086 @@
+/*
+ * Unit tests for the standalone core library (road_core.c)
+ * Run with: make check-core   (or make -f Makefile.core check)
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "road_core.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define CHECK_NEAR(a, b, eps) CHECK(fabs((a) - (b)) <= (eps))
+
+/* Chainage of d degrees in km */
+#define KM(d) degreesToKm(d)
+
+static const RoadAllocator *A = &road_malloc_allocator;
+
+static void test_parse_line(void) {
+    RoadLine line;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+    CHECK(line.coords.size == 3 && line.coords.capacity == 3);
+    CHECK(line.coords.data[2].x == 10 && line.coords.data[2].y == 10);
+    CHECK_NEAR(line.prefix[1], 10.0, 1e-12);
+    CHECK_NEAR(roadLineLength(&line), 20.0, 1e-12);
+    freeRoadLine(&line);
+
+    CHECK(parseLineWKT("  linestring z (0 0 5, 3 4 6)", A, &line));
+    CHECK(line.coords.size == 2);
+    CHECK_NEAR(roadLineLength(&line), 5.0, 1e-12);
+    freeRoadLine(&line);
+
+    CHECK(parseLineWKT("SRID=4326;MULTILINESTRING((0 0, 10 0), (10 0, 10 10))", A, &line));
+    CHECK(line.coords.size == 2);
+    freeRoadLine(&line);
+
+    CHECK(!parseLineWKT("LINESTRING EMPTY", A, &line));
+    CHECK(!parseLineWKT("LINESTRING(0 0)", A, &line));
+    CHECK(!parseLineWKT("LINESTRING(0 0, 1)", A, &line));
+    CHECK(!parseLineWKT("POLYGON((0 0, 1 0, 1 1, 0 0))", A, &line));
+    CHECK(!parseLineWKT(NULL, A, &line));
+}
+
+static void test_parse_point(void) {
+    Coordinate pt;
+
+    CHECK(parsePointWKT("POINT(5.1 0.1)", &pt));
+    CHECK(pt.x == 5.1 && pt.y == 0.1);
+    CHECK(parsePointWKT("POINT Z (1 2 3)", &pt));
+    CHECK(pt.x == 1 && pt.y == 2);
+    CHECK(!parsePointWKT("POINT EMPTY", &pt));
+    CHECK(!parsePointWKT("LINESTRING(0 0, 1 1)", &pt));
+}
+
+static void test_calibrate(void) {
+    RoadLine line;
+    PointDto dto;
+    Coordinate ref = {10.1, 0.1};
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+
+    CHECK(calibratePoint(&line, ref, 1.0, &dto));
+    CHECK(dto.index == 1);
+    CHECK_NEAR(dto.chainage, KM(10.0), 1e-9);
+    CHECK(dto.lon == 10 && dto.lat == 0);
+
+    ref.x = 5.0;
+    CHECK(!calibratePoint(&line, ref, 1.0, &dto));
+
+    freeRoadLine(&line);
+}
+
+static void test_along_road(void) {
+    RoadLine line;
+    AlongRoadDto dto;
+    Coordinate a = {0.1, 0.1}, b = {10.1, 9.9}, far = {5.0, 5.0};
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+
+    CHECK(distanceAlongRoad(&line, a, b, 1.0, &dto));
+    CHECK_NEAR(dto.distance, KM(20.0), 1e-9);
+    CHECK(dto.direction == ROAD_FORWARD);
+
+    CHECK(distanceAlongRoad(&line, b, a, 1.0, &dto));
+    CHECK_NEAR(dto.fromCh, KM(20.0), 1e-9);
+    CHECK_NEAR(dto.distance, -KM(20.0), 1e-9);
+    CHECK(dto.direction == ROAD_REVERSE);
+
+    CHECK(distanceAlongRoad(&line, a, a, 1.0, &dto));
+    CHECK(dto.distance == 0.0 && dto.direction == 0);
+
+    CHECK(!distanceAlongRoad(&line, a, far, 1.0, &dto));
+
+    freeRoadLine(&line);
+}
+
+static void test_extract(void) {
+    RoadLine line;
+    SectionDto section;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+
+    memset(&section, 0, sizeof(section));
+    CHECK(extractSubLineStringByChainages(&line, KM(2.0), KM(15.0), &section));
+    CHECK(section.geometry && strcmp(section.geometry, "LINESTRING (2 0, 10 0, 10 5)") == 0);
+    CHECK_NEAR(section.startLon, 2.0, 1e-9);
+    CHECK_NEAR(section.endLat, 5.0, 1e-9);
+    CHECK_NEAR(section.length, KM(13.0), 1e-9);
+    free(section.geometry);
+
+    /* Boundary on a vertex is not duplicated */
+    memset(&section, 0, sizeof(section));
+    CHECK(extractSubLineStringByChainages(&line, KM(0.0), KM(10.0), &section));
+    CHECK(section.geometry && strcmp(section.geometry, "LINESTRING (0 0, 10 0)") == 0);
+    free(section.geometry);
+
+    /* Past the end: clipped to the last vertex */
+    memset(&section, 0, sizeof(section));
+    CHECK(extractSubLineStringByChainages(&line, KM(15.0), KM(50.0), &section));
+    CHECK(section.endLon == 10 && section.endLat == 10);
+    free(section.geometry);
+
+    CHECK(!extractSubLineStringByChainages(&line, KM(5.0), KM(5.0), &section));
+    CHECK(!extractSubLineStringByChainages(&line, KM(25.0), KM(30.0), &section));
+
+    freeRoadLine(&line);
+
+    /* Start found by binary search far along a long line, on and off vertices */
+    memset(&line, 0, sizeof(line));
+    line.allocator = A;
+    int ok = initCoordinateArray(&line.coords, 1000, A);
+    for (int i = 0; ok && i < 1000; i++)
+        ok = addCoordinate(&line.coords, i, 0);
+    CHECK(ok);
+    CHECK(computePrefixLengths(&line));
+
+    memset(&section, 0, sizeof(section));
+    CHECK(extractSubLineStringByChainages(&line, KM(997.5), KM(999.0), &section));
+    CHECK(section.geometry && strcmp(section.geometry, "LINESTRING (997.5 0, 998 0, 999 0)") == 0);
+    free(section.geometry);
+
+    memset(&section, 0, sizeof(section));
+    CHECK(extractSubLineStringByChainages(&line, KM(500.0), KM(500.25), &section));
+    CHECK(section.geometry && strcmp(section.geometry, "LINESTRING (500 0, 500.25 0)") == 0);
+    free(section.geometry);
+
+    freeRoadLine(&line);
+}
+
+static void test_direction(void) {
+    RoadLine line, reversed;
+    SectionDto a, b;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+    CHECK(parseLineWKT("LINESTRING(10 10, 10 0, 0 0)", A, &reversed));
+    CHECK_NEAR(reverseChainage(&line, KM(2.0)), KM(18.0), 1e-9);
+    CHECK_NEAR(reverseChainage(&line, reverseChainage(&line, 7.5)), 7.5, 1e-9);
+
+    /* Same section as on the reversed line, without building it */
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    CHECK(extractSectionInDirection(&line, KM(2.0), KM(15.0), ROAD_REVERSE, &a));
+    CHECK(extractSubLineStringByChainages(&reversed, KM(2.0), KM(15.0), &b));
+    CHECK(a.geometry && strcmp(a.geometry, "LINESTRING (10 8, 10 0, 5 0)") == 0);
+    CHECK(b.geometry && strcmp(a.geometry, b.geometry) == 0);
+    CHECK(a.startLat == b.startLat && a.startLon == b.startLon);
+    CHECK(a.endLat == b.endLat && a.endLon == b.endLon);
+    CHECK_NEAR(a.startCh, KM(2.0), 1e-12);
+    free(a.geometry);
+    free(b.geometry);
+
+    freeRoadLine(&reversed);
+    freeRoadLine(&line);
+}
+
+static void test_interpolate(void) {
+    RoadLine line;
+    Coordinate pt;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+
+    CHECK(interpolatePoint(&line, 0.0, &pt));
+    CHECK(pt.x == 0 && pt.y == 0);
+    CHECK(interpolatePoint(&line, 5.0, &pt));
+    CHECK_NEAR(pt.x, 5.0, 1e-12);
+    CHECK(interpolatePoint(&line, 10.0, &pt));
+    CHECK(pt.x == 10 && pt.y == 0);
+    CHECK(interpolatePoint(&line, 12.5, &pt));
+    CHECK_NEAR(pt.y, 2.5, 1e-12);
+    CHECK(interpolatePoint(&line, 20.0, &pt));
+    CHECK(pt.x == 10 && pt.y == 10);
+    CHECK(!interpolatePoint(&line, 20.5, &pt));
+    CHECK(!interpolatePoint(&line, -1.0, &pt));
+
+    freeRoadLine(&line);
+}
+
+static void test_equations(void) {
+    /* At 2 km posted jumps ahead to 2.5; at 5 km it falls back to 5.3 */
+    double measured[2] = {2.0, 5.0};
+    double posted[2] = {2.5, 5.3};
+    ChainageEquations eq = {measured, posted, 2};
+    double m;
+
+    CHECK(checkChainageEquations(&eq));
+    CHECK_NEAR(measuredToPosted(&eq, 1.0), 1.0, 1e-12);
+    CHECK_NEAR(measuredToPosted(&eq, 2.0), 2.5, 1e-12);
+    CHECK_NEAR(measuredToPosted(&eq, 4.0), 4.5, 1e-12);
+    CHECK_NEAR(measuredToPosted(&eq, 6.0), 6.3, 1e-12);
+
+    CHECK(postedToMeasured(&eq, 1.5, &m) && fabs(m - 1.5) < 1e-12);
+    CHECK(postedToMeasured(&eq, 2.0, &m) && fabs(m - 2.0) < 1e-12);
+    CHECK(!postedToMeasured(&eq, 2.2, &m));
+    CHECK(postedToMeasured(&eq, 3.0, &m) && fabs(m - 2.5) < 1e-12);
+    /* 5.3 to 5.5 is posted twice; the stretch after the break wins */
+    CHECK(postedToMeasured(&eq, 5.4, &m) && fabs(m - 5.1) < 1e-12);
+
+    /* Round trip everywhere outside the overlap */
+    int ok = 1;
+    for (double x = 0.0; x < 8.0; x += 0.25) {
+        if (x >= 4.8 && x < 5.0) continue;
+        ok = ok && postedToMeasured(&eq, measuredToPosted(&eq, x), &m) && fabs(m - x) < 1e-9;
+    }
+    CHECK(ok);
+
+    eq.count = 0;
+    CHECK(checkChainageEquations(&eq));
+    CHECK(postedToMeasured(&eq, 3.0, &m) && m == 3.0);
+
+    posted[1] = 2.4;
+    eq.count = 2;
+    CHECK(!checkChainageEquations(&eq));
+}
+
+static void test_offsets(void) {
+    RoadLine line;
+    Coordinate pt;
+    CoordinateArray out;
+    double bearing;
+    double m = 1.0 / METERS_PER_DEGREE;   /* one meter in degrees */
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 10 0, 10 10)", A, &line));
+
+    /* Heading east: left is north */
+    CHECK(pointAtChainageOffset(&line, KM(5.0), 20.0, &pt, &bearing));
+    CHECK_NEAR(pt.x, 5.0, 1e-9);
+    CHECK_NEAR(pt.y, 20.0 * m, 1e-12);
+    CHECK_NEAR(bearing, 90.0, 1e-9);
+
+    /* Heading north: right is east */
+    CHECK(pointAtChainageOffset(&line, KM(15.0), -20.0, &pt, &bearing));
+    CHECK_NEAR(pt.x, 10.0 + 20.0 * m, 1e-12);
+    CHECK_NEAR(pt.y, 5.0, 1e-9);
+    CHECK_NEAR(bearing, 0.0, 1e-9);
+
+    CHECK(!pointAtChainageOffset(&line, KM(25.0), 1.0, &pt, NULL));
+
+    /* Mitered corner keeps the offset distance from both legs */
+    CHECK(offsetSection(&line, KM(5.0), KM(15.0), -10.0, &out));
+    CHECK(out.size == 3);
+    CHECK_NEAR(out.data[0].x, 5.0, 1e-9);
+    CHECK_NEAR(out.data[0].y, -10.0 * m, 1e-12);
+    CHECK_NEAR(out.data[1].x, 10.0 + 10.0 * m, 1e-12);
+    CHECK_NEAR(out.data[1].y, -10.0 * m, 1e-12);
+    CHECK_NEAR(out.data[2].x, 10.0 + 10.0 * m, 1e-12);
+    CHECK_NEAR(out.data[2].y, 5.0, 1e-9);
+    freeCoordinateArray(&out);
+
+    CHECK(!offsetSection(&line, KM(15.0), KM(5.0), 1.0, &out));
+
+    freeRoadLine(&line);
+}
+
+static void test_simplify(void) {
+    RoadLine line, simple, reparsed;
+    Coordinate p, q;
+    char *wkt;
+
+    /* Oversampled straight run with one bend: only the corners survive */
+    CHECK(parseLineWKT("LINESTRING(0 0, 1 0, 2 0.0001, 3 0, 4 0, 4 1, 4 2, 4 3)", A, &line));
+    CHECK(simplifyLine(&line, 0.001, &simple));
+    CHECK(simple.measured);
+    CHECK(simple.coords.size == 3);
+    CHECK(simple.coords.data[1].x == 4 && simple.coords.data[1].y == 0);
+    CHECK_NEAR(roadLineLength(&simple), roadLineLength(&line), 1e-12);
+    CHECK_NEAR(simple.prefix[1], line.prefix[4], 1e-12);
+
+    /* Chainages on the simplified line match the original */
+    CHECK(interpolatePoint(&simple, line.prefix[5], &p));
+    CHECK(interpolatePoint(&line, line.prefix[5], &q));
+    CHECK_NEAR(p.x, q.x, 1e-9);
+    CHECK_NEAR(p.y, q.y, 1e-9);
+
+    /* Measures round-trip through WKT */
+    wkt = measuredLineToWKT(&simple, A);
+    CHECK(wkt && strncmp(wkt, "LINESTRING M (0 0 0, 4 0 ", 25) == 0);
+    CHECK(parseLineWKT(wkt, A, &reparsed));
+    CHECK(reparsed.measured && reparsed.coords.size == 3);
+    CHECK_NEAR(reparsed.prefix[2], simple.prefix[2], 1e-12);
+    free(wkt);
+    freeRoadLine(&reparsed);
+
+    /* Zero tolerance only drops exactly collinear vertices */
+    CHECK(simplifyLine(&line, 0.0, &reparsed));
+    CHECK(reparsed.coords.size == 6);
+    freeRoadLine(&reparsed);
+
+    freeRoadLine(&simple);
+    freeRoadLine(&line);
+
+    /* Measured input need not start at zero; decreasing measures are rejected */
+    CHECK(parseLineWKT("LINESTRINGM(0 0 12.5, 1 0 14.5)", A, &line));
+    CHECK_NEAR(KM(roadLineStart(&line)), 12.5, 1e-9);
+    CHECK(!interpolatePoint(&line, kmToDegrees(12.0), &p));
+    CHECK(interpolatePoint(&line, kmToDegrees(13.5), &p));
+    CHECK_NEAR(p.x, 0.5, 1e-9);
+    freeRoadLine(&line);
+    CHECK(!parseLineWKT("LINESTRING M (0 0 2, 1 0 1)", A, &line));
+    CHECK(!parseLineWKT("LINESTRING M (0 0, 1 0)", A, &line));
+}
+
+static void test_compact(void) {
+    RoadLine line, decoded, simple;
+    unsigned char *buf;
+    size_t len;
+
+    CHECK(parseLineWKT("LINESTRING(39.2083 -6.7924, 39.2101 -6.7950, 39.2155 -6.8012, 39.2203 -6.8101)", A, &line));
+    buf = encodeCompactLine(&line, ROAD_COMPACT_XY_PRECISION, ROAD_COMPACT_M_PRECISION, A, &len);
+    CHECK(buf != NULL);
+    CHECK(isCompactLine(buf, len));
+    CHECK(len < 40);
+
+    CHECK(decodeCompactLine(buf, len, A, &decoded));
+    CHECK(decoded.coords.size == 4 && !decoded.measured);
+    CHECK_NEAR(decoded.coords.data[3].x, 39.2203, 1e-7);
+    CHECK_NEAR(decoded.coords.data[3].y, -6.8101, 1e-7);
+    CHECK_NEAR(roadLineLength(&decoded), roadLineLength(&line), 1e-7);
+    freeRoadLine(&decoded);
+
+    /* Truncated or trailing bytes are rejected */
+    CHECK(!decodeCompactLine(buf, len - 1, A, &decoded));
+    CHECK(!decodeCompactLine(buf, 3, A, &decoded));
+    free(buf);
+
+    /* Deltas of 0xFFFFFFFFFFFFFFFF would leave the quantized range */
+    unsigned char crafted[6 + 4 * 10] = {0x00, 1, 0, 7, 6, 2};   /* version 1, 2 vertices */
+    for (int k = 0; k < 4; k++) {
+        memset(crafted + 6 + 10 * k, 0xFF, 9);
+        crafted[6 + 10 * k + 9] = 0x01;
+    }
+    CHECK(!decodeCompactLine(crafted, sizeof(crafted), A, &decoded));
+
+    /* Measures survive the round trip */
+    CHECK(simplifyLine(&line, 0.1, &simple));
+    buf = encodeCompactLine(&simple, 7, 6, A, &len);
+    CHECK(buf && decodeCompactLine(buf, len, A, &decoded));
+    CHECK(decoded.measured && decoded.coords.size == 2);
+    CHECK_NEAR(KM(roadLineLength(&decoded)), KM(roadLineLength(&line)), 1e-6);
+    free(buf);
+    freeRoadLine(&decoded);
+    freeRoadLine(&simple);
+
+    /* Ordinates that do not fit the grid */
+    CHECK(encodeCompactLine(&line, 16, 6, A, &len) == NULL);
+    line.coords.data[0].x = 1e300;
+    CHECK(encodeCompactLine(&line, 7, 6, A, &len) == NULL);
+    freeRoadLine(&line);
+
+    CHECK(!isCompactLine("LINESTRING(0 0, 1 1)", 20));
+}
+
+static void test_indexed(void) {
+    RoadLine line, decoded, window;
+    IndexedLineInfo info;
+    unsigned char *buf;
+    size_t len, first, count;
+    Coordinate full, part;
+    int ok = 1;
+
+    /* A zig-zag long enough to span several index blocks */
+    size_t n = 3 * ROAD_INDEXED_BLOCK + 17;
+    memset(&line, 0, sizeof(line));
+    line.allocator = A;
+    CHECK(initCoordinateArray(&line.coords, n, A));
+    for (size_t i = 0; i < n; i++) {
+        line.coords.data[i].x = 0.001 * (double) i;
+        line.coords.data[i].y = (i % 2) ? 0.0005 : 0.0;
+    }
+    line.coords.size = n;
+    CHECK(computePrefixLengths(&line));
+
+    buf = encodeIndexedLine(&line, A, &len);
+    CHECK(buf != NULL && isCompactLine(buf, len));
+    CHECK(readIndexedLineHeader(buf, ROAD_INDEXED_HEADER, &info));
+    CHECK(info.count == n && info.blocks == 4);
+    CHECK(len == indexedLineRecordOffset(&info, n));
+
+    /* Full decoding goes through decodeCompactLine */
+    CHECK(decodeCompactLine(buf, len, A, &decoded));
+    CHECK(decoded.coords.size == n && decoded.prefix[n - 1] == line.prefix[n - 1]);
+    freeRoadLine(&decoded);
+    CHECK(!decodeCompactLine(buf, len - 1, A, &decoded));
+
+    /* A non-finite record is rejected, as the encoder never writes one */
+    unsigned char saved[8];
+    unsigned char *rec = buf + indexedLineRecordOffset(&info, 1);
+    memcpy(saved, rec, 8);
+    memset(rec, 0xFF, 8);
+    CHECK(!decodeCompactLine(buf, len, A, &decoded));
+    CHECK(!decodeIndexedRecords(&info, buf + indexedLineRecordOffset(&info, 0), 0, 2, A, &window));
+    memcpy(rec, saved, 8);
+
+    /* A window from the block index gives the same points as the whole line */
+    double length = KM(roadLineLength(&line));
+    for (int k = 0; k < 50; k++) {
+        double ch = length * k / 50.0;
+        ok &= indexedLineWindow(&info, buf + ROAD_INDEXED_HEADER, kmToDegrees(ch), &first, &count);
+        ok &= count <= ROAD_INDEXED_BLOCK + 1;
+        ok &= decodeIndexedRecords(&info, buf + indexedLineRecordOffset(&info, first), first, count, A, &window);
+        ok &= pointAtChainageOffset(&line, ch, 2.0, &full, NULL);
+        ok &= pointAtChainageOffset(&window, ch, 2.0, &part, NULL);
+        ok &= full.x == part.x && full.y == part.y;
+        ok &= interpolatePoint(&line, kmToDegrees(ch), &full) && interpolatePoint(&window, kmToDegrees(ch), &part);
+        ok &= full.x == part.x && full.y == part.y;
+        freeRoadLine(&window);
+    }
+    CHECK(ok);
+    CHECK(indexedLineWindow(&info, buf + ROAD_INDEXED_HEADER, roadLineLength(&line), &first, &count));
+    CHECK(first + count == n);
+    CHECK(!indexedLineWindow(&info, buf + ROAD_INDEXED_HEADER, roadLineLength(&line) * 1.01, &first, &count));
+
+    /* The varint encoding and WKT are not the indexed layout */
+    CHECK(!readIndexedLineHeader("LINESTRING(0 0, 1 1)", 20, &info));
+    free(buf);
+    buf = encodeCompactLine(&line, 7, 6, A, &len);
+    CHECK(buf && !readIndexedLineHeader(buf, len, &info));
+    free(buf);
+    freeRoadLine(&line);
+}
+
+static void test_profile(void) {
+    RoadLine line, decoded;
+    RoadProfileCursor cursor;
+    ProfileSampleDto samples[8];
+    unsigned char *buf;
+    size_t len, n = 0;
+    char *wkt;
+
+    /* 111.32 m east rising 1 %, then 111.32 m north on the level */
+    CHECK(parseLineWKT("LINESTRING Z (0 0 100, 0.001 0 101.1132, 0.001 0.001 101.1132)", A, &line));
+    CHECK(line.z && line.z[1] == 101.1132);
+
+    wkt = lineToWKT(&line, A);
+    CHECK(wkt && strcmp(wkt, "LINESTRING Z (0 0 100, 0.001 0 101.1132, 0.001 0.001 101.1132)") == 0);
+    free(wkt);
+
+    /* Elevations survive the compact encoding to the millimeter */
+    buf = encodeCompactLine(&line, 7, 6, A, &len);
+    CHECK(buf && decodeCompactLine(buf, len, A, &decoded));
+    CHECK(decoded.z && fabs(decoded.z[1] - 101.113) < 1e-9);
+    free(buf);
+    freeRoadLine(&decoded);
+
+    CHECK(initProfileCursor(&cursor, &line, 40.0));
+    while (n < 8 && nextProfileSample(&cursor, &samples[n])) n++;
+    CHECK(n == 6);
+
+    CHECK_NEAR(samples[0].startCh, 0.0, 1e-12);
+    CHECK_NEAR(samples[0].grade, 1.0, 1e-6);
+    CHECK_NEAR(samples[0].bearing, 90.0, 1e-9);
+    CHECK_NEAR(samples[0].curvature, 0.0, 1e-12);
+    CHECK_NEAR(samples[1].elevation, 100.4, 1e-6);
+
+    /* The corner at 111.32 m falls in [80, 120): a quarter turn left over 40 m */
+    CHECK_NEAR(samples[2].curvature, (M_PI / 2) / 40.0, 1e-9);
+    CHECK_NEAR(samples[2].grade, 0.3132 / 40.0 * 100.0, 1e-6);
+    CHECK_NEAR(samples[3].bearing, 0.0, 1e-9);
+    CHECK_NEAR(samples[3].grade, 0.0, 1e-9);
+
+    /* The last interval is cut short at the end of the line */
+    CHECK_NEAR(samples[5].endCh, KM(roadLineLength(&line)), 1e-12);
+    CHECK_NEAR(samples[5].endCh - samples[5].startCh, 0.02264, 1e-9);
+
+    CHECK(!initProfileCursor(&cursor, &line, 0.0));
+    freeRoadLine(&line);
+
+    /* 2D lines have no elevation or grade; mixed dimensions are rejected */
+    CHECK(parseLineWKT("LINESTRING(0 0, 0.001 0)", A, &line));
+    CHECK(line.z == NULL);
+    CHECK(initProfileCursor(&cursor, &line, 200.0) && nextProfileSample(&cursor, &samples[0]));
+    CHECK(isnan(samples[0].elevation) && isnan(samples[0].grade));
+    CHECK(!nextProfileSample(&cursor, &samples[0]));
+    freeRoadLine(&line);
+
+    CHECK(!parseLineWKT("LINESTRING(0 0 1, 1 0)", A, &line));
+
+    /* ZM: ordinate 3 is the chainage, ordinate 2 the elevation */
+    CHECK(parseLineWKT("LINESTRING ZM (0 0 5 2.0, 0.001 0 6 2.2)", A, &line));
+    CHECK(line.measured && line.z && line.z[0] == 5.0);
+    CHECK_NEAR(KM(roadLineStart(&line)), 2.0, 1e-9);
+    freeRoadLine(&line);
+}
+
+static void test_split(void) {
+    RoadLine line;
+    CoordinateArray pieces[4];
+    double cuts[3] = {KM(2.5), KM(10.0), KM(15.0)};
+    SectionDto section;
+    char *wkt;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 5 0, 10 0, 10 10)", A, &line));
+    CHECK(splitLineAtChainages(&line, cuts, 3, pieces));
+
+    CHECK(pieces[0].size == 2);
+    CHECK_NEAR(pieces[0].data[1].x, 2.5, 1e-9);
+    /* Cut exactly on a vertex: no duplicate point */
+    CHECK(pieces[1].size == 3);
+    CHECK(pieces[1].data[2].x == 10 && pieces[1].data[2].y == 0);
+    CHECK(pieces[2].size == 2);
+    CHECK(pieces[3].size == 2 && pieces[3].data[1].y == 10);
+
+    /* Shared endpoints are bit-identical */
+    for (int i = 0; i < 3; i++) {
+        Coordinate end = pieces[i].data[pieces[i].size - 1];
+        CHECK(end.x == pieces[i + 1].data[0].x && end.y == pieces[i + 1].data[0].y);
+    }
+
+    /* Same geometry as extracting the piece on its own */
+    CHECK(extractSubLineStringByChainages(&line, cuts[0], cuts[1], &section));
+    wkt = coordsToWKT(pieces[1].data, pieces[1].size, A);
+    CHECK(wkt && strcmp(wkt, section.geometry) == 0);
+    free(wkt);
+    free(section.geometry);
+
+    for (int i = 0; i < 4; i++) freeCoordinateArray(&pieces[i]);
+
+    /* No cuts: the whole line */
+    CHECK(splitLineAtChainages(&line, NULL, 0, pieces));
+    CHECK(pieces[0].size == 4);
+    freeCoordinateArray(&pieces[0]);
+
+    /* Unsorted or out-of-range cuts are rejected */
+    cuts[0] = KM(11.0);
+    CHECK(!splitLineAtChainages(&line, cuts, 2, pieces));
+    cuts[0] = KM(20.0);
+    CHECK(!splitLineAtChainages(&line, cuts, 1, pieces));
+
+    freeRoadLine(&line);
+}
+
+static void test_km_posts(void) {
+    RoadLine line;
+    PointDto *posts;
+    size_t n;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 0.02 0, 0.02 0.0105)", A, &line));
+    double length = degreesToKm(roadLineLength(&line));
+
+    /* Every km from 0.5, each post on the line at its own chainage */
+    CHECK(kilometerPosts(&line, 0.5, 1.0, &posts, &n));
+    CHECK(n == (size_t) floor(length - 0.5) + 1);
+    int ok = posts != NULL;
+    for (size_t i = 0; ok && i < n; i++) {
+        Coordinate p;
+        ok = posts[i].chainage == 0.5 + (double) i &&
+             interpolatePoint(&line, kmToDegrees(posts[i].chainage), &p) &&
+             fabs(p.x - posts[i].lon) < 1e-12 && fabs(p.y - posts[i].lat) < 1e-12;
+    }
+    CHECK(ok);
+    CHECK(posts[1].index == 0 && posts[n - 1].index == 1);
+    roadFree(A, posts);
+
+    /* Negative start skips the chainages before the line; past the end gives none */
+    CHECK(kilometerPosts(&line, -2.0, 1.0, &posts, &n));
+    CHECK(n > 0 && posts[0].chainage == 0.0);
+    roadFree(A, posts);
+    CHECK(kilometerPosts(&line, length + 1.0, 1.0, &posts, &n));
+    CHECK(n == 0 && posts == NULL);
+    CHECK(!kilometerPosts(&line, 0.0, 0.0, &posts, &n));
+
+    freeRoadLine(&line);
+}
+
+static void test_diff(void) {
+    RoadLine oldLine, newLine;
+    LineEditDto edit;
+
+    /* One bend moved: vertex 2 replaced by two vertices further out */
+    CHECK(parseLineWKT("LINESTRING(0 0, 1 0, 2 0, 3 0, 4 0)", A, &oldLine));
+    CHECK(parseLineWKT("LINESTRING(0 0, 1 0, 1.5 1, 2.5 1, 3 0, 4 0)", A, &newLine));
+    CHECK(diffLines(&oldLine, &newLine, &edit));
+    CHECK(edit.changed);
+    CHECK(edit.oldStart == 2 && edit.oldEnd == 3);
+    CHECK(edit.newStart == 2 && edit.newEnd == 4);
+    CHECK_NEAR(edit.startCh, KM(1.0), 1e-9);
+    CHECK_NEAR(edit.oldEndCh, KM(3.0), 1e-9);
+    CHECK_NEAR(edit.newEndCh, KM(2.0 + 2 * sqrt(1.25)), 1e-9);
+    CHECK_NEAR(edit.delta, KM(2 * sqrt(1.25) - 1.0), 1e-9);
+    freeRoadLine(&newLine);
+
+    /* Identical lines */
+    CHECK(parseLineWKT("LINESTRING(0 0, 1 0, 2 0, 3 0, 4 0)", A, &newLine));
+    CHECK(diffLines(&oldLine, &newLine, &edit));
+    CHECK(!edit.changed);
+    CHECK_NEAR(edit.delta, 0.0, 1e-12);
+    freeRoadLine(&newLine);
+
+    /* Extension at the end: everything before is untouched */
+    CHECK(parseLineWKT("LINESTRING(0 0, 1 0, 2 0, 3 0, 4 0, 6 0)", A, &newLine));
+    CHECK(diffLines(&oldLine, &newLine, &edit));
+    CHECK(edit.changed && edit.oldStart == 5 && edit.oldEnd == 5 && edit.newEnd == 6);
+    CHECK_NEAR(edit.startCh, KM(4.0), 1e-9);
+    CHECK_NEAR(edit.delta, KM(2.0), 1e-9);
+    freeRoadLine(&newLine);
+
+    /* New first vertex */
+    CHECK(parseLineWKT("LINESTRING(0 1, 1 0, 2 0, 3 0, 4 0)", A, &newLine));
+    CHECK(diffLines(&oldLine, &newLine, &edit));
+    CHECK(edit.oldStart == 0 && edit.oldEnd == 1);
+    CHECK_NEAR(edit.startCh, 0.0, 1e-12);
+    CHECK_NEAR(edit.oldEndCh, KM(1.0), 1e-9);
+    CHECK_NEAR(edit.newEndCh, KM(sqrt(2.0)), 1e-9);
+    freeRoadLine(&newLine);
+
+    freeRoadLine(&oldLine);
+}
+
+static void test_grid_index(void) {
+    RoadLine lines[3];
+    RoadGridIndex index;
+    RoadMatchArray matches = {0};
+    PointDto dto;
+    Coordinate p = {5.02, 0.01};
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 5 0, 10 0)", A, &lines[0]));
+    CHECK(parseLineWKT("LINESTRING(5 -1, 5.05 0.02, 5 1)", A, &lines[1]));
+    CHECK(parseLineWKT("LINESTRING(20 20, 30 30)", A, &lines[2]));
+
+    CHECK(buildGridIndex(&index, lines, 3, 0.1, A));
+    CHECK(index.numEntries == 8);
+    CHECK(queryGridIndex(&index, p, 0.1, &matches));
+    CHECK(matches.size == 2);
+
+    /* Same answer as calibratePoint on each line */
+    for (size_t i = 0; i < matches.size; i++) {
+        RoadMatch *m = &matches.data[i];
+        CHECK(calibratePoint(&lines[m->line], p, 0.1, &dto));
+        CHECK((size_t) dto.index == m->vertex);
+        CHECK(m->line != 2);
+    }
+
+    /* Nothing in range */
+    p.x = 15;
+    CHECK(queryGridIndex(&index, p, 0.1, &matches));
+    CHECK(matches.size == 0);
+
+    /* Negative coordinates fall in the right cells */
+    p.x = 5.0;
+    p.y = -0.98;
+    CHECK(queryGridIndex(&index, p, 0.05, &matches));
+    CHECK(matches.size == 1 && matches.data[0].line == 1 && matches.data[0].vertex == 0);
+
+    /* Non-finite queries match nothing or are rejected */
+    p.x = NAN;
+    CHECK(queryGridIndex(&index, p, 0.05, &matches));
+    CHECK(matches.size == 0);
+    p.x = 5.0;
+    CHECK(!queryGridIndex(&index, p, INFINITY, &matches));
+    freeGridIndex(&index);
+
+    /* A tiny radius on projected coordinates keeps cell indices in range */
+    RoadLine utm;
+    Coordinate q = {512345.25, 9234567.5};
+    CHECK(parseLineWKT("LINESTRING(512000 9234000, 512345.25 9234567.5, 513000 9235000)", A, &utm));
+    CHECK(buildGridIndex(&index, &utm, 1, 1e-15, A));
+    CHECK(index.cellSize == ROAD_GRID_MIN_CELL);
+    CHECK(queryGridIndex(&index, q, 1e-15, &matches));
+    CHECK(matches.size == 1 && matches.data[0].vertex == 1);
+    freeGridIndex(&index);
+
+    /* Vertices that cannot be placed in a cell are rejected before indexing */
+    utm.coords.data[2].y = NAN;
+    CHECK(!lineInGridRange(&utm));
+    CHECK(!buildGridIndex(&index, &utm, 1, 1.0, A));
+    utm.coords.data[2].y = 2e9;
+    CHECK(!buildGridIndex(&index, &utm, 1, 1.0, A));
+    freeRoadLine(&utm);
+
+    freeRoadMatchArray(&matches);
+    for (int i = 0; i < 3; i++) freeRoadLine(&lines[i]);
+}
+
+static void test_topology(void) {
+    const char *wkt[] = {
+        "LINESTRING(0 0, 1 0)",
+        "LINESTRING(1.0004 0.0003, 1 1)",   /* snaps onto (1 0) */
+        "LINESTRING(1 0, 2 0)",
+        "LINESTRING(1 1, 1.5 1.5, 1 1)",    /* loop */
+        "LINESTRING(5 5, 6 5)"              /* separate component */
+    };
+    RoadTopology topo;
+    RoadLine line;
+    size_t node;
+
+    CHECK(initTopology(&topo, 2, 0.001, A));
+    for (size_t i = 0; i < 5; i++) {
+        CHECK(parseLineWKT(wkt[i], A, &line));
+        CHECK(addTopologyLine(&topo, i, &line));
+        freeRoadLine(&line);
+    }
+    CHECK(topo.numEdges == 5 && topo.numNodes == 6);
+    CHECK(topo.edges[1].startNode == topo.edges[0].endNode);
+    CHECK(topo.edges[2].startNode == topo.edges[0].endNode);
+    CHECK(topo.nodes[topo.edges[0].endNode].degree == 3);
+    CHECK(topo.edges[3].startNode == topo.edges[3].endNode);
+    CHECK(topo.nodes[topo.edges[1].endNode].degree == 3);
+    CHECK_NEAR(topo.edges[0].length, KM(1.0), 1e-9);
+
+    /* Snapped ends keep the first node's position */
+    CHECK(topo.nodes[topo.edges[0].endNode].x == 1.0);
+
+    CHECK(labelTopologyComponents(&topo));
+    CHECK(topo.numComponents == 2);
+    CHECK(topo.nodes[topo.edges[4].startNode].component == 1);
+    CHECK(topo.nodes[topo.edges[2].endNode].component == 0);
+
+    Coordinate p = {2.0005, 0.0};
+    CHECK(findTopologyNode(&topo, p, &node) && node == topo.edges[2].endNode);
+    p.x = 2.002;
+    CHECK(!findTopologyNode(&topo, p, &node));
+    p.x = NAN;
+    CHECK(!findTopologyNode(&topo, p, &node));
+    freeTopology(&topo);
+
+    /* A tiny tolerance; non-finite lines and tolerances are rejected */
+    CHECK(!initTopology(&topo, 4, INFINITY, A));
+    CHECK(initTopology(&topo, 4, 1e-15, A));
+    CHECK(topo.cellSize == ROAD_GRID_MIN_CELL);
+    CHECK(parseLineWKT("LINESTRING(106.8 -6.2, 106.85 -6.25)", A, &line));
+    CHECK(addTopologyLine(&topo, 0, &line));
+    freeRoadLine(&line);
+    CHECK(parseLineWKT("LINESTRING(106.85 -6.25, 106.9 -6.2)", A, &line));
+    CHECK(addTopologyLine(&topo, 1, &line));
+    CHECK(topo.numNodes == 3 && topo.edges[1].startNode == topo.edges[0].endNode);
+    line.coords.data[1].x = INFINITY;
+    CHECK(!addTopologyLine(&topo, 2, &line));
+    freeRoadLine(&line);
+    freeTopology(&topo);
+
+    /* Tolerance 0 only joins equal ends; the table grows past the estimate */
+    CHECK(initTopology(&topo, 0, 0.0, A));
+    int ok = 1;
+    for (int i = 0; i < 200; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "LINESTRING(%d 0, %d 0)", i, i + 1);
+        ok &= parseLineWKT(buf, A, &line) && addTopologyLine(&topo, (size_t) i, &line);
+        freeRoadLine(&line);
+    }
+    CHECK(ok);
+    CHECK(topo.numNodes == 201 && topo.numEdges == 200);
+    CHECK(labelTopologyComponents(&topo) && topo.numComponents == 1);
+    freeTopology(&topo);
+}
+
+static int legIs(const RoadRouteLeg *leg, size_t edge, double startCh, double endCh) {
+    return leg->edge == edge && fabs(leg->startCh - startCh) < 1e-9 && fabs(leg->endCh - endCh) < 1e-9;
+}
+
+static void test_routing(void) {
+    const char *wkt[] = {
+        "LINESTRING(0 0, 1 0)",
+        "LINESTRING(1 0, 2 0)",
+        "LINESTRING(0 0, 0 1, 2 1, 2 0)",
+        "LINESTRING(5 5, 6 5)",
+        "LINESTRING(10 0, 10 10, 11 10, 11 0)",
+        "LINESTRING(10 0, 11 0)"
+    };
+    RoadTopology topo;
+    RoadGraph graph;
+    RoadRoute route;
+    RoadLine line;
+
+    CHECK(initTopology(&topo, 6, 0.0, A));
+    for (size_t i = 0; i < 6; i++) {
+        CHECK(parseLineWKT(wkt[i], A, &line));
+        CHECK(addTopologyLine(&topo, i, &line));
+        freeRoadLine(&line);
+    }
+    CHECK(buildRoadGraph(&graph, &topo, A));
+    CHECK(graph.numArcs == 12 && graph.offsets[graph.numNodes] == 12);
+
+    /* Across a junction */
+    RoadGraphPosition from = {0, KM(0.25)}, to = {1, KM(0.5)};
+    CHECK(findRoadRoute(&graph, from, to, A, &route));
+    CHECK_NEAR(route.distance, KM(1.25), 1e-9);
+    CHECK(route.numLegs == 2 && legIs(&route.legs[0], 0, KM(0.25), KM(1.0)) && legIs(&route.legs[1], 1, 0.0, KM(0.5)));
+    freeRoadRoute(&route);
+
+    /* The short way round, ending against the line's direction */
+    to.edge = 2;
+    to.chainage = KM(3.5);
+    CHECK(findRoadRoute(&graph, from, to, A, &route));
+    CHECK_NEAR(route.distance, KM(2.25), 1e-9);
+    CHECK(route.numLegs == 3 && legIs(&route.legs[1], 1, 0.0, KM(1.0)) && legIs(&route.legs[2], 2, KM(4.0), KM(3.5)));
+    freeRoadRoute(&route);
+
+    /* Same edge, direct */
+    to.edge = 0;
+    to.chainage = KM(0.9);
+    CHECK(findRoadRoute(&graph, from, to, A, &route));
+    CHECK_NEAR(route.distance, KM(0.65), 1e-9);
+    CHECK(route.numLegs == 1 && legIs(&route.legs[0], 0, KM(0.25), KM(0.9)));
+    freeRoadRoute(&route);
+
+    /* Same edge, shorter over the network */
+    from.edge = to.edge = 4;
+    from.chainage = KM(0.5);
+    to.chainage = KM(20.5);
+    CHECK(findRoadRoute(&graph, from, to, A, &route));
+    CHECK_NEAR(route.distance, KM(2.0), 1e-9);
+    CHECK(route.numLegs == 3 && legIs(&route.legs[0], 4, KM(0.5), 0.0) && legIs(&route.legs[1], 5, 0.0, KM(1.0)) &&
+          legIs(&route.legs[2], 4, KM(21.0), KM(20.5)));
+    freeRoadRoute(&route);
+
+    /* From a node: no zero-length first leg */
+    from.edge = 0;
+    from.chainage = KM(1.0);
+    to.edge = 1;
+    to.chainage = KM(0.5);
+    CHECK(findRoadRoute(&graph, from, to, A, &route));
+    CHECK(route.numLegs == 1 && legIs(&route.legs[0], 1, 0.0, KM(0.5)));
+    freeRoadRoute(&route);
+
+    /* Unreachable and out of range */
+    to.edge = 3;
+    to.chainage = 0.0;
+    CHECK(!findRoadRoute(&graph, from, to, A, &route) && route.numLegs == 0);
+    to.edge = 1;
+    to.chainage = KM(1.5);
+    CHECK(!findRoadRoute(&graph, from, to, A, &route));
+
+    freeRoadGraph(&graph);
+    freeTopology(&topo);
+
+    /* Grid with uneven edge lengths against all-pairs distances over the nodes */
+    enum { G = 6, NN = G * G };
+    static double apsp[NN][NN];
+    int ok = 1;
+    CHECK(initTopology(&topo, 0, 0.0, A));
+    for (int y = 0; y < G; y++) {
+        for (int x = 0; x < G; x++) {
+            char buf[128];
+            /* A detour in the middle of every edge makes lengths differ */
+            double bend = ((x * 7 + y * 3) % 5) * 0.1;
+            if (x + 1 < G) {
+                snprintf(buf, sizeof(buf), "LINESTRING(%d %d, %f %f, %d %d)", x, y, x + 0.5, y + bend, x + 1, y);
+                ok &= parseLineWKT(buf, A, &line) && addTopologyLine(&topo, topo.numEdges, &line);
+                freeRoadLine(&line);
+            }
+            if (y + 1 < G) {
+                snprintf(buf, sizeof(buf), "LINESTRING(%d %d, %f %f, %d %d)", x, y, x + bend, y + 0.5, x, y + 1);
+                ok &= parseLineWKT(buf, A, &line) && addTopologyLine(&topo, topo.numEdges, &line);
+                freeRoadLine(&line);
+            }
+        }
+    }
+    CHECK(ok && topo.numNodes == NN && buildRoadGraph(&graph, &topo, A));
+
+    for (int i = 0; i < NN; i++)
+        for (int j = 0; j < NN; j++) apsp[i][j] = i == j ? 0.0 : INFINITY;
+    for (size_t e = 0; e < topo.numEdges; e++) {
+        size_t a = topo.edges[e].startNode, b = topo.edges[e].endNode;
+        apsp[a][b] = apsp[b][a] = fmin(apsp[a][b], topo.edges[e].length);
+    }
+    for (int k = 0; k < NN; k++)
+        for (int i = 0; i < NN; i++)
+            for (int j = 0; j < NN; j++)
+                if (apsp[i][k] + apsp[k][j] < apsp[i][j]) apsp[i][j] = apsp[i][k] + apsp[k][j];
+
+    unsigned seed = 12345;
+    for (int q = 0; q < 500; q++) {
+        seed = seed * 1103515245u + 12345u;
+        from.edge = (seed >> 8) % topo.numEdges;
+        seed = seed * 1103515245u + 12345u;
+        to.edge = (seed >> 8) % topo.numEdges;
+        const RoadTopoEdge *fe = &topo.edges[from.edge], *te = &topo.edges[to.edge];
+        from.chainage = fe->length * (q % 7) / 6.0;
+        to.chainage = te->length * (q % 5) / 4.0;
+
+        double ends[2] = {from.chainage, fe->length - from.chainage};
+        double tails[2] = {to.chainage, te->length - to.chainage};
+        size_t fn[2] = {fe->startNode, fe->endNode}, tn[2] = {te->startNode, te->endNode};
+        double expected = from.edge == to.edge ? fabs(to.chainage - from.chainage) : INFINITY;
+        for (int i = 0; i < 2; i++)
+            for (int j = 0; j < 2; j++)
+                expected = fmin(expected, ends[i] + apsp[fn[i]][tn[j]] + tails[j]);
+
+        double legs = 0.0;
+        ok &= findRoadRoute(&graph, from, to, A, &route);
+        for (size_t l = 0; l < route.numLegs; l++) legs += fabs(route.legs[l].endCh - route.legs[l].startCh);
+        ok &= fabs(route.distance - expected) < 1e-9 && fabs(legs - expected) < 1e-9;
+        freeRoadRoute(&route);
+    }
+    CHECK(ok);
+
+    freeRoadGraph(&graph);
+    freeTopology(&topo);
+}
+
+static void test_assemble(void) {
+    const char *wkt[] = {
+        "LINESTRING(1 0, 2 0)",
+        "LINESTRING(3 0, 2.0005 0)",        /* reversed, gap within tolerance */
+        "LINESTRING(0 0, 0.5 0, 1 0)",
+        "LINESTRING(5 5, 6 5)",             /* not connected */
+        "LINESTRING(3 0, 4 0)"
+    };
+    RoadLine lines[5];
+    AssembledRoute route;
+
+    for (int i = 0; i < 5; i++) CHECK(parseLineWKT(wkt[i], A, &lines[i]));
+
+    CHECK(assembleRoute(lines, 5, 0.001, A, &route));
+    CHECK(route.numSegments == 4);
+    CHECK(route.line.coords.size == 7);
+    CHECK(route.line.coords.data[0].x == 0.0 && route.line.coords.data[6].x == 4.0);
+    CHECK(route.segments[0].line == 2 && !route.segments[0].reversed);
+    CHECK(route.segments[1].line == 0 && !route.segments[1].reversed);
+    CHECK(route.segments[2].line == 1 && route.segments[2].reversed);
+    CHECK(route.segments[3].line == 4 && !route.segments[3].reversed);
+    CHECK_NEAR(route.segments[0].startCh, 0.0, 1e-12);
+    CHECK_NEAR(route.segments[1].startCh, KM(1.0), 1e-9);
+    CHECK_NEAR(route.segments[1].endCh, KM(2.0), 1e-9);
+    /* The gap is between the segments */
+    CHECK_NEAR(route.segments[2].startCh, KM(2.0005), 1e-9);
+    CHECK_NEAR(route.segments[3].endCh, KM(4.0), 1e-9);
+    freeAssembledRoute(&route);
+
+    /* Tolerance 0 leaves the gap unbridged: line 1 starts a free end and is walked alone */
+    CHECK(assembleRoute(lines, 3, 0.0, A, &route));
+    CHECK(route.numSegments == 1 && route.segments[0].line == 1 && !route.segments[0].reversed);
+    freeAssembledRoute(&route);
+
+    for (int i = 0; i < 5; i++) freeRoadLine(&lines[i]);
+}
+
+static void test_coalesce(void) {
+    /* Out of order, with a gap after 0.3 and a NULL run */
+    EventRun runs[] = {
+        {0.2, 0.30000000000000004, "A", 1},
+        {0.0, 0.1, "A", 1},
+        {0.5, 0.6, "A", 1},
+        {0.1, 0.2, "A", 1},
+        {0.6, 0.7, "B", 1},
+        {0.7, 0.8, NULL, 0},
+        {0.8, 0.9, NULL, 0},
+        {0.9, 1.0, "BB", 2}
+    };
+    size_t n = coalesceEventRuns(runs, 8);
+
+    CHECK(n == 5);
+    CHECK(runs[0].from == 0.0 && runs[0].to == 0.30000000000000004);
+    CHECK(runs[1].from == 0.5 && runs[1].to == 0.6);
+    CHECK(strcmp(runs[2].value, "B") == 0);
+    CHECK(runs[3].value == NULL && runs[3].from == 0.7 && runs[3].to == 0.9);
+    CHECK(runs[4].valueLen == 2);
+
+    /* Chainages a rounding step apart still join */
+    EventRun run = {0.0, 0.30000000000000004, "A", 1};
+    CHECK(extendEventRun(&run, 0.3, 0.4, "A", 1) && run.to == 0.4);
+    CHECK(!extendEventRun(&run, 0.41, 0.5, "A", 1));
+    CHECK(!extendEventRun(&run, 0.4, 0.5, "B", 1));
+    CHECK(coalesceEventRuns(runs, 0) == 0);
+}
+
+static void test_parallel(void) {
+    enum { N = 5000 };
+    RoadLine line;
+    Coordinate *points = malloc(N * sizeof(Coordinate));
+    Coordinate *serial = malloc(N * sizeof(Coordinate));
+    Coordinate *threaded = malloc(N * sizeof(Coordinate));
+    double *chainages = malloc(N * sizeof(double));
+    PointDto *serialDto = malloc(N * sizeof(PointDto));
+    PointDto *threadedDto = malloc(N * sizeof(PointDto));
+    unsigned char serialFound[N], threadedFound[N];
+    double offset = -4.5;
+    int ok = 1;
+
+    CHECK(parseLineWKT("LINESTRING(0 0, 2 0, 2 2, 4 2, 4 4)", A, &line));
+    for (int i = 0; i < N; i++) {
+        chainages[i] = KM(i * 0.002);
+        points[i].x = i * 0.001;
+        points[i].y = (i % 7) * 0.0001;
+    }
+    /* Past the end of the line */
+    chainages[N - 1] = KM(9.0);
+
+    pointsAtChainageOffsetParallel(&line, chainages, N, &offset, 1, 1, serial, serialFound);
+    pointsAtChainageOffsetParallel(&line, chainages, N, &offset, 1, 4, threaded, threadedFound);
+    for (int i = 0; i < N; i++) {
+        ok &= serialFound[i] == threadedFound[i];
+        ok &= !serialFound[i] || (serial[i].x == threaded[i].x && serial[i].y == threaded[i].y);
+    }
+    CHECK(ok);
+    CHECK(serialFound[0] && !serialFound[N - 1]);
+
+    calibratePointsParallel(&line, points, N, 0.5, 1, serialDto, serialFound);
+    calibratePointsParallel(&line, points, N, 0.5, 4, threadedDto, threadedFound);
+    ok = 1;
+    for (int i = 0; i < N; i++) {
+        ok &= serialFound[i] == threadedFound[i];
+        ok &= !serialFound[i] || (serialDto[i].chainage == threadedDto[i].chainage &&
+                                  serialDto[i].index == threadedDto[i].index);
+    }
+    CHECK(ok);
+    CHECK(serialFound[0] && serialDto[0].index == 0);
+    CHECK(!serialFound[N - 1]);
+
+    /* More threads than the limit and arrays too small to split */
+    pointsAtChainageOffsetParallel(&line, chainages, 3, &offset, 1, 1000, threaded, threadedFound);
+    CHECK(threadedFound[0] && threaded[0].x == serial[0].x && threaded[0].y == serial[0].y);
+
+    free(points);
+    free(serial);
+    free(threaded);
+    free(chainages);
+    free(serialDto);
+    free(threadedDto);
+    freeRoadLine(&line);
+}
+
+static void test_wkt_output(void) {
+    char *wkt = pointToWKT(39.2083, -6.8161, A);
+    CHECK(wkt && strcmp(wkt, "POINT (39.2083 -6.8161)") == 0);
+    free(wkt);
+
+    wkt = pointToWKT(0.1 + 0.2, 1e-20, A);
+    CHECK(wkt && strtod(wkt + 7, NULL) == 0.1 + 0.2);
+    free(wkt);
+}
+
+int main(void) {
+    test_parse_line();
+    test_parse_point();
+    test_calibrate();
+    test_along_road();
+    test_extract();
+    test_direction();
+    test_interpolate();
+    test_equations();
+    test_offsets();
+    test_simplify();
+    test_compact();
+    test_indexed();
+    test_profile();
+    test_split();
+    test_km_posts();
+    test_diff();
+    test_grid_index();
+    test_topology();
+    test_routing();
+    test_assemble();
+    test_coalesce();
+    test_parallel();
+    test_wkt_output();
+
+    printf("%d checks, %d failures\n", checks, failures);
+    return failures ? 1 : 0;
+}